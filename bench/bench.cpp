@@ -0,0 +1,222 @@
+#include "cpu.hpp"
+#include "dataflow.hpp"
+#include "decoder.hpp"
+#include "memory.hpp"
+#include "packed.hpp"
+#include "parser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Times the parser, the decoder and execution on a corpus of programs, and prints the
+// results as JSON so runs from different commits can be compared.
+namespace
+{
+    struct Options
+    {
+        std::vector<std::string> files;
+        std::uint64_t max_steps = 100000000; // per run, for programs that never stop
+        double min_time = 0.25;            // seconds spent on each measurement
+        unsigned samples = 5;
+        std::string commit; // recorded as-is
+    };
+
+    // Seconds per iteration
+    struct Timing
+    {
+        double best;
+        double median;
+        std::uint64_t iterations;
+    };
+
+    void usage(const char *argv0)
+    {
+        std::cerr << "Usage: " << argv0 << " [options] file...\n"
+                  << "  --max-steps N     stop each run after N retired instructions (default 100000000)\n"
+                  << "  --min-time SECS   time spent on each measurement (default 0.25)\n"
+                  << "  --samples N       samples per measurement; the best and median are reported (default 5)\n"
+                  << "  --commit ID       revision to record in the results\n";
+    }
+
+    bool parse_options(int argc, char *argv[], Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char *arg = argv[i];
+            if (std::strcmp(arg, "--max-steps") == 0 && i + 1 < argc)
+                options.max_steps = std::stoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(arg, "--min-time") == 0 && i + 1 < argc)
+                options.min_time = std::stod(argv[++i]);
+            else if (std::strcmp(arg, "--samples") == 0 && i + 1 < argc)
+                options.samples = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (std::strcmp(arg, "--commit") == 0 && i + 1 < argc)
+                options.commit = argv[++i];
+            else if (arg[0] == '-')
+                return false;
+            else
+                options.files.push_back(arg);
+        }
+        return !options.files.empty() && options.samples > 0;
+    }
+
+    // Splits min_time into samples, repeating fn until each sample has run its share
+    template <typename Fn>
+    Timing measure(const Options &options, Fn fn)
+    {
+        using Clock = std::chrono::steady_clock;
+        const double share = options.min_time / options.samples;
+        std::vector<double> seconds;
+        std::uint64_t iterations = 0;
+        for (unsigned sample = 0; sample < options.samples; sample++)
+        {
+            std::uint64_t n = 0;
+            const auto start = Clock::now();
+            std::chrono::duration<double> elapsed{};
+            do
+            {
+                fn();
+                n++;
+                elapsed = Clock::now() - start;
+            } while (elapsed.count() < share);
+            seconds.push_back(elapsed.count() / n);
+            iterations += n;
+        }
+        std::sort(seconds.begin(), seconds.end());
+        return {seconds.front(), seconds[seconds.size() / 2], iterations};
+    }
+
+    std::string quote(std::string_view text)
+    {
+        std::string quoted = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                quoted += '\\';
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+            }
+            else
+                quoted += c;
+        }
+        return quoted + '"';
+    }
+
+    std::string timing_fields(const Timing &timing)
+    {
+        std::ostringstream out;
+        out << "\"seconds\": " << timing.best << ", \"median_seconds\": " << timing.median
+            << ", \"iterations\": " << timing.iterations;
+        return out.str();
+    }
+
+    // Runs the program from a fresh machine on each iteration
+    std::string execute(const Options &options, std::shared_ptr<const Cpu::Program> program)
+    {
+        Memory::Space memory;
+        Cpu::Machine machine(program, memory);
+        const Cpu::Snapshot start = machine.snapshot();
+        Cpu::Status status = Cpu::Status::BUDGET_EXHAUSTED;
+        const Timing timing = measure(options, [&]()
+                                      {
+                                          machine.restore(start);
+                                          status = machine.run(options.max_steps); });
+        if (status == Cpu::Status::FAULT)
+            throw std::runtime_error("fault at instruction " + std::to_string(machine.state.pc) + ": " + machine.fault());
+
+        std::ostringstream out;
+        out << "{\"retired\": " << machine.retired << ", \"status\": " << quote(Cpu::to_string(status)) << ", "
+            << timing_fields(timing) << ", \"mips\": " << machine.retired / timing.best / 1e6 << "}";
+        return out.str();
+    }
+
+    void bench_file(const Options &options, const std::string &path, std::ostream &os)
+    {
+        Parser::Source source(path);
+        const std::string_view text = source.text();
+
+        std::size_t sink = 0;
+        std::vector<Parser::Token> tokens = Parser::parse(text);
+        const Timing parse = measure(options, [&]()
+                                     { sink += Parser::parse(text).size(); });
+
+        std::vector<Decoder::Instruction> instructions = Decoder::decode(tokens);
+        const Timing decode = measure(options, [&]()
+                                      { sink += Decoder::decode(tokens).size(); });
+        if (sink == 0)
+            throw std::runtime_error(path + ": no instructions");
+
+        std::vector<Packed::Op> ops = Packed::pack(instructions);
+        auto interpreted = std::make_shared<Cpu::Program>(ops);
+        auto fused = std::make_shared<Cpu::Program>(ops);
+        fused->enable_fusion();
+        auto jit = std::make_shared<Cpu::Program>(ops);
+        const bool has_jit = jit->enable_jit();
+        auto optimized = std::make_shared<Cpu::Program>(Dataflow::optimize(ops).ops);
+
+        os << "    {\"file\": " << quote(path) << ", \"bytes\": " << text.size() << ", \"tokens\": " << tokens.size()
+           << ", \"instructions\": " << instructions.size() << ",\n"
+           << "     \"parse\": {" << timing_fields(parse) << ", \"tokens_per_s\": " << tokens.size() / parse.best
+           << ", \"mb_per_s\": " << text.size() / parse.best / 1e6 << "},\n"
+           << "     \"decode\": {" << timing_fields(decode) << ", \"instructions_per_s\": "
+           << instructions.size() / decode.best << "},\n"
+           << "     \"execute\": {\n"
+           << "       \"interpret\": " << execute(options, interpreted) << ",\n"
+           << "       \"fused\": " << execute(options, fused) << ",\n"
+           << "       \"optimized\": " << execute(options, optimized);
+        if (has_jit)
+            os << ",\n       \"jit\": " << execute(options, jit);
+        os << "}}";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    try
+    {
+        if (!parse_options(argc, argv, options))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        // Nothing is printed unless every file succeeds, so a failed run never leaves half a report
+        std::ostringstream out;
+        out << "{\n  \"commit\": " << quote(options.commit) << ",\n  \"compiler\": " << quote(__VERSION__)
+            << ",\n  \"max_steps\": " << options.max_steps << ",\n  \"min_time\": " << options.min_time
+            << ",\n  \"samples\": " << options.samples << ",\n  \"results\": [\n";
+        for (std::size_t i = 0; i < options.files.size(); i++)
+        {
+            std::cerr << "Benchmarking " << options.files[i] << std::endl;
+            bench_file(options, options.files[i], out);
+            out << (i + 1 < options.files.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        std::cout << out.str() << std::flush;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
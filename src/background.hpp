@@ -0,0 +1,129 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Hands items from one producing thread to a consumer running on a thread of its own.
+//
+// Items go into one of two buffers of SIZE. Appending is a store into the current buffer;
+// when it fills, the producer passes it to the background thread and carries on in the
+// other, so it only waits if the consumer is a whole buffer behind. The mutex is taken once
+// per buffer, on each side. Buffers are consumed in the order they were filled.
+namespace Background
+{
+    template <typename T, std::size_t SIZE>
+    class Writer
+    {
+    public:
+        // Called on the background thread with each filled buffer in turn
+        using Consume = std::function<void(const T *items, std::size_t count)>;
+
+        explicit Writer(Consume consume) : consume_(std::move(consume))
+        {
+            thread_ = std::thread(&Writer::run, this);
+        }
+
+        ~Writer() { finish(); }
+
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        // The next item to fill in
+        T &append()
+        {
+            if (used_ == SIZE)
+                hand_off();
+            return buffers_[current_].items[used_++];
+        }
+
+        // Returns once everything appended so far has been consumed
+        void flush()
+        {
+            if (used_)
+                hand_off();
+            std::unique_lock<std::mutex> lock(mutex_);
+            drained_.wait(lock, [this]
+                          { return !buffers_[current_ ^ 1].full; });
+        }
+
+        // Consumes everything appended and stops the background thread
+        void finish()
+        {
+            if (finished_)
+                return;
+            finished_ = true;
+            if (used_)
+                hand_off();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_ = true;
+                ready_.notify_one();
+            }
+            thread_.join();
+        }
+
+        // Items appended so far
+        std::uint64_t count() const { return handed_ + used_; }
+
+    private:
+        struct Buffer
+        {
+            std::vector<T> items = std::vector<T>(SIZE);
+            std::size_t used = 0;
+            bool full = false; // owned by the background thread while set
+        };
+
+        void hand_off()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            buffers_[current_].used = used_;
+            buffers_[current_].full = true;
+            ready_.notify_one();
+            handed_ += used_;
+
+            current_ ^= 1;
+            used_ = 0;
+            drained_.wait(lock, [this]
+                          { return !buffers_[current_].full; });
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (std::size_t next = 0;;)
+            {
+                Buffer &buffer = buffers_[next];
+                ready_.wait(lock, [&]
+                            { return buffer.full || done_; });
+                // The producer hands buffers over alternately, so if this one is not
+                // full, neither is the other
+                if (!buffer.full)
+                    return;
+
+                lock.unlock();
+                consume_(buffer.items.data(), buffer.used);
+                lock.lock();
+                buffer.full = false;
+                drained_.notify_one();
+                next ^= 1;
+            }
+        }
+
+        Consume consume_;
+        Buffer buffers_[2];
+        std::size_t current_ = 0;  // buffer being filled, by the producer
+        std::size_t used_ = 0;     // items in it
+        std::uint64_t handed_ = 0; // items in buffers handed over
+
+        std::thread thread_;
+        std::mutex mutex_; // guards each Buffer's used and full, and done_
+        std::condition_variable ready_, drained_;
+        bool done_ = false;
+        bool finished_ = false;
+    };
+} // namespace Background
@@ -0,0 +1,449 @@
+#include "batch.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "cache.hpp"
+#include "cpu.hpp"
+#include "dataflow.hpp"
+#include "encoding.hpp"
+#include "lockstep.hpp"
+#include "parser.hpp"
+
+namespace Batch
+{
+    namespace
+    {
+        std::runtime_error line_error(int line, const std::string &what)
+        {
+            return std::runtime_error("Line " + std::to_string(line) + ": Error: " + what);
+        }
+
+        std::uint64_t parse_value(std::string_view text, int line)
+        {
+            std::string digits(text);
+            char *end = nullptr;
+            errno = 0;
+            std::uint64_t value = digits[0] == '-' ? static_cast<std::uint64_t>(std::strtoll(digits.c_str(), &end, 0))
+                                                   : std::strtoull(digits.c_str(), &end, 0);
+            if (digits.empty() || *end != '\0' || errno == ERANGE)
+                throw line_error(line, "invalid number '" + digits + "'");
+            return value;
+        }
+
+        // Calls fn(i) for every i in [0, count) on `threads` workers. Each worker starts on its
+        // own contiguous share of the indices and, once that runs dry, steals from the far end
+        // of another worker's share, so a few long jobs do not leave the other cores idle.
+        template <typename Fn>
+        void parallel_for(std::size_t count, unsigned threads, Fn fn)
+        {
+            struct Queue
+            {
+                std::mutex mutex;
+                std::deque<std::size_t> items;
+            };
+
+            std::vector<Queue> queues(threads);
+            for (unsigned t = 0; t < threads; t++)
+                for (std::size_t i = count * t / threads; i < count * (t + 1) / threads; i++)
+                    queues[t].items.push_back(i);
+
+            auto worker = [&](unsigned self)
+            {
+                for (;;)
+                {
+                    std::size_t item = 0;
+                    bool found = false;
+                    for (unsigned k = 0; k < threads && !found; k++)
+                    {
+                        Queue &queue = queues[(self + k) % threads];
+                        std::lock_guard<std::mutex> lock(queue.mutex);
+                        if (queue.items.empty())
+                            continue;
+                        if (k == 0)
+                        {
+                            item = queue.items.front();
+                            queue.items.pop_front();
+                        }
+                        else
+                        {
+                            item = queue.items.back();
+                            queue.items.pop_back();
+                        }
+                        found = true;
+                    }
+                    if (!found) // nothing is ever added back, so every queue stays empty
+                        return;
+                    fn(item);
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for (unsigned t = 1; t < threads; t++)
+                pool.emplace_back(worker, t);
+            worker(0);
+            for (std::thread &thread : pool)
+                thread.join();
+        }
+
+        struct Loaded
+        {
+            std::shared_ptr<const Cpu::Program> program;
+            std::vector<int> lines; // source line of each instruction, empty for images
+            std::string error;
+        };
+
+        void load(const std::string &path, const Options &options, Loaded &loaded)
+        {
+            Parser::Source source(path);
+            Cache::Program program;
+            if (Encoding::is_image(source.text()))
+                program.ops = Packed::pack(Encoding::decode(Encoding::read_image(source.text())));
+            else
+            {
+                const bool use_cache = !options.cache_dir.empty();
+                const std::uint64_t key = use_cache ? Cache::key(source.text()) : 0;
+                if (!use_cache || !Cache::load(options.cache_dir, key, source.text(), program))
+                {
+                    program.ops = Packed::pack(Decoder::decode(Parser::parse(source.text()), program.symbols));
+                    if (use_cache)
+                        Cache::store(options.cache_dir, key, source.text(), program);
+                }
+            }
+
+            if (options.optimize)
+                program.ops = Dataflow::optimize(program.ops).ops;
+            auto executable = std::make_shared<Cpu::Program>(std::move(program.ops));
+            if (options.fuse)
+                executable->enable_fusion();
+            if (options.jit)
+                executable->enable_jit();
+            loaded.program = std::move(executable);
+            loaded.lines = std::move(program.symbols.lines);
+        }
+
+        struct Taken
+        {
+            Cpu::Snapshot snapshot;
+            std::string error; // the setup failed; jobs starting from it report this instead
+        };
+
+        // Puts a freshly built machine in the state `job` starts from
+        void prepare(const Job &job, const std::vector<Taken> &snapshots, Cpu::Machine &machine)
+        {
+            if (job.snapshot != NO_SNAPSHOT)
+            {
+                const Taken &from = snapshots[job.snapshot];
+                if (!from.error.empty())
+                    throw std::runtime_error(from.error);
+                machine.restore(from.snapshot);
+            }
+            for (const auto &[reg, value] : job.registers)
+                machine.state.x[reg] = value;
+            for (const auto &[addr, value] : job.memory)
+                if (!machine.memory().store(addr, 8, value))
+                    throw std::runtime_error("initial memory exceeds the guest memory limit");
+        }
+
+        const char *status_name(Cpu::Status status)
+        {
+            switch (status)
+            {
+            case Cpu::Status::HALTED:
+                return "HALTED";
+            case Cpu::Status::BUDGET_EXHAUSTED:
+                return "BUDGET_EXHAUSTED";
+            default:
+                return "FAULT";
+            }
+        }
+
+        void quoted(std::string &out, const std::string &text)
+        {
+            out += '"';
+            for (char ch : text)
+                out += ch == '"' ? '\'' : ch;
+            out += '"';
+        }
+    } // namespace
+
+    Manifest parse_manifest(std::string_view text, const std::string &base_dir, std::uint64_t default_steps)
+    {
+        Manifest manifest;
+        std::unordered_map<std::string, std::size_t> programs;
+        std::unordered_map<std::string, std::size_t> snapshots;
+
+        int line = 0;
+        while (!text.empty())
+        {
+            ++line;
+            std::size_t newline = text.find('\n');
+            std::string_view rest = text.substr(0, newline);
+            text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+            rest = rest.substr(0, rest.find('#'));
+
+            Job job{0, line, default_steps, {}, {}, NO_SNAPSHOT};
+            bool is_snapshot = false;
+            std::string name;
+            bool have_program = false;
+            while (!rest.empty())
+            {
+                std::size_t start = rest.find_first_not_of(" \t\r");
+                if (start == std::string_view::npos)
+                    break;
+                rest.remove_prefix(start);
+                std::string_view field = rest.substr(0, rest.find_first_of(" \t\r"));
+                rest.remove_prefix(field.size());
+
+                if (!have_program)
+                {
+                    if (!is_snapshot && field == "snapshot")
+                    {
+                        is_snapshot = true;
+                        continue;
+                    }
+                    if (is_snapshot && name.empty())
+                    {
+                        name = field;
+                        if (name[0] == '@' || snapshots.count(name))
+                            throw line_error(line, "invalid or duplicate snapshot name '" + name + "'");
+                        continue;
+                    }
+
+                    if (field[0] == '@')
+                    {
+                        auto it = snapshots.find(std::string(field.substr(1)));
+                        if (it == snapshots.end())
+                            throw line_error(line, "unknown snapshot '" + std::string(field.substr(1)) + "'");
+                        job.snapshot = it->second;
+                        job.program = manifest.snapshots[it->second].setup.program;
+                    }
+                    else
+                    {
+                        std::string path(field);
+                        if (path[0] != '/' && !base_dir.empty())
+                            path = base_dir + "/" + path;
+                        auto [it, inserted] = programs.emplace(path, manifest.programs.size());
+                        if (inserted)
+                            manifest.programs.push_back(path);
+                        job.program = it->second;
+                    }
+                    have_program = true;
+                    continue;
+                }
+
+                std::size_t equals = field.find('=');
+                if (equals == std::string_view::npos || equals == 0)
+                    throw line_error(line, "expected name=value, got '" + std::string(field) + "'");
+                std::string_view key = field.substr(0, equals);
+                std::uint64_t value = parse_value(field.substr(equals + 1), line);
+
+                if (key == "steps")
+                    job.max_steps = value;
+                else if (key.front() == '[' && key.back() == ']')
+                    job.memory.emplace_back(parse_value(key.substr(1, key.size() - 2), line), value);
+                else
+                {
+                    Register::Name reg = Register::from_string(key);
+                    if (reg == Register::NONE || reg == Register::XZR)
+                        throw line_error(line, "invalid register '" + std::string(key) + "'");
+                    job.registers.emplace_back(reg, value);
+                }
+            }
+
+            if (is_snapshot && !have_program)
+                throw line_error(line, "expected 'snapshot <name> <program>'");
+            if (is_snapshot)
+            {
+                snapshots.emplace(name, manifest.snapshots.size());
+                manifest.snapshots.push_back({name, std::move(job)});
+            }
+            else if (have_program)
+                manifest.jobs.push_back(std::move(job));
+        }
+        return manifest;
+    }
+
+    Summary run(const Manifest &manifest, const Options &options, std::ostream &out)
+    {
+        unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+        if (threads == 0)
+            threads = 1;
+
+        std::vector<Loaded> programs(manifest.programs.size());
+        parallel_for(programs.size(), threads, [&](std::size_t i)
+                     {
+                         try
+                         {
+                             load(manifest.programs[i], options, programs[i]);
+                         }
+                         catch (const std::exception &e)
+                         {
+                             programs[i].error = e.what();
+                         } });
+
+        Summary summary;
+        summary.jobs = manifest.jobs.size();
+        std::mutex output;
+
+        // Take the snapshots, in waves so each starts after the one it builds on
+        std::vector<Taken> snapshots(manifest.snapshots.size());
+        std::vector<std::size_t> depth(snapshots.size(), 0);
+        std::vector<std::vector<std::size_t>> waves;
+        for (std::size_t i = 0; i < snapshots.size(); i++)
+        {
+            std::size_t from = manifest.snapshots[i].setup.snapshot;
+            depth[i] = from == NO_SNAPSHOT ? 0 : depth[from] + 1;
+            if (depth[i] == waves.size())
+                waves.emplace_back();
+            waves[depth[i]].push_back(i);
+        }
+        for (const std::vector<std::size_t> &wave : waves)
+            parallel_for(wave.size(), threads, [&](std::size_t w)
+                         {
+                             const Snapshot &definition = manifest.snapshots[wave[w]];
+                             const Loaded &program = programs[definition.setup.program];
+                             Taken &taken = snapshots[wave[w]];
+                             try
+                             {
+                                 if (!program.program)
+                                     throw std::runtime_error(program.error);
+                                 Memory::Space memory(options.memory);
+                                 Cpu::Machine machine(program.program, memory);
+                                 prepare(definition.setup, snapshots, machine);
+                                 const std::uint64_t before = machine.retired;
+                                 if (machine.run(definition.setup.max_steps) == Cpu::Status::FAULT)
+                                     throw std::runtime_error(machine.fault() + (machine.state.pc < program.lines.size()
+                                                                                     ? " on line " + std::to_string(program.lines[machine.state.pc])
+                                                                                     : " at pc " + std::to_string(machine.state.pc)));
+                                 taken.snapshot = machine.snapshot();
+                                 std::lock_guard<std::mutex> lock(output);
+                                 summary.retired += machine.retired - before;
+                             }
+                             catch (const std::exception &e)
+                             {
+                                 taken.error = "snapshot " + definition.name + ": " + e.what();
+                             } });
+
+        // A task is one job, or with lockstep up to Lockstep::WIDTH jobs that share a program
+        std::vector<std::vector<std::size_t>> tasks;
+        if (options.lockstep)
+        {
+            std::vector<std::size_t> open(manifest.programs.size(), SIZE_MAX); // task being filled
+            for (std::size_t i = 0; i < manifest.jobs.size(); i++)
+            {
+                std::size_t &task = open[manifest.jobs[i].program];
+                if (task == SIZE_MAX || tasks[task].size() == Lockstep::WIDTH)
+                {
+                    task = tasks.size();
+                    tasks.emplace_back();
+                }
+                tasks[task].push_back(i);
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < manifest.jobs.size(); i++)
+                tasks.push_back({i});
+        }
+
+        parallel_for(tasks.size(), threads, [&](std::size_t t)
+                     {
+                         const std::vector<std::size_t> &task = tasks[t];
+                         const Loaded &program = programs[manifest.jobs[task.front()].program];
+                         std::vector<std::unique_ptr<Memory::Space>> memories(task.size());
+                         std::vector<std::unique_ptr<Cpu::Machine>> machines(task.size());
+                         std::vector<std::string> errors(task.size());
+                         std::vector<std::uint64_t> starts(task.size());
+                         std::vector<Cpu::Machine *> ready;
+                         std::vector<std::uint64_t> budgets;
+
+                         for (std::size_t k = 0; k < task.size(); k++)
+                         {
+                             const Job &job = manifest.jobs[task[k]];
+                             if (!program.program)
+                             {
+                                 errors[k] = program.error;
+                                 continue;
+                             }
+                             try
+                             {
+                                 memories[k] = std::make_unique<Memory::Space>(options.memory);
+                                 machines[k] = std::make_unique<Cpu::Machine>(program.program, *memories[k]);
+                                 prepare(job, snapshots, *machines[k]);
+                                 starts[k] = machines[k]->retired;
+                                 ready.push_back(machines[k].get());
+                                 budgets.push_back(job.max_steps);
+                             }
+                             catch (const std::exception &e)
+                             {
+                                 errors[k] = e.what();
+                                 machines[k].reset();
+                             }
+                         }
+
+                         std::vector<Cpu::Status> statuses;
+                         if (options.lockstep)
+                             statuses = Lockstep::run(ready, budgets);
+                         else
+                             for (std::size_t k = 0; k < ready.size(); k++)
+                                 statuses.push_back(ready[k]->run(budgets[k]));
+
+                         std::string results;
+                         std::uint64_t retired = 0;
+                         std::size_t failed = 0;
+                         for (std::size_t k = 0, next = 0; k < task.size(); k++)
+                         {
+                             const Job &job = manifest.jobs[task[k]];
+                             results += "job=" + std::to_string(task[k]) + " line=" + std::to_string(job.line) +
+                                        " program=" + manifest.programs[job.program];
+                             if (!machines[k])
+                             {
+                                 results += " status=ERROR error=";
+                                 quoted(results, errors[k]);
+                                 results += '\n';
+                                 failed++;
+                                 continue;
+                             }
+
+                             const Cpu::Machine &machine = *machines[k];
+                             Cpu::Status status = statuses[next++];
+                             retired += machine.retired - starts[k];
+                             results += std::string(" status=") + status_name(status) +
+                                        " retired=" + std::to_string(machine.retired) +
+                                        " pc=" + std::to_string(machine.state.pc);
+                             if (status == Cpu::Status::FAULT)
+                             {
+                                 failed++;
+                                 results += " fault=";
+                                 quoted(results, machine.fault());
+                                 if (machine.state.pc < program.lines.size())
+                                     results += " source_line=" + std::to_string(program.lines[machine.state.pc]);
+                             }
+                             char hex[32];
+                             for (int r = Register::X0; r < Register::XZR; r++)
+                             {
+                                 if (machine.state.x[r] == 0)
+                                     continue;
+                                 std::snprintf(hex, sizeof(hex), "=0x%llx", static_cast<unsigned long long>(machine.state.x[r]));
+                                 results += " " + Register::to_string(static_cast<Register::Name>(r)) + hex;
+                             }
+                             results += '\n';
+                         }
+
+                         std::lock_guard<std::mutex> lock(output);
+                         out << results << std::flush;
+                         summary.retired += retired;
+                         summary.failed += failed;
+                     });
+        return summary;
+    }
+} // namespace Batch
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "memory.hpp"
+#include "registers.hpp"
+
+// Runs many (program, initial state, budget) jobs across a pool of threads.
+//
+// A manifest holds one job per line; '#' starts a comment:
+//
+//   <program> [steps=N] [<register>=V ...] [[ADDR]=V ...]
+//   snapshot <name> <program> [steps=N] [<register>=V ...] [[ADDR]=V ...]
+//   @<name> [steps=N] [<register>=V ...] [[ADDR]=V ...]
+//
+// `program` is a source file or binary image, relative to the manifest's directory.
+// Registers are named as in assembly (X0, SP, LR, ...), and [ADDR]=V stores the
+// 64-bit value V at ADDR before the job starts. Numbers may be decimal, hex or negative.
+//
+// A `snapshot` line is run once, before any job, and its final state saved under `name`.
+// Lines starting with @<name>, snapshots included, start from that state instead of from
+// reset, sharing its memory copy-on-write; their registers and memory are applied on top.
+namespace Batch
+{
+    constexpr std::size_t NO_SNAPSHOT = SIZE_MAX;
+
+    struct Job
+    {
+        std::size_t program; // index into Manifest::programs
+        int line;            // in the manifest
+        std::uint64_t max_steps;
+        std::vector<std::pair<Register::Name, std::uint64_t>> registers;
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> memory;
+        std::size_t snapshot; // index into Manifest::snapshots to start from, or NO_SNAPSHOT
+    };
+
+    struct Snapshot
+    {
+        std::string name;
+        Job setup; // starts only from snapshots defined before it
+    };
+
+    struct Manifest
+    {
+        std::vector<std::string> programs; // distinct paths, as resolved
+        std::vector<Snapshot> snapshots;
+        std::vector<Job> jobs;
+    };
+
+    struct Options
+    {
+        unsigned threads = 0; // 0 for one per core
+        bool jit = false;
+        bool fuse = false;
+        bool optimize = false; // run Dataflow::optimize on each program
+        bool lockstep = false; // run jobs that share a program together with Lockstep::run
+        std::string cache_dir;
+        std::uint64_t max_steps = UINT64_MAX; // for jobs without steps=
+        Memory::Config memory;                // per job
+    };
+
+    struct Summary
+    {
+        std::size_t jobs = 0;
+        std::size_t failed = 0; // faulted, or the program failed to load
+        std::uint64_t retired = 0; // executed by this run, counting each snapshot's setup once
+    };
+
+    // Throws std::runtime_error on malformed lines
+    Manifest parse_manifest(std::string_view text, const std::string &base_dir, std::uint64_t default_steps);
+
+    // Loads each distinct program once and takes each snapshot, then runs every job on its
+    // own machine and memory, writing one line per job to `out` as it finishes. A job's
+    // retired count includes the instructions retired before its snapshot.
+    Summary run(const Manifest &manifest, const Options &options, std::ostream &out);
+} // namespace Batch
@@ -0,0 +1,253 @@
+#include "branchsim.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace BranchSim
+{
+    namespace
+    {
+        // Two-bit saturating counters: 2 and 3 predict taken
+        void train(std::uint8_t &counter, bool taken)
+        {
+            if (taken && counter < 3)
+                counter++;
+            else if (!taken && counter > 0)
+                counter--;
+        }
+
+        std::string percent(std::uint64_t part, std::uint64_t whole)
+        {
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(2) << (whole ? 100.0 * part / whole : 0.0) << '%';
+            return out.str();
+        }
+    } // namespace
+
+    Predictor::Predictor(Kind kind, unsigned bits) : kind_(kind), mask_((std::size_t{1} << bits) - 1)
+    {
+        switch (kind)
+        {
+        case Kind::STATIC:
+            name_ = "static";
+            break;
+        case Kind::BIMODAL:
+            name_ = "bimodal:" + std::to_string(bits);
+            local_.assign(mask_ + 1, 1);
+            break;
+        case Kind::GSHARE:
+            name_ = "gshare:" + std::to_string(bits);
+            global_.assign(mask_ + 1, 1);
+            break;
+        case Kind::TOURNAMENT:
+            name_ = "tournament:" + std::to_string(bits);
+            local_.assign(mask_ + 1, 1);
+            global_.assign(mask_ + 1, 1);
+            chooser_.assign(mask_ + 1, 1);
+            break;
+        }
+    }
+
+    Predictor Predictor::parse(std::string_view spec)
+    {
+        const std::size_t colon = spec.find(':');
+        const std::string_view kind = spec.substr(0, colon);
+        unsigned bits = 12;
+        if (colon != std::string_view::npos)
+        {
+            const std::string_view digits = spec.substr(colon + 1);
+            if (digits.empty() || digits.size() > 2 || !std::all_of(digits.begin(), digits.end(), [](char c)
+                                                                      { return c >= '0' && c <= '9'; }))
+                throw std::runtime_error("Error: bad predictor '" + std::string(spec) + "'");
+            bits = static_cast<unsigned>(std::stoul(std::string(digits)));
+            if (bits < 1 || bits > 24)
+                throw std::runtime_error("Error: predictor tables take 1 to 24 index bits, not " + std::to_string(bits));
+        }
+
+        if (kind == "static" && colon == std::string_view::npos)
+            return Predictor(Kind::STATIC, 0);
+        if (kind == "bimodal")
+            return Predictor(Kind::BIMODAL, bits);
+        if (kind == "gshare")
+            return Predictor(Kind::GSHARE, bits);
+        if (kind == "tournament")
+            return Predictor(Kind::TOURNAMENT, bits);
+        throw std::runtime_error("Error: unknown predictor '" + std::string(spec) +
+                                 "' (expected static, bimodal[:BITS], gshare[:BITS] or tournament[:BITS])");
+    }
+
+    bool Predictor::predict(std::size_t pc, bool backward)
+    {
+        switch (kind_)
+        {
+        case Kind::STATIC:
+            return backward;
+        case Kind::BIMODAL:
+            return local_[pc & mask_] >= 2;
+        case Kind::GSHARE:
+            return global_[(pc ^ history_) & mask_] >= 2;
+        default:
+            local_guess_ = local_[pc & mask_] >= 2;
+            global_guess_ = global_[(pc ^ history_) & mask_] >= 2;
+            return chooser_[pc & mask_] >= 2 ? global_guess_ : local_guess_;
+        }
+    }
+
+    void Predictor::update(std::size_t pc, bool taken)
+    {
+        switch (kind_)
+        {
+        case Kind::STATIC:
+            return;
+        case Kind::BIMODAL:
+            train(local_[pc & mask_], taken);
+            return;
+        case Kind::GSHARE:
+            train(global_[(pc ^ history_) & mask_], taken);
+            break;
+        default:
+            // The chooser only learns when the two disagree
+            if (local_guess_ != global_guess_)
+                train(chooser_[pc & mask_], global_guess_ == taken);
+            train(local_[pc & mask_], taken);
+            train(global_[(pc ^ history_) & mask_], taken);
+            break;
+        }
+        history_ = (history_ << 1 | taken) & mask_;
+    }
+
+    Simulator::Simulator(Cpu::Machine &machine, std::vector<Predictor> predictors,
+                         const std::vector<Decoder::Label> &labels, const std::vector<int> &lines, unsigned return_stack)
+        : machine_(machine), predictors_(std::move(predictors)), labels_(labels), lines_(lines),
+          returns_(std::max(return_stack, 1u)), sites_(machine.program_size()),
+          site_misses_(machine.program_size() * predictors_.size()), last_target_(machine.program_size(), SIZE_MAX),
+          misses_(predictors_.size())
+    {
+        std::stable_sort(labels_.begin(), labels_.end(), [](const Decoder::Label &a, const Decoder::Label &b)
+                         { return a.index < b.index; });
+    }
+
+    Cpu::Status Simulator::run(std::uint64_t max_steps)
+    {
+        Cpu::Status status = machine_.run(max_steps, *this);
+
+        // A branch seen last retired if the budget ran out; otherwise it faulted
+        if (pending_ && status == Cpu::Status::BUDGET_EXHAUSTED)
+            resolve(machine_.state.pc);
+        pending_ = false;
+        return status;
+    }
+
+    void Simulator::resolve(std::size_t next_pc)
+    {
+        Site &site = sites_[pc_];
+        const bool taken = next_pc != pc_ + 1;
+        site.executed++;
+        site.taken += taken;
+
+        switch (KINDS[op_.opcode])
+        {
+        case CONDITIONAL:
+        {
+            conditional_++;
+            conditional_taken_ += taken;
+            const bool backward = op_.imm <= 0;
+            for (std::size_t i = 0; i < predictors_.size(); i++)
+            {
+                const bool miss = predictors_[i].predict(pc_, backward) != taken;
+                predictors_[i].update(pc_, taken);
+                misses_[i] += miss;
+                site_misses_[pc_ * predictors_.size() + i] += miss;
+            }
+            break;
+        }
+        case DIRECT:
+            direct_++;
+            if (op_.opcode == Opcode::BL)
+            {
+                returns_[return_top_++ % returns_.size()] = pc_ + 1;
+                return_depth_ = std::min(return_depth_ + 1, returns_.size());
+            }
+            break;
+        default:
+            if (op_.rn == Register::X30)
+            {
+                // An empty stack predicts nothing, which counts as a miss
+                bool miss = true;
+                if (return_depth_)
+                {
+                    return_depth_--;
+                    miss = returns_[--return_top_ % returns_.size()] != next_pc;
+                }
+                returns_seen_++;
+                return_misses_ += miss;
+                site.target_misses += miss;
+            }
+            else
+            {
+                const bool miss = last_target_[pc_] != next_pc;
+                last_target_[pc_] = next_pc;
+                indirect_++;
+                indirect_misses_ += miss;
+                site.target_misses += miss;
+            }
+            break;
+        }
+    }
+
+    std::string Simulator::site_name(std::size_t pc) const
+    {
+        auto label = std::upper_bound(labels_.begin(), labels_.end(), pc, [](std::size_t pc, const Decoder::Label &label)
+                                      { return pc < label.index; });
+        std::string name = label == labels_.begin() ? std::to_string(pc)
+                                                    : std::prev(label)->name + "+" + std::to_string(pc - std::prev(label)->index);
+        if (pc < lines_.size())
+            name += " (line " + std::to_string(lines_[pc]) + ")";
+        return name;
+    }
+
+    void Simulator::report(std::ostream &os) const
+    {
+        os << "Branches: " << conditional_ << " conditional (" << percent(conditional_taken_, conditional_)
+           << " taken), " << direct_ << " B/BL, " << returns_seen_ << " returns, " << indirect_ << " other BR\n";
+        for (std::size_t i = 0; i < predictors_.size(); i++)
+            os << "  " << std::left << std::setw(16) << predictors_[i].name() << std::right << std::setw(12) << misses_[i]
+               << " mispredicts (" << percent(misses_[i], conditional_) << ")\n";
+        os << "  " << std::left << std::setw(16) << "return stack" << std::right << std::setw(12) << return_misses_
+           << " mispredicts (" << percent(return_misses_, returns_seen_) << ")\n";
+        if (indirect_)
+            os << "  " << std::left << std::setw(16) << "last target" << std::right << std::setw(12) << indirect_misses_
+               << " mispredicts (" << percent(indirect_misses_, indirect_) << ")\n";
+
+        // Per site: the rate of each direction predictor, or of the target for BR
+        std::vector<std::string> names;
+        std::size_t width = 4;
+        for (std::size_t pc = 0; pc < sites_.size(); pc++)
+        {
+            names.push_back(sites_[pc].executed ? site_name(pc) : std::string());
+            width = std::max(width, names.back().size() + 2);
+        }
+        os << std::left << std::setw(static_cast<int>(width)) << "site" << std::right << std::setw(12) << "executed"
+           << std::setw(10) << "taken";
+        for (const Predictor &predictor : predictors_)
+            os << std::setw(16) << predictor.name();
+        os << '\n';
+        for (std::size_t pc = 0; pc < sites_.size(); pc++)
+        {
+            const Site &site = sites_[pc];
+            if (!site.executed)
+                continue;
+            os << std::left << std::setw(static_cast<int>(width)) << names[pc] << std::right << std::setw(12)
+               << site.executed << std::setw(10) << percent(site.taken, site.executed);
+            const Opcode::Type opcode = static_cast<Opcode::Type>(machine_.program().ops()[pc].opcode);
+            if (KINDS[opcode] == CONDITIONAL)
+                for (std::size_t i = 0; i < predictors_.size(); i++)
+                    os << std::setw(16) << percent(site_misses_[pc * predictors_.size() + i], site.executed);
+            else if (KINDS[opcode] == INDIRECT)
+                os << std::setw(16) << percent(site.target_misses, site.executed) << " (target)";
+            os << '\n';
+        }
+    }
+} // namespace BranchSim
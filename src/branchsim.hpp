@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "decoder.hpp"
+#include "opcodes.hpp"
+#include "packed.hpp"
+
+// Measures how well branch predictors would do on a machine's execution.
+//
+// Every B.cond, CBZ and CBNZ is shown to each configured direction predictor, all in the same
+// pass, so one run compares them on identical history. B and BL always go where they say. A
+// return-address stack predicts BR X30: BL pushes its return address and the return pops
+// one. Other BRs are predicted to go where they went last time. Mispredicts are counted per
+// predictor and per branch site, sites being named after the closest label before them.
+namespace BranchSim
+{
+    enum class Kind
+    {
+        STATIC,     // backward taken, forward not taken
+        BIMODAL,    // two-bit counter per pc
+        GSHARE,     // two-bit counters indexed by pc xor global history
+        TOURNAMENT, // bimodal and gshare, with a two-bit chooser per pc
+    };
+
+    class Predictor
+    {
+    public:
+        // 2^bits counters per table; history is as long as the index
+        Predictor(Kind kind, unsigned bits);
+
+        // Parses "static", "bimodal[:BITS]", "gshare[:BITS]" or "tournament[:BITS]"; BITS
+        // defaults to 12. Throws std::runtime_error.
+        static Predictor parse(std::string_view spec);
+
+        const std::string &name() const { return name_; }
+
+        // Predicts the conditional branch at `pc`, then learns its outcome
+        bool predict(std::size_t pc, bool backward);
+        void update(std::size_t pc, bool taken);
+
+    private:
+        Kind kind_;
+        std::string name_;
+        std::size_t mask_;
+        std::vector<std::uint8_t> local_;   // bimodal counters
+        std::vector<std::uint8_t> global_;  // gshare counters
+        std::vector<std::uint8_t> chooser_; // tournament: 2 and up prefer gshare
+        std::uint64_t history_ = 0;
+        bool local_guess_ = false;
+        bool global_guess_ = false;
+    };
+
+    class Simulator : public Cpu::Observer
+    {
+    public:
+        // `lines` may be empty. The predictors see every conditional branch, in order.
+        Simulator(Cpu::Machine &machine, std::vector<Predictor> predictors, const std::vector<Decoder::Label> &labels,
+                  const std::vector<int> &lines, unsigned return_stack = 16);
+
+        // Like Machine::run, but observed. Interprets without the JIT or fused instructions.
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // Totals per predictor, then each branch site that executed
+        void report(std::ostream &os) const;
+
+        // Hook for the interpreter, called before each instruction executes. A branch is
+        // resolved once the next instruction arrives.
+        static constexpr bool OBSERVING = true;
+        void before(const Packed::Op &op, std::size_t pc, std::uint64_t)
+        {
+            if (pending_)
+                resolve(pc);
+            pending_ = KINDS[op.opcode] != NOT_BRANCH;
+            op_ = op;
+            pc_ = pc;
+        }
+
+    private:
+        enum Branch : std::uint8_t
+        {
+            NOT_BRANCH,
+            CONDITIONAL,
+            DIRECT, // B, BL
+            INDIRECT,
+        };
+
+        static constexpr std::array<Branch, Opcode::NONE + 1> KINDS = []
+        {
+            std::array<Branch, Opcode::NONE + 1> kinds{};
+            for (int op = 0; op < Opcode::NONE; op++)
+                if (Opcode::INFO[op].format == Opcode::Format::CB)
+                    kinds[op] = CONDITIONAL;
+            kinds[Opcode::B] = kinds[Opcode::BL] = DIRECT;
+            kinds[Opcode::BR] = INDIRECT;
+            return kinds;
+        }();
+
+        struct Site
+        {
+            std::uint64_t executed = 0;
+            std::uint64_t taken = 0;
+            std::uint64_t target_misses = 0; // BR only; conditional sites use site_misses_
+        };
+
+        void resolve(std::size_t next_pc);
+        std::string site_name(std::size_t pc) const;
+
+        Cpu::Machine &machine_;
+        std::vector<Predictor> predictors_;
+        std::vector<Decoder::Label> labels_; // by index
+        std::vector<int> lines_;
+
+        std::vector<std::size_t> returns_; // ring of return addresses
+        std::size_t return_top_ = 0;       // pushes so far; the newest is at (top - 1) % size
+        std::size_t return_depth_ = 0;     // valid entries
+
+        std::vector<Site> sites_;                  // by pc
+        std::vector<std::uint64_t> site_misses_;   // by pc, then predictor
+        std::vector<std::size_t> last_target_;     // by pc, for BR not through X30
+        std::vector<std::uint64_t> misses_;        // by predictor
+        std::uint64_t conditional_ = 0, conditional_taken_ = 0, direct_ = 0;
+        std::uint64_t returns_seen_ = 0, return_misses_ = 0, indirect_ = 0, indirect_misses_ = 0;
+
+        Packed::Op op_{};
+        std::size_t pc_ = 0;
+        bool pending_ = false;
+    };
+} // namespace BranchSim
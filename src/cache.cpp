@@ -0,0 +1,196 @@
+#include "cache.hpp"
+#include "version.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Cache
+{
+    namespace
+    {
+        constexpr char MAGIC[8] = {'L', 'E', 'G', '8', 'P', 'R', 'O', 'G'};
+        constexpr std::uint32_t FORMAT = 2;
+
+        struct Header
+        {
+            char magic[8];
+            std::uint64_t key;
+            std::uint32_t format;
+            std::uint32_t op_count;
+            std::uint32_t label_count;
+            std::uint32_t name_bytes;
+            std::uint64_t source_bytes;
+        };
+
+        struct Entry
+        {
+            std::uint32_t name_offset;
+            std::uint32_t name_length;
+            std::uint64_t index;
+        };
+
+        std::uint64_t fnv1a(std::uint64_t h, std::string_view bytes)
+        {
+            for (char c : bytes)
+            {
+                h ^= static_cast<std::uint8_t>(c);
+                h *= 1099511628211ull;
+            }
+            return h;
+        }
+
+        // Guards the interpreter against a damaged entry: registers, branch targets, shift
+        // amounts and wide immediates in the ranges the decoder allows
+        bool valid(const Packed::Op &op, std::size_t pc, std::size_t count)
+        {
+            if (op.opcode >= Opcode::NONE || op.rd > Packed::DISCARD || op.rn > Packed::DISCARD || op.rm > Packed::DISCARD)
+                return false;
+            if (op.opcode == Opcode::LSL || op.opcode == Opcode::LSR)
+                return op.imm >= 0 && op.imm <= 63;
+            Opcode::Format format = Opcode::format(static_cast<Opcode::Type>(op.opcode));
+            if (format == Opcode::Format::IW)
+                return op.rm <= 48 && op.rm % 16 == 0 && op.imm >= 0 && op.imm <= 0xFFFF;
+            if (format == Opcode::Format::B || format == Opcode::Format::CB)
+            {
+                std::int64_t target = static_cast<std::int64_t>(pc) + op.imm;
+                return target >= 0 && target <= static_cast<std::int64_t>(count);
+            }
+            return true;
+        }
+
+        // Unmaps on scope exit
+        struct Mapping
+        {
+            void *data = MAP_FAILED;
+            std::size_t size = 0;
+
+            ~Mapping()
+            {
+                if (data != MAP_FAILED)
+                    munmap(data, size);
+            }
+        };
+    } // namespace
+
+    std::uint64_t key(std::string_view source)
+    {
+        std::uint64_t h = fnv1a(14695981039346656037ull, LEGV8EMU_VERSION);
+        h = fnv1a(h, std::string_view(reinterpret_cast<const char *>(&FORMAT), sizeof(FORMAT)));
+        return fnv1a(h, source);
+    }
+
+    std::string path(const std::string &dir, std::uint64_t key)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.prog", static_cast<unsigned long long>(key));
+        return dir + "/" + name;
+    }
+
+    bool load(const std::string &dir, std::uint64_t key, std::string_view source, Program &program)
+    {
+        int fd = open(path(dir, key).c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        Mapping mapping;
+        if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(Header))
+        {
+            mapping.size = static_cast<std::size_t>(st.st_size);
+            mapping.data = mmap(nullptr, mapping.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapping.data == MAP_FAILED)
+            return false;
+
+        const char *base = static_cast<const char *>(mapping.data);
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.format != FORMAT || header.key != key ||
+            header.source_bytes != source.size())
+            return false;
+
+        const std::size_t ops_offset = sizeof(Header);
+        const std::size_t lines_offset = ops_offset + sizeof(Packed::Op) * std::size_t{header.op_count};
+        const std::size_t labels_offset = lines_offset + sizeof(std::int32_t) * std::size_t{header.op_count};
+        const std::size_t names_offset = labels_offset + sizeof(Entry) * std::size_t{header.label_count};
+        const std::size_t source_offset = names_offset + header.name_bytes;
+        if (source_offset + source.size() != mapping.size || std::memcmp(base + source_offset, source.data(), source.size()) != 0)
+            return false;
+
+        program.ops.resize(header.op_count);
+        std::memcpy(program.ops.data(), base + ops_offset, sizeof(Packed::Op) * program.ops.size());
+        for (std::size_t pc = 0; pc < program.ops.size(); pc++)
+            if (!valid(program.ops[pc], pc, program.ops.size()))
+                return false;
+
+        std::vector<std::int32_t> lines(header.op_count);
+        std::memcpy(lines.data(), base + lines_offset, sizeof(std::int32_t) * lines.size());
+        for (std::int32_t line : lines)
+            if (line < 0 || static_cast<std::uint64_t>(line) > source.size() + 1)
+                return false;
+        program.symbols.lines.assign(lines.begin(), lines.end());
+
+        program.symbols.labels.clear();
+        program.symbols.labels.reserve(header.label_count);
+        for (std::uint32_t i = 0; i < header.label_count; i++)
+        {
+            Entry entry;
+            std::memcpy(&entry, base + labels_offset + sizeof(Entry) * i, sizeof(entry));
+            if (std::size_t{entry.name_offset} + entry.name_length > header.name_bytes || entry.index > header.op_count)
+                return false;
+            program.symbols.labels.push_back({std::string(base + names_offset + entry.name_offset, entry.name_length), entry.index});
+        }
+        return true;
+    }
+
+    bool store(const std::string &dir, std::uint64_t key, std::string_view source, const Program &program)
+    {
+        mkdir(dir.c_str(), 0777); // may already exist
+
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.key = key;
+        header.format = FORMAT;
+        header.op_count = static_cast<std::uint32_t>(program.ops.size());
+        header.label_count = static_cast<std::uint32_t>(program.symbols.labels.size());
+        header.source_bytes = source.size();
+
+        std::vector<std::int32_t> lines(program.ops.size(), 0);
+        for (std::size_t i = 0; i < lines.size() && i < program.symbols.lines.size(); i++)
+            lines[i] = program.symbols.lines[i];
+
+        std::vector<Entry> entries;
+        std::string names;
+        for (const Decoder::Label &label : program.symbols.labels)
+        {
+            entries.push_back({static_cast<std::uint32_t>(names.size()), static_cast<std::uint32_t>(label.name.size()), label.index});
+            names += label.name;
+        }
+        header.name_bytes = static_cast<std::uint32_t>(names.size());
+
+        // Unique per process so concurrent runners never write the same temporary file
+        const std::string final_path = path(dir, key);
+        const std::string temp_path = final_path + ".tmp" + std::to_string(getpid());
+        std::FILE *file = std::fopen(temp_path.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  std::fwrite(program.ops.data(), sizeof(Packed::Op), program.ops.size(), file) == program.ops.size() &&
+                  std::fwrite(lines.data(), sizeof(std::int32_t), lines.size(), file) == lines.size() &&
+                  std::fwrite(entries.data(), sizeof(Entry), entries.size(), file) == entries.size() &&
+                  std::fwrite(names.data(), 1, names.size(), file) == names.size() &&
+                  std::fwrite(source.data(), 1, source.size(), file) == source.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok || std::rename(temp_path.c_str(), final_path.c_str()) != 0)
+        {
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+} // namespace Cache
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "decoder.hpp"
+#include "packed.hpp"
+
+// On-disk cache of assembled programs, keyed by the source text and emulator version.
+//
+// Each entry is one file holding the packed instruction stream, the label table, the
+// line map and the source it was assembled from, laid out so it can be validated and read
+// straight out of a read-only mapping:
+//
+//   Header | Packed::Op ops[op_count] | std::int32_t lines[op_count]
+//          | Entry labels[label_count] | char names[name_bytes] | char source[source_bytes]
+//
+// Files are named by a 64-bit hash of the source, so a hit also compares the stored source
+// with the one being run; two sources with the same hash never share an entry.
+namespace Cache
+{
+    struct Program
+    {
+        std::vector<Packed::Op> ops;
+        Decoder::Symbols symbols;
+    };
+
+    std::uint64_t key(std::string_view source);
+    std::string path(const std::string &dir, std::uint64_t key);
+
+    // False if there is no valid entry for `key` assembled from `source`
+    bool load(const std::string &dir, std::uint64_t key, std::string_view source, Program &program);
+
+    // Best effort: writes to a temporary file and renames it into place. False on failure.
+    bool store(const std::string &dir, std::uint64_t key, std::string_view source, const Program &program);
+} // namespace Cache
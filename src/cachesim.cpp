@@ -0,0 +1,276 @@
+#include "cachesim.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+namespace CacheSim
+{
+    namespace
+    {
+        constexpr const char *LEVEL_NAMES[LEVELS] = {"L1I", "L1D", "L2"};
+
+        bool power_of_two(std::uint64_t n) { return n && !(n & (n - 1)); }
+
+        unsigned log2(std::uint64_t n)
+        {
+            unsigned bits = 0;
+            while (n >>= 1)
+                bits++;
+            return bits;
+        }
+
+        std::runtime_error spec_error(std::string_view spec)
+        {
+            return std::runtime_error("Error: bad cache spec '" + std::string(spec) +
+                                      "' (expected SIZE,WAYS,LINE[,lru|plru|random][,wb|wt][,wa|nwa] or none)");
+        }
+
+        std::uint64_t parse_number(std::string_view text, std::string_view spec)
+        {
+            std::uint64_t scale = 1;
+            if (!text.empty() && (text.back() == 'K' || text.back() == 'k'))
+                scale = 1024;
+            else if (!text.empty() && (text.back() == 'M' || text.back() == 'm'))
+                scale = 1024 * 1024;
+            if (scale != 1)
+                text.remove_suffix(1);
+            if (text.empty() || text.size() > 12 || !std::all_of(text.begin(), text.end(), [](char c)
+                                                                 { return c >= '0' && c <= '9'; }))
+                throw spec_error(spec);
+            return std::stoull(std::string(text)) * scale;
+        }
+    } // namespace
+
+    Config parse_config(std::string_view spec)
+    {
+        Config config;
+        if (spec == "none")
+            return config;
+
+        std::vector<std::string_view> fields;
+        for (std::size_t start = 0;;)
+        {
+            std::size_t comma = spec.find(',', start);
+            fields.push_back(spec.substr(start, comma - start));
+            if (comma == std::string_view::npos)
+                break;
+            start = comma + 1;
+        }
+        if (fields.size() < 3)
+            throw spec_error(spec);
+
+        config.size = parse_number(fields[0], spec);
+        config.ways = static_cast<unsigned>(parse_number(fields[1], spec));
+        config.line = static_cast<unsigned>(parse_number(fields[2], spec));
+        for (std::size_t i = 3; i < fields.size(); i++)
+        {
+            if (fields[i] == "lru")
+                config.replacement = Replacement::LRU;
+            else if (fields[i] == "plru")
+                config.replacement = Replacement::PLRU;
+            else if (fields[i] == "random")
+                config.replacement = Replacement::RANDOM;
+            else if (fields[i] == "wb" || fields[i] == "wt")
+                config.write_back = fields[i] == "wb";
+            else if (fields[i] == "wa" || fields[i] == "nwa")
+                config.write_allocate = fields[i] == "wa";
+            else
+                throw spec_error(spec);
+        }
+        return config;
+    }
+
+    Cache::Cache(const Config &config) : config_(config), line_bits_(log2(config.line))
+    {
+        if (!power_of_two(config.line) || !power_of_two(config.ways) || config.ways > 64)
+            throw std::runtime_error("cache ways and line size must be powers of two, with at most 64 ways");
+        const std::uint64_t sets = config.size / config.ways / config.line;
+        if (!power_of_two(sets) || sets * config.ways * config.line != config.size)
+            throw std::runtime_error("cache size must be a power-of-two multiple of ways * line size");
+
+        set_mask_ = sets - 1;
+        tags_.assign(sets * config.ways, 0);
+        dirty_.assign(sets * config.ways, 0);
+        order_.assign(config.replacement == Replacement::PLRU ? sets : sets * config.ways, 0);
+    }
+
+    Cache::Result Cache::access(std::uint64_t addr, bool write)
+    {
+        const std::uint64_t line = addr >> line_bits_;
+        const std::size_t base = (line & set_mask_) * config_.ways;
+        (write ? stats_.writes : stats_.reads)++;
+        for (unsigned way = 0; way < config_.ways; way++)
+        {
+            if (tags_[base + way] == line + 1)
+            {
+                touch(base, way);
+                dirty_[base + way] |= write && config_.write_back;
+                return {true, false, false, 0};
+            }
+        }
+
+        (write ? stats_.write_misses : stats_.read_misses)++;
+        if (write && !config_.write_allocate)
+            return {false, false, false, 0};
+
+        const unsigned way = victim(base);
+        Result result{false, true, false, 0};
+        if (tags_[base + way])
+        {
+            stats_.evictions++;
+            if (dirty_[base + way])
+            {
+                stats_.writebacks++;
+                result.writeback = true;
+                result.victim = (tags_[base + way] - 1) << line_bits_;
+            }
+        }
+        tags_[base + way] = line + 1;
+        dirty_[base + way] = write && config_.write_back;
+        touch(base, way);
+        return result;
+    }
+
+    unsigned Cache::victim(std::size_t base)
+    {
+        for (unsigned way = 0; way < config_.ways; way++)
+            if (!tags_[base + way])
+                return way;
+
+        switch (config_.replacement)
+        {
+        case Replacement::LRU:
+            return static_cast<unsigned>(std::min_element(order_.begin() + base, order_.begin() + base + config_.ways) -
+                                         (order_.begin() + base));
+        case Replacement::PLRU:
+        {
+            // Follow the tree bits, which point away from recently used halves
+            const std::uint64_t bits = order_[base / config_.ways];
+            unsigned node = 1;
+            while (node < config_.ways)
+                node = node * 2 + ((bits >> node) & 1);
+            return node - config_.ways;
+        }
+        default:
+            random_ ^= random_ << 13;
+            random_ ^= random_ >> 7;
+            random_ ^= random_ << 17;
+            return static_cast<unsigned>(random_ & (config_.ways - 1));
+        }
+    }
+
+    void Cache::touch(std::size_t base, unsigned way)
+    {
+        if (config_.replacement == Replacement::LRU)
+            order_[base + way] = ++clock_;
+        else if (config_.replacement == Replacement::PLRU)
+        {
+            std::uint64_t &bits = order_[base / config_.ways];
+            for (unsigned node = way + config_.ways; node > 1; node /= 2)
+            {
+                // Point the parent at the sibling subtree
+                const std::uint64_t mask = std::uint64_t{1} << (node / 2);
+                bits = node & 1 ? bits & ~mask : bits | mask;
+            }
+        }
+    }
+
+    Simulator::Simulator(Cpu::Machine &machine, const std::array<Config, LEVELS> &configs,
+                         const std::vector<Decoder::Label> &labels)
+        : machine_(machine), fetch_(configs[L1I].size != 0)
+    {
+        for (int level = 0; level < LEVELS; level++)
+            if (configs[level].size)
+                caches_[level].emplace(configs[level]);
+
+        // Row 0 collects instructions before the first label
+        std::vector<const Decoder::Label *> sorted;
+        for (const Decoder::Label &label : labels)
+            sorted.push_back(&label);
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Decoder::Label *a, const Decoder::Label *b)
+                         { return a->index < b->index; });
+        names_.push_back("(no label)");
+        labels_.assign(machine.program_size() + 1, 0);
+        for (std::size_t i = 0; i < sorted.size(); i++)
+        {
+            // Each label's rows run up to the next label
+            names_.push_back(sorted[i]->name);
+            const std::size_t end = i + 1 < sorted.size() ? sorted[i + 1]->index : labels_.size();
+            std::fill(labels_.begin() + std::min(sorted[i]->index, labels_.size()), labels_.begin() + std::min(end, labels_.size()),
+                      static_cast<std::uint32_t>(names_.size() - 1));
+        }
+        counts_.resize(names_.size());
+    }
+
+    Cpu::Status Simulator::run(std::uint64_t max_steps)
+    {
+        return machine_.run(max_steps, *this);
+    }
+
+    void Simulator::access(Level level, std::uint64_t addr, unsigned size, bool write)
+    {
+        if (!caches_[level])
+            level = L2;
+        if (!caches_[level])
+            return;
+        const std::uint64_t line = caches_[level]->config().line;
+        access_line(level, addr, write);
+        if ((addr & (line - 1)) + size > line)
+            access_line(level, (addr | (line - 1)) + 1, write);
+    }
+
+    void Simulator::access_line(Level level, std::uint64_t addr, bool write)
+    {
+        Cache &cache = *caches_[level];
+        const Cache::Result result = cache.access(addr, write);
+        Counts &counts = counts_[label_];
+        counts.accesses[level]++;
+        counts.misses[level] += !result.hit;
+        if (level == L2 || !caches_[L2])
+            return;
+
+        if (result.fill)
+            access_line(L2, addr, false);
+        if (write && (!cache.config().write_back || !(result.hit || result.fill)))
+            access_line(L2, addr, true);
+        if (result.writeback)
+            access_line(L2, result.victim, true);
+    }
+
+    void Simulator::report(std::ostream &os) const
+    {
+        for (int level = 0; level < LEVELS; level++)
+        {
+            if (!caches_[level])
+                continue;
+            const Stats &stats = caches_[level]->stats();
+            os << LEVEL_NAMES[level] << ": " << stats.reads << " reads, " << stats.writes << " writes, "
+               << stats.misses() << " misses (" << std::fixed << std::setprecision(2)
+               << (stats.accesses() ? 100.0 * stats.misses() / stats.accesses() : 0.0) << "%), "
+               << stats.evictions << " evictions, " << stats.writebacks << " writebacks\n";
+        }
+        os << std::defaultfloat;
+
+        std::size_t width = 12;
+        for (const std::string &name : names_)
+            width = std::max(width, name.size() + 2);
+        os << std::left << std::setw(static_cast<int>(width)) << "misses/accesses";
+        for (int level = 0; level < LEVELS; level++)
+            if (caches_[level])
+                os << std::right << std::setw(24) << LEVEL_NAMES[level];
+        os << '\n';
+        for (std::size_t row = 0; row < names_.size(); row++)
+        {
+            const Counts &counts = counts_[row];
+            if (std::all_of(std::begin(counts.accesses), std::end(counts.accesses), [](std::uint64_t n)
+                            { return n == 0; }))
+                continue;
+            os << std::left << std::setw(static_cast<int>(width)) << names_[row] << std::right;
+            for (int level = 0; level < LEVELS; level++)
+                if (caches_[level])
+                    os << std::setw(24) << (std::to_string(counts.misses[level]) + "/" + std::to_string(counts.accesses[level]));
+            os << '\n';
+        }
+    }
+} // namespace CacheSim
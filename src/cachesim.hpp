@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cpu.hpp"
+#include "decoder.hpp"
+#include "opcodes.hpp"
+#include "packed.hpp"
+
+// Simulates L1 instruction, L1 data and unified L2 caches over a machine's memory accesses.
+//
+// Every load and store is looked up in L1D, and optionally every instruction fetch in L1I;
+// misses, write-throughs and dirty evictions go on to L2 if there is one. Only tags are
+// modelled, never data, and all state is allocated up front, so an access costs a scan of
+// one set. Counts are kept per cache and per label, each instruction belonging to the
+// closest label at or before it.
+namespace CacheSim
+{
+    enum class Replacement
+    {
+        LRU,
+        PLRU, // tree pseudo-LRU
+        RANDOM,
+    };
+
+    struct Config
+    {
+        std::uint64_t size = 0; // bytes; 0 for no cache
+        unsigned ways = 8;
+        unsigned line = 64; // bytes
+        Replacement replacement = Replacement::LRU;
+        bool write_back = true;     // else write-through
+        bool write_allocate = true; // else write misses go straight to the next level
+    };
+
+    // Parses "SIZE,WAYS,LINE[,lru|plru|random][,wb|wt][,wa|nwa]", with K or M allowed on
+    // SIZE, or "none". Throws std::runtime_error.
+    Config parse_config(std::string_view spec);
+
+    struct Stats
+    {
+        std::uint64_t reads = 0;
+        std::uint64_t writes = 0;
+        std::uint64_t read_misses = 0;
+        std::uint64_t write_misses = 0;
+        std::uint64_t evictions = 0;  // valid lines replaced
+        std::uint64_t writebacks = 0; // dirty lines among them
+
+        std::uint64_t accesses() const { return reads + writes; }
+        std::uint64_t misses() const { return read_misses + write_misses; }
+    };
+
+    // One set-associative cache. Sets and ways are powers of two.
+    class Cache
+    {
+    public:
+        struct Result
+        {
+            bool hit;
+            bool fill;      // the line was brought in, so the next level must supply it
+            bool writeback; // a dirty line was evicted to make room
+            std::uint64_t victim; // its address
+        };
+
+        // Throws std::runtime_error for impossible geometries
+        explicit Cache(const Config &config);
+
+        Result access(std::uint64_t addr, bool write);
+
+        const Config &config() const { return config_; }
+        const Stats &stats() const { return stats_; }
+
+    private:
+        unsigned victim(std::size_t base);
+        void touch(std::size_t base, unsigned way);
+
+        Config config_;
+        Stats stats_;
+        unsigned line_bits_;
+        std::uint64_t set_mask_;
+        std::vector<std::uint64_t> tags_; // line number + 1 per way, 0 when empty
+        std::vector<std::uint8_t> dirty_;
+        std::vector<std::uint64_t> order_; // LRU: last use per way; PLRU: tree bits per set
+        std::uint64_t clock_ = 0;
+        std::uint64_t random_ = 0x9E3779B97F4A7C15; // xorshift state
+    };
+
+    enum Level
+    {
+        L1I,
+        L1D,
+        L2,
+        LEVELS
+    };
+
+    // Instructions are not in guest memory, so fetches are modelled as reading the 32-bit
+    // encoding of instruction `pc` at CODE_BASE + 4 * pc, clear of data and stack.
+    constexpr std::uint64_t CODE_BASE = std::uint64_t{1} << 46;
+
+    class Simulator : public Cpu::Observer
+    {
+    public:
+        // Levels with size 0 are left out. The program's labels name the report's rows.
+        Simulator(Cpu::Machine &machine, const std::array<Config, LEVELS> &configs,
+                  const std::vector<Decoder::Label> &labels);
+
+        // Like Machine::run, but simulated. Interprets without the JIT or fused instructions.
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // Null for levels left out
+        const Cache *cache(Level level) const { return caches_[level] ? &*caches_[level] : nullptr; }
+
+        // Totals per cache, then accesses and misses per label
+        void report(std::ostream &os) const;
+
+        // Hook for the interpreter, called before each instruction executes
+        static constexpr bool OBSERVING = true;
+        void before(const Packed::Op &op, std::size_t pc, std::uint64_t)
+        {
+            if (op.opcode == Opcode::NONE || op.opcode == Opcode::HALT) // neither retires
+                return;
+            label_ = labels_[pc];
+            if (fetch_)
+                access(L1I, CODE_BASE + 4 * pc, 4, false);
+            if (const unsigned size = SIZES[op.opcode])
+                access(L1D, machine_.state.x[op.rn] + static_cast<std::int64_t>(op.imm), size, STORES[op.opcode]);
+        }
+
+    private:
+        struct Counts
+        {
+            std::uint64_t accesses[LEVELS] = {};
+            std::uint64_t misses[LEVELS] = {};
+        };
+
+        static constexpr std::array<std::uint8_t, Opcode::NONE + 1> SIZES = []
+        {
+            std::array<std::uint8_t, Opcode::NONE + 1> sizes{};
+            sizes[Opcode::LDUR] = sizes[Opcode::STUR] = sizes[Opcode::LDXR] = sizes[Opcode::STXR] = 8;
+            sizes[Opcode::LDURSW] = sizes[Opcode::STURW] = 4;
+            sizes[Opcode::LDURH] = sizes[Opcode::STURH] = 2;
+            sizes[Opcode::LDURB] = sizes[Opcode::STURB] = 1;
+            return sizes;
+        }();
+        static constexpr std::array<bool, Opcode::NONE + 1> STORES = []
+        {
+            std::array<bool, Opcode::NONE + 1> stores{};
+            stores[Opcode::STUR] = stores[Opcode::STXR] = stores[Opcode::STURW] = true;
+            stores[Opcode::STURH] = stores[Opcode::STURB] = true;
+            return stores;
+        }();
+
+        // An access of `size` bytes at `addr`, split where it crosses a line
+        void access(Level level, std::uint64_t addr, unsigned size, bool write);
+        void access_line(Level level, std::uint64_t addr, bool write);
+
+        Cpu::Machine &machine_;
+        std::optional<Cache> caches_[LEVELS];
+        bool fetch_;
+        std::vector<std::uint32_t> labels_; // row of each instruction, the sentinel included
+        std::vector<std::string> names_;    // of each row
+        std::vector<Counts> counts_;        // by row
+        std::uint32_t label_ = 0;           // row of the current instruction
+    };
+} // namespace CacheSim
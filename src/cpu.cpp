@@ -0,0 +1,630 @@
+#include "cpu.hpp"
+#include "branchsim.hpp"
+#include "cachesim.hpp"
+#include "fusion.hpp"
+#include "harts.hpp"
+#include "jit.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
+#include "replay.hpp"
+#include "trace.hpp"
+
+#include <iomanip>
+
+namespace Cpu
+{
+    namespace
+    {
+        inline void add_flags(Flags &f, std::uint64_t a, std::uint64_t b, std::uint64_t r)
+        {
+            f.n = r >> 63;
+            f.z = r == 0;
+            f.c = r < a;
+            f.v = (~(a ^ b) & (a ^ r)) >> 63;
+        }
+
+        inline void sub_flags(Flags &f, std::uint64_t a, std::uint64_t b, std::uint64_t r)
+        {
+            f.n = r >> 63;
+            f.z = r == 0;
+            f.c = a >= b;
+            f.v = ((a ^ b) & (a ^ r)) >> 63;
+        }
+
+        inline void logic_flags(Flags &f, std::uint64_t r)
+        {
+            f.n = r >> 63;
+            f.z = r == 0;
+            f.c = false;
+            f.v = false;
+        }
+
+        constexpr std::uint16_t CONDITION_MASKS[] = {
+            Fusion::condition_mask(Opcode::B_EQ), Fusion::condition_mask(Opcode::B_NE),
+            Fusion::condition_mask(Opcode::B_LT), Fusion::condition_mask(Opcode::B_LE),
+            Fusion::condition_mask(Opcode::B_GT), Fusion::condition_mask(Opcode::B_GE),
+            Fusion::condition_mask(Opcode::B_LO), Fusion::condition_mask(Opcode::B_LS),
+            Fusion::condition_mask(Opcode::B_HI), Fusion::condition_mask(Opcode::B_HS),
+            Fusion::condition_mask(Opcode::B_MI), Fusion::condition_mask(Opcode::B_VS)};
+
+        inline std::uint64_t sext(int imm) { return static_cast<std::uint64_t>(static_cast<std::int64_t>(imm)); }
+
+// The interpreter's handler for every opcode, real then synthetic, as (opcode, label) pairs.
+// Both the handler table and the check below are built from this one list.
+#define HANDLERS(H)                                                                                          \
+    H(Opcode::B, B) H(Opcode::FMULS, UNSUPPORTED) H(Opcode::FDIVS, UNSUPPORTED)                              \
+    H(Opcode::FCMPS, UNSUPPORTED) H(Opcode::FADDS, UNSUPPORTED) H(Opcode::FSUBS, UNSUPPORTED)                \
+    H(Opcode::FMULD, UNSUPPORTED) H(Opcode::FDIVD, UNSUPPORTED) H(Opcode::FCMPD, UNSUPPORTED)                \
+    H(Opcode::FADDD, UNSUPPORTED) H(Opcode::FSUBD, UNSUPPORTED) H(Opcode::STURB, STURB)                      \
+    H(Opcode::LDURB, LDURB) H(Opcode::B_EQ, B_EQ) H(Opcode::B_NE, B_NE) H(Opcode::B_LT, B_LT)                \
+    H(Opcode::B_LE, B_LE) H(Opcode::B_GT, B_GT) H(Opcode::B_GE, B_GE) H(Opcode::B_LO, B_LO)                  \
+    H(Opcode::B_LS, B_LS) H(Opcode::B_HI, B_HI) H(Opcode::B_HS, B_HS) H(Opcode::B_MI, B_MI)                  \
+    H(Opcode::B_VS, B_VS) H(Opcode::STURH, STURH) H(Opcode::LDURH, LDURH) H(Opcode::AND, AND)                \
+    H(Opcode::ADD, ADD) H(Opcode::ADDI, ADDI) H(Opcode::ANDI, ANDI) H(Opcode::BL, BL)                        \
+    H(Opcode::SDIV, SDIV) H(Opcode::UDIV, UDIV) H(Opcode::MUL, MUL) H(Opcode::SMULH, SMULH)                  \
+    H(Opcode::UMULH, UMULH) H(Opcode::ORR, ORR) H(Opcode::ADDS, ADDS) H(Opcode::ADDIS, ADDIS)                \
+    H(Opcode::ORRI, ORRI) H(Opcode::CBZ, CBZ) H(Opcode::CBNZ, CBNZ) H(Opcode::STURW, STURW)                  \
+    H(Opcode::LDURSW, LDURSW) H(Opcode::STURS, UNSUPPORTED) H(Opcode::LDURS, UNSUPPORTED)                    \
+    H(Opcode::STXR, STXR) H(Opcode::LDXR, LDXR) H(Opcode::EOR, EOR) H(Opcode::SUB, SUB)                      \
+    H(Opcode::SUBI, SUBI) H(Opcode::EORI, EORI) H(Opcode::MOVZ, MOVZ) H(Opcode::LSR, LSR)                    \
+    H(Opcode::LSL, LSL) H(Opcode::BR, BR) H(Opcode::ANDS, ANDS) H(Opcode::SUBS, SUBS)                        \
+    H(Opcode::SUBIS, SUBIS) H(Opcode::ANDIS, ANDIS) H(Opcode::MOVK, MOVK) H(Opcode::STUR, STUR)              \
+    H(Opcode::LDUR, LDUR) H(Opcode::STURD, UNSUPPORTED) H(Opcode::LDURD, UNSUPPORTED)                        \
+    H(Opcode::HALT, HALT) H(Opcode::NONE, NONE)                                                              \
+    H(Packed::CMP_BRANCH, CMP_BRANCH) H(Packed::CMPI_BRANCH, CMPI_BRANCH) H(Packed::CONST64, CONST64)        \
+    H(Packed::ADJUST_LOAD, ADJUST_LOAD) H(Packed::ADJUST_STORE, ADJUST_STORE)                                \
+    H(Packed::LOAD_ADJUST, LOAD_ADJUST) H(Packed::SHIFT_ADD, SHIFT_ADD)
+#define HANDLER_OPCODE(opcode, label) opcode,
+
+        constexpr int HANDLER_OPCODES[] = {HANDLERS(HANDLER_OPCODE)};
+
+        constexpr bool handlers_in_order()
+        {
+            for (int op = 0; op < Packed::SYNTHETIC_END; op++)
+                if (HANDLER_OPCODES[op] != op)
+                    return false;
+            return sizeof(HANDLER_OPCODES) / sizeof(HANDLER_OPCODES[0]) == Packed::SYNTHETIC_END;
+        }
+        static_assert(handlers_in_order(), "HANDLERS must list every real and synthetic opcode in order");
+#undef HANDLER_OPCODE
+    } // namespace
+
+    const char *to_string(Status status)
+    {
+        switch (status)
+        {
+        case Status::HALTED:
+            return "halted";
+        case Status::BUDGET_EXHAUSTED:
+            return "budget exhausted";
+        case Status::FAULT:
+            return "fault";
+        default:
+            return "unknown";
+        }
+    }
+
+    Program::Program(std::vector<Packed::Op> ops) : ops_(std::move(ops))
+    {
+        ops_.push_back(Packed::pack(Decoder::Instruction(Opcode::NONE)));
+    }
+
+    Program::~Program() = default;
+
+    bool Program::enable_jit()
+    {
+        if (!Jit::available())
+            return false;
+        jit_ = std::make_unique<Jit::Engine>(ops_);
+        return true;
+    }
+
+    Fusion::Stats Program::enable_fusion()
+    {
+        Fusion::Program fused = Fusion::fuse(ops_);
+        fused_ = std::move(fused.ops);
+        constants_ = std::move(fused.constants);
+        return fused.stats;
+    }
+
+    Machine::Machine(std::shared_ptr<const Program> program, Memory::Space &memory)
+        : state{}, program_(std::move(program)), memory_(memory)
+    {
+        state.x[Register::X28] = Memory::STACK_TOP;
+    }
+
+    Machine::Machine(const std::vector<Decoder::Instruction> &program, Memory::Space &memory)
+        : Machine(std::make_shared<const Program>(Packed::pack(program)), memory)
+    {
+    }
+
+    Snapshot Machine::snapshot()
+    {
+        return {program_, state, retired, memory_.snapshot()};
+    }
+
+    void Machine::restore(const Snapshot &snapshot)
+    {
+        program_ = snapshot.program;
+        state = snapshot.state;
+        retired = snapshot.retired;
+        fault_.clear();
+        memory_.restore(snapshot.memory);
+    }
+
+    Status Machine::run(std::uint64_t max_steps)
+    {
+        Observer hooks;
+        const Jit::Engine *jit = program_->jit_.get();
+        if (!jit)
+            return interpret(max_steps, hooks);
+
+        // Native blocks run until they reach something they do not translate; the interpreter
+        // then steps over that instruction and native execution resumes.
+        std::uint64_t remaining = max_steps;
+        while (true)
+        {
+            std::uint64_t before = remaining;
+            jit->enter(state, memory_, remaining);
+            retired += before - remaining;
+            if (remaining == 0)
+                return Status::BUDGET_EXHAUSTED;
+
+            Status status = interpret(1, hooks);
+            if (status != Status::BUDGET_EXHAUSTED)
+                return status;
+            remaining--;
+        }
+    }
+
+    Status Machine::run(std::uint64_t max_steps, Replay::Recorder &recorder)
+    {
+        return interpret(max_steps, recorder);
+    }
+
+    Status Machine::run(std::uint64_t max_steps, Pipeline::Model &model)
+    {
+        return interpret(max_steps, model);
+    }
+
+    Status Machine::run(std::uint64_t max_steps, CacheSim::Simulator &simulator)
+    {
+        return interpret(max_steps, simulator);
+    }
+
+    Status Machine::run(std::uint64_t max_steps, BranchSim::Simulator &simulator)
+    {
+        return interpret(max_steps, simulator);
+    }
+
+    Status Machine::run(std::uint64_t max_steps, Profile::Profiler &profiler)
+    {
+        return interpret(max_steps, profiler);
+    }
+
+    Status Machine::run(std::uint64_t max_steps, Trace::Tracer &tracer)
+    {
+        return interpret(max_steps, tracer);
+    }
+
+    Status Machine::run(std::uint64_t max_steps, Harts::Shared &shared)
+    {
+        return interpret(max_steps, shared);
+    }
+
+    template <typename Hooks>
+    Status Machine::interpret(std::uint64_t max_steps, Hooks &hooks)
+    {
+        // Threaded dispatch: every handler ends by jumping straight to the next handler,
+        // indexed by opcode
+#define HANDLER_LABEL(opcode, label) &&op_##label,
+        static const void *const handlers[] = {HANDLERS(HANDLER_LABEL)};
+#undef HANDLER_LABEL
+
+        std::uint64_t *const x = state.x;
+        Flags &f = state.flags;
+        const Packed::Op *const code = Hooks::OBSERVING || program_->fused_.empty() ? program_->ops_.data() : program_->fused_.data();
+        const Packed::Op *const original = program_->ops_.data();
+        const std::uint64_t *const constants = program_->constants_.data();
+        const Packed::Op *op;
+        std::size_t pc = state.pc;
+        std::uint64_t remaining = max_steps;
+        Status status;
+
+#define DISPATCH()                                        \
+    do                                                    \
+    {                                                     \
+        if (remaining == 0)                               \
+            goto budget;                                  \
+        --remaining;                                      \
+        op = &code[pc];                                   \
+        hooks.before(*op, pc, max_steps - remaining - 1); \
+        goto *handlers[op->opcode];                       \
+    } while (0)
+#define NEXT()      \
+    do              \
+    {               \
+        ++pc;       \
+        DISPATCH(); \
+    } while (0)
+#define BRANCH_IF(cond)                                                               \
+    do                                                                                \
+    {                                                                                 \
+        const std::size_t next = pc + ((cond) ? static_cast<std::ptrdiff_t>(op->imm) : 1); \
+        hooks.branch(pc, next);                                                       \
+        pc = next;                                                                    \
+        DISPATCH();                                                                   \
+    } while (0)
+#define MEMORY_LOAD(addr, size, v) (Hooks::SHARED ? memory_.load_shared(addr, size, v) : memory_.load(addr, size, v))
+#define MEMORY_STORE(addr, size, v) (Hooks::SHARED ? memory_.store_shared(addr, size, v) : memory_.store(addr, size, v))
+#define LOAD(size, convert)                                     \
+    do                                                          \
+    {                                                           \
+        std::uint64_t v;                                        \
+        if (!MEMORY_LOAD(x[op->rn] + sext(op->imm), size, v))   \
+            goto memory_fault;                                  \
+        x[op->rd] = convert;                                    \
+        NEXT();                                                 \
+    } while (0)
+#define STORE(size)                                                      \
+    do                                                                   \
+    {                                                                    \
+        if (!MEMORY_STORE(x[op->rn] + sext(op->imm), size, x[op->rm]))   \
+            goto memory_fault;                                           \
+        NEXT();                                                          \
+    } while (0)
+
+        DISPATCH();
+
+    // R format
+    op_AND:
+        x[op->rd] = x[op->rn] & x[op->rm];
+        NEXT();
+    op_ADD:
+        x[op->rd] = x[op->rn] + x[op->rm];
+        NEXT();
+    op_ORR:
+        x[op->rd] = x[op->rn] | x[op->rm];
+        NEXT();
+    op_EOR:
+        x[op->rd] = x[op->rn] ^ x[op->rm];
+        NEXT();
+    op_SUB:
+        x[op->rd] = x[op->rn] - x[op->rm];
+        NEXT();
+    op_MUL:
+        x[op->rd] = x[op->rn] * x[op->rm];
+        NEXT();
+    op_SDIV:
+    {
+        // Division by zero yields zero, as on ARMv8
+        std::int64_t n = static_cast<std::int64_t>(x[op->rn]);
+        std::int64_t m = static_cast<std::int64_t>(x[op->rm]);
+        std::int64_t q = m == 0 ? 0 : (m == -1 ? static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(n)) : n / m);
+        x[op->rd] = static_cast<std::uint64_t>(q);
+        NEXT();
+    }
+    op_UDIV:
+    {
+        std::uint64_t m = x[op->rm];
+        x[op->rd] = m == 0 ? 0 : x[op->rn] / m;
+        NEXT();
+    }
+    op_SMULH:
+    {
+        __int128 p = static_cast<__int128>(static_cast<std::int64_t>(x[op->rn])) * static_cast<std::int64_t>(x[op->rm]);
+        x[op->rd] = static_cast<std::uint64_t>(p >> 64);
+        NEXT();
+    }
+    op_UMULH:
+    {
+        unsigned __int128 p = static_cast<unsigned __int128>(x[op->rn]) * x[op->rm];
+        x[op->rd] = static_cast<std::uint64_t>(p >> 64);
+        NEXT();
+    }
+    op_ADDS:
+    {
+        std::uint64_t a = x[op->rn], b = x[op->rm], r = a + b;
+        add_flags(f, a, b, r);
+        x[op->rd] = r;
+        NEXT();
+    }
+    op_SUBS:
+    {
+        std::uint64_t a = x[op->rn], b = x[op->rm], r = a - b;
+        sub_flags(f, a, b, r);
+        x[op->rd] = r;
+        NEXT();
+    }
+    op_ANDS:
+    {
+        std::uint64_t r = x[op->rn] & x[op->rm];
+        logic_flags(f, r);
+        x[op->rd] = r;
+        NEXT();
+    }
+    op_LSL:
+        x[op->rd] = x[op->rn] << (op->imm & 63);
+        NEXT();
+    op_LSR:
+        x[op->rd] = x[op->rn] >> (op->imm & 63);
+        NEXT();
+    op_BR:
+    {
+        std::uint64_t target = x[op->rn];
+        if (target > program_size())
+        {
+            fault_ = "branch target " + std::to_string(target) + " outside program";
+            goto fault;
+        }
+        hooks.branch(pc, target);
+        pc = target;
+        DISPATCH();
+    }
+
+    // I format
+    op_ADDI:
+        x[op->rd] = x[op->rn] + sext(op->imm);
+        NEXT();
+    op_SUBI:
+        x[op->rd] = x[op->rn] - sext(op->imm);
+        NEXT();
+    op_ANDI:
+        x[op->rd] = x[op->rn] & sext(op->imm);
+        NEXT();
+    op_ORRI:
+        x[op->rd] = x[op->rn] | sext(op->imm);
+        NEXT();
+    op_EORI:
+        x[op->rd] = x[op->rn] ^ sext(op->imm);
+        NEXT();
+    op_ADDIS:
+    {
+        std::uint64_t a = x[op->rn], b = sext(op->imm), r = a + b;
+        add_flags(f, a, b, r);
+        x[op->rd] = r;
+        NEXT();
+    }
+    op_SUBIS:
+    {
+        std::uint64_t a = x[op->rn], b = sext(op->imm), r = a - b;
+        sub_flags(f, a, b, r);
+        x[op->rd] = r;
+        NEXT();
+    }
+    op_ANDIS:
+    {
+        std::uint64_t r = x[op->rn] & sext(op->imm);
+        logic_flags(f, r);
+        x[op->rd] = r;
+        NEXT();
+    }
+
+    // D format
+    op_LDUR:
+        LOAD(8, v);
+    op_LDURB:
+        LOAD(1, v);
+    op_LDURH:
+        LOAD(2, v);
+    op_LDURSW:
+        LOAD(4, static_cast<std::uint64_t>(static_cast<std::int64_t>(static_cast<std::int32_t>(v))));
+    op_STUR:
+        STORE(8);
+    op_STURB:
+        STORE(1);
+    op_STURH:
+        STORE(2);
+    op_STURW:
+        STORE(4);
+    op_LDXR:
+    {
+        const std::uint64_t address = x[op->rn] + sext(op->imm);
+        std::uint64_t v, generation;
+        if (address & 7)
+            goto unaligned_exclusive;
+        if (!memory_.load_exclusive(address, v, generation))
+            goto memory_fault;
+        state.monitor = {true, address, generation};
+        x[op->rd] = v;
+        NEXT();
+    }
+    op_STXR:
+    {
+        // Status 0 if stored, 1 if not; either way the monitor is cleared
+        const std::uint64_t address = x[op->rn] + sext(op->imm);
+        bool stored = false;
+        if (address & 7)
+            goto unaligned_exclusive;
+        if (state.monitor.armed && state.monitor.address == address &&
+            !memory_.store_exclusive(address, x[op->rm], state.monitor.generation, stored))
+            goto memory_fault;
+        state.monitor.armed = false;
+        x[op->rd] = !stored;
+        NEXT();
+    }
+
+    // B format
+    op_B:
+        hooks.branch(pc, pc + op->imm);
+        pc += op->imm;
+        DISPATCH();
+    op_BL:
+        x[Register::X30] = pc + 1;
+        hooks.branch(pc, pc + op->imm);
+        pc += op->imm;
+        DISPATCH();
+
+    // CB format
+    op_CBZ:
+        BRANCH_IF(x[op->rn] == 0);
+    op_CBNZ:
+        BRANCH_IF(x[op->rn] != 0);
+    op_B_EQ:
+        BRANCH_IF(f.z);
+    op_B_NE:
+        BRANCH_IF(!f.z);
+    op_B_LT:
+        BRANCH_IF(f.n != f.v);
+    op_B_LE:
+        BRANCH_IF(f.z || f.n != f.v);
+    op_B_GT:
+        BRANCH_IF(!f.z && f.n == f.v);
+    op_B_GE:
+        BRANCH_IF(f.n == f.v);
+    op_B_LO:
+        BRANCH_IF(!f.c);
+    op_B_LS:
+        BRANCH_IF(!f.c || f.z);
+    op_B_HI:
+        BRANCH_IF(f.c && !f.z);
+    op_B_HS:
+        BRANCH_IF(f.c);
+    op_B_MI:
+        BRANCH_IF(f.n);
+    op_B_VS:
+        BRANCH_IF(f.v);
+
+    // IW format
+    op_MOVZ:
+        x[op->rd] = static_cast<std::uint64_t>(op->imm) << op->rm;
+        NEXT();
+    op_MOVK:
+        x[op->rd] = (x[op->rn] & ~(std::uint64_t{0xFFFF} << op->rm)) | (static_cast<std::uint64_t>(op->imm) << op->rm);
+        NEXT();
+
+    // Superinstructions: the slot's own record describes the first instruction (or the whole
+    // pair), and original[pc + 1] the second. If the budget cannot cover every instruction
+    // they stand for, the original instruction runs on its own instead.
+#define FUSED(count)                                         \
+    do                                                       \
+    {                                                        \
+        if (remaining < static_cast<std::uint64_t>(count) - 1) \
+            goto unfused;                                    \
+        remaining -= static_cast<std::uint64_t>(count) - 1;  \
+    } while (0)
+#define COMPARE_BRANCH(b)                                                                           \
+    do                                                                                              \
+    {                                                                                               \
+        FUSED(2);                                                                                   \
+        std::uint64_t a = x[op->rn], r = a - (b);                                                   \
+        sub_flags(f, a, (b), r);                                                                    \
+        x[op->rd] = r;                                                                              \
+        const Packed::Op &branch = original[pc + 1];                                                \
+        unsigned nzcv = f.n << 3 | f.z << 2 | f.c << 1 | f.v;                                       \
+        bool taken = (CONDITION_MASKS[branch.opcode - Opcode::B_EQ] >> nzcv) & 1;                   \
+        const std::size_t next = pc + 1 + (taken ? static_cast<std::ptrdiff_t>(branch.imm) : 1);    \
+        hooks.branch(pc + 1, next);                                                                 \
+        pc = next;                                                                                  \
+        DISPATCH();                                                                                 \
+    } while (0)
+
+    op_CMP_BRANCH:
+        COMPARE_BRANCH(x[op->rm]);
+    op_CMPI_BRANCH:
+        COMPARE_BRANCH(sext(op->imm));
+    op_CONST64:
+        FUSED(op->rm);
+        x[op->rd] = constants[op->imm];
+        pc += op->rm;
+        DISPATCH();
+    op_ADJUST_LOAD:
+    {
+        FUSED(2);
+        x[op->rd] = x[op->rn] + sext(op->imm);
+        ++pc;
+        const Packed::Op &load = original[pc];
+        std::uint64_t v;
+        if (!MEMORY_LOAD(x[load.rn] + sext(load.imm), 8, v))
+            goto memory_fault;
+        x[load.rd] = v;
+        NEXT();
+    }
+    op_ADJUST_STORE:
+    {
+        FUSED(2);
+        x[op->rd] = x[op->rn] + sext(op->imm);
+        ++pc;
+        const Packed::Op &store = original[pc];
+        if (!MEMORY_STORE(x[store.rn] + sext(store.imm), 8, x[store.rm]))
+            goto memory_fault;
+        NEXT();
+    }
+    op_LOAD_ADJUST:
+    {
+        if (remaining < 1)
+            goto unfused;
+        const Packed::Op &load = original[pc];
+        std::uint64_t v;
+        if (!MEMORY_LOAD(x[load.rn] + sext(load.imm), 8, v))
+            goto memory_fault;
+        x[load.rd] = v;
+        --remaining;
+        x[op->rd] = x[op->rn] + sext(op->imm);
+        pc += 2;
+        DISPATCH();
+    }
+    op_SHIFT_ADD:
+    {
+        FUSED(2);
+        x[op->rd] = x[op->rn] << op->imm;
+        const Packed::Op &add = original[pc + 1];
+        x[add.rd] = x[add.rn] + x[add.rm];
+        pc += 2;
+        DISPATCH();
+    }
+    unfused:
+        op = &original[pc];
+        goto *handlers[op->opcode];
+#undef FUSED
+#undef COMPARE_BRANCH
+
+    op_UNSUPPORTED:
+        fault_ = "unsupported instruction " + Opcode::to_string(static_cast<Opcode::Type>(op->opcode));
+        goto fault;
+    memory_fault:
+        fault_ = "guest memory limit exceeded";
+        goto fault;
+    unaligned_exclusive:
+        fault_ = "unaligned exclusive access";
+        goto fault;
+
+    op_HALT: // like running off the end: not retired, and pc stays on it
+    op_NONE: // sentinel past the last instruction
+        status = Status::HALTED;
+        ++remaining;
+        goto done;
+    fault:
+        status = Status::FAULT;
+        ++remaining;
+        goto done;
+    budget:
+        status = Status::BUDGET_EXHAUSTED;
+    done:
+#undef DISPATCH
+#undef NEXT
+#undef BRANCH_IF
+#undef MEMORY_LOAD
+#undef MEMORY_STORE
+#undef LOAD
+#undef STORE
+#undef HANDLERS
+        state.pc = pc;
+        retired += max_steps - remaining;
+        return status;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const State &state)
+    {
+        std::ios::fmtflags saved = os.flags();
+        for (int r = Register::X0; r < Register::XZR; r++)
+        {
+            os << std::setw(3) << std::left << Register::to_string(static_cast<Register::Name>(r)) << " = 0x"
+               << std::setw(16) << std::setfill('0') << std::right << std::hex << state.x[r]
+               << std::setfill(' ') << std::dec << ((r % 4 == 3) ? "\n" : "  ");
+        }
+        os << "PC  = " << state.pc << "  NZCV = " << state.flags.n << state.flags.z << state.flags.c << state.flags.v << '\n';
+        os.flags(saved);
+        return os;
+    }
+} // namespace Cpu
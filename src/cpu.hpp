@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "decoder.hpp"
+#include "fusion.hpp"
+#include "memory.hpp"
+#include "packed.hpp"
+#include "registers.hpp"
+
+namespace Jit
+{
+    class Engine;
+}
+
+namespace Replay
+{
+    class Recorder;
+}
+
+namespace Pipeline
+{
+    class Model;
+}
+
+namespace CacheSim
+{
+    class Simulator;
+}
+
+namespace BranchSim
+{
+    class Simulator;
+}
+
+namespace Profile
+{
+    class Profiler;
+}
+
+namespace Trace
+{
+    class Tracer;
+}
+
+namespace Harts
+{
+    struct Shared;
+}
+
+namespace Cpu
+{
+    struct Flags
+    {
+        bool n, z, c, v;
+    };
+
+    // Exclusive monitor: LDXR arms it with the address and the generation of its granule,
+    // and STXR stores only if it is armed for the same address and nothing has been stored
+    // to the granule since (see Memory::Space::load_exclusive)
+    struct Monitor
+    {
+        bool armed;
+        std::uint64_t address;
+        std::uint64_t generation;
+    };
+
+    struct State
+    {
+        std::uint64_t x[Register::NONE + 1]; // X0-X30, XZR (always reads as zero), Packed::DISCARD
+        std::size_t pc;                      // index into the instruction stream
+        Flags flags;
+        Monitor monitor;
+    };
+
+    enum class Status
+    {
+        HALTED,           // HALT, or pc ran off the end of the program
+        BUDGET_EXHAUSTED, // max_steps instructions retired
+        FAULT,            // see Machine::fault()
+    };
+
+    const char *to_string(Status status);
+
+    // Callbacks the interpreter makes into whatever watches a run (see the Machine::run
+    // overloads). Observers derive from this and hide the members they use; the rest compile
+    // away. Setting OBSERVING has before() called ahead of every instruction, with how many
+    // instructions this run started before it, which needs the unfused program. branch() is
+    // called for every branch executed, taken or not, and works on fused programs too. Setting
+    // SHARED makes every memory access atomic, for machines whose memory other threads use too
+    // (see Memory::Space's views).
+    struct Observer
+    {
+        static constexpr bool OBSERVING = false;
+        static constexpr bool SHARED = false;
+        void before(const Packed::Op &, std::size_t, std::uint64_t) {}
+        void branch(std::size_t, std::size_t) {} // from the branch's pc to the next pc
+    };
+
+    // Executable form of a program. Prepare it once, then share it read-only between any
+    // number of machines, including machines running on other threads.
+    class Program
+    {
+    public:
+        explicit Program(std::vector<Packed::Op> ops);
+        ~Program();
+
+        // Translates the program to native code, which machines then run in preference to
+        // interpreting. Returns false if the host has no JIT support.
+        bool enable_jit();
+
+        // Rewrites common instruction pairs into superinstructions for the interpreter
+        Fusion::Stats enable_fusion();
+
+        std::size_t size() const { return ops_.size() - 1; }
+
+        // Unfused instructions, followed by an Opcode::NONE sentinel
+        const Packed::Op *ops() const { return ops_.data(); }
+
+    private:
+        friend class Machine;
+
+        std::vector<Packed::Op> ops_;   // followed by an Opcode::NONE sentinel
+        std::vector<Packed::Op> fused_; // ops_ after Fusion::fuse, if enabled
+        std::vector<std::uint64_t> constants_;
+        std::unique_ptr<Jit::Engine> jit_;
+    };
+
+    // A machine's complete state at one point in its run; see Machine::snapshot
+    struct Snapshot
+    {
+        std::shared_ptr<const Program> program;
+        State state;
+        std::uint64_t retired;
+        std::shared_ptr<const Memory::Snapshot> memory;
+    };
+
+    class Machine
+    {
+    public:
+        Machine(std::shared_ptr<const Program> program, Memory::Space &memory);
+        Machine(const std::vector<Decoder::Instruction> &program, Memory::Space &memory);
+
+        // Executes until the program halts, faults, or `max_steps` more instructions retire.
+        // A faulting instruction or HALT is not retired and leaves pc pointing at it.
+        Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // As above, but interprets without the JIT, calling into the observer
+        Status run(std::uint64_t max_steps, Replay::Recorder &recorder);
+        Status run(std::uint64_t max_steps, Pipeline::Model &model);
+        Status run(std::uint64_t max_steps, CacheSim::Simulator &simulator);
+        Status run(std::uint64_t max_steps, BranchSim::Simulator &simulator);
+        Status run(std::uint64_t max_steps, Profile::Profiler &profiler);
+        Status run(std::uint64_t max_steps, Trace::Tracer &tracer);
+        Status run(std::uint64_t max_steps, Harts::Shared &shared);
+
+        // Captures registers, flags, pc and memory. Memory is shared copy-on-write, so a snapshot
+        // is cheap to take and cheap to restore into any number of machines to fork this one.
+        Snapshot snapshot();
+
+        // Returns this machine and its memory to `snapshot`, which may come from any machine
+        void restore(const Snapshot &snapshot);
+
+        const std::string &fault() const { return fault_; }
+        std::size_t program_size() const { return program_->size(); }
+        const Program &program() const { return *program_; }
+        Memory::Space &memory() { return memory_; }
+
+        State state;
+        std::uint64_t retired = 0;
+
+    private:
+        template <typename Hooks>
+        Status interpret(std::uint64_t max_steps, Hooks &hooks);
+
+        std::shared_ptr<const Program> program_;
+        Memory::Space &memory_;
+        std::string fault_;
+    };
+
+    std::ostream &operator<<(std::ostream &os, const State &state);
+} // namespace Cpu
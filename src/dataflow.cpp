@@ -0,0 +1,877 @@
+#include "dataflow.hpp"
+
+#include "fusion.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <utility>
+
+namespace Dataflow
+{
+    namespace
+    {
+        // Bit r stands for register Xr and FLAGS for NZCV
+        using Set = std::uint64_t;
+        constexpr Set FLAGS = Set{1} << 32;
+        constexpr Set REGISTERS = (Set{1} << Register::XZR) - 1;
+        constexpr Set EVERYTHING = REGISTERS | FLAGS;
+
+        // XZR and DISCARD have no bit: they are never live
+        Set bit(unsigned reg) { return reg < Register::XZR ? Set{1} << reg : 0; }
+
+        enum class Kind
+        {
+            PURE,   // reads and writes registers and flags, nothing else, and never faults
+            ACCESS, // memory accesses and anything else that can fault; all state is observable before it
+            JUMP,   // B
+            CALL,   // BL
+            BRANCH, // CBZ, CBNZ and B.cond
+            RETURN, // BR
+            HALT,   // HALT: all state is observable and nothing runs after it
+        };
+
+        Kind kind(std::uint8_t opcode)
+        {
+            switch (opcode)
+            {
+            case Opcode::AND:
+            case Opcode::ADD:
+            case Opcode::ORR:
+            case Opcode::EOR:
+            case Opcode::SUB:
+            case Opcode::MUL:
+            case Opcode::SDIV:
+            case Opcode::UDIV:
+            case Opcode::SMULH:
+            case Opcode::UMULH:
+            case Opcode::ADDS:
+            case Opcode::SUBS:
+            case Opcode::ANDS:
+            case Opcode::LSL:
+            case Opcode::LSR:
+            case Opcode::ADDI:
+            case Opcode::SUBI:
+            case Opcode::ANDI:
+            case Opcode::ORRI:
+            case Opcode::EORI:
+            case Opcode::ADDIS:
+            case Opcode::SUBIS:
+            case Opcode::ANDIS:
+            case Opcode::MOVZ:
+            case Opcode::MOVK:
+                return Kind::PURE;
+            case Opcode::B:
+                return Kind::JUMP;
+            case Opcode::BL:
+                return Kind::CALL;
+            case Opcode::BR:
+                return Kind::RETURN;
+            case Opcode::HALT:
+                return Kind::HALT;
+            default:
+                return Opcode::INFO[opcode].format == Opcode::Format::CB ? Kind::BRANCH : Kind::ACCESS;
+            }
+        }
+
+        bool sets_flags(std::uint8_t opcode)
+        {
+            switch (opcode)
+            {
+            case Opcode::ADDS:
+            case Opcode::SUBS:
+            case Opcode::ANDS:
+            case Opcode::ADDIS:
+            case Opcode::SUBIS:
+            case Opcode::ANDIS:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        Opcode::Type without_flags(std::uint8_t opcode)
+        {
+            switch (opcode)
+            {
+            case Opcode::ADDS:
+                return Opcode::ADD;
+            case Opcode::SUBS:
+                return Opcode::SUB;
+            case Opcode::ANDS:
+                return Opcode::AND;
+            case Opcode::ADDIS:
+                return Opcode::ADDI;
+            case Opcode::SUBIS:
+                return Opcode::SUBI;
+            case Opcode::ANDIS:
+                return Opcode::ANDI;
+            default:
+                return static_cast<Opcode::Type>(opcode);
+            }
+        }
+
+        // The I-format opcode computing the same thing with Rm as an immediate, or NONE
+        Opcode::Type with_immediate(std::uint8_t opcode)
+        {
+            switch (opcode)
+            {
+            case Opcode::ADD:
+                return Opcode::ADDI;
+            case Opcode::SUB:
+                return Opcode::SUBI;
+            case Opcode::AND:
+                return Opcode::ANDI;
+            case Opcode::ORR:
+                return Opcode::ORRI;
+            case Opcode::EOR:
+                return Opcode::EORI;
+            case Opcode::ADDS:
+                return Opcode::ADDIS;
+            case Opcode::SUBS:
+                return Opcode::SUBIS;
+            case Opcode::ANDS:
+                return Opcode::ANDIS;
+            default:
+                return Opcode::NONE;
+            }
+        }
+
+        bool commutes(std::uint8_t opcode)
+        {
+            return opcode == Opcode::ADD || opcode == Opcode::AND || opcode == Opcode::ORR || opcode == Opcode::EOR ||
+                   opcode == Opcode::ADDS || opcode == Opcode::ANDS;
+        }
+
+        bool is_register_form(const Packed::Op &op)
+        {
+            return Opcode::INFO[op.opcode].format == Opcode::Format::R && op.opcode != Opcode::LSL &&
+                   op.opcode != Opcode::LSR;
+        }
+
+        bool is_load(std::uint8_t opcode)
+        {
+            switch (opcode)
+            {
+            case Opcode::LDUR:
+            case Opcode::LDURB:
+            case Opcode::LDURH:
+            case Opcode::LDURSW:
+            case Opcode::LDXR:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // Loads read their base register and stores the value as well. HALT, BR and
+        // instructions the engines do not support observe everything.
+        Set uses(const Packed::Op &op)
+        {
+            switch (kind(op.opcode))
+            {
+            case Kind::PURE:
+                if (op.opcode == Opcode::MOVZ)
+                    return 0;
+                return bit(op.rn) | (is_register_form(op) ? bit(op.rm) : 0);
+            case Kind::BRANCH:
+                return op.opcode == Opcode::CBZ || op.opcode == Opcode::CBNZ ? bit(op.rn) : FLAGS;
+            case Kind::JUMP:
+            case Kind::CALL:
+                return 0;
+            case Kind::ACCESS:
+                if (is_load(op.opcode))
+                    return bit(op.rn);
+                if (Packed::is_store(static_cast<Opcode::Type>(op.opcode)))
+                    return bit(op.rn) | bit(op.rm);
+                return EVERYTHING;
+            default:
+                return EVERYTHING;
+            }
+        }
+
+        // The register a plain move copies, or XZR: ADD, ORR or EOR with XZR, or ADDI, SUBI,
+        // ORRI or EORI of 0
+        std::uint8_t moved(const Packed::Op &op)
+        {
+            switch (op.opcode)
+            {
+            case Opcode::ADD:
+            case Opcode::ORR:
+            case Opcode::EOR:
+                return op.rm == Register::XZR ? op.rn : (op.rn == Register::XZR ? op.rm : Register::XZR);
+            case Opcode::ADDI:
+            case Opcode::SUBI:
+            case Opcode::ORRI:
+            case Opcode::EORI:
+                return op.imm == 0 ? op.rn : Register::XZR;
+            default:
+                return Register::XZR;
+            }
+        }
+
+        // A doubleword load or store of X30, through which the link register is saved and restored
+        bool moves_link(const Packed::Op &op)
+        {
+            if (op.opcode == Opcode::LDUR || op.opcode == Opcode::LDXR)
+                return op.rd == Register::X30;
+            return (op.opcode == Opcode::STUR || op.opcode == Opcode::STXR) && op.rm == Register::X30;
+        }
+
+        Set defs(const Packed::Op &op)
+        {
+            if (op.opcode == Opcode::BL)
+                return bit(Register::X30);
+            return bit(op.rd) | (sets_flags(op.opcode) ? FLAGS : 0);
+        }
+
+        bool fits_immediate(std::uint64_t value)
+        {
+            return static_cast<std::int64_t>(value) == static_cast<std::int32_t>(value);
+        }
+
+        std::uint64_t sext(std::int32_t imm) { return static_cast<std::uint64_t>(static_cast<std::int64_t>(imm)); }
+
+        std::uint8_t nzcv(bool n, bool z, bool c, bool v)
+        {
+            return static_cast<std::uint8_t>(n << 3 | z << 2 | c << 1 | v);
+        }
+
+        Packed::Op jump(std::size_t offset)
+        {
+            return {Opcode::B, Packed::DISCARD, Register::XZR, Register::XZR, static_cast<std::int32_t>(offset)};
+        }
+
+        // ADDI Xd, XZR, #value or MOVZ Xd, #chunk, LSL #shift, if the value fits either
+        bool constant_load(std::uint8_t rd, std::uint64_t value, Packed::Op &op)
+        {
+            if (fits_immediate(value))
+            {
+                op = {Opcode::ADDI, rd, Register::XZR, Register::XZR, static_cast<std::int32_t>(value)};
+                return true;
+            }
+            for (unsigned shift = 0; shift < 64; shift += 16)
+            {
+                if ((value & ~(std::uint64_t{0xFFFF} << shift)) == 0)
+                {
+                    op = {Opcode::MOVZ, rd, rd, static_cast<std::uint8_t>(shift), static_cast<std::int32_t>(value >> shift)};
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Sets of instruction indices a register may hold, such as the return addresses of
+        // every BL that calls one function, numbered as they turn up. Set 0 stands for any
+        // value at all, which is also what a set grows into once it is too large to follow.
+        class Sites
+        {
+        public:
+            static constexpr std::uint32_t ANY = 0;
+            static constexpr std::size_t MAX_SIZE = 64;
+
+            explicit Sites(std::size_t size) : size_(size), sets_(1) {}
+
+            const std::vector<std::uint64_t> &operator[](std::uint32_t id) const { return sets_[id]; }
+
+            std::uint32_t of(std::uint64_t value) { return value > size_ ? ANY : intern({value}); }
+
+            std::uint32_t unite(std::uint32_t a, std::uint32_t b)
+            {
+                if (a == ANY || b == ANY || a == b)
+                    return a == b ? a : ANY;
+                std::vector<std::uint64_t> both;
+                std::set_union(sets_[a].begin(), sets_[a].end(), sets_[b].begin(), sets_[b].end(), std::back_inserter(both));
+                return both.size() > MAX_SIZE ? ANY : intern(std::move(both));
+            }
+
+            std::uint32_t intern(std::vector<std::uint64_t> values)
+            {
+                const auto [it, added] = ids_.emplace(values, static_cast<std::uint32_t>(sets_.size()));
+                if (added)
+                    sets_.push_back(std::move(values));
+                return it->second;
+            }
+
+        private:
+            std::size_t size_;
+            std::vector<std::vector<std::uint64_t>> sets_; // each sorted
+            std::map<std::vector<std::uint64_t>, std::uint32_t> ids_;
+        };
+
+        // What constant propagation knows about the registers and flags at one point
+        struct Known
+        {
+            bool reached = false;
+            std::uint32_t known = std::uint32_t{1} << Register::XZR; // bit r: value[r] holds Xr
+            bool flags_known = false;
+            std::uint8_t nzcv = 0;
+            std::uint64_t value[Register::XZR + 1] = {};
+            std::uint32_t sites[Register::XZR + 1] = {}; // where Xr is not known: the Sites it may hold
+
+            bool has(unsigned reg) const { return reg <= Register::XZR && (known >> reg & 1); }
+
+            void set(unsigned reg, bool is_known, std::uint64_t v)
+            {
+                if (reg >= Register::XZR)
+                    return;
+                sites[reg] = Sites::ANY;
+                if (is_known)
+                {
+                    known |= std::uint32_t{1} << reg;
+                    value[reg] = v;
+                }
+                else
+                    known &= ~(std::uint32_t{1} << reg);
+            }
+
+            // The Sites Xr may hold, a single one when it is known
+            std::uint32_t site(unsigned reg, Sites &all) const { return has(reg) ? all.of(value[reg]) : sites[reg]; }
+
+            // Keeps what both agree on, and where they disagree every index either may hold;
+            // returns whether anything was forgotten
+            bool meet(const Known &other, Sites &all)
+            {
+                bool changed = false;
+                for (unsigned reg = 0; reg < Register::XZR; reg++)
+                {
+                    const std::uint32_t mask = std::uint32_t{1} << reg;
+                    if ((known & other.known & mask) && value[reg] == other.value[reg])
+                        continue;
+                    const std::uint32_t either = all.unite(site(reg, all), other.site(reg, all));
+                    changed = changed || (known & mask) || either != sites[reg];
+                    known &= ~mask;
+                    sites[reg] = either;
+                }
+                const bool flags = flags_known && other.flags_known && nzcv == other.nzcv;
+                changed = changed || flags != flags_known;
+                flags_known = flags;
+                return changed;
+            }
+        };
+
+        // Computes a PURE instruction's result and flags, if all its inputs are known
+        bool evaluate(const Packed::Op &op, const Known &in, std::uint64_t &r, std::uint8_t &flags)
+        {
+            if (uses(op) & ~static_cast<Set>(in.known))
+                return false;
+            const std::uint64_t a = in.value[op.rn];
+            const std::uint64_t b = is_register_form(op) ? in.value[op.rm] : sext(op.imm);
+            flags = in.nzcv;
+            switch (op.opcode)
+            {
+            case Opcode::AND:
+            case Opcode::ANDI:
+                r = a & b;
+                break;
+            case Opcode::ADD:
+            case Opcode::ADDI:
+                r = a + b;
+                break;
+            case Opcode::ORR:
+            case Opcode::ORRI:
+                r = a | b;
+                break;
+            case Opcode::EOR:
+            case Opcode::EORI:
+                r = a ^ b;
+                break;
+            case Opcode::SUB:
+            case Opcode::SUBI:
+                r = a - b;
+                break;
+            case Opcode::MUL:
+                r = a * b;
+                break;
+            case Opcode::SDIV:
+            {
+                std::int64_t n = static_cast<std::int64_t>(a), m = static_cast<std::int64_t>(b);
+                r = m == 0 ? 0 : (m == -1 ? 0 - a : static_cast<std::uint64_t>(n / m));
+                break;
+            }
+            case Opcode::UDIV:
+                r = b == 0 ? 0 : a / b;
+                break;
+            case Opcode::SMULH:
+                r = static_cast<std::uint64_t>(static_cast<__int128>(static_cast<std::int64_t>(a)) * static_cast<std::int64_t>(b) >> 64);
+                break;
+            case Opcode::UMULH:
+                r = static_cast<std::uint64_t>(static_cast<unsigned __int128>(a) * b >> 64);
+                break;
+            case Opcode::ADDS:
+            case Opcode::ADDIS:
+                r = a + b;
+                flags = nzcv(r >> 63, r == 0, r < a, (~(a ^ b) & (a ^ r)) >> 63);
+                break;
+            case Opcode::SUBS:
+            case Opcode::SUBIS:
+                r = a - b;
+                flags = nzcv(r >> 63, r == 0, a >= b, ((a ^ b) & (a ^ r)) >> 63);
+                break;
+            case Opcode::ANDS:
+            case Opcode::ANDIS:
+                r = a & b;
+                flags = nzcv(r >> 63, r == 0, false, false);
+                break;
+            case Opcode::LSL:
+                r = a << (op.imm & 63);
+                break;
+            case Opcode::LSR:
+                r = a >> (op.imm & 63);
+                break;
+            case Opcode::MOVZ:
+                r = static_cast<std::uint64_t>(op.imm) << op.rm;
+                break;
+            case Opcode::MOVK:
+                r = (a & ~(std::uint64_t{0xFFFF} << op.rm)) | (static_cast<std::uint64_t>(op.imm) << op.rm);
+                break;
+            default:
+                return false;
+            }
+            return true;
+        }
+
+        // 1 if a conditional branch is always taken, 0 if never, -1 if it depends
+        int decide(const Packed::Op &op, const Known &in)
+        {
+            if (op.opcode == Opcode::CBZ || op.opcode == Opcode::CBNZ)
+            {
+                if (!in.has(op.rn))
+                    return -1;
+                return (in.value[op.rn] == 0) == (op.opcode == Opcode::CBZ);
+            }
+            if (!in.flags_known)
+                return -1;
+            return Fusion::condition_mask(static_cast<Opcode::Type>(op.opcode)) >> in.nzcv & 1;
+        }
+
+        // `link` is the Sites a doubleword loaded into X30 may hold
+        void step(const Packed::Op &op, std::size_t pc, Known &state, std::uint32_t link)
+        {
+            switch (kind(op.opcode))
+            {
+            case Kind::PURE:
+            {
+                std::uint64_t r = 0;
+                std::uint8_t flags = 0;
+                const bool known = evaluate(op, state, r, flags);
+                const std::uint8_t from = moved(op);
+                const std::uint32_t sites = from < Register::XZR ? state.sites[from] : Sites::ANY;
+                state.set(op.rd, known, r);
+                if (!known && op.rd < Register::XZR)
+                    state.sites[op.rd] = sites;
+                if (sets_flags(op.opcode))
+                {
+                    state.flags_known = known;
+                    state.nzcv = flags;
+                }
+                break;
+            }
+            case Kind::CALL:
+                state.set(Register::X30, true, pc + 1);
+                break;
+            case Kind::ACCESS:
+                state.set(op.rd, false, 0);
+                if (moves_link(op) && is_load(op.opcode))
+                    state.sites[Register::X30] = link;
+                break;
+            default:
+                break;
+            }
+        }
+
+        class Optimizer
+        {
+        public:
+            explicit Optimizer(const std::vector<Packed::Op> &ops)
+                : ops_(ops), removed_(ops.size()), entry_(ops.size() + 1), sites_(ops.size())
+            {
+            }
+
+            Program run()
+            {
+                if (!ops_.empty())
+                {
+                    find_entries();
+                    for (bool changed = true; changed;)
+                    {
+                        changed = propagate();
+                        changed = remove_dead() || changed;
+                    }
+                    skip_dead();
+                }
+                return {std::move(ops_), stats_};
+            }
+
+        private:
+            struct Block
+            {
+                std::size_t first, end;
+            };
+
+            // Branch target, or SIZE_MAX outside the program; ops_.size() halts
+            std::size_t target(std::size_t pc) const
+            {
+                const std::int64_t to = static_cast<std::int64_t>(pc) + ops_[pc].imm;
+                return to < 0 || static_cast<std::size_t>(to) > ops_.size() ? SIZE_MAX : static_cast<std::size_t>(to);
+            }
+
+            // Where execution can start knowing nothing: pc 0 and every index a BR can land on.
+            // A BR lands on whatever its register may hold there: a known value, or one of a
+            // set, such as the return addresses of the BLs that reach a function. X30 is saved
+            // and restored through memory, so a doubleword loaded into it is one stored from it,
+            // or anything if the program never stores it. Propagating until no new entries or
+            // stored values turn up finds them all. If a reachable BR's register may hold any
+            // value, it could land anywhere, so every instruction becomes an entry.
+            void find_entries()
+            {
+                const std::size_t size = ops_.size();
+                const std::uint32_t none = sites_.intern({});
+                entry_[0] = true;
+                link_ = none;
+                for (bool found = true; found;)
+                {
+                    find_blocks();
+                    const std::vector<Known> in = solve();
+                    found = false;
+                    for (std::size_t b = 0; b < blocks_.size(); b++)
+                    {
+                        if (!in[b].reached)
+                            continue;
+                        Known state = in[b];
+                        for (std::size_t pc = blocks_[b].first; pc < blocks_[b].end; pc++)
+                        {
+                            const Packed::Op &op = ops_[pc];
+                            if (moves_link(op) && !is_load(op.opcode))
+                            {
+                                const std::uint32_t link = sites_.unite(link_, state.site(Register::X30, sites_));
+                                found = found || link != link_;
+                                link_ = link;
+                            }
+                            if (kind(op.opcode) != Kind::RETURN)
+                            {
+                                step(op, pc, state, link_);
+                                continue;
+                            }
+                            const std::uint32_t targets = state.site(op.rn, sites_);
+                            if (targets == Sites::ANY)
+                            {
+                                entry_.assign(size + 1, true);
+                                find_blocks();
+                                return;
+                            }
+                            for (const std::uint64_t to : sites_[targets])
+                            {
+                                if (!entry_[to])
+                                {
+                                    entry_[to] = true;
+                                    found = true;
+                                }
+                            }
+                        }
+                    }
+                    if (!found && link_ == none)
+                    {
+                        link_ = Sites::ANY; // nothing stores X30, so a load into it reads data
+                        found = true;
+                    }
+                }
+            }
+
+            void find_blocks()
+            {
+                const std::size_t size = ops_.size();
+                std::vector<bool> leader(entry_);
+                for (std::size_t pc = 0; pc < size; pc++)
+                {
+                    const Kind k = kind(ops_[pc].opcode);
+                    if (k == Kind::PURE || k == Kind::ACCESS)
+                        continue;
+                    leader[pc + 1] = true;
+                    if (k != Kind::RETURN && k != Kind::HALT && target(pc) != SIZE_MAX)
+                        leader[target(pc)] = true;
+                }
+
+                blocks_.clear();
+                block_at_.assign(size, 0);
+                for (std::size_t pc = 0; pc < size; pc++)
+                {
+                    if (leader[pc])
+                    {
+                        block_at_[pc] = static_cast<std::uint32_t>(blocks_.size());
+                        blocks_.push_back({pc, pc + 1});
+                    }
+                    blocks_.back().end = pc + 1;
+                }
+            }
+
+            // Constant propagation: what is known on entry to each block
+            std::vector<Known> solve()
+            {
+                const std::size_t size = ops_.size();
+                std::vector<Known> in(blocks_.size());
+                std::vector<bool> queued(blocks_.size());
+                std::vector<std::uint32_t> work;
+                auto reach = [&](std::size_t pc, const Known &state)
+                {
+                    if (pc >= size)
+                        return;
+                    const std::uint32_t block = block_at_[pc];
+                    if (!in[block].reached)
+                        in[block] = state;
+                    else if (!in[block].meet(state, sites_))
+                        return;
+                    if (!queued[block])
+                    {
+                        queued[block] = true;
+                        work.push_back(block);
+                    }
+                };
+
+                Known unknown;
+                unknown.reached = true;
+                for (std::size_t pc = 0; pc < size; pc++)
+                {
+                    if (entry_[pc])
+                        reach(pc, unknown);
+                }
+
+                while (!work.empty())
+                {
+                    const std::uint32_t b = work.back();
+                    work.pop_back();
+                    queued[b] = false;
+
+                    const Block &block = blocks_[b];
+                    Known state = in[b];
+                    for (std::size_t pc = block.first; pc < block.end; pc++)
+                    {
+                        if (!removed_[pc])
+                            step(ops_[pc], pc, state, link_);
+                    }
+
+                    const std::size_t last = block.end - 1;
+                    if (removed_[last])
+                    {
+                        reach(block.end, state);
+                        continue;
+                    }
+                    switch (kind(ops_[last].opcode))
+                    {
+                    case Kind::JUMP:
+                    case Kind::CALL:
+                        reach(target(last), state);
+                        break;
+                    case Kind::BRANCH:
+                    {
+                        const int taken = decide(ops_[last], state);
+                        if (taken != 1)
+                            reach(block.end, state);
+                        if (taken != 0)
+                            reach(target(last), state);
+                        break;
+                    }
+                    case Kind::RETURN:
+                        break; // lands on an entry, which assumes nothing
+                    case Kind::HALT:
+                        break;
+                    default:
+                        reach(block.end, state);
+                        break;
+                    }
+                }
+                return in;
+            }
+
+            // The rewrites constant propagation allows. Returns whether anything changed.
+            bool propagate()
+            {
+                const std::vector<Known> in = solve();
+                bool changed = false;
+                for (std::size_t b = 0; b < blocks_.size(); b++)
+                {
+                    if (!in[b].reached)
+                        continue;
+                    Known state = in[b];
+                    for (std::size_t pc = blocks_[b].first; pc < blocks_[b].end; pc++)
+                    {
+                        if (removed_[pc])
+                            continue;
+                        changed = rewrite(pc, state) || changed;
+                        if (!removed_[pc])
+                            step(ops_[pc], pc, state, link_);
+                    }
+                }
+                return changed;
+            }
+
+            // Simplifies one instruction given what is known before it
+            bool rewrite(std::size_t pc, const Known &state)
+            {
+                Packed::Op &op = ops_[pc];
+                const Kind k = kind(op.opcode);
+                if (k == Kind::BRANCH)
+                {
+                    const int taken = decide(op, state);
+                    if (taken < 0)
+                        return false;
+                    if (taken)
+                        op = jump(static_cast<std::size_t>(op.imm));
+                    else
+                        removed_[pc] = true;
+                    stats_.branches++;
+                    return true;
+                }
+                if (k != Kind::PURE)
+                    return false;
+
+                std::uint64_t r;
+                std::uint8_t flags;
+                if (op.rd != Packed::DISCARD && !sets_flags(op.opcode) && uses(op) != 0 && evaluate(op, state, r, flags) &&
+                    constant_load(op.rd, r, op))
+                {
+                    stats_.constants++;
+                    return true;
+                }
+
+                const Opcode::Type immediate = with_immediate(op.opcode);
+                if (immediate == Opcode::NONE || !is_register_form(op))
+                    return false;
+                std::uint8_t rn = op.rn, rm = op.rm;
+                if (!(state.has(rm) && rm != Register::XZR) && commutes(op.opcode))
+                    std::swap(rn, rm);
+                if (rm == Register::XZR || !state.has(rm) || !fits_immediate(state.value[rm]))
+                    return false;
+                op = {static_cast<std::uint8_t>(immediate), op.rd, rn, Register::XZR, static_cast<std::int32_t>(state.value[rm])};
+                stats_.immediates++;
+                return true;
+            }
+
+            // Liveness, then removes writes nobody reads and flag updates nobody tests.
+            // Returns whether anything changed.
+            bool remove_dead()
+            {
+                const std::size_t size = ops_.size();
+                std::vector<Set> live_in(blocks_.size());
+                auto live_at = [&](std::size_t pc)
+                { return pc < size ? live_in[block_at_[pc]] : EVERYTHING; };
+                auto live_out = [&](const Block &block) -> Set
+                {
+                    const std::size_t last = block.end - 1;
+                    if (removed_[last])
+                        return live_at(block.end);
+                    switch (kind(ops_[last].opcode))
+                    {
+                    case Kind::JUMP:
+                    case Kind::CALL:
+                        return live_at(target(last));
+                    case Kind::BRANCH:
+                        return live_at(block.end) | live_at(target(last));
+                    case Kind::RETURN:
+                    case Kind::HALT:
+                        return EVERYTHING;
+                    default:
+                        return live_at(block.end);
+                    }
+                };
+                auto backward = [&](std::size_t pc, Set live) -> Set
+                {
+                    if (removed_[pc])
+                        return live;
+                    return (live & ~defs(ops_[pc])) | uses(ops_[pc]);
+                };
+
+                for (bool changed = true; changed;)
+                {
+                    changed = false;
+                    for (std::size_t b = blocks_.size(); b-- > 0;)
+                    {
+                        Set live = live_out(blocks_[b]);
+                        for (std::size_t pc = blocks_[b].end; pc-- > blocks_[b].first;)
+                            live = backward(pc, live);
+                        if (live != live_in[b])
+                        {
+                            live_in[b] = live;
+                            changed = true;
+                        }
+                    }
+                }
+
+                bool changed = false;
+                for (const Block &block : blocks_)
+                {
+                    Set live = live_out(block);
+                    for (std::size_t pc = block.end; pc-- > block.first;)
+                    {
+                        Packed::Op &op = ops_[pc];
+                        if (!removed_[pc] && kind(op.opcode) == Kind::PURE)
+                        {
+                            if (!(defs(op) & live))
+                            {
+                                removed_[pc] = true;
+                                stats_.dead++;
+                                changed = true;
+                                continue;
+                            }
+                            if (sets_flags(op.opcode) && !(live & FLAGS))
+                            {
+                                op.opcode = without_flags(op.opcode);
+                                stats_.flags++;
+                                changed = true;
+                            }
+                        }
+                        live = backward(pc, live);
+                    }
+                }
+                return changed;
+            }
+
+            // Jumps over each run of removed instructions from its first slot. Removed branches
+            // become jumps too, since their operands may no longer hold what decided them;
+            // other removed instructions are harmless to run when something branches into a run.
+            void skip_dead()
+            {
+                const std::size_t size = ops_.size();
+                for (std::size_t pc = 0; pc < size;)
+                {
+                    if (!removed_[pc])
+                    {
+                        pc++;
+                        continue;
+                    }
+                    std::size_t end = pc;
+                    while (end < size && removed_[end])
+                        end++;
+                    for (std::size_t i = pc; i < end; i++)
+                    {
+                        if ((i == pc && end - pc > 1) || kind(ops_[i].opcode) == Kind::BRANCH)
+                            ops_[i] = jump(end - i);
+                    }
+                    stats_.skipped += end - pc - 1;
+                    pc = end;
+                }
+            }
+
+            std::vector<Packed::Op> ops_;
+            std::vector<bool> removed_;
+            std::vector<bool> entry_; // by pc, up to and including ops_.size()
+            std::vector<Block> blocks_;
+            std::vector<std::uint32_t> block_at_; // by pc, meaningful where a block starts
+            Sites sites_;
+            std::uint32_t link_ = Sites::ANY; // the Sites a doubleword loaded into X30 may hold
+            Stats stats_;
+        };
+    } // namespace
+
+    Program optimize(const std::vector<Packed::Op> &ops)
+    {
+        return Optimizer(ops).run();
+    }
+
+    std::ostream &operator<<(std::ostream &os, const Stats &stats)
+    {
+        return os << stats.total() << " rewrites (" << stats.constants << " constant, " << stats.immediates
+                  << " immediate, " << stats.branches << " branch, " << stats.flags << " flag, " << stats.dead
+                  << " dead), " << stats.skipped << " instructions jumped over";
+    }
+} // namespace Dataflow
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "packed.hpp"
+
+// Dataflow optimizer for packed programs.
+//
+// Splits the program into basic blocks using the branch offsets the decoder resolved, then
+// runs constant propagation and liveness over the control-flow graph. With the results it
+// loads constant results directly, turns register operands with known values into
+// immediates, resolves conditional branches that always go the same way, drops flag updates
+// that are never read and removes writes that are never read, including writes to XZR.
+//
+// Like Fusion::fuse it keeps every instruction at its index, so branch offsets and link
+// addresses mean the same: a run of removed instructions is jumped over with a B in its
+// first slot. Registers, flags and memory match the unoptimized program when it halts and at
+// every BR; at a load or store, memory and the registers it reads do. Fewer instructions
+// retire, so a run cut short by a step budget may stop in a different place, and one that
+// faults may differ in registers that are not read again. Nothing is assumed about the state
+// where a BR lands, so every index a BR's register may hold is an entry: constants, and sets
+// of them such as a function's return addresses, which moves copy and which X30 keeps when
+// saved to and restored from memory. If a reachable BR's register may hold anything else,
+// any instruction may be an entry, and only dead writes are removed.
+namespace Dataflow
+{
+    struct Stats
+    {
+        std::size_t constants = 0;  // results replaced by constant loads
+        std::size_t immediates = 0; // register operands replaced by immediates
+        std::size_t branches = 0;   // conditional branches resolved
+        std::size_t flags = 0;      // flag-setting instructions that no longer set flags
+        std::size_t dead = 0;       // instructions whose writes are never read
+        std::size_t skipped = 0;    // dispatches saved each time a run of dead instructions is passed
+
+        std::size_t total() const { return constants + immediates + branches + flags + dead; }
+    };
+
+    struct Program
+    {
+        std::vector<Packed::Op> ops; // same length and indices as the input
+        Stats stats;
+    };
+
+    Program optimize(const std::vector<Packed::Op> &ops);
+
+    std::ostream &operator<<(std::ostream &os, const Stats &stats);
+} // namespace Dataflow
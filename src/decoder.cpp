@@ -1,96 +1,230 @@
 #include "decoder.hpp"
 
-#include <exception>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
 
 namespace Decoder
 {
-    Operand instruction_offset(
-        const Parser::Token &label_token,
-        const std::unordered_map<std::string, std::size_t> &labels,
-        std::size_t current_instruction)
+    namespace
     {
-        const std::string &label = label_token.lexeme;
-        auto it = labels.find(label);
-        if (it == labels.end())
-        {
-            throw std::runtime_error("Line " + std::to_string(label_token.line) + ": Error: unknown label '" + label + "'");
-        }
-
-        int offset = static_cast<int>(it->second) - static_cast<int>(current_instruction);
-        return Operand(offset); // treated as immediate
-    }
-
-    Operand decode_operand(const Parser::Token &token)
-    {
-        if (token.type != Parser::TOKEN_OPERAND)
-            throw std::runtime_error("Line " + std::to_string(token.line) + ": Internal Error: attempted operand decoding on non operand token (" + token.lexeme + ")");
-        if (token.lexeme.empty())
-            throw std::runtime_error("Line " + std::to_string(token.line) + ": Internal Error: empty operand");
+        using Diagnostics::List;
+        using Labels = std::unordered_map<std::string_view, std::size_t>;
 
-        if (token.lexeme[0] == '#')
+        // Parses an immediate's text after '#' as std::stoi(text, nullptr, 0) would, but
+        // only if the whole text is a number that fits
+        bool parse_immediate(std::string_view text, int &value)
         {
-            return Operand{std::stoi(token.lexeme.substr(1), nullptr, 0)};
+            char digits[32];
+            if (text.empty() || text.size() >= sizeof(digits))
+                return false;
+            std::memcpy(digits, text.data(), text.size());
+            digits[text.size()] = '\0';
+            char *end;
+            errno = 0;
+            const long long parsed = std::strtoll(digits, &end, 0);
+            if (end != digits + text.size() || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+                return false;
+            value = static_cast<int>(parsed);
+            return true;
         }
-        else // should be register
-        {
-            Register::Name reg = Register::from_string(token.lexeme);
-            if (reg == Register::NONE)
-                throw std::runtime_error("Line " + std::to_string(token.line) + ": Error: expected register name, got (" + token.lexeme + ")");
-            return Operand{reg};
-        }
-    }
 
-    // has_offset passed in determines if the token should be the immediate, and changes only in the case of an implicit #0 immediate
-    // e.g., `LDUR X0, [X4]`
-    Operand bracketed_operand(const Parser::Token &token, bool &has_offset)
-    {
-        if (has_offset) // should be immediate
-        {
-            if (token.lexeme[0] != '#' || token.lexeme.back() != ']')
-                throw std::runtime_error("Line " + std::to_string(token.line) + ": Error: expected immediate offset, got (" + token.lexeme + ")");
-            return Operand{std::stoi(token.lexeme.substr(1), nullptr, 0)};
-        }
-        else // should be register
+        // The operand tokens of one instruction, each taken once. A missing operand is
+        // reported once, just past the last token the instruction has.
+        class Operands
         {
-            const std::size_t rb = token.lexeme.find(']');
-            if (rb != std::string::npos) // implicit offset
+        public:
+            Operands(const std::vector<Parser::Token> &tokens, std::size_t &i, List &diagnostics)
+                : tokens_(tokens), i_(i), line_(tokens[i].line), diagnostics_(diagnostics) {}
+
+            const Parser::Token *next()
+            {
+                if (i_ + 1 < tokens_.size() && tokens_[i_ + 1].type == Parser::TOKEN_OPERAND && tokens_[i_ + 1].line == line_)
+                    return &tokens_[++i_];
+                const Parser::Token &last = tokens_[i_];
+                diagnostics_.report(Diagnostics::MISSING_OPERAND, line_, last.column + static_cast<int>(last.lexeme.size()), {});
+                return nullptr;
+            }
+
+            bool reg(Operand &out)
             {
-                Register::Name reg = Register::from_string(token.lexeme.substr(1, rb));
+                const Parser::Token *token = next();
+                if (!token)
+                    return false;
+                Register::Name reg = Register::from_string(token->lexeme);
                 if (reg == Register::NONE)
-                    throw std::runtime_error("Line " + std::to_string(token.line) + ": Error: expected register name, got (" + token.lexeme + ")");
-                has_offset = true;
-                return Operand{reg};
+                    return fail(Diagnostics::EXPECTED_REGISTER, *token);
+                out = Operand(reg);
+                return true;
             }
-            else // next token is the offset
+
+            bool immediate(Operand &out)
             {
-                Register::Name reg = Register::from_string(token.lexeme.substr(1));
+                const Parser::Token *token = next();
+                if (!token)
+                    return false;
+                if (token->lexeme[0] != '#')
+                    return fail(Diagnostics::EXPECTED_IMMEDIATE, *token);
+                int value;
+                if (!parse_immediate(token->lexeme.substr(1), value))
+                    return fail(Diagnostics::INVALID_IMMEDIATE, *token);
+                out = Operand(value);
+                return true;
+            }
+
+            // Reports the immediate just taken unless `fits`
+            bool in_range(bool fits)
+            {
+                return fits || fail(Diagnostics::IMMEDIATE_RANGE, tokens_[i_]);
+            }
+
+            // "[Xn, #offset]" or "[Xn]", the latter with an offset of 0
+            bool address(Operand &base, Operand &offset)
+            {
+                const Parser::Token *token = next();
+                if (!token)
+                    return false;
+                std::string_view lexeme = token->lexeme;
+                const bool closed = lexeme.back() == ']';
+                Register::Name reg = lexeme[0] == '[' ? Register::from_string(lexeme.substr(1, lexeme.size() - 1 - closed)) : Register::NONE;
                 if (reg == Register::NONE)
-                    throw std::runtime_error("Line " + std::to_string(token.line) + ": Error: expected register name, got (" + token.lexeme + ")");
-                return Operand{reg};
+                    return fail(Diagnostics::EXPECTED_REGISTER, *token);
+                base = Operand(reg);
+                if (closed)
+                {
+                    offset = Operand(0);
+                    return true;
+                }
+
+                if (!(token = next()))
+                    return false;
+                lexeme = token->lexeme;
+                if (lexeme[0] != '#' || lexeme.back() != ']')
+                    return fail(Diagnostics::EXPECTED_OFFSET, *token);
+                int value;
+                if (!parse_immediate(lexeme.substr(1, lexeme.size() - 2), value))
+                    return fail(Diagnostics::INVALID_IMMEDIATE, *token);
+                offset = Operand(value);
+                return true;
+            }
+
+            // Offset from the instruction at `current` to the label
+            bool label(const Labels &labels, std::size_t current, Operand &out)
+            {
+                const Parser::Token *token = next();
+                if (!token)
+                    return false;
+                auto it = labels.find(token->lexeme);
+                if (it == labels.end())
+                    return fail(Diagnostics::UNKNOWN_LABEL, *token);
+                out = Operand(static_cast<int>(it->second) - static_cast<int>(current));
+                return true;
+            }
+
+        private:
+            bool fail(Diagnostics::Code code, const Parser::Token &token)
+            {
+                diagnostics_.report(code, token.line, token.column, token.lexeme);
+                return false;
+            }
+
+            const std::vector<Parser::Token> &tokens_;
+            std::size_t &i_;
+            int line_;
+            List &diagnostics_;
+        };
+
+        bool decode_operands(Instruction &instruction, Operands &operands, const Labels &labels, std::size_t current)
+        {
+            const Opcode::Type opcode = instruction.opcode;
+            switch (instruction.format)
+            {
+            case Opcode::Format::R:
+                if (opcode == Opcode::LSL || opcode == Opcode::LSR)
+                {
+                    instruction.R.Rm = Operand(Register::XZR); // unused
+                    return operands.reg(instruction.R.Rd) && operands.reg(instruction.R.Rn) && operands.immediate(instruction.R.shamt) &&
+                           operands.in_range(instruction.R.shamt.imm >= 0 && instruction.R.shamt.imm <= 63);
+                }
+                instruction.R.shamt = Operand(0); // unused
+                if (opcode == Opcode::HALT)
+                {
+                    instruction.R.Rd = Operand(Register::XZR); // no operands
+                    instruction.R.Rn = Operand(Register::XZR);
+                    instruction.R.Rm = Operand(Register::XZR);
+                    return true;
+                }
+                if (opcode == Opcode::BR)
+                {
+                    // Only 1 operand: target register (treated like Rn)
+                    instruction.R.Rd = Operand(Register::XZR); // unused
+                    instruction.R.Rm = Operand(Register::XZR); // unused
+                    return operands.reg(instruction.R.Rn);
+                }
+                return operands.reg(instruction.R.Rd) && operands.reg(instruction.R.Rn) && operands.reg(instruction.R.Rm);
+
+            case Opcode::Format::I:
+                return operands.reg(instruction.I.Rd) && operands.reg(instruction.I.Rn) && operands.immediate(instruction.I.imm);
+
+            case Opcode::Format::D:
+                instruction.D.Rs = Operand(Register::XZR);
+                return operands.reg(instruction.D.Rt) && (opcode != Opcode::STXR || operands.reg(instruction.D.Rs)) &&
+                       operands.address(instruction.D.Rn, instruction.D.offset);
+
+            case Opcode::Format::B:
+                return operands.label(labels, current, instruction.B.label);
+
+            case Opcode::Format::CB:
+                instruction.CB.Rt = Operand(Register::XZR); // B.cond types like B.EQ, B.GT, etc.
+                return ((opcode != Opcode::CBZ && opcode != Opcode::CBNZ) || operands.reg(instruction.CB.Rt)) &&
+                       operands.label(labels, current, instruction.CB.label);
+
+            case Opcode::Format::IW:
+                return operands.reg(instruction.IW.Rd) && operands.immediate(instruction.IW.imm) &&
+                       operands.in_range(instruction.IW.imm.imm >= 0 && instruction.IW.imm.imm <= 0xFFFF) &&
+                       operands.immediate(instruction.IW.shift) &&
+                       operands.in_range(instruction.IW.shift.imm >= 0 && instruction.IW.shift.imm <= 48 && instruction.IW.shift.imm % 16 == 0);
+
+            default:
+                return false;
             }
         }
+    } // namespace
+
+    std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens)
+    {
+        Symbols symbols;
+        return decode(tokens, symbols);
     }
 
-    Operand expect_operand(const Parser::Token &token, bool should_be_reg)
+    std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens, Symbols &symbols)
     {
-        Operand op = decode_operand(token);
-        if (op.is_reg && !should_be_reg)
-            throw std::runtime_error("Line " + std::to_string(token.line) + ": Error: expected register operand (" + token.lexeme + ")");
-        else if (!op.is_reg && should_be_reg)
-            throw std::runtime_error("Line " + std::to_string(token.line) + ": Error: expected immediate operand (" + token.lexeme + ")");
-        return op;
+        Diagnostics::List diagnostics(0);
+        std::vector<Instruction> instructions = decode(tokens, symbols, diagnostics);
+        Diagnostics::throw_first(diagnostics);
+        return instructions;
     }
 
-    std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens)
+    std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens, Symbols &symbols, Diagnostics::List &diagnostics)
     {
+        symbols = Symbols();
+
         // first pass: create label table
-        std::unordered_map<std::string, std::size_t> labels;
+        Labels labels;
         std::size_t instruction_num = 0;
         for (const auto &t : tokens)
         {
             if (t.type == Parser::TOKEN_LABEL)
             {
-                labels[t.lexeme] = instruction_num;
+                auto [it, added] = labels.emplace(t.lexeme, instruction_num);
+                if (!added)
+                {
+                    diagnostics.report(Diagnostics::DUPLICATE_LABEL, t.line, t.column, t.lexeme);
+                    it->second = instruction_num;
+                }
+                symbols.labels.push_back({std::string(t.lexeme), instruction_num});
             }
             else if (t.type == Parser::TOKEN_INSTRUCTION)
             {
@@ -98,111 +232,45 @@ namespace Decoder
             }
         }
 
-        // second pass: validate and structure instructions
+        // second pass: validate and structure instructions, one per instruction token
         std::vector<Instruction> instructions;
+        instructions.reserve(instruction_num);
         instruction_num = 0;
         for (std::size_t i = 0; i < tokens.size(); i++)
         {
-            if (tokens[i].type == Parser::TOKEN_INSTRUCTION)
+            const Parser::Token &token = tokens[i];
+            if (token.type == Parser::TOKEN_INSTRUCTION)
             {
-                Opcode::Type opcode = Opcode::from_string(tokens[i].lexeme);
-                if (opcode == Opcode::NONE)
-                    throw std::runtime_error("Line " + std::to_string(tokens[i].line) + ": Error: unexpected opcode (" + tokens[i].lexeme + ")");
-
-                Instruction instruction(opcode);
-
-                switch (instruction.format)
-                {
-                case Opcode::Format::R:
-                {
-                    if (opcode == Opcode::LSL || opcode == Opcode::LSR)
-                    {
-                        instruction.R.Rd = decode_operand(tokens[++i]);
-                        instruction.R.Rn = decode_operand(tokens[++i]);
-                        instruction.R.shamt = decode_operand(tokens[++i]);
-                        instruction.R.Rm = Operand(Register::XZR); // unused
-                    }
-                    else if (opcode == Opcode::BR)
-                    {
-                        // Only 1 operand: target register (treated like Rn)
-                        instruction.R.Rd = Operand(Register::XZR);      // unused
-                        instruction.R.Rm = Operand(Register::XZR);      // unused
-                        instruction.R.shamt = Operand(0);               // unused
-                        instruction.R.Rn = decode_operand(tokens[++i]); // actual register
-                    }
-                    else
-                    {
-                        instruction.R.Rd = decode_operand(tokens[++i]);
-                        instruction.R.Rn = decode_operand(tokens[++i]);
-                        instruction.R.Rm = decode_operand(tokens[++i]);
-                        instruction.R.shamt = Operand(0); // unused
-                    }
-                }
-                break;
-
-                case Opcode::Format::I:
-                {
-                    instruction.I.Rd = decode_operand(tokens[++i]);
-                    instruction.I.Rn = decode_operand(tokens[++i]);
-                    instruction.I.imm = decode_operand(tokens[++i]);
-                }
-                break;
+                symbols.lines.push_back(token.line);
+                Opcode::Type opcode = Opcode::from_string(token.lexeme);
+                Instruction instruction(opcode == Opcode::NONE ? Opcode::B : opcode);
+                Operands operands(tokens, i, diagnostics);
+                bool valid = opcode != Opcode::NONE;
+                if (!valid)
+                    diagnostics.report(Diagnostics::UNKNOWN_OPCODE, token.line, token.column, token.lexeme);
+                else
+                    valid = decode_operands(instruction, operands, labels, instruction_num);
 
-                case Opcode::Format::D:
+                if (!valid)
                 {
-                    instruction.D.Rt = decode_operand(tokens[++i]);
-
-                    bool has_offset = false;
-                    instruction.D.Rn = bracketed_operand(tokens[++i], has_offset);
-
-                    if (has_offset)
-                        instruction.D.offset = Operand{0};
-                    else
-                    {
-                        has_offset = true;
-                        instruction.D.offset = bracketed_operand(tokens[++i], has_offset);
-                    }
-                }
-                break;
-
-                case Opcode::Format::B:
-                {
-                    instruction.B.label = instruction_offset(tokens[++i], labels, instruction_num);
-                }
-                break;
-
-                case Opcode::Format::CB:
-                {
-                    if (opcode == Opcode::CBZ || opcode == Opcode::CBNZ)
-                    {
-                        instruction.CB.Rt = decode_operand(tokens[++i]);
-                        instruction.CB.label = instruction_offset(tokens[++i], labels, instruction_num);
-                    }
-                    else // B.cond types like B.EQ, B.GT, etc.
-                    {
-                        instruction.CB.Rt = Operand(Register::XZR);
-                        instruction.CB.label = instruction_offset(tokens[++i], labels, instruction_num);
-                    }
-                }
-                break;
-
-                case Opcode::Format::IW:
-                {
-                    instruction.IW.Rd = decode_operand(tokens[++i]);
-                    instruction.IW.imm = decode_operand(tokens[++i]);
-                    instruction.IW.shift = decode_operand(tokens[++i]);
-                }
-                break;
-
-                default:
-                    throw std::runtime_error("Line " + std::to_string(tokens[i].line) + ": Internal Error: unexpected opcode format (" + tokens[i].lexeme + ")");
+                    // Keeps later instructions at their indices; never runs, since decoding failed
+                    instruction = Instruction(Opcode::B);
+                    instruction.B.label = Operand(0);
                 }
+                else if (i + 1 < tokens.size() && tokens[i + 1].type == Parser::TOKEN_OPERAND && tokens[i + 1].line == token.line)
+                    diagnostics.report(Diagnostics::UNEXPECTED_OPERAND, tokens[i + 1].line, tokens[i + 1].column, tokens[i + 1].lexeme);
+                while (i + 1 < tokens.size() && tokens[i + 1].type == Parser::TOKEN_OPERAND && tokens[i + 1].line == token.line)
+                    i++;
 
                 instructions.push_back(instruction);
                 instruction_num++;
             }
-            else if (tokens[i].type == Parser::TOKEN_OPERAND)
-                throw std::runtime_error("Line " + std::to_string(tokens[i].line) + ": Error: unexpected operand (" + tokens[i].lexeme + ")");
+            else if (token.type == Parser::TOKEN_OPERAND)
+            {
+                diagnostics.report(Diagnostics::UNEXPECTED_OPERAND, token.line, token.column, token.lexeme);
+                while (i + 1 < tokens.size() && tokens[i + 1].type == Parser::TOKEN_OPERAND && tokens[i + 1].line == token.line)
+                    i++;
+            }
         }
         return instructions;
     }
@@ -223,6 +291,8 @@ namespace Decoder
         switch (inst.format)
         {
         case Opcode::Format::R:
+            if (inst.opcode == Opcode::HALT)
+                break;
             os << " " << inst.R.Rd << ", " << inst.R.Rn << ", ";
             if (inst.opcode == Opcode::LSL || inst.opcode == Opcode::LSR)
                 os << inst.R.shamt;
@@ -235,7 +305,10 @@ namespace Decoder
             break;
 
         case Opcode::Format::D:
-            os << " " << inst.D.Rt << ", [" << inst.D.Rn << ", " << inst.D.offset << "]";
+            os << " " << inst.D.Rt << ", ";
+            if (inst.opcode == Opcode::STXR)
+                os << inst.D.Rs << ", ";
+            os << "[" << inst.D.Rn << ", " << inst.D.offset << "]";
             break;
 
         case Opcode::Format::B:
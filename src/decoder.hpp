@@ -1,7 +1,9 @@
 #pragma once
 
+#include <string>
 #include <vector>
 
+#include "diagnostics.hpp"
 #include "parser.hpp"
 #include "opcodes.hpp"
 #include "registers.hpp"
@@ -38,7 +40,7 @@ namespace Decoder
             } I;
             struct
             {
-                Operand Rt, Rn, offset;
+                Operand Rt, Rn, offset, Rs; // Rs: STXR's status register, XZR otherwise
             } D;
             struct
             {
@@ -57,7 +59,25 @@ namespace Decoder
         Instruction(Opcode::Type op) : opcode(op), format(Opcode::format(op)) {}
     };
 
+    struct Label
+    {
+        std::string name;
+        std::size_t index; // instruction the label refers to
+    };
+
+    struct Symbols
+    {
+        std::vector<Label> labels; // in definition order
+        std::vector<int> lines;    // source line of each instruction
+    };
+
+    // Throw std::runtime_error with the first error
     std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens);
+    std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens, Symbols &symbols);
+
+    // Reports problems into `diagnostics` instead. Still returns one instruction per
+    // instruction token, but the program must not be run if there were errors.
+    std::vector<Instruction> decode(const std::vector<Parser::Token> &tokens, Symbols &symbols, Diagnostics::List &diagnostics);
 
     std::ostream &operator<<(std::ostream &os, const Operand &operand);
     std::ostream &operator<<(std::ostream &os, const Instruction &instruction);
@@ -0,0 +1,240 @@
+#include "devices.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace Devices
+{
+    namespace
+    {
+        constexpr std::size_t INPUT_CHUNK = std::size_t{1} << 16;
+
+        bool write_all(int fd, const std::uint8_t *data, std::size_t size)
+        {
+            while (size)
+            {
+                const ssize_t n = ::write(fd, data, size);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                data += n;
+                size -= static_cast<std::size_t>(n);
+            }
+            return true;
+        }
+
+        // Whether [address, address + bytes) is memory rather than devices
+        bool in_memory(std::uint64_t address, std::uint64_t bytes)
+        {
+            return address < Memory::DEVICE_BASE && bytes <= Memory::DEVICE_BASE - address;
+        }
+
+        bool load_doubleword(Memory::Space &memory, std::uint64_t addr, std::uint64_t &value)
+        {
+            return memory.has_views() ? memory.load_shared(addr, 8, value) : memory.load(addr, 8, value);
+        }
+
+        bool store_doubleword(Memory::Space &memory, std::uint64_t addr, std::uint64_t value)
+        {
+            return memory.has_views() ? memory.store_shared(addr, 8, value) : memory.store(addr, 8, value);
+        }
+    } // namespace
+
+    Bus::Bus(const Config &config)
+        : config_(config), output_([this](const std::uint8_t *bytes, std::size_t size)
+                                   { output_failed_ = output_failed_ || !write_all(config_.output, bytes, size); })
+    {
+        if (config_.disk.empty())
+            return;
+        std::ifstream in(config_.disk, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Failed to open " + config_.disk);
+        image_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (in.bad())
+            throw std::runtime_error("Failed to read " + config_.disk);
+        image_.resize((image_.size() + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE); // a partial last block reads as zeros
+    }
+
+    Bus::~Bus()
+    {
+        try
+        {
+            finish();
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    std::uint64_t Bus::load(Memory::Space &memory, std::uint64_t addr, unsigned size)
+    {
+        std::unique_lock<std::mutex> lock;
+        if (memory.has_views())
+            lock = std::unique_lock<std::mutex>(mutex_);
+        const std::uint64_t value = read_register(addr);
+        return size == 8 ? value : value & ((std::uint64_t{1} << (8 * size)) - 1);
+    }
+
+    void Bus::store(Memory::Space &memory, std::uint64_t addr, unsigned size, std::uint64_t value)
+    {
+        std::unique_lock<std::mutex> lock;
+        if (memory.has_views())
+            lock = std::unique_lock<std::mutex>(mutex_);
+        write_register(memory, addr, size == 8 ? value : value & ((std::uint64_t{1} << (8 * size)) - 1));
+    }
+
+    void Bus::flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        output_.flush();
+    }
+
+    void Bus::finish()
+    {
+        if (finished_)
+            return;
+        finished_ = true;
+        output_.finish();
+        if (output_failed_)
+            throw std::runtime_error("failed to write console output");
+        if (image_changed_)
+        {
+            std::ofstream out(config_.disk, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(image_.data()), static_cast<std::streamsize>(image_.size()));
+            if (!out.flush())
+                throw std::runtime_error("failed to write " + config_.disk);
+        }
+    }
+
+    std::uint64_t Bus::read_register(std::uint64_t addr)
+    {
+        switch (addr)
+        {
+        case CONSOLE_IN:
+            return static_cast<std::uint64_t>(static_cast<std::int64_t>(get()));
+        case CONSOLE_EXIT:
+            return exit_status_;
+        case CONSOLE_ADDRESS:
+            return write_address_;
+        case DISK_BLOCK:
+            return block_;
+        case DISK_ADDRESS:
+            return address_;
+        case DISK_COUNT:
+            return count_;
+        case DISK_STATUS:
+            return status_;
+        case DISK_BLOCKS:
+            return image_.size() / BLOCK_SIZE;
+        default:
+            return 0;
+        }
+    }
+
+    void Bus::write_register(Memory::Space &memory, std::uint64_t addr, std::uint64_t value)
+    {
+        switch (addr)
+        {
+        case CONSOLE_OUT:
+            output_.append() = static_cast<std::uint8_t>(value);
+            break;
+        case CONSOLE_EXIT:
+            exit_status_ = value;
+            break;
+        case CONSOLE_ADDRESS:
+            write_address_ = value;
+            break;
+        case CONSOLE_WRITE:
+        {
+            // A doubleword at a time; a range reaching the devices writes nothing
+            if (!in_memory(write_address_, value))
+                break;
+            for (std::uint64_t done = 0; done < value; done += 8)
+            {
+                std::uint64_t v = 0;
+                load_doubleword(memory, write_address_ + done, v);
+                const std::uint64_t n = value - done < 8 ? value - done : 8;
+                for (std::uint64_t i = 0; i < n; i++)
+                    output_.append() = static_cast<std::uint8_t>(v >> (8 * i));
+            }
+            break;
+        }
+        case DISK_BLOCK:
+            block_ = value;
+            break;
+        case DISK_ADDRESS:
+            address_ = value;
+            break;
+        case DISK_COUNT:
+            count_ = value;
+            break;
+        case DISK_COMMAND:
+            status_ = transfer(memory, value) ? 0 : 1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    int Bus::get()
+    {
+        if (input_next_ == input_.size())
+        {
+            if (input_ended_ || config_.input < 0)
+                return -1;
+            output_.flush(); // so a prompt shows before waiting for the answer
+
+            input_.resize(INPUT_CHUNK);
+            ssize_t n;
+            do
+                n = ::read(config_.input, input_.data(), input_.size());
+            while (n < 0 && errno == EINTR);
+            input_.resize(n > 0 ? static_cast<std::size_t>(n) : 0);
+            input_next_ = 0;
+            if (n <= 0)
+            {
+                input_ended_ = true;
+                return -1;
+            }
+        }
+        return input_[input_next_++];
+    }
+
+    bool Bus::transfer(Memory::Space &memory, std::uint64_t command)
+    {
+        const std::uint64_t blocks = image_.size() / BLOCK_SIZE;
+        if ((command != DISK_READ && command != DISK_WRITE) || block_ > blocks || count_ > blocks - block_)
+            return false;
+        const std::uint64_t bytes = count_ * BLOCK_SIZE;
+        if (!in_memory(address_, bytes))
+            return false;
+
+        // Whole blocks are whole doublewords. A write to memory past its limit stops the
+        // transfer part way, as on a real device.
+        std::uint8_t *data = image_.data() + block_ * BLOCK_SIZE;
+        if (command == DISK_WRITE)
+            image_changed_ = true;
+        for (std::uint64_t done = 0; done < bytes; done += 8)
+        {
+            std::uint64_t v = 0;
+            if (command == DISK_READ)
+            {
+                std::memcpy(&v, data + done, 8);
+                if (!store_doubleword(memory, address_ + done, v))
+                    return false;
+            }
+            else
+            {
+                load_doubleword(memory, address_ + done, v);
+                std::memcpy(data + done, &v, 8);
+            }
+        }
+        return true;
+    }
+} // namespace Devices
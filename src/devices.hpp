@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "background.hpp"
+#include "memory.hpp"
+
+// Memory-mapped devices for guest programs: a console and a block device.
+//
+// A space whose Memory::Config names a Bus sends every access from Memory::DEVICE_BASE up to
+// the bus instead of to memory. Device pages never enter a TLB, so ordinary accesses cost
+// nothing extra. Each register is a doubleword at the address listed; an access of any size
+// there reads or writes its low bytes. Other device addresses read as zero and ignore writes.
+//
+// Console:
+//   CONSOLE_OUT      store: writes the low byte
+//   CONSOLE_IN       load: the next input byte, or -1 at the end of input
+//   CONSOLE_EXIT     exit status of the run, 0 until stored
+//   CONSOLE_ADDRESS  guest address for CONSOLE_WRITE
+//   CONSOLE_WRITE    store N: writes N bytes of guest memory from CONSOLE_ADDRESS
+//
+// Block device, over an image file of 512-byte blocks:
+//   DISK_BLOCK       first block of a transfer
+//   DISK_ADDRESS     guest address of a transfer
+//   DISK_COUNT       blocks in a transfer
+//   DISK_COMMAND     store DISK_READ or DISK_WRITE: copies DISK_COUNT blocks to or from memory
+//   DISK_STATUS      0 if the last command succeeded, 1 if not
+//   DISK_BLOCKS      size of the image in blocks
+//
+// Console output goes through a Background::Writer, so a guest printing a byte at a time
+// costs a store to a buffer, and the host makes one write call per 256 KiB. Buffered output
+// is written out before the console waits for input and when the bus finishes. The disk image
+// is read in full when the bus is created, commands copy between that copy and guest
+// memory, and it is written back to the file when the bus finishes, if it changed.
+namespace Devices
+{
+    constexpr std::uint64_t CONSOLE = Memory::DEVICE_BASE;
+    constexpr std::uint64_t CONSOLE_OUT = CONSOLE + 0x00;
+    constexpr std::uint64_t CONSOLE_IN = CONSOLE + 0x08;
+    constexpr std::uint64_t CONSOLE_EXIT = CONSOLE + 0x10;
+    constexpr std::uint64_t CONSOLE_ADDRESS = CONSOLE + 0x18;
+    constexpr std::uint64_t CONSOLE_WRITE = CONSOLE + 0x20;
+
+    constexpr std::uint64_t DISK = Memory::DEVICE_BASE + 0x1000;
+    constexpr std::uint64_t DISK_BLOCK = DISK + 0x00;
+    constexpr std::uint64_t DISK_ADDRESS = DISK + 0x08;
+    constexpr std::uint64_t DISK_COUNT = DISK + 0x10;
+    constexpr std::uint64_t DISK_COMMAND = DISK + 0x18;
+    constexpr std::uint64_t DISK_STATUS = DISK + 0x20;
+    constexpr std::uint64_t DISK_BLOCKS = DISK + 0x28;
+
+    constexpr std::uint64_t DISK_READ = 1;  // image to memory
+    constexpr std::uint64_t DISK_WRITE = 2; // memory to image
+    constexpr std::uint64_t BLOCK_SIZE = 512;
+
+    struct Config
+    {
+        int input = 0;    // file descriptor CONSOLE_IN reads, or -1 for no input
+        int output = 1;   // file descriptor console output goes to
+        std::string disk; // block device image; no block device if empty
+    };
+
+    class Bus
+    {
+    public:
+        // Throws std::runtime_error if the disk image cannot be read
+        explicit Bus(const Config &config = Config());
+        ~Bus();
+
+        Bus(const Bus &) = delete;
+        Bus &operator=(const Bus &) = delete;
+
+        // Device accesses, for Memory::Space. `memory` is the space accessing the device,
+        // which block transfers use. Accesses from spaces with views are serialized.
+        std::uint64_t load(Memory::Space &memory, std::uint64_t addr, unsigned size);
+        void store(Memory::Space &memory, std::uint64_t addr, unsigned size, std::uint64_t value);
+
+        // Returns once all console output so far has been written
+        void flush();
+
+        // Writes out console output and the disk image. Throws std::runtime_error if either
+        // could not be written.
+        void finish();
+
+        std::uint64_t exit_status() const { return exit_status_; }
+        std::uint64_t output_bytes() const { return output_.count(); }
+
+    private:
+        static constexpr std::size_t OUTPUT_BUFFER = std::size_t{1} << 18;
+
+        std::uint64_t read_register(std::uint64_t addr);
+        void write_register(Memory::Space &memory, std::uint64_t addr, std::uint64_t value);
+        int get();
+        bool transfer(Memory::Space &memory, std::uint64_t command);
+
+        Config config_;
+        bool output_failed_ = false; // written by the output thread, read after it stops
+        Background::Writer<std::uint8_t, OUTPUT_BUFFER> output_;
+        std::mutex mutex_;
+
+        std::vector<std::uint8_t> input_;
+        std::size_t input_next_ = 0;
+        bool input_ended_ = false;
+
+        std::uint64_t exit_status_ = 0;
+        std::uint64_t write_address_ = 0;
+
+        std::vector<std::uint8_t> image_;
+        bool image_changed_ = false;
+        std::uint64_t block_ = 0, address_ = 0, count_ = 0, status_ = 0;
+        bool finished_ = false;
+    };
+} // namespace Devices
@@ -0,0 +1,138 @@
+#include "diagnostics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "decoder.hpp"
+#include "encoding.hpp"
+#include "parser.hpp"
+
+namespace Diagnostics
+{
+    namespace
+    {
+        const char *severity_name(Code code)
+        {
+            return INFO[code].severity == Severity::ERROR ? "error" : "warning";
+        }
+
+        void write_json_string(std::ostream &os, std::string_view text)
+        {
+            os << '"';
+            for (char ch : text)
+            {
+                if (ch == '"' || ch == '\\')
+                    os << '\\' << ch;
+                else if (static_cast<unsigned char>(ch) < 0x20)
+                {
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", ch);
+                    os << escape;
+                }
+                else
+                    os << ch;
+            }
+            os << '"';
+        }
+
+        // Parsing finds its problems before decoding does; print them in source order
+        std::vector<Diagnostic> sorted(const List &list)
+        {
+            std::vector<Diagnostic> entries = list.entries();
+            std::stable_sort(entries.begin(), entries.end(), [](const Diagnostic &a, const Diagnostic &b)
+                             { return a.line != b.line ? a.line < b.line : a.column < b.column; });
+            return entries;
+        }
+    } // namespace
+
+    void List::clear()
+    {
+        entries_.clear();
+        errors_ = warnings_ = 0;
+    }
+
+    std::string describe(const Diagnostic &diagnostic)
+    {
+        if (!diagnostic.detail)
+            return INFO[diagnostic.code].message;
+        return std::string(diagnostic.detail) + " " + INFO[diagnostic.code].message;
+    }
+
+    std::string message(const Diagnostic &diagnostic)
+    {
+        std::string text = "Line " + std::to_string(diagnostic.line) +
+                           (INFO[diagnostic.code].severity == Severity::ERROR ? ": Error: " : ": Warning: ") +
+                           describe(diagnostic);
+        if (!diagnostic.lexeme.empty())
+            text += " (" + std::string(diagnostic.lexeme) + ")";
+        return text;
+    }
+
+    void throw_first(const List &list)
+    {
+        if (const Diagnostic *error = list.first_error())
+            throw std::runtime_error(message(*error));
+    }
+
+    void write_text(std::ostream &os, std::string_view path, const List &list)
+    {
+        for (const Diagnostic &d : sorted(list))
+        {
+            os << path << ':' << d.line << ':' << d.column << ": " << severity_name(d.code) << ": " << describe(d);
+            if (!d.lexeme.empty())
+                os << " (" << d.lexeme << ")";
+            os << " [" << INFO[d.code].name << "]\n";
+        }
+        if (list.dropped())
+            os << path << ": " << list.dropped() << " more not shown\n";
+    }
+
+    void write_json(std::ostream &os, std::string_view path, const List &list)
+    {
+        for (const Diagnostic &d : sorted(list))
+        {
+            os << "{\"file\":";
+            write_json_string(os, path);
+            os << ",\"line\":" << d.line << ",\"column\":" << d.column << ",\"severity\":\"" << severity_name(d.code)
+               << "\",\"code\":\"" << INFO[d.code].name << "\",\"message\":";
+            write_json_string(os, describe(d));
+            os << ",\"text\":";
+            write_json_string(os, d.lexeme);
+            os << "}\n";
+        }
+        if (list.dropped())
+        {
+            os << "{\"file\":";
+            write_json_string(os, path);
+            os << ",\"not_shown\":" << list.dropped() << "}\n";
+        }
+    }
+
+    bool check(std::string_view text, List &list)
+    {
+        list.clear();
+        std::vector<Parser::Token> tokens = Parser::parse(text, list);
+        Decoder::Symbols symbols;
+        std::vector<Decoder::Instruction> instructions = Decoder::decode(tokens, symbols, list);
+
+        // Instructions line up with their mnemonics; placeholders for failed ones always fit.
+        // A misfit is reported at its operand's token, or at the mnemonic if it has no such operand.
+        std::size_t index = 0;
+        for (std::size_t i = 0; i < tokens.size(); i++)
+        {
+            if (tokens[i].type != Parser::TOKEN_INSTRUCTION)
+                continue;
+            const Encoding::Misfit misfit = Encoding::out_of_range(instructions[index++]);
+            if (!misfit.field)
+                continue;
+            const Parser::Token *at = &tokens[i];
+            int operand = 0;
+            for (std::size_t j = i + 1; j < tokens.size() && tokens[j].type == Parser::TOKEN_OPERAND; j++, operand++)
+                if (misfit.operand < 0 || operand == misfit.operand)
+                    at = &tokens[j];
+            list.report(OUT_OF_RANGE, at->line, at->column, at == &tokens[i] ? std::string_view() : at->lexeme, misfit.field);
+        }
+        return list.errors() == 0;
+    }
+} // namespace Diagnostics
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Problems found while assembling, collected instead of thrown.
+//
+// Given a List, Parser::parse and Decoder::decode report every problem they find and carry
+// on with the next line or instruction, so one pass over a file finds all of them. An entry
+// is a code, a position and a view of the offending text, and the list reserves its
+// capacity up front, so reporting never allocates; problems past the capacity are only
+// counted. Messages are only formatted when a list is printed. The overloads without a
+// List throw std::runtime_error with the first error instead.
+namespace Diagnostics
+{
+    enum Code : std::uint8_t
+    {
+        // Errors
+        EMPTY_LABEL,
+        MULTIPLE_LABELS,
+        EXPECTED_COMMA,
+        UNKNOWN_OPCODE,
+        UNEXPECTED_OPERAND,
+        MISSING_OPERAND,
+        EXPECTED_REGISTER,
+        EXPECTED_IMMEDIATE,
+        INVALID_IMMEDIATE,
+        EXPECTED_OFFSET,
+        UNKNOWN_LABEL,
+        IMMEDIATE_RANGE,
+        // Warnings
+        DUPLICATE_LABEL,
+        OUT_OF_RANGE,
+        CODES
+    };
+
+    enum class Severity
+    {
+        ERROR,
+        WARNING
+    };
+
+    struct Info
+    {
+        const char *name; // stable identifier for tools
+        Severity severity;
+        const char *message;
+    };
+
+    constexpr Info INFO[CODES] = {
+        {"empty-label", Severity::ERROR, "empty label"},
+        {"multiple-labels", Severity::ERROR, "multiple labels on the same line"},
+        {"expected-comma", Severity::ERROR, "expected comma-separated operands"},
+        {"unknown-opcode", Severity::ERROR, "unexpected opcode"},
+        {"unexpected-operand", Severity::ERROR, "unexpected operand"},
+        {"missing-operand", Severity::ERROR, "missing operand"},
+        {"expected-register", Severity::ERROR, "expected register name"},
+        {"expected-immediate", Severity::ERROR, "expected immediate operand"},
+        {"invalid-immediate", Severity::ERROR, "invalid immediate"},
+        {"expected-offset", Severity::ERROR, "expected immediate offset"},
+        {"unknown-label", Severity::ERROR, "unknown label"},
+        {"immediate-range", Severity::ERROR, "immediate out of range for this instruction"},
+        {"duplicate-label", Severity::WARNING, "label defined again; branches go to the last definition"},
+        {"out-of-range", Severity::WARNING, "does not fit the binary encoding, so --assemble will fail"},
+    };
+
+    struct Diagnostic
+    {
+        Code code;
+        int line;
+        int column;              // 1-based, in bytes
+        std::string_view lexeme; // the text at fault, in the source; may be empty
+        const char *detail;      // what in that text is at fault, leading the message; may be null
+    };
+
+    class List
+    {
+    public:
+        explicit List(std::size_t capacity = 1000) { entries_.reserve(capacity); }
+
+        void report(Code code, int line, int column, std::string_view lexeme, const char *detail = nullptr)
+        {
+            const Diagnostic diagnostic{code, line, column, lexeme, detail};
+            if (INFO[code].severity == Severity::WARNING)
+                warnings_++;
+            else if (errors_++ == 0)
+                first_error_ = diagnostic;
+            if (entries_.size() < entries_.capacity())
+                entries_.push_back(diagnostic);
+        }
+
+        const std::vector<Diagnostic> &entries() const { return entries_; } // in the order found
+        std::size_t errors() const { return errors_; }
+        std::size_t warnings() const { return warnings_; }
+        std::size_t dropped() const { return errors_ + warnings_ - entries_.size(); }
+
+        // Kept even when the list is full, so a list with no capacity still says what failed
+        const Diagnostic *first_error() const { return errors_ ? &first_error_ : nullptr; }
+
+        // Forgets every entry, keeping the capacity, to reuse the list for another file
+        void clear();
+
+    private:
+        std::vector<Diagnostic> entries_;
+        std::size_t errors_ = 0, warnings_ = 0;
+        Diagnostic first_error_{};
+    };
+
+    // "unknown label", or with a detail, "immediate does not fit the binary encoding, ..."
+    std::string describe(const Diagnostic &diagnostic);
+
+    // "Line 3: Error: unknown label (loop)", the form the throwing overloads use
+    std::string message(const Diagnostic &diagnostic);
+
+    // Throws std::runtime_error with the list's first error, if it has one
+    void throw_first(const List &list);
+
+    // One "path:line:column: error: message (lexeme) [code]" line per entry, in source order
+    void write_text(std::ostream &os, std::string_view path, const List &list);
+
+    // One JSON object per entry and line, in source order:
+    // {"file":...,"line":3,"column":9,"severity":"error","code":"unknown-label","message":...,"text":"loop"}
+    // followed, if the list was full, by {"file":...,"not_shown":N}
+    void write_json(std::ostream &os, std::string_view path, const List &list);
+
+    // Assembles `text` without running it, reporting into `list`, which is cleared first.
+    // Also warns about values the binary encoding cannot hold. Returns whether there were
+    // no errors.
+    bool check(std::string_view text, List &list);
+} // namespace Diagnostics
@@ -0,0 +1,305 @@
+#include "embed.hpp"
+#include "legv8emu.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "dataflow.hpp"
+#include "decoder.hpp"
+#include "encoding.hpp"
+#include "packed.hpp"
+#include "parser.hpp"
+#include "version.hpp"
+
+namespace Embed
+{
+    struct Program::Compiled
+    {
+        std::shared_ptr<const Cpu::Program> program;
+        Decoder::Symbols symbols; // empty for images
+    };
+
+    Program Program::compile(std::string_view text, const Options &options)
+    {
+        auto compiled = std::make_shared<Compiled>();
+        std::vector<Packed::Op> ops;
+        if (Encoding::is_image(text))
+            ops = Packed::pack(Encoding::decode(Encoding::read_image(text)));
+        else
+            ops = Packed::pack(Decoder::decode(Parser::parse(text), compiled->symbols));
+
+        if (options.optimize)
+            ops = Dataflow::optimize(ops).ops;
+        auto executable = std::make_shared<Cpu::Program>(std::move(ops));
+        if (options.fuse)
+            executable->enable_fusion();
+        if (options.jit)
+            executable->enable_jit();
+        compiled->program = std::move(executable);
+        return Program(std::move(compiled));
+    }
+
+    Program Program::load(const std::string &path, const Options &options)
+    {
+        Parser::Source source(path);
+        return compile(source.text(), options);
+    }
+
+    std::size_t Program::size() const
+    {
+        return compiled_->program->size();
+    }
+
+    std::size_t Program::label(std::string_view name) const
+    {
+        for (const Decoder::Label &label : compiled_->symbols.labels)
+            if (label.name == name)
+                return label.index;
+        throw std::runtime_error("Error: no label " + std::string(name));
+    }
+
+    int Program::line(std::size_t index) const
+    {
+        const std::vector<int> &lines = compiled_->symbols.lines;
+        return index < lines.size() ? lines[index] : 0;
+    }
+
+    Machine::Machine(const Program &program, const Memory::Config &memory)
+        : memory_(std::make_unique<Memory::Space>(memory)),
+          machine_(std::make_unique<Cpu::Machine>(program.compiled_->program, *memory_)),
+          initial_(machine_->snapshot())
+    {
+    }
+
+    Machine::~Machine() = default;
+
+    Cpu::Status Machine::run(std::uint64_t max_steps)
+    {
+        return machine_->run(max_steps);
+    }
+
+    void Machine::reset()
+    {
+        machine_->restore(initial_);
+    }
+
+    void Machine::set_reg(Register::Name name, std::uint64_t value)
+    {
+        if (name < Register::XZR)
+            machine_->state.x[name] = value;
+    }
+
+    void Machine::set_pc(std::size_t pc)
+    {
+        if (pc > machine_->program_size())
+            throw std::runtime_error("Error: pc outside program");
+        machine_->state.pc = pc;
+    }
+
+    void Machine::read(std::uint64_t addr, void *out, std::size_t size)
+    {
+        // Whole doublewords, then the bytes left; loads never fail outside of harts
+        auto *bytes = static_cast<std::uint8_t *>(out);
+        for (std::size_t done = 0; done < size;)
+        {
+            const unsigned n = size - done >= 8 ? 8 : 1;
+            std::uint64_t value = 0;
+            memory_->load(addr + done, n, value);
+            std::memcpy(bytes + done, &value, n);
+            done += n;
+        }
+    }
+
+    void Machine::write(std::uint64_t addr, const void *data, std::size_t size)
+    {
+        const auto *bytes = static_cast<const std::uint8_t *>(data);
+        for (std::size_t done = 0; done < size;)
+        {
+            const unsigned n = size - done >= 8 ? 8 : 1;
+            std::uint64_t value = 0;
+            std::memcpy(&value, bytes + done, n);
+            if (!memory_->store(addr + done, n, value))
+                throw std::runtime_error("Error: guest memory limit exceeded");
+            done += n;
+        }
+    }
+
+    std::uint64_t Machine::load64(std::uint64_t addr)
+    {
+        std::uint64_t value = 0;
+        memory_->load(addr, 8, value);
+        return value;
+    }
+
+    void Machine::store64(std::uint64_t addr, std::uint64_t value)
+    {
+        if (!memory_->store(addr, 8, value))
+            throw std::runtime_error("Error: guest memory limit exceeded");
+    }
+} // namespace Embed
+
+// C interface
+
+struct legv8_program
+{
+    Embed::Program program;
+};
+
+struct legv8_machine
+{
+    Embed::Machine machine;
+};
+
+namespace
+{
+    thread_local std::string last_error;
+
+    Embed::Options options_from(const legv8_options *options)
+    {
+        Embed::Options converted;
+        if (options)
+        {
+            converted.optimize = options->optimize != 0;
+            converted.fuse = options->fuse != 0;
+            converted.jit = options->jit != 0;
+        }
+        return converted;
+    }
+
+    // Runs `body`, turning an exception into `failed` and its message into the last error
+    template <typename Result, typename Body>
+    Result guard(Result failed, Body body)
+    {
+        try
+        {
+            return body();
+        }
+        catch (const std::exception &e)
+        {
+            last_error = e.what();
+            return failed;
+        }
+    }
+} // namespace
+
+extern "C"
+{
+    const char *legv8_version(void)
+    {
+        return LEGV8EMU_VERSION;
+    }
+
+    const char *legv8_last_error(void)
+    {
+        return last_error.c_str();
+    }
+
+    legv8_program *legv8_compile(const char *text, size_t length, const legv8_options *options)
+    {
+        return guard<legv8_program *>(nullptr, [&]
+                                      { return new legv8_program{Embed::Program::compile(std::string_view(text, length), options_from(options))}; });
+    }
+
+    legv8_program *legv8_load(const char *path, const legv8_options *options)
+    {
+        return guard<legv8_program *>(nullptr, [&]
+                                      { return new legv8_program{Embed::Program::load(path, options_from(options))}; });
+    }
+
+    void legv8_program_free(legv8_program *program)
+    {
+        delete program;
+    }
+
+    size_t legv8_program_size(const legv8_program *program)
+    {
+        return program->program.size();
+    }
+
+    int64_t legv8_program_label(const legv8_program *program, const char *name)
+    {
+        return guard<int64_t>(-1, [&]
+                              { return static_cast<int64_t>(program->program.label(name)); });
+    }
+
+    legv8_machine *legv8_machine_new(const legv8_program *program, uint64_t memory_limit)
+    {
+        Memory::Config memory;
+        if (memory_limit)
+            memory.max_bytes = memory_limit;
+        return guard<legv8_machine *>(nullptr, [&]
+                                      { return new legv8_machine{Embed::Machine(program->program, memory)}; });
+    }
+
+    void legv8_machine_free(legv8_machine *machine)
+    {
+        delete machine;
+    }
+
+    void legv8_machine_reset(legv8_machine *machine)
+    {
+        machine->machine.reset();
+    }
+
+    legv8_status legv8_run(legv8_machine *machine, uint64_t max_steps)
+    {
+        switch (machine->machine.run(max_steps))
+        {
+        case Cpu::Status::HALTED:
+            return LEGV8_HALTED;
+        case Cpu::Status::BUDGET_EXHAUSTED:
+            return LEGV8_BUDGET_EXHAUSTED;
+        default:
+            return LEGV8_FAULT;
+        }
+    }
+
+    uint64_t legv8_get_reg(const legv8_machine *machine, unsigned reg)
+    {
+        return reg <= Register::XZR ? machine->machine.reg(static_cast<Register::Name>(reg)) : 0;
+    }
+
+    void legv8_set_reg(legv8_machine *machine, unsigned reg, uint64_t value)
+    {
+        if (reg <= Register::XZR)
+            machine->machine.set_reg(static_cast<Register::Name>(reg), value);
+    }
+
+    size_t legv8_get_pc(const legv8_machine *machine)
+    {
+        return machine->machine.pc();
+    }
+
+    int legv8_set_pc(legv8_machine *machine, size_t pc)
+    {
+        return guard(-1, [&]
+                     {
+                         machine->machine.set_pc(pc);
+                         return 0; });
+    }
+
+    int legv8_read(legv8_machine *machine, uint64_t addr, void *out, size_t size)
+    {
+        machine->machine.read(addr, out, size);
+        return 0;
+    }
+
+    int legv8_write(legv8_machine *machine, uint64_t addr, const void *data, size_t size)
+    {
+        return guard(-1, [&]
+                     {
+                         machine->machine.write(addr, data, size);
+                         return 0; });
+    }
+
+    uint64_t legv8_retired(const legv8_machine *machine)
+    {
+        return machine->machine.retired();
+    }
+
+    const char *legv8_fault(const legv8_machine *machine)
+    {
+        return machine->machine.fault().c_str();
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "registers.hpp"
+
+// The emulator as a library, for programs that run many short guest jobs without paying
+// for a process and an assembly each time (liblegv8emu; see legv8emu.h for the C API).
+//
+// A Program is compiled once: assembled or loaded from an image, optionally optimized,
+// fused and translated, then frozen. Copies share it, and any number of threads may create
+// and run Machines from it at once. A Machine is one hart with its own registers and
+// sparse memory, cheap to create, and used by one thread at a time.
+namespace Embed
+{
+    struct Options
+    {
+        bool optimize = false; // Dataflow::optimize
+        bool fuse = false;     // superinstructions for the interpreter
+        bool jit = false;      // native code where the host supports it
+    };
+
+    class Program
+    {
+    public:
+        // Assembles source text, or loads a binary program image. Throws std::runtime_error
+        // with the assembler's message if it is not a valid program.
+        static Program compile(std::string_view text, const Options &options = Options());
+
+        // As compile, reading the file at `path`
+        static Program load(const std::string &path, const Options &options = Options());
+
+        // Number of instructions
+        std::size_t size() const;
+
+        // Instruction the label marks, for starting a machine there. Throws
+        // std::runtime_error if there is no such label (images have none).
+        std::size_t label(std::string_view name) const;
+
+        // Source line of instruction `index`, or 0 for images
+        int line(std::size_t index) const;
+
+    private:
+        struct Compiled;
+        explicit Program(std::shared_ptr<const Compiled> compiled) : compiled_(std::move(compiled)) {}
+
+        friend class Machine;
+        std::shared_ptr<const Compiled> compiled_;
+    };
+
+    class Machine
+    {
+    public:
+        // Starts at the first instruction with zeroed registers and memory, and SP at
+        // Memory::STACK_TOP
+        explicit Machine(const Program &program, const Memory::Config &memory = Memory::Config());
+        ~Machine();
+
+        Machine(const Machine &) = delete;
+        Machine &operator=(const Machine &) = delete;
+
+        // Executes until the program halts, faults, or `max_steps` more instructions retire
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // Returns to the state the machine was created in, releasing its memory
+        void reset();
+
+        std::uint64_t reg(Register::Name name) const { return machine_->state.x[name]; }
+        void set_reg(Register::Name name, std::uint64_t value); // writes to XZR are ignored
+
+        std::size_t pc() const { return machine_->state.pc; }
+        void set_pc(std::size_t pc); // throws std::runtime_error past the end of the program
+
+        Cpu::Flags flags() const { return machine_->state.flags; }
+        void set_flags(Cpu::Flags flags) { machine_->state.flags = flags; }
+
+        // Copies `size` bytes of guest memory at `addr`. write throws std::runtime_error,
+        // leaving memory partly written, if it would exceed the memory limit.
+        void read(std::uint64_t addr, void *out, std::size_t size);
+        void write(std::uint64_t addr, const void *data, std::size_t size);
+
+        std::uint64_t load64(std::uint64_t addr);
+        void store64(std::uint64_t addr, std::uint64_t value);
+
+        // Instructions retired since the machine was created or reset
+        std::uint64_t retired() const { return machine_->retired; }
+
+        // Why the last run faulted
+        const std::string &fault() const { return machine_->fault(); }
+
+    private:
+        std::unique_ptr<Memory::Space> memory_;
+        std::unique_ptr<Cpu::Machine> machine_;
+        Cpu::Snapshot initial_;
+    };
+} // namespace Embed
@@ -0,0 +1,369 @@
+#include "encoding.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace Encoding
+{
+    namespace
+    {
+        // B.cond condition codes (Rt field), B_EQ through B_VS
+        constexpr std::uint8_t CONDITIONS[] = {0x0, 0x1, 0xB, 0xD, 0xC, 0xA, 0x3, 0x9, 0x8, 0x2, 0x4, 0x6};
+
+        // Number of 11-bit opcode values a format's shorter opcode field covers
+        constexpr unsigned span(Opcode::Format format)
+        {
+            switch (format)
+            {
+            case Opcode::Format::I:
+                return 2;
+            case Opcode::Format::IW:
+                return 4;
+            case Opcode::Format::CB:
+                return 8;
+            case Opcode::Format::B:
+                return 32;
+            default:
+                return 1;
+            }
+        }
+
+        constexpr std::uint8_t SHARED = Opcode::NONE + 1; // more than one opcode; resolved by shamt or Rt
+
+        struct Tables
+        {
+            std::array<std::uint8_t, 2048> opcode; // Opcode::Type (or NONE/SHARED) by bits [31:21]
+            std::array<std::uint8_t, 32> condition; // Opcode::Type by B.cond Rt field
+        };
+
+        Tables build_tables()
+        {
+            Tables tables;
+            tables.opcode.fill(Opcode::NONE);
+            tables.condition.fill(Opcode::NONE);
+            for (int op = 0; op < Opcode::NONE; op++)
+            {
+                const Opcode::Info &field = Opcode::INFO[op];
+                for (unsigned v = field.opcode; v < field.opcode + span(field.format); v++)
+                    tables.opcode[v] = tables.opcode[v] == Opcode::NONE ? op : SHARED;
+            }
+            for (int op = Opcode::B_EQ; op <= Opcode::B_VS; op++)
+                tables.condition[CONDITIONS[op - Opcode::B_EQ]] = static_cast<std::uint8_t>(op);
+            return tables;
+        }
+
+        const Tables tables = build_tables();
+
+        std::runtime_error encode_error(const Decoder::Instruction &inst, const std::string &what)
+        {
+            return std::runtime_error("Error: " + what + " in " + Opcode::to_string(inst.opcode));
+        }
+
+        std::uint32_t reg(const Decoder::Operand &operand)
+        {
+            return static_cast<std::uint32_t>(operand.reg) & 31;
+        }
+
+        bool fits_signed(int value, unsigned bits)
+        {
+            const int limit = 1 << (bits - 1);
+            return value >= -limit && value < limit;
+        }
+
+        bool fits_unsigned(int value, unsigned bits)
+        {
+            return value >= 0 && value < (1 << bits);
+        }
+
+        bool is_shift(int shift)
+        {
+            return shift == 0 || shift == 16 || shift == 32 || shift == 48;
+        }
+
+        // Two's-complement field of `bits` bits
+        std::uint32_t signed_field(const Decoder::Instruction &inst, int value, unsigned bits, const char *name)
+        {
+            if (!fits_signed(value, bits))
+                throw encode_error(inst, std::string(name) + " out of range (#" + std::to_string(value) + ")");
+            return static_cast<std::uint32_t>(value) & ((1u << bits) - 1);
+        }
+
+        std::uint32_t unsigned_field(const Decoder::Instruction &inst, int value, unsigned bits, const char *name)
+        {
+            if (!fits_unsigned(value, bits))
+                throw encode_error(inst, std::string(name) + " out of range (#" + std::to_string(value) + ")");
+            return static_cast<std::uint32_t>(value);
+        }
+
+        int sign_extend(std::uint32_t value, unsigned bits)
+        {
+            const std::uint32_t sign = 1u << (bits - 1);
+            return static_cast<int>((value ^ sign) - sign);
+        }
+
+        Opcode::Type lookup(std::uint32_t word)
+        {
+            const std::uint32_t field = word >> 21;
+            std::uint8_t op = tables.opcode[field];
+            if (op != SHARED)
+                return static_cast<Opcode::Type>(op);
+
+            if ((field & ~7u) == Opcode::INFO[Opcode::B_EQ].opcode)
+                return static_cast<Opcode::Type>(tables.condition[word & 31]);
+
+            const std::int8_t shamt = static_cast<std::int8_t>((word >> 10) & 63);
+            for (int candidate = 0; candidate < Opcode::NONE; candidate++)
+                if (Opcode::INFO[candidate].opcode == field && Opcode::INFO[candidate].shamt == shamt)
+                    return static_cast<Opcode::Type>(candidate);
+            return Opcode::NONE;
+        }
+
+        // Whether a branch at `pc` lands in [0, count]; count itself is the end of the program
+        bool target_in_range(const Decoder::Instruction &inst, std::size_t pc, std::size_t count)
+        {
+            std::int64_t offset;
+            if (inst.format == Opcode::Format::B)
+                offset = inst.B.label.imm;
+            else if (inst.format == Opcode::Format::CB)
+                offset = inst.CB.label.imm;
+            else
+                return true;
+            const std::int64_t target = static_cast<std::int64_t>(pc) + offset;
+            return target >= 0 && target <= static_cast<std::int64_t>(count);
+        }
+    } // namespace
+
+    std::uint32_t encode(const Decoder::Instruction &inst)
+    {
+        Opcode::Type opcode = inst.opcode;
+        if (opcode >= Opcode::NONE)
+            throw encode_error(inst, "no encoding");
+
+        switch (inst.format)
+        {
+        case Opcode::Format::R:
+        {
+            std::uint32_t shamt = 0;
+            if (Opcode::INFO[opcode].shamt != Opcode::ANY_SHAMT)
+                shamt = static_cast<std::uint32_t>(Opcode::INFO[opcode].shamt);
+            else if (opcode == Opcode::LSL || opcode == Opcode::LSR)
+                shamt = unsigned_field(inst, inst.R.shamt.imm, 6, "shift amount");
+            return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | reg(inst.R.Rm) << 16 | shamt << 10 |
+                   reg(inst.R.Rn) << 5 | reg(inst.R.Rd);
+        }
+
+        case Opcode::Format::I:
+        {
+            // A negative ADDI/SUBI encodes as the other one; anything that would not fit either
+            // way is left alone to be reported as is, and never negated (INT_MIN overflows)
+            int imm = inst.I.imm.imm;
+            if (imm < 0 && imm > -(1 << 12) && (opcode == Opcode::ADDI || opcode == Opcode::SUBI))
+            {
+                opcode = opcode == Opcode::ADDI ? Opcode::SUBI : Opcode::ADDI;
+                imm = -imm;
+            }
+            return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | unsigned_field(inst, imm, 12, "immediate") << 10 |
+                   reg(inst.I.Rn) << 5 | reg(inst.I.Rd);
+        }
+
+        case Opcode::Format::D:
+            if (opcode == Opcode::STXR)
+            {
+                // The status register takes the upper bits of the address field, as in ARMv8
+                if (inst.D.offset.imm != 0)
+                    throw encode_error(inst, "STXR takes no offset (#" + std::to_string(inst.D.offset.imm) + ")");
+                return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | reg(inst.D.Rs) << 16 | reg(inst.D.Rn) << 5 |
+                       reg(inst.D.Rt);
+            }
+            return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | signed_field(inst, inst.D.offset.imm, 9, "offset") << 12 |
+                   reg(inst.D.Rn) << 5 | reg(inst.D.Rt);
+
+        case Opcode::Format::B:
+            return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | signed_field(inst, inst.B.label.imm, 26, "branch offset");
+
+        case Opcode::Format::CB:
+        {
+            std::uint32_t rt = opcode == Opcode::CBZ || opcode == Opcode::CBNZ ? reg(inst.CB.Rt) : CONDITIONS[opcode - Opcode::B_EQ];
+            return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | signed_field(inst, inst.CB.label.imm, 19, "branch offset") << 5 | rt;
+        }
+
+        case Opcode::Format::IW:
+        {
+            int shift = inst.IW.shift.imm;
+            if (!is_shift(shift))
+                throw encode_error(inst, "shift must be 0, 16, 32 or 48 (#" + std::to_string(shift) + ")");
+            return std::uint32_t{Opcode::INFO[opcode].opcode} << 21 | static_cast<std::uint32_t>(shift / 16) << 21 |
+                   unsigned_field(inst, inst.IW.imm.imm, 16, "immediate") << 5 | reg(inst.IW.Rd);
+        }
+
+        default:
+            throw encode_error(inst, "no encoding");
+        }
+    }
+
+    Misfit out_of_range(const Decoder::Instruction &inst)
+    {
+        const Opcode::Type opcode = inst.opcode;
+        switch (inst.format)
+        {
+        case Opcode::Format::R:
+            if ((opcode == Opcode::LSL || opcode == Opcode::LSR) && !fits_unsigned(inst.R.shamt.imm, 6))
+                return {"shift amount", 2};
+            return {};
+        case Opcode::Format::I:
+            // A negative ADDI/SUBI immediate flips the operation
+            if ((opcode == Opcode::ADDI || opcode == Opcode::SUBI) && inst.I.imm.imm < 0)
+                return inst.I.imm.imm > -(1 << 12) ? Misfit{} : Misfit{"immediate", 2};
+            return fits_unsigned(inst.I.imm.imm, 12) ? Misfit{} : Misfit{"immediate", 2};
+        case Opcode::Format::D:
+            if (opcode == Opcode::STXR)
+                return inst.D.offset.imm == 0 ? Misfit{} : Misfit{"offset", -1};
+            return fits_signed(inst.D.offset.imm, 9) ? Misfit{} : Misfit{"offset", -1};
+        case Opcode::Format::B:
+            return fits_signed(inst.B.label.imm, 26) ? Misfit{} : Misfit{"branch offset", -1};
+        case Opcode::Format::CB:
+            return fits_signed(inst.CB.label.imm, 19) ? Misfit{} : Misfit{"branch offset", -1};
+        case Opcode::Format::IW:
+            if (!is_shift(inst.IW.shift.imm))
+                return {"shift", 2};
+            return fits_unsigned(inst.IW.imm.imm, 16) ? Misfit{} : Misfit{"immediate", 1};
+        default:
+            return {};
+        }
+    }
+
+    std::vector<std::uint32_t> encode(const std::vector<Decoder::Instruction> &instructions)
+    {
+        std::vector<std::uint32_t> words;
+        words.reserve(instructions.size());
+        for (std::size_t i = 0; i < instructions.size(); i++)
+        {
+            try
+            {
+                words.push_back(encode(instructions[i]));
+            }
+            catch (const std::runtime_error &e)
+            {
+                throw std::runtime_error("Instruction " + std::to_string(i) + ": " + e.what());
+            }
+        }
+        return words;
+    }
+
+    Decoder::Instruction decode(std::uint32_t word)
+    {
+        Opcode::Type opcode = lookup(word);
+        if (opcode == Opcode::NONE)
+        {
+            char hex[16];
+            std::snprintf(hex, sizeof(hex), "0x%08X", word);
+            throw std::runtime_error(std::string("Error: invalid instruction word (") + hex + ")");
+        }
+
+        const auto rd = static_cast<Register::Name>(word & 31);
+        const auto rn = static_cast<Register::Name>((word >> 5) & 31);
+        const auto rm = static_cast<Register::Name>((word >> 16) & 31);
+
+        Decoder::Instruction inst(opcode);
+        switch (inst.format)
+        {
+        case Opcode::Format::R:
+            inst.R.Rd = Decoder::Operand(opcode == Opcode::BR || opcode == Opcode::HALT ? Register::XZR : rd);
+            inst.R.Rn = Decoder::Operand(opcode == Opcode::HALT ? Register::XZR : rn);
+            inst.R.Rm = Decoder::Operand(opcode == Opcode::BR || opcode == Opcode::HALT || opcode == Opcode::LSL || opcode == Opcode::LSR ? Register::XZR : rm);
+            inst.R.shamt = Decoder::Operand(opcode == Opcode::LSL || opcode == Opcode::LSR ? static_cast<int>((word >> 10) & 63) : 0);
+            break;
+
+        case Opcode::Format::I:
+            inst.I.Rd = Decoder::Operand(rd);
+            inst.I.Rn = Decoder::Operand(rn);
+            inst.I.imm = Decoder::Operand(static_cast<int>((word >> 10) & 0xFFF));
+            break;
+
+        case Opcode::Format::D:
+            inst.D.Rt = Decoder::Operand(rd);
+            inst.D.Rn = Decoder::Operand(rn);
+            inst.D.offset = Decoder::Operand(opcode == Opcode::STXR ? 0 : sign_extend((word >> 12) & 0x1FF, 9));
+            inst.D.Rs = Decoder::Operand(opcode == Opcode::STXR ? rm : Register::XZR);
+            break;
+
+        case Opcode::Format::B:
+            inst.B.label = Decoder::Operand(sign_extend(word & 0x3FFFFFF, 26));
+            break;
+
+        case Opcode::Format::CB:
+            inst.CB.Rt = Decoder::Operand(opcode == Opcode::CBZ || opcode == Opcode::CBNZ ? rd : Register::XZR);
+            inst.CB.label = Decoder::Operand(sign_extend((word >> 5) & 0x7FFFF, 19));
+            break;
+
+        case Opcode::Format::IW:
+            inst.IW.Rd = Decoder::Operand(rd);
+            inst.IW.imm = Decoder::Operand(static_cast<int>((word >> 5) & 0xFFFF));
+            inst.IW.shift = Decoder::Operand(static_cast<int>((word >> 21) & 3) * 16);
+            break;
+
+        default:
+            break;
+        }
+        return inst;
+    }
+
+    std::vector<Decoder::Instruction> decode(const std::vector<std::uint32_t> &words)
+    {
+        std::vector<Decoder::Instruction> instructions;
+        instructions.reserve(words.size());
+        for (std::size_t i = 0; i < words.size(); i++)
+        {
+            try
+            {
+                instructions.push_back(decode(words[i]));
+                if (!target_in_range(instructions.back(), i, words.size()))
+                    throw std::runtime_error("Error: branch target outside program");
+            }
+            catch (const std::runtime_error &e)
+            {
+                throw std::runtime_error("Instruction " + std::to_string(i) + ": " + e.what());
+            }
+        }
+        return instructions;
+    }
+
+    bool is_image(std::string_view bytes)
+    {
+        return bytes.size() >= sizeof(IMAGE_MAGIC) && std::memcmp(bytes.data(), IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0;
+    }
+
+    void write_image(std::ostream &out, const std::vector<std::uint32_t> &words)
+    {
+        std::vector<char> bytes(sizeof(ImageHeader) + 4 * words.size());
+        std::memcpy(bytes.data(), IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+        for (int i = 0; i < 4; i++)
+            bytes[4 + i] = static_cast<char>(words.size() >> (8 * i));
+        for (std::size_t w = 0; w < words.size(); w++)
+            for (int i = 0; i < 4; i++)
+                bytes[sizeof(ImageHeader) + 4 * w + i] = static_cast<char>(words[w] >> (8 * i));
+        if (!out.write(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+            throw std::runtime_error("Error: failed to write program image");
+    }
+
+    std::vector<std::uint32_t> read_image(std::string_view bytes)
+    {
+        if (bytes.size() < sizeof(ImageHeader) || !is_image(bytes))
+            throw std::runtime_error("Error: not a program image");
+        const auto *data = reinterpret_cast<const unsigned char *>(bytes.data());
+        auto word = [data](std::size_t offset)
+        { return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 | static_cast<std::uint32_t>(data[offset + 3]) << 24; };
+
+        std::uint32_t count = word(4);
+        if ((bytes.size() - sizeof(ImageHeader)) / 4 < count)
+            throw std::runtime_error("Error: truncated program image");
+
+        std::vector<std::uint32_t> words(count);
+        for (std::size_t w = 0; w < count; w++)
+            words[w] = word(sizeof(ImageHeader) + 4 * w);
+        return words;
+    }
+} // namespace Encoding
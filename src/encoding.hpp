@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "decoder.hpp"
+
+namespace Encoding
+{
+    // Binary program image: this header followed by `count` little-endian instruction words
+    struct ImageHeader
+    {
+        char magic[4]; // "LEG8"
+        std::uint32_t count;
+    };
+    static_assert(sizeof(ImageHeader) == 8, "image header layout is part of the file format");
+
+    constexpr char IMAGE_MAGIC[4] = {'L', 'E', 'G', '8'};
+
+    // Standard LEGv8 32-bit machine code, field layouts as on the reference card:
+    //
+    //  R   opcode[31:21] Rm[20:16] shamt[15:10] Rn[9:5] Rd[4:0]
+    //  I   opcode[31:22] ALU_immediate[21:10]   Rn[9:5] Rd[4:0]
+    //  D   opcode[31:21] DT_address[20:12] op[11:10] Rn[9:5] Rt[4:0]
+    //  B   opcode[31:26] BR_address[25:0]
+    //  CB  opcode[31:24] COND_BR_address[23:5] Rt[4:0]
+    //  IW  opcode[31:23] shift[22:21] MOV_immediate[20:5] Rd[4:0]
+    //
+    // Branch addresses are in instructions, as in the assembler. B.cond keeps its condition
+    // in the Rt field. A negative ADDI/SUBI immediate is encoded as the opposite operation.
+    // Throws std::runtime_error if an operand does not fit its field.
+    std::uint32_t encode(const Decoder::Instruction &instruction);
+    std::vector<std::uint32_t> encode(const std::vector<Decoder::Instruction> &instructions);
+
+    // The first operand of an instruction that does not fit its field
+    struct Misfit
+    {
+        const char *field = nullptr; // "immediate", "offset", ...; nullptr if encode would accept it
+        int operand = -1;            // which operand in the source, counting from 0; -1 for the last
+    };
+    Misfit out_of_range(const Decoder::Instruction &instruction);
+
+    // Throws std::runtime_error for words that are not LEGv8 instructions
+    Decoder::Instruction decode(std::uint32_t word);
+
+    // Decodes a whole program. Also throws if a branch lands outside it, which labels rule out
+    // in assembly but a word can encode.
+    std::vector<Decoder::Instruction> decode(const std::vector<std::uint32_t> &words);
+
+    bool is_image(std::string_view bytes);
+    void write_image(std::ostream &out, const std::vector<std::uint32_t> &words);
+    std::vector<std::uint32_t> read_image(std::string_view bytes);
+} // namespace Encoding
@@ -0,0 +1,102 @@
+#include "fusion.hpp"
+
+#include <climits>
+
+namespace Fusion
+{
+    namespace
+    {
+        bool is_condition(std::uint8_t op)
+        {
+            return op >= Opcode::B_EQ && op <= Opcode::B_VS;
+        }
+
+        // ADDI/SUBI Xa, Xa, #k with Xa a real register; returns the signed adjustment
+        bool is_adjust(const Packed::Op &op, std::int32_t &delta)
+        {
+            if ((op.opcode != Opcode::ADDI && op.opcode != Opcode::SUBI) || op.rd != op.rn || op.imm == INT_MIN)
+                return false;
+            delta = op.opcode == Opcode::ADDI ? op.imm : -op.imm;
+            return true;
+        }
+
+        bool is_word_access(const Packed::Op &op)
+        {
+            return op.opcode == Opcode::LDUR || op.opcode == Opcode::STUR;
+        }
+
+        Packed::Op synthetic(Packed::Synthetic opcode, const Packed::Op &base)
+        {
+            Packed::Op op = base;
+            op.opcode = opcode;
+            return op;
+        }
+    } // namespace
+
+    Program fuse(const std::vector<Packed::Op> &ops)
+    {
+        Program program;
+        program.ops = ops;
+        Stats &stats = program.stats;
+
+        for (std::size_t i = 0; i + 1 < ops.size(); i++)
+        {
+            const Packed::Op &first = ops[i];
+            const Packed::Op &second = ops[i + 1];
+            std::int32_t delta;
+
+            if ((first.opcode == Opcode::SUBS || first.opcode == Opcode::SUBIS) && is_condition(second.opcode))
+            {
+                program.ops[i] = synthetic(first.opcode == Opcode::SUBS ? Packed::CMP_BRANCH : Packed::CMPI_BRANCH, first);
+                stats.compare_branch++;
+            }
+            else if (first.opcode == Opcode::MOVZ && first.rd != Packed::DISCARD &&
+                     second.opcode == Opcode::MOVK && second.rd == first.rd)
+            {
+                std::uint64_t value = static_cast<std::uint64_t>(first.imm) << first.rm;
+                std::size_t count = 1;
+                while (i + count < ops.size() && count < UINT8_MAX && ops[i + count].opcode == Opcode::MOVK && ops[i + count].rd == first.rd)
+                {
+                    const Packed::Op &movk = ops[i + count];
+                    value = (value & ~(std::uint64_t{0xFFFF} << movk.rm)) | (static_cast<std::uint64_t>(movk.imm) << movk.rm);
+                    count++;
+                }
+
+                Packed::Op op = synthetic(Packed::CONST64, first);
+                op.rm = static_cast<std::uint8_t>(count);
+                op.imm = static_cast<std::int32_t>(program.constants.size());
+                program.constants.push_back(value);
+                program.ops[i] = op;
+                stats.constant++;
+            }
+            else if (is_adjust(first, delta) && is_word_access(second) && second.rn == first.rd)
+            {
+                Packed::Op op = synthetic(second.opcode == Opcode::LDUR ? Packed::ADJUST_LOAD : Packed::ADJUST_STORE, first);
+                op.imm = delta;
+                program.ops[i] = op;
+                stats.memory_adjust++;
+            }
+            else if (first.opcode == Opcode::LDUR && is_adjust(second, delta) && second.rd == first.rn)
+            {
+                Packed::Op op = synthetic(Packed::LOAD_ADJUST, second);
+                op.imm = delta;
+                program.ops[i] = op;
+                stats.memory_adjust++;
+            }
+            else if (first.opcode == Opcode::LSL && second.opcode == Opcode::ADD &&
+                     first.rd != Packed::DISCARD && (second.rn == first.rd || second.rm == first.rd))
+            {
+                program.ops[i] = synthetic(Packed::SHIFT_ADD, first);
+                stats.shift_add++;
+            }
+        }
+        return program;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const Stats &stats)
+    {
+        return os << stats.total() << " fusions (" << stats.compare_branch << " compare-branch, "
+                  << stats.constant << " constant, " << stats.memory_adjust << " memory-adjust, "
+                  << stats.shift_add << " shift-add)";
+    }
+} // namespace Fusion
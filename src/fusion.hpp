@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "packed.hpp"
+
+namespace Fusion
+{
+    struct Stats
+    {
+        std::size_t compare_branch = 0; // SUBS/SUBIS + B.cond
+        std::size_t constant = 0;       // MOVZ + MOVK chains
+        std::size_t memory_adjust = 0;  // pointer bump + LDUR/STUR, in either order
+        std::size_t shift_add = 0;      // LSL + ADD
+
+        std::size_t total() const { return compare_branch + constant + memory_adjust + shift_add; }
+    };
+
+    struct Program
+    {
+        std::vector<Packed::Op> ops; // same length and indices as the input
+        std::vector<std::uint64_t> constants;
+        Stats stats;
+    };
+
+    // Peephole pass that replaces the first instruction of common pairs with a
+    // Packed::Synthetic superinstruction. Only that slot changes: the following
+    // instruction keeps its original record, so branches into it still work and
+    // instruction indices (branch offsets, link addresses) are unaffected.
+    Program fuse(const std::vector<Packed::Op> &ops);
+
+    // Bit (n << 3 | z << 2 | c << 1 | v) of the result is set when a B.cond opcode is taken
+    constexpr std::uint16_t condition_mask(Opcode::Type op)
+    {
+        std::uint16_t mask = 0;
+        for (unsigned nzcv = 0; nzcv < 16; nzcv++)
+        {
+            bool n = nzcv & 8, z = nzcv & 4, c = nzcv & 2, v = nzcv & 1;
+            bool taken = false;
+            switch (op)
+            {
+            case Opcode::B_EQ:
+                taken = z;
+                break;
+            case Opcode::B_NE:
+                taken = !z;
+                break;
+            case Opcode::B_LT:
+                taken = n != v;
+                break;
+            case Opcode::B_LE:
+                taken = z || n != v;
+                break;
+            case Opcode::B_GT:
+                taken = !z && n == v;
+                break;
+            case Opcode::B_GE:
+                taken = n == v;
+                break;
+            case Opcode::B_LO:
+                taken = !c;
+                break;
+            case Opcode::B_LS:
+                taken = !c || z;
+                break;
+            case Opcode::B_HI:
+                taken = c && !z;
+                break;
+            case Opcode::B_HS:
+                taken = c;
+                break;
+            case Opcode::B_MI:
+                taken = n;
+                break;
+            case Opcode::B_VS:
+                taken = v;
+                break;
+            default:
+                taken = false;
+                break;
+            }
+            mask |= static_cast<std::uint16_t>(taken) << nzcv;
+        }
+        return mask;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const Stats &stats);
+} // namespace Fusion
@@ -0,0 +1,85 @@
+#include "harts.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+namespace Harts
+{
+    namespace
+    {
+        // Instructions a threaded hart runs between checks for another hart's fault
+        constexpr std::uint64_t SLICE = std::uint64_t{1} << 16;
+    } // namespace
+
+    System::System(std::shared_ptr<const Cpu::Program> program, Memory::Space &memory, const Config &config)
+        : config_(config)
+    {
+        if (config.count == 0)
+            throw std::runtime_error("Error: at least one hart is needed");
+        for (unsigned i = 0; i < config.count; i++)
+        {
+            views_.push_back(std::make_unique<Memory::Space>(memory));
+            harts_.push_back(std::make_unique<Cpu::Machine>(program, *views_.back()));
+            Cpu::State &state = harts_.back()->state;
+            state.x[Register::X0] = i;
+            state.x[Register::X1] = config.count;
+            state.x[Register::X28] -= i * STACK_SIZE;
+        }
+    }
+
+    std::vector<Cpu::Status> System::run(std::uint64_t max_steps)
+    {
+        std::vector<Cpu::Status> statuses(harts_.size(), Cpu::Status::BUDGET_EXHAUSTED);
+        std::vector<std::uint64_t> remaining(harts_.size(), max_steps);
+        std::atomic<bool> stop{false};
+
+        // Runs hart i for up to `steps` instructions; returns whether it has more to run
+        auto turn = [&](std::size_t i, std::uint64_t steps)
+        {
+            if (stop.load(std::memory_order_relaxed))
+                return false;
+            Cpu::Machine &hart = *harts_[i];
+            Shared shared;
+            const std::uint64_t before = hart.retired;
+            statuses[i] = hart.run(std::min(steps, remaining[i]), shared);
+            remaining[i] -= hart.retired - before;
+            if (statuses[i] == Cpu::Status::FAULT)
+                stop.store(true, std::memory_order_relaxed);
+            return statuses[i] == Cpu::Status::BUDGET_EXHAUSTED && remaining[i] > 0;
+        };
+
+        if (config_.quantum)
+        {
+            std::vector<bool> running(harts_.size(), true);
+            for (bool any = true; any;)
+            {
+                any = false;
+                for (std::size_t i = 0; i < harts_.size(); i++)
+                {
+                    if (running[i])
+                        running[i] = turn(i, config_.quantum);
+                    any = any || running[i];
+                }
+            }
+            return statuses;
+        }
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < harts_.size(); i++)
+            threads.emplace_back([&turn, i]
+                                 { while (turn(i, SLICE)); });
+        for (std::thread &thread : threads)
+            thread.join();
+        return statuses;
+    }
+
+    std::uint64_t System::retired() const
+    {
+        std::uint64_t total = 0;
+        for (const auto &hart : harts_)
+            total += hart->retired;
+        return total;
+    }
+} // namespace Harts
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+
+// Runs one program on several harts (hardware threads) sharing guest memory.
+//
+// Each hart is a Cpu::Machine with its own registers and exclusive monitor, reaching the
+// shared memory through a Memory::Space view with TLBs of its own. Hart i starts at
+// instruction 0 with X0 = i, X1 = the number of harts, and SP i * STACK_SIZE below the usual
+// stack top.
+//
+// Memory model: a naturally aligned load or store of up to 8 bytes is single-copy atomic;
+// unaligned ones may tear. Every load is an acquire and every store a release, so each
+// hart's stores become visible to the others in the order it made them (which plain moves
+// already give on x86 hosts). LDXR reserves the 64-byte granule holding its doubleword, and
+// any store to that granule by any hart, STXR or plain, ends the reservation, even one that
+// puts back the value LDXR read; the STXR that follows then fails. A successful STXR is
+// atomic against every other store. Exclusive accesses must be aligned.
+//
+// Harts run either on a host thread each, or all on the calling thread, taking turns of
+// `quantum` instructions in index order, which makes every run of a program the same.
+namespace Harts
+{
+    constexpr std::uint64_t STACK_SIZE = std::uint64_t{1} << 20;
+
+    // Hooks for Machine::run that make its memory accesses atomic
+    struct Shared : Cpu::Observer
+    {
+        static constexpr bool SHARED = true;
+    };
+
+    struct Config
+    {
+        unsigned count = 2;
+        std::uint64_t quantum = 0; // instructions per turn on one thread; 0 for a thread per hart
+    };
+
+    class System
+    {
+    public:
+        // `memory` is shared by the harts and must outlive the system. Throws
+        // std::runtime_error if there are no harts.
+        System(std::shared_ptr<const Cpu::Program> program, Memory::Space &memory, const Config &config);
+
+        // Runs until every hart halts or has retired `max_steps` more instructions, or one
+        // faults, which stops the rest with their budget reported as exhausted. Returns each
+        // hart's status. Harts interpret, fused or not, without the JIT.
+        std::vector<Cpu::Status> run(std::uint64_t max_steps = UINT64_MAX);
+
+        std::size_t size() const { return harts_.size(); }
+        Cpu::Machine &hart(std::size_t i) { return *harts_[i]; }
+
+        // Instructions retired by all harts
+        std::uint64_t retired() const;
+
+    private:
+        Config config_;
+        std::vector<std::unique_ptr<Memory::Space>> views_;
+        std::vector<std::unique_ptr<Cpu::Machine>> harts_;
+    };
+} // namespace Harts
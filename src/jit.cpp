@@ -0,0 +1,1196 @@
+#include "jit.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define LEGV8_JIT 1
+#else
+#define LEGV8_JIT 0
+#endif
+
+namespace Jit
+{
+    namespace
+    {
+        // Passed to the entry trampoline; pinned in r15 while native code runs
+        struct Context
+        {
+            Cpu::State *state;
+            const Memory::TlbEntry *read_tlb;
+            const Memory::TlbEntry *write_tlb;
+            std::uint64_t remaining;
+            Memory::Space *memory;
+            std::uint64_t scratch; // load result from the slow path
+            bool (*load)(Memory::Space *, std::uint64_t, unsigned, std::uint64_t *);
+            bool (*store)(Memory::Space *, std::uint64_t, unsigned, std::uint64_t);
+            const void *const *blocks; // native entry of the block starting at each pc, or null; for BR
+        };
+
+        // Slow paths for TLB misses, called from native code with the System V calling convention
+        bool load_helper(Memory::Space *memory, std::uint64_t addr, unsigned size, std::uint64_t *value)
+        {
+            return memory->load(addr, size, *value);
+        }
+
+        bool store_helper(Memory::Space *memory, std::uint64_t addr, unsigned size, std::uint64_t value)
+        {
+            return memory->store(addr, size, value);
+        }
+
+        static_assert(sizeof(Memory::TlbEntry) == 16, "TLB index scaling assumes 16-byte entries");
+
+        using Trampoline = void (*)(Context *, const void *);
+
+        enum Reg
+        {
+            RAX,
+            RCX,
+            RDX,
+            RBX,
+            RSP,
+            RBP,
+            RSI,
+            RDI,
+            R8,
+            R9,
+            R10,
+            R11,
+            R12,
+            R13,
+            R14,
+            R15
+        };
+
+        // Host register roles
+        constexpr Reg STATE = RBX;     // Cpu::State *
+        constexpr Reg REMAINING = R12; // instruction budget
+        constexpr Reg READ_TLB = R13;  // Memory::Space read TLB
+        constexpr Reg CONTEXT = R15;   // Context *
+
+        enum Cond
+        {
+            CC_O = 0x0,
+            CC_B = 0x2,
+            CC_AE = 0x3,
+            CC_E = 0x4,
+            CC_NE = 0x5,
+            CC_BE = 0x6,
+            CC_A = 0x7,
+            CC_S = 0x8,
+            CC_L = 0xC,
+            CC_GE = 0xD,
+            CC_LE = 0xE,
+            CC_G = 0xF,
+        };
+
+        constexpr std::int32_t reg_disp(int guest) { return static_cast<std::int32_t>(guest * sizeof(std::uint64_t)); }
+        const std::int32_t PC_DISP = offsetof(Cpu::State, pc);
+        const std::int32_t FLAG_N = offsetof(Cpu::State, flags) + offsetof(Cpu::Flags, n);
+        const std::int32_t FLAG_Z = offsetof(Cpu::State, flags) + offsetof(Cpu::Flags, z);
+        const std::int32_t FLAG_C = offsetof(Cpu::State, flags) + offsetof(Cpu::Flags, c);
+        const std::int32_t FLAG_V = offsetof(Cpu::State, flags) + offsetof(Cpu::Flags, v);
+
+        // Minimal x86-64 assembler for the instruction forms the translator needs
+        class Assembler
+        {
+        public:
+            using Label = std::size_t;
+
+            std::vector<std::uint8_t> code;
+
+            Label label()
+            {
+                bound_.push_back(-1);
+                return bound_.size() - 1;
+            }
+
+            void bind(Label l) { bound_[l] = static_cast<std::int64_t>(code.size()); }
+            bool is_bound(Label l) const { return bound_[l] >= 0; }
+            std::int64_t position(Label l) const { return bound_[l]; }
+
+            void jmp(Label l)
+            {
+                byte(0xE9);
+                rel32(l);
+            }
+
+            void jcc(Cond cc, Label l)
+            {
+                byte(0x0F);
+                byte(0x80 | cc);
+                rel32(l);
+            }
+
+            void resolve()
+            {
+                for (const auto &fixup : fixups_)
+                {
+                    if (bound_[fixup.second] < 0)
+                        throw std::runtime_error("JIT Internal Error: unbound label");
+                    std::int32_t rel = static_cast<std::int32_t>(bound_[fixup.second] - static_cast<std::int64_t>(fixup.first + 4));
+                    std::memcpy(&code[fixup.first], &rel, 4);
+                }
+            }
+
+            void byte(std::uint8_t b) { code.push_back(b); }
+
+            void imm32(std::int32_t v)
+            {
+                for (int i = 0; i < 4; i++)
+                    byte(static_cast<std::uint8_t>(v >> (8 * i)));
+            }
+
+            void rex(bool w, int reg, int base)
+            {
+                std::uint8_t r = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+                if (r != 0x40)
+                    byte(r);
+            }
+
+            // ModRM (+SIB, +displacement) for [base + disp]
+            void mem(int reg, int base, std::int32_t disp)
+            {
+                std::uint8_t mod = (disp == 0 && (base & 7) != RBP) ? 0x00 : (disp >= -128 && disp <= 127) ? 0x40 : 0x80;
+                byte(mod | ((reg & 7) << 3) | (base & 7));
+                if ((base & 7) == RSP)
+                    byte(0x24);
+                if (mod == 0x40)
+                    byte(static_cast<std::uint8_t>(disp));
+                else if (mod == 0x80)
+                    imm32(disp);
+            }
+
+            // <opcode> reg, [base + disp] (or the reverse, depending on opcode)
+            void op_mem(bool w, std::initializer_list<std::uint8_t> opcode, int reg, int base, std::int32_t disp)
+            {
+                rex(w, reg, base);
+                for (std::uint8_t b : opcode)
+                    byte(b);
+                mem(reg, base, disp);
+            }
+
+            // <opcode> reg, rm (register direct)
+            void op_reg(bool w, std::initializer_list<std::uint8_t> opcode, int reg, int rm)
+            {
+                rex(w, reg, rm);
+                for (std::uint8_t b : opcode)
+                    byte(b);
+                byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+            }
+
+            // Byte-register form; SPL/BPL/SIL/DIL need a REX prefix to not mean AH/CH/DH/BH
+            void op_mem_byte(std::uint8_t opcode, int reg, int base, std::int32_t disp)
+            {
+                if (reg >= RSP && reg <= RDI && base < R8)
+                    byte(0x40);
+                op_mem(false, {opcode}, reg, base, disp);
+            }
+
+            void load(int reg, int base, std::int32_t disp) { op_mem(true, {0x8B}, reg, base, disp); }
+            void store(int base, std::int32_t disp, int reg) { op_mem(true, {0x89}, reg, base, disp); }
+
+            void mov_imm64(int reg, std::uint64_t v)
+            {
+                if (v <= 0xFFFFFFFFu)
+                {
+                    rex(false, 0, reg);
+                    byte(0xB8 | (reg & 7));
+                    imm32(static_cast<std::int32_t>(v));
+                    return;
+                }
+                rex(true, 0, reg);
+                byte(0xB8 | (reg & 7));
+                for (int i = 0; i < 8; i++)
+                    byte(static_cast<std::uint8_t>(v >> (8 * i)));
+            }
+
+            // Group-1 ALU with sign-extended imm32: /0 add, /1 or, /4 and, /5 sub, /6 xor, /7 cmp
+            void alu_imm(int ext, int rm, std::int32_t v)
+            {
+                rex(true, 0, rm);
+                if (v >= -128 && v <= 127)
+                {
+                    byte(0x83);
+                    byte(0xC0 | (ext << 3) | (rm & 7));
+                    byte(static_cast<std::uint8_t>(v));
+                }
+                else
+                {
+                    byte(0x81);
+                    byte(0xC0 | (ext << 3) | (rm & 7));
+                    imm32(v);
+                }
+            }
+
+            void shift_imm(int ext, int rm, std::uint8_t amount)
+            {
+                op_reg(true, {0xC1}, ext, rm);
+                byte(amount);
+            }
+
+            void store_imm32(int base, std::int32_t disp, std::int32_t v)
+            {
+                op_mem(true, {0xC7}, 0, base, disp);
+                imm32(v);
+            }
+
+            void setcc(Cond cc, int base, std::int32_t disp) { op_mem(false, {0x0F, static_cast<std::uint8_t>(0x90 | cc)}, 0, base, disp); }
+
+            void store_byte_imm(int base, std::int32_t disp, std::uint8_t v)
+            {
+                op_mem(false, {0xC6}, 0, base, disp);
+                byte(v);
+            }
+
+            void push(int reg)
+            {
+                rex(false, 0, reg);
+                byte(0x50 | (reg & 7));
+            }
+
+            void pop(int reg)
+            {
+                rex(false, 0, reg);
+                byte(0x58 | (reg & 7));
+            }
+
+        private:
+            void rel32(Label l)
+            {
+                fixups_.emplace_back(code.size(), l);
+                imm32(0);
+            }
+
+            std::vector<std::int64_t> bound_;
+            std::vector<std::pair<std::size_t, Label>> fixups_;
+        };
+
+        bool is_branch(Opcode::Type op)
+        {
+            Opcode::Format format = Opcode::format(op);
+            return format == Opcode::Format::B || format == Opcode::Format::CB || op == Opcode::BR;
+        }
+
+        bool translatable(Opcode::Type op)
+        {
+            switch (op)
+            {
+            case Opcode::AND:
+            case Opcode::ADD:
+            case Opcode::ORR:
+            case Opcode::EOR:
+            case Opcode::SUB:
+            case Opcode::MUL:
+            case Opcode::SMULH:
+            case Opcode::UMULH:
+            case Opcode::ADDS:
+            case Opcode::SUBS:
+            case Opcode::ANDS:
+            case Opcode::LSL:
+            case Opcode::LSR:
+            case Opcode::ADDI:
+            case Opcode::SUBI:
+            case Opcode::ANDI:
+            case Opcode::ORRI:
+            case Opcode::EORI:
+            case Opcode::ADDIS:
+            case Opcode::SUBIS:
+            case Opcode::ANDIS:
+            case Opcode::LDUR:
+            case Opcode::LDURB:
+            case Opcode::LDURH:
+            case Opcode::LDURSW:
+            case Opcode::STUR:
+            case Opcode::STURB:
+            case Opcode::STURH:
+            case Opcode::STURW:
+            case Opcode::B:
+            case Opcode::BL:
+            case Opcode::BR:
+            case Opcode::CBZ:
+            case Opcode::CBNZ:
+            case Opcode::B_EQ:
+            case Opcode::B_NE:
+            case Opcode::B_LT:
+            case Opcode::B_LE:
+            case Opcode::B_GT:
+            case Opcode::B_GE:
+            case Opcode::B_LO:
+            case Opcode::B_LS:
+            case Opcode::B_HI:
+            case Opcode::B_HS:
+            case Opcode::B_MI:
+            case Opcode::B_VS:
+            case Opcode::MOVZ:
+            case Opcode::MOVK:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // x86 condition equivalent to a LEGv8 condition, valid directly after an x86 SUB/CMP
+        Cond sub_condition(Opcode::Type op)
+        {
+            switch (op)
+            {
+            case Opcode::B_EQ:
+                return CC_E;
+            case Opcode::B_NE:
+                return CC_NE;
+            case Opcode::B_LT:
+                return CC_L;
+            case Opcode::B_LE:
+                return CC_LE;
+            case Opcode::B_GT:
+                return CC_G;
+            case Opcode::B_GE:
+                return CC_GE;
+            case Opcode::B_LO:
+                return CC_B;
+            case Opcode::B_LS:
+                return CC_BE;
+            case Opcode::B_HI:
+                return CC_A;
+            case Opcode::B_HS:
+                return CC_AE;
+            case Opcode::B_MI:
+                return CC_S;
+            default: // B_VS
+                return CC_O;
+            }
+        }
+
+        class Translator
+        {
+        public:
+            explicit Translator(const std::vector<Packed::Op> &program)
+                : program_(program), block_(program.size() + 1), entry_(program.size() + 1)
+            {
+            }
+
+            std::vector<std::int32_t> translate(std::size_t &blocks)
+            {
+                find_leaders();
+                find_loops();
+
+                exit_ = a_.label();
+                indirect_exit_ = a_.label();
+                emit_trampoline();
+
+                for (std::size_t pc = 0; pc < program_.size(); pc++)
+                {
+                    if (translated(pc))
+                    {
+                        block_[pc] = a_.label();
+                        entry_[pc] = loop_at_[pc] < 0 ? block_[pc] : a_.label();
+                    }
+                }
+
+                for (std::size_t pc = 0; pc < program_.size(); pc++)
+                {
+                    if (!translated(pc))
+                        continue;
+                    emit_block(pc);
+                    blocks++;
+                }
+                loop_ = -1;
+
+                for (const Stub &stub : stubs_)
+                {
+                    a_.bind(stub.label);
+                    flush(stub.cache);
+                    a_.store_imm32(STATE, PC_DISP, static_cast<std::int32_t>(stub.pc));
+                    if (stub.refund != 0)
+                        a_.alu_imm(0, REMAINING, stub.refund);
+                    a_.jmp(exit_);
+                }
+                for (const auto &edge : leaves_)
+                {
+                    const Loop &loop = loops_[edge.first.first];
+                    a_.bind(edge.second);
+                    for (int i = 0; i < loop.pinned; i++)
+                        if (loop.dirty[i])
+                            a_.store(STATE, reg_disp(loop.guest[i]), CACHE_REGS[i]);
+                    a_.jmp(target(edge.first.second));
+                }
+                for (std::size_t pc = 0; pc < program_.size(); pc++)
+                {
+                    if (!translated(pc) || loop_at_[pc] < 0)
+                        continue;
+                    const Loop &loop = loops_[loop_at_[pc]];
+                    a_.bind(entry_[pc]);
+                    for (int i = 0; i < loop.pinned; i++)
+                        a_.load(CACHE_REGS[i], STATE, reg_disp(loop.guest[i]));
+                    a_.jmp(block_[pc]);
+                }
+                a_.bind(indirect_exit_);
+                a_.store(STATE, PC_DISP, RAX);
+                a_.jmp(exit_);
+                for (const auto &stub : exits_)
+                {
+                    a_.bind(stub.second);
+                    a_.store_imm32(STATE, PC_DISP, static_cast<std::int32_t>(stub.first));
+                    a_.jmp(exit_);
+                }
+                for (const SlowPath &path : slow_paths_)
+                    emit_slow_path(path);
+                a_.resolve();
+
+                std::vector<std::int32_t> entry(program_.size(), -1);
+                for (std::size_t pc = 0; pc < program_.size(); pc++)
+                    if (translated(pc))
+                        entry[pc] = static_cast<std::int32_t>(a_.position(entry_[pc]));
+                return entry;
+            }
+
+            const std::vector<std::uint8_t> &code() const { return a_.code; }
+
+        private:
+            Opcode::Type opcode(std::size_t pc) const { return static_cast<Opcode::Type>(program_[pc].opcode); }
+
+            void find_leaders()
+            {
+                leader_.assign(program_.size() + 1, false);
+                leader_[0] = true;
+                for (std::size_t pc = 0; pc < program_.size(); pc++)
+                {
+                    Opcode::Type op = opcode(pc);
+                    if (is_branch(op) || !translatable(op))
+                        leader_[pc + 1] = true;
+                    std::size_t target = pc + program_[pc].imm;
+                    if (op != Opcode::BR && is_branch(op) && target <= program_.size())
+                        leader_[target] = true;
+                }
+            }
+
+            bool translated(std::size_t pc) const { return pc < program_.size() && leader_[pc] && translatable(opcode(pc)); }
+
+            // Finds the loops whose registers can stay in host registers between iterations: a
+            // direct branch back to an earlier instruction, with only translated instructions
+            // from its target to it. A BL leaves the loop like any other jump out of it, and the
+            // return comes back in through the interpreter, so loops without one are preferred;
+            // otherwise, where loops overlap, the outermost is kept. Each pins the guest
+            // registers its instructions name most often, counting those in nested loops eight
+            // times for each level. X30 is not pinned where a BL is, since BL writes it straight
+            // to Cpu::State.
+            void find_loops()
+            {
+                struct Candidate
+                {
+                    std::size_t first, last;
+                    bool calls;
+                };
+                const std::size_t size = program_.size();
+                std::vector<Candidate> candidates;
+                for (std::size_t pc = 0; pc < size; pc++)
+                {
+                    const Opcode::Type op = opcode(pc);
+                    const std::size_t first = pc + program_[pc].imm;
+                    if (!is_branch(op) || op == Opcode::BR || op == Opcode::BL || first > pc)
+                        continue;
+                    bool straight = true, calls = false;
+                    for (std::size_t i = first; i <= pc && straight; i++)
+                    {
+                        straight = translatable(opcode(i));
+                        calls = calls || opcode(i) == Opcode::BL;
+                    }
+                    if (straight)
+                        candidates.push_back({first, pc, calls});
+                }
+
+                std::vector<unsigned> depth(size);
+                for (const Candidate &candidate : candidates)
+                    for (std::size_t pc = candidate.first; pc <= candidate.last; pc++)
+                        depth[pc]++;
+
+                std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b)
+                          { return a.calls != b.calls ? b.calls : a.last - a.first > b.last - b.first; });
+                loop_at_.assign(size + 1, -1);
+                for (const Candidate &candidate : candidates)
+                {
+                    bool overlaps = false;
+                    for (std::size_t pc = candidate.first; pc <= candidate.last && !overlaps; pc++)
+                        overlaps = loop_at_[pc] >= 0;
+                    if (overlaps)
+                        continue;
+
+                    std::uint64_t uses[Register::XZR] = {};
+                    bool written[Register::XZR] = {};
+                    for (std::size_t pc = candidate.first; pc <= candidate.last; pc++)
+                    {
+                        const Packed::Op &op = program_[pc];
+                        const std::uint64_t weight = std::uint64_t{1} << 3 * std::min(depth[pc], 8u);
+                        for (std::uint8_t guest : {op.rd, op.rn, op.rm})
+                            if (guest < Register::XZR)
+                                uses[guest] += weight;
+                        if (op.rd < Register::XZR && !Packed::is_store(opcode(pc)))
+                            written[op.rd] = true;
+                        loop_at_[pc] = static_cast<int>(loops_.size());
+                    }
+                    if (candidate.calls)
+                        uses[Register::X30] = 0;
+
+                    Loop loop{candidate.first, candidate.last, {}, {}, 0};
+                    while (loop.pinned < PINNED_MAX)
+                    {
+                        const std::uint64_t *hottest = std::max_element(uses, uses + Register::XZR);
+                        if (*hottest == 0)
+                            break;
+                        const int guest = static_cast<int>(hottest - uses);
+                        loop.guest[loop.pinned] = guest;
+                        loop.dirty[loop.pinned] = written[guest];
+                        loop.pinned++;
+                        uses[guest] = 0;
+                    }
+                    loops_.push_back(loop);
+                }
+            }
+
+            // Label that continues execution at `pc` from the block being emitted: its block if
+            // translated, otherwise an exit stub. Jumps within a loop keep its pinned registers;
+            // jumps out of one go through a stub writing them back, and jumps into one through
+            // the block's entry, which loads them.
+            Assembler::Label target(std::size_t pc)
+            {
+                if (loop_ >= 0)
+                {
+                    if (translated(pc) && loop_at_[pc] == loop_)
+                        return block_[pc];
+                    auto it = leaves_.find({loop_, pc});
+                    if (it == leaves_.end())
+                        it = leaves_.emplace(std::make_pair(loop_, pc), a_.label()).first;
+                    return it->second;
+                }
+                if (translated(pc))
+                    return entry_[pc];
+                auto it = exits_.find(pc);
+                if (it == exits_.end())
+                    it = exits_.emplace(pc, a_.label()).first;
+                return it->second;
+            }
+
+            // void trampoline(Context *ctx, const void *block)
+            void emit_trampoline()
+            {
+                const Reg saved[] = {RBX, RBP, R12, R13, R14, R15};
+                for (Reg r : saved)
+                    a_.push(r);
+                a_.alu_imm(5, RSP, 8); // keep the stack 16-byte aligned
+                a_.op_reg(true, {0x89}, RDI, CONTEXT);
+                a_.load(STATE, CONTEXT, offsetof(Context, state));
+                a_.load(READ_TLB, CONTEXT, offsetof(Context, read_tlb));
+                a_.load(REMAINING, CONTEXT, offsetof(Context, remaining));
+                a_.op_reg(false, {0xFF}, 4, RSI); // jmp rsi
+
+                a_.bind(exit_);
+                a_.store(CONTEXT, offsetof(Context, remaining), REMAINING);
+                a_.alu_imm(0, RSP, 8);
+                for (int i = 5; i >= 0; i--)
+                    a_.pop(saved[i]);
+                a_.byte(0xC3);
+            }
+
+            // Guest registers are cached in host registers for the duration of a block and
+            // written back before every exit from it. Inside a loop, the first host registers
+            // are pinned to the loop's hottest guest registers instead, which stay there across
+            // its blocks and are written back only when execution leaves the loop.
+            static constexpr Reg CACHE_REGS[] = {RSI, RDI, R8, R9, R10, R11, R14, RBP};
+            static constexpr int CACHE_SIZE = sizeof(CACHE_REGS) / sizeof(CACHE_REGS[0]);
+            static constexpr int PINNED_MAX = CACHE_SIZE - 3; // an instruction names up to three
+
+            struct Cache
+            {
+                int guest[CACHE_SIZE]; // guest register held by each host register, or -1
+                bool dirty[CACHE_SIZE];
+                int next_victim;
+                int pinned; // host registers pinned by the loop
+            };
+
+            struct Loop
+            {
+                std::size_t first, last;
+                int guest[PINNED_MAX]; // guest register pinned to each of the first host registers
+                bool dirty[PINNED_MAX]; // written somewhere in the loop
+                int pinned;
+            };
+
+            void cache_reset()
+            {
+                const int pinned = loop_ < 0 ? 0 : loops_[loop_].pinned;
+                for (int i = 0; i < CACHE_SIZE; i++)
+                {
+                    cache_.guest[i] = i < pinned ? loops_[loop_].guest[i] : -1;
+                    cache_.dirty[i] = i < pinned && loops_[loop_].dirty[i];
+                }
+                cache_.next_victim = pinned;
+                cache_.pinned = pinned;
+            }
+
+            int cache_find(int guest) const
+            {
+                for (int i = 0; i < CACHE_SIZE; i++)
+                    if (cache_.guest[i] == guest)
+                        return i;
+                return -1;
+            }
+
+            int cache_alloc(int guest)
+            {
+                for (int i = cache_.pinned; i < CACHE_SIZE; i++)
+                {
+                    if (cache_.guest[i] < 0)
+                    {
+                        cache_.guest[i] = guest;
+                        return i;
+                    }
+                }
+                int victim = cache_.next_victim;
+                cache_.next_victim = victim + 1 < CACHE_SIZE ? victim + 1 : cache_.pinned;
+                if (cache_.dirty[victim])
+                    a_.store(STATE, reg_disp(cache_.guest[victim]), CACHE_REGS[victim]);
+                cache_.guest[victim] = guest;
+                cache_.dirty[victim] = false;
+                return victim;
+            }
+
+            // Host register holding the current value of a guest register
+            Reg use(int guest)
+            {
+                int slot = cache_find(guest);
+                if (slot < 0)
+                {
+                    slot = cache_alloc(guest);
+                    a_.load(CACHE_REGS[slot], STATE, reg_disp(guest));
+                }
+                return CACHE_REGS[slot];
+            }
+
+            // Guest register = host register (writes to the discard slot vanish)
+            void set(int guest, Reg value)
+            {
+                if (guest == Packed::DISCARD)
+                    return;
+                int slot = cache_find(guest);
+                if (slot < 0)
+                    slot = cache_alloc(guest);
+                cache_.dirty[slot] = true;
+                a_.op_reg(true, {0x89}, value, CACHE_REGS[slot]);
+            }
+
+            // Writes back dirty registers, leaving out pinned ones unless `pinned`; emits only
+            // MOVs, so host flags survive
+            void flush(const Cache &cache, bool pinned = true)
+            {
+                for (int i = pinned ? 0 : cache.pinned; i < CACHE_SIZE; i++)
+                    if (cache.dirty[i])
+                        a_.store(STATE, reg_disp(cache.guest[i]), CACHE_REGS[i]);
+            }
+
+            void emit_block(std::size_t start)
+            {
+                std::size_t end = start;
+                while (end < program_.size() && translatable(opcode(end)))
+                {
+                    end++;
+                    if (is_branch(opcode(end - 1)) || leader_[end])
+                        break;
+                }
+                const std::int32_t length = static_cast<std::int32_t>(end - start);
+
+                a_.bind(block_[start]);
+                loop_ = loop_at_[start];
+                cache_reset();
+
+                // Hand back to the interpreter if the whole block does not fit in the budget
+                Assembler::Label over_budget = a_.label();
+                a_.op_reg(true, {0x81}, 7, REMAINING); // cmp r12, length
+                a_.imm32(length);
+                a_.jcc(CC_B, over_budget);
+                stubs_.push_back({over_budget, start, 0, cache_});
+                a_.alu_imm(5, REMAINING, length);
+
+                bool sub_flags_live = false;
+                bool ends_with_jump = false;
+
+                for (std::size_t pc = start; pc < end; pc++)
+                {
+                    const Packed::Op &op = program_[pc];
+                    Opcode::Type type = opcode(pc);
+                    bool sets_sub_flags = false;
+
+                    switch (type)
+                    {
+                    case Opcode::AND:
+                        alu_rr(0x21, op);
+                        break;
+                    case Opcode::ADD:
+                        alu_rr(0x01, op);
+                        break;
+                    case Opcode::ORR:
+                        alu_rr(0x09, op);
+                        break;
+                    case Opcode::EOR:
+                        alu_rr(0x31, op);
+                        break;
+                    case Opcode::SUB:
+                        alu_rr(0x29, op);
+                        break;
+                    case Opcode::MUL:
+                        a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                        a_.op_reg(true, {0x0F, 0xAF}, RAX, use(op.rm)); // imul rax, rm
+                        set(op.rd, RAX);
+                        break;
+                    case Opcode::SMULH:
+                    case Opcode::UMULH:
+                        a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                        a_.op_reg(true, {0xF7}, type == Opcode::SMULH ? 5 : 4, use(op.rm));
+                        set(op.rd, RDX);
+                        break;
+                    case Opcode::ADDS:
+                        alu_rr(0x01, op);
+                        add_flags();
+                        break;
+                    case Opcode::SUBS:
+                        alu_rr(0x29, op);
+                        sub_flags();
+                        sets_sub_flags = true;
+                        break;
+                    case Opcode::ANDS:
+                        alu_rr(0x21, op);
+                        logic_flags();
+                        break;
+                    case Opcode::LSL:
+                    case Opcode::LSR:
+                        a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                        if (op.imm != 0)
+                            a_.shift_imm(type == Opcode::LSL ? 4 : 5, RAX, static_cast<std::uint8_t>(op.imm));
+                        set(op.rd, RAX);
+                        break;
+                    case Opcode::ADDI:
+                        alu_ri(0, op);
+                        break;
+                    case Opcode::SUBI:
+                        alu_ri(5, op);
+                        break;
+                    case Opcode::ANDI:
+                        alu_ri(4, op);
+                        break;
+                    case Opcode::ORRI:
+                        alu_ri(1, op);
+                        break;
+                    case Opcode::EORI:
+                        alu_ri(6, op);
+                        break;
+                    case Opcode::ADDIS:
+                        alu_ri(0, op);
+                        add_flags();
+                        break;
+                    case Opcode::SUBIS:
+                        alu_ri(5, op);
+                        sub_flags();
+                        sets_sub_flags = true;
+                        break;
+                    case Opcode::ANDIS:
+                        alu_ri(4, op);
+                        logic_flags();
+                        break;
+                    case Opcode::MOVZ:
+                        a_.mov_imm64(RAX, static_cast<std::uint64_t>(op.imm) << op.rm);
+                        set(op.rd, RAX);
+                        break;
+                    case Opcode::MOVK:
+                        a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                        a_.mov_imm64(RCX, ~(std::uint64_t{0xFFFF} << op.rm));
+                        a_.op_reg(true, {0x21}, RCX, RAX);
+                        if (op.imm != 0)
+                        {
+                            a_.mov_imm64(RCX, static_cast<std::uint64_t>(op.imm) << op.rm);
+                            a_.op_reg(true, {0x09}, RCX, RAX);
+                        }
+                        set(op.rd, RAX);
+                        break;
+
+                    case Opcode::LDUR:
+                    case Opcode::LDURB:
+                    case Opcode::LDURH:
+                    case Opcode::LDURSW:
+                    case Opcode::STUR:
+                    case Opcode::STURB:
+                    case Opcode::STURH:
+                    case Opcode::STURW:
+                        emit_memory(type, op, pc, end);
+                        break;
+
+                    case Opcode::B:
+                        flush(cache_, false);
+                        a_.jmp(target(pc + op.imm));
+                        ends_with_jump = true;
+                        break;
+                    case Opcode::BL:
+                        flush(cache_, false);
+                        a_.store_imm32(STATE, reg_disp(Register::X30), static_cast<std::int32_t>(pc + 1));
+                        a_.jmp(target(pc + op.imm));
+                        ends_with_jump = true;
+                        break;
+                    case Opcode::BR:
+                        emit_indirect(op, pc);
+                        ends_with_jump = true;
+                        break;
+                    case Opcode::CBZ:
+                    case Opcode::CBNZ:
+                    {
+                        Reg value = use(op.rn);
+                        a_.op_reg(true, {0x85}, value, value); // test
+                        flush(cache_, false);
+                        a_.jcc(type == Opcode::CBZ ? CC_E : CC_NE, target(pc + op.imm));
+                        break;
+                    }
+                    default: // B.cond
+                        flush(cache_, false);
+                        if (sub_flags_live)
+                            a_.jcc(sub_condition(type), target(pc + op.imm));
+                        else
+                            emit_condition(type, target(pc + op.imm));
+                        break;
+                    }
+                    sub_flags_live = sets_sub_flags;
+                }
+
+                if (!ends_with_jump)
+                {
+                    // Conditional branches have already flushed; a plain fallthrough has not
+                    if (!is_branch(opcode(end - 1)))
+                        flush(cache_, false);
+                    Assembler::Label next = target(end);
+                    if (!(translated(end) && next == block_[end]))
+                        a_.jmp(next);
+                    // otherwise the next block is emitted immediately after this one
+                }
+            }
+
+            // Jumps to the block entry Context::blocks holds for x[rn], as any jump from outside a
+            // loop would. A target outside the program leaves the BR for the interpreter to fault
+            // on; one with no block there hands back with pc at it.
+            void emit_indirect(const Packed::Op &op, std::size_t pc)
+            {
+                a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                flush(cache_);
+                Assembler::Label outside = a_.label();
+                stubs_.push_back({outside, pc, 1, cache_});
+                a_.op_reg(true, {0x81}, 7, RAX); // cmp rax, size
+                a_.imm32(static_cast<std::int32_t>(program_.size()));
+                a_.jcc(CC_AE, outside);
+                a_.op_reg(true, {0x89}, RAX, RCX);
+                a_.shift_imm(4, RCX, 3);                                            // shl rcx, 3
+                a_.op_mem(true, {0x03}, RCX, CONTEXT, offsetof(Context, blocks)); // add rcx, blocks
+                a_.load(RCX, RCX, 0);
+                a_.op_reg(true, {0x85}, RCX, RCX); // test rcx, rcx
+                a_.jcc(CC_E, indirect_exit_);
+                a_.op_reg(false, {0xFF}, 4, RCX); // jmp rcx
+            }
+
+            // rax = x[rn] <op> x[rm]; x[rd] = rax
+            void alu_rr(std::uint8_t opcode, const Packed::Op &op)
+            {
+                a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                a_.op_reg(true, {opcode}, use(op.rm), RAX);
+                set(op.rd, RAX);
+            }
+
+            void alu_ri(int ext, const Packed::Op &op)
+            {
+                a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                a_.alu_imm(ext, RAX, op.imm);
+                set(op.rd, RAX);
+            }
+
+            // ARM carry is the inverse of the x86 borrow after a subtraction
+            void sub_flags()
+            {
+                a_.setcc(CC_S, STATE, FLAG_N);
+                a_.setcc(CC_E, STATE, FLAG_Z);
+                a_.setcc(CC_AE, STATE, FLAG_C);
+                a_.setcc(CC_O, STATE, FLAG_V);
+            }
+
+            void add_flags()
+            {
+                a_.setcc(CC_S, STATE, FLAG_N);
+                a_.setcc(CC_E, STATE, FLAG_Z);
+                a_.setcc(CC_B, STATE, FLAG_C);
+                a_.setcc(CC_O, STATE, FLAG_V);
+            }
+
+            void logic_flags()
+            {
+                a_.setcc(CC_S, STATE, FLAG_N);
+                a_.setcc(CC_E, STATE, FLAG_Z);
+                a_.store_byte_imm(STATE, FLAG_C, 0);
+                a_.store_byte_imm(STATE, FLAG_V, 0);
+            }
+
+            // Branches to `taken` if the condition holds for the flags stored in Cpu::State
+            void emit_condition(Opcode::Type type, Assembler::Label taken)
+            {
+                auto load_flag = [this](std::int32_t flag)
+                { a_.op_mem(false, {0x8A}, RAX, STATE, flag); }; // mov al, [flag]
+                auto test_flag = [this](std::int32_t flag)
+                {
+                    a_.op_mem(false, {0x80}, 7, STATE, flag); // cmp byte [flag], 0
+                    a_.byte(0);
+                };
+
+                switch (type)
+                {
+                case Opcode::B_EQ:
+                case Opcode::B_NE:
+                    test_flag(FLAG_Z);
+                    a_.jcc(type == Opcode::B_EQ ? CC_NE : CC_E, taken);
+                    break;
+                case Opcode::B_HS:
+                case Opcode::B_LO:
+                    test_flag(FLAG_C);
+                    a_.jcc(type == Opcode::B_HS ? CC_NE : CC_E, taken);
+                    break;
+                case Opcode::B_MI:
+                    test_flag(FLAG_N);
+                    a_.jcc(CC_NE, taken);
+                    break;
+                case Opcode::B_VS:
+                    test_flag(FLAG_V);
+                    a_.jcc(CC_NE, taken);
+                    break;
+                case Opcode::B_LT:
+                case Opcode::B_GE:
+                    load_flag(FLAG_N);
+                    a_.op_mem(false, {0x3A}, RAX, STATE, FLAG_V); // cmp al, [v]
+                    a_.jcc(type == Opcode::B_LT ? CC_NE : CC_E, taken);
+                    break;
+                case Opcode::B_HI:
+                case Opcode::B_LS:
+                    load_flag(FLAG_C);
+                    a_.op_mem(false, {0x3A}, RAX, STATE, FLAG_Z); // c > z  <=>  c && !z
+                    a_.jcc(type == Opcode::B_HI ? CC_A : CC_BE, taken);
+                    break;
+                default: // B_GT, B_LE: (n ^ v) | z == 0  <=>  GT
+                    load_flag(FLAG_N);
+                    a_.op_mem(false, {0x32}, RAX, STATE, FLAG_V); // xor al, [v]
+                    a_.op_mem(false, {0x0A}, RAX, STATE, FLAG_Z); // or al, [z]
+                    a_.jcc(type == Opcode::B_GT ? CC_E : CC_NE, taken);
+                    break;
+                }
+            }
+
+            struct SlowPath
+            {
+                Assembler::Label label, resume, fault;
+                Opcode::Type type;
+                unsigned size;
+                Reg value; // host register holding the value to store
+                bool store;
+            };
+
+            void emit_memory(Opcode::Type type, const Packed::Op &op, std::size_t pc, std::size_t end)
+            {
+                unsigned size;
+                switch (type)
+                {
+                case Opcode::LDURB:
+                case Opcode::STURB:
+                    size = 1;
+                    break;
+                case Opcode::LDURH:
+                case Opcode::STURH:
+                    size = 2;
+                    break;
+                case Opcode::LDURSW:
+                case Opcode::STURW:
+                    size = 4;
+                    break;
+                default:
+                    size = 8;
+                    break;
+                }
+                bool store = Packed::is_store(type);
+
+                a_.op_reg(true, {0x89}, use(op.rn), RAX);
+                if (op.imm != 0)
+                    a_.alu_imm(0, RAX, op.imm);
+                Reg value = store ? use(op.rm) : RAX;
+
+                // A faulting access exits before retiring, refunding the rest of the block
+                Assembler::Label fault = a_.label();
+                stubs_.push_back({fault, pc, static_cast<std::int32_t>(end - pc), cache_});
+
+                // Inline TLB lookup: the entry's tag matches only for an aligned access to a cached page
+                Assembler::Label slow = a_.label(), resume = a_.label();
+                slow_paths_.push_back({slow, resume, fault, type, size, value, store});
+                a_.op_reg(true, {0x89}, RAX, RCX);
+                a_.shift_imm(5, RCX, Memory::PAGE_BITS - 4);                                         // shr rcx
+                a_.alu_imm(4, RCX, static_cast<std::int32_t>((Memory::TLB_ENTRIES - 1) * sizeof(Memory::TlbEntry))); // and rcx
+                if (store)
+                    a_.op_mem(true, {0x03}, RCX, CONTEXT, offsetof(Context, write_tlb)); // add rcx, write_tlb
+                else
+                    a_.op_reg(true, {0x01}, READ_TLB, RCX); // add rcx, r13
+                a_.op_reg(true, {0x89}, RAX, RDX);
+                a_.alu_imm(4, RDX, static_cast<std::int32_t>(~Memory::PAGE_MASK | (size - 1))); // and rdx, tag mask
+                a_.op_mem(true, {0x3B}, RDX, RCX, 0);                                             // cmp rdx, tag
+                a_.jcc(CC_NE, slow);
+                a_.alu_imm(4, RAX, static_cast<std::int32_t>(Memory::PAGE_MASK));
+                a_.op_mem(true, {0x03}, RAX, RCX, offsetof(Memory::TlbEntry, page)); // add rax, page
+
+                switch (type)
+                {
+                case Opcode::LDUR:
+                    a_.load(RAX, RAX, 0);
+                    break;
+                case Opcode::LDURB:
+                    a_.op_mem(false, {0x0F, 0xB6}, RAX, RAX, 0);
+                    break;
+                case Opcode::LDURH:
+                    a_.op_mem(false, {0x0F, 0xB7}, RAX, RAX, 0);
+                    break;
+                case Opcode::LDURSW:
+                    a_.op_mem(true, {0x63}, RAX, RAX, 0);
+                    break;
+                default:
+                    if (type == Opcode::STURB)
+                        a_.op_mem_byte(0x88, value, RAX, 0);
+                    else if (type == Opcode::STURH)
+                    {
+                        a_.byte(0x66);
+                        a_.op_mem(false, {0x89}, value, RAX, 0);
+                    }
+                    else
+                        a_.op_mem(type == Opcode::STUR, {0x89}, value, RAX, 0);
+                    a_.bind(resume);
+                    return;
+                }
+                a_.bind(resume);
+                set(op.rd, RAX);
+            }
+
+            // Calls into Memory::Space on a TLB miss; the address is in rax and a load's result is
+            // returned there. Cached guest registers in caller-saved host registers are preserved.
+            void emit_slow_path(const SlowPath &path)
+            {
+                const Reg volatile_regs[] = {RSI, RDI, R8, R9, R10, R11}; // six pushes keep rsp 16-byte aligned
+
+                a_.bind(path.label);
+                for (Reg r : volatile_regs)
+                    a_.push(r);
+                if (path.store)
+                    a_.op_reg(true, {0x89}, path.value, RCX); // before rsi/rdi are overwritten
+                else
+                    a_.op_mem(true, {0x8D}, RCX, CONTEXT, offsetof(Context, scratch)); // lea rcx, scratch
+                a_.op_reg(true, {0x89}, RAX, RSI);
+                a_.mov_imm64(RDX, path.size);
+                a_.load(RDI, CONTEXT, offsetof(Context, memory));
+                a_.op_mem(false, {0xFF}, 2, CONTEXT, path.store ? offsetof(Context, store) : offsetof(Context, load)); // call
+                for (int i = 5; i >= 0; i--)
+                    a_.pop(volatile_regs[i]);
+                a_.op_reg(false, {0x84}, RAX, RAX); // test al, al
+                a_.jcc(CC_E, path.fault);
+                if (!path.store)
+                {
+                    a_.load(RAX, CONTEXT, offsetof(Context, scratch));
+                    if (path.type == Opcode::LDURSW)
+                        a_.op_reg(true, {0x63}, RAX, RAX); // movsxd rax, eax
+                }
+                a_.jmp(path.resume);
+            }
+
+            const std::vector<Packed::Op> &program_;
+            Assembler a_;
+            std::vector<bool> leader_;
+            std::vector<Assembler::Label> block_;
+            std::vector<Assembler::Label> entry_; // block_, or for a block in a loop, code loading its pinned registers first
+            std::map<std::size_t, Assembler::Label> exits_;
+            std::vector<Loop> loops_;
+            std::vector<int> loop_at_; // by pc, index into loops_, or -1
+            int loop_ = -1;            // loop of the block being emitted
+            std::map<std::pair<int, std::size_t>, Assembler::Label> leaves_; // stubs leaving a loop for a pc
+
+            // Out-of-line exits that store pc and refund unexecuted instructions to the budget
+            struct Stub
+            {
+                Assembler::Label label;
+                std::size_t pc;
+                std::int32_t refund;
+                Cache cache; // registers to write back
+            };
+            std::vector<Stub> stubs_;
+
+            std::vector<SlowPath> slow_paths_;
+            Cache cache_;
+            Assembler::Label exit_ = 0;
+            Assembler::Label indirect_exit_ = 0; // hands back at the pc in rax
+        };
+    } // namespace
+
+#if LEGV8_JIT
+    bool available() { return true; }
+
+    Engine::Engine(const std::vector<Packed::Op> &program)
+    {
+        Translator translator(program);
+        entry_ = translator.translate(blocks_);
+        const std::vector<std::uint8_t> &code = translator.code();
+
+        code_size_ = code.size();
+        mapped_size_ = (code_size_ + 4095) & ~std::size_t{4095};
+        void *mapping = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("JIT Error: failed to map code buffer");
+        std::memcpy(mapping, code.data(), code_size_);
+        if (mprotect(mapping, mapped_size_, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(mapping, mapped_size_);
+            throw std::runtime_error("JIT Error: failed to make code buffer executable");
+        }
+        code_ = static_cast<std::uint8_t *>(mapping);
+
+        blocks_by_pc_.assign(entry_.size(), nullptr);
+        for (std::size_t pc = 0; pc < entry_.size(); pc++)
+            if (entry_[pc] >= 0)
+                blocks_by_pc_[pc] = code_ + entry_[pc];
+    }
+
+    Engine::~Engine()
+    {
+        if (code_)
+            munmap(code_, mapped_size_);
+    }
+
+    bool Engine::enter(Cpu::State &state, Memory::Space &memory, std::uint64_t &remaining) const
+    {
+        if (state.pc >= entry_.size() || entry_[state.pc] < 0)
+            return false;
+
+        Context context{&state,      memory.read_tlb(), memory.write_tlb(), remaining,
+                        &memory,     0,                 load_helper,        store_helper,
+                        blocks_by_pc_.data()};
+        reinterpret_cast<Trampoline>(code_)(&context, code_ + entry_[state.pc]);
+        remaining = context.remaining;
+        return true;
+    }
+#else
+    bool available() { return false; }
+
+    Engine::Engine(const std::vector<Packed::Op> &program)
+    {
+        throw std::runtime_error("JIT Error: native code generation is not supported on this host");
+    }
+
+    Engine::~Engine() {}
+
+    bool Engine::enter(Cpu::State &, Memory::Space &, std::uint64_t &) const { return false; }
+#endif
+} // namespace Jit
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "memory.hpp"
+#include "packed.hpp"
+
+namespace Cpu
+{
+    struct State;
+}
+
+namespace Jit
+{
+    // True when native code generation is supported on this host (x86-64 with mmap)
+    bool available();
+
+    // Translates the basic blocks of a packed program into x86-64 code. Guest registers and
+    // flags stay in Cpu::State, whose address is pinned in a host register while native code runs.
+    //
+    // Native code hands control back (with state.pc at the instruction to interpret next) on
+    // instructions it does not translate (division, FP, LDXR/STXR), on a BR to an instruction
+    // that starts no translated block, on memory accesses outside guest memory, and when the
+    // next block would overrun the instruction budget.
+    class Engine
+    {
+    public:
+        explicit Engine(const std::vector<Packed::Op> &program);
+        ~Engine();
+
+        Engine(const Engine &) = delete;
+        Engine &operator=(const Engine &) = delete;
+
+        // Runs native code from state.pc, decrementing `remaining` by the number of retired
+        // instructions. Returns false without doing anything if no block starts at state.pc.
+        bool enter(Cpu::State &state, Memory::Space &memory, std::uint64_t &remaining) const;
+
+        std::size_t blocks() const { return blocks_; }
+        std::size_t code_size() const { return code_size_; }
+
+    private:
+        std::vector<std::int32_t> entry_;        // code offset of the block starting at each pc, or -1
+        std::vector<const void *> blocks_by_pc_; // the same as addresses, or null, for BR
+        std::uint8_t *code_ = nullptr;
+        std::size_t code_size_ = 0;
+        std::size_t mapped_size_ = 0;
+        std::size_t blocks_ = 0;
+    };
+} // namespace Jit
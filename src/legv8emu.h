@@ -0,0 +1,85 @@
+#ifndef LEGV8EMU_H
+#define LEGV8EMU_H
+
+/* C interface to liblegv8emu; see embed.hpp for the C++ one it wraps.
+ *
+ * Compile a program once with legv8_compile, then create any number of machines from it,
+ * on any threads. A machine is used by one thread at a time. Functions that can fail return
+ * NULL or -1, and legv8_last_error then describes the failure on the calling thread. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct legv8_program legv8_program;
+    typedef struct legv8_machine legv8_machine;
+
+    typedef enum
+    {
+        LEGV8_HALTED,           /* HALT, or pc ran off the end of the program */
+        LEGV8_BUDGET_EXHAUSTED, /* max_steps instructions retired */
+        LEGV8_FAULT             /* see legv8_fault */
+    } legv8_status;
+
+    typedef struct
+    {
+        int optimize; /* propagate constants and remove dead writes */
+        int fuse;     /* fuse common instruction pairs */
+        int jit;      /* translate to native code where supported */
+    } legv8_options;
+
+    /* Registers, as numbered in assembly: 0-30 are X0-X30 (28 is SP, 30 is LR), 31 is XZR */
+    enum
+    {
+        LEGV8_SP = 28,
+        LEGV8_LR = 30,
+        LEGV8_XZR = 31
+    };
+
+    const char *legv8_version(void);
+    const char *legv8_last_error(void);
+
+    /* Assembles `length` bytes of source, or loads a binary program image. `options` may be
+     * NULL. Returns NULL if the program is not valid. */
+    legv8_program *legv8_compile(const char *text, size_t length, const legv8_options *options);
+    legv8_program *legv8_load(const char *path, const legv8_options *options);
+    void legv8_program_free(legv8_program *program);
+
+    size_t legv8_program_size(const legv8_program *program);
+
+    /* Instruction index of a label, or -1 if there is none */
+    int64_t legv8_program_label(const legv8_program *program, const char *name);
+
+    /* A machine holds its own reference to the program, which may be freed first.
+     * `memory_limit` caps committed guest memory in bytes, 0 for the default of 1 GiB. */
+    legv8_machine *legv8_machine_new(const legv8_program *program, uint64_t memory_limit);
+    void legv8_machine_free(legv8_machine *machine);
+    void legv8_machine_reset(legv8_machine *machine);
+
+    legv8_status legv8_run(legv8_machine *machine, uint64_t max_steps);
+
+    uint64_t legv8_get_reg(const legv8_machine *machine, unsigned reg);
+    void legv8_set_reg(legv8_machine *machine, unsigned reg, uint64_t value);
+    size_t legv8_get_pc(const legv8_machine *machine);
+
+    /* Returns 0, or -1 if `pc` is past the end of the program */
+    int legv8_set_pc(legv8_machine *machine, size_t pc);
+
+    /* Return 0, or -1 if a write would exceed the memory limit */
+    int legv8_read(legv8_machine *machine, uint64_t addr, void *out, size_t size);
+    int legv8_write(legv8_machine *machine, uint64_t addr, const void *data, size_t size);
+
+    uint64_t legv8_retired(const legv8_machine *machine);
+
+    /* Why the last run faulted; valid until the machine next runs */
+    const char *legv8_fault(const legv8_machine *machine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEGV8EMU_H */
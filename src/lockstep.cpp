@@ -0,0 +1,516 @@
+#include "lockstep.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace Lockstep
+{
+    namespace
+    {
+        // One register of LANES machines. GCC lowers the arithmetic to whatever vector width
+        // the target has. Values travel only through memory and macros, never as function
+        // arguments, so the ABI of wide vectors does not matter.
+        typedef std::uint64_t Vec __attribute__((vector_size(8 * LANES)));
+
+        constexpr unsigned GROUPS = WIDTH / LANES;
+        static_assert(WIDTH % LANES == 0 && WIDTH <= 32, "lane sets are 32-bit masks");
+
+        inline std::uint64_t sext(int imm) { return static_cast<std::uint64_t>(static_cast<std::int64_t>(imm)); }
+
+        // Each flag is kept in the top bit of a lane, so flags and branch conditions are plain
+        // bitwise operations, with no 64-bit compares or per-lane shifts (SSE2 has neither)
+#define ZERO(r) (~((r) | -(r)))
+#define ADD_CARRY(a, b, r) (((a) & (b)) | (((a) | (b)) & ~(r)))
+#define SUB_CARRY(a, b, r) (~((~(a) & (b)) | ((~(a) | (b)) & (r))))
+#define ADD_OVERFLOW(a, b, r) (~((a) ^ (b)) & ((a) ^ (r)))
+#define SUB_OVERFLOW(a, b, r) (((a) ^ (b)) & ((a) ^ (r)))
+#define BLEND(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+#define LANE(v, l) (v)[(l) / LANES][(l) % LANES]
+#define FOR_EACH_LANE(l, set) \
+    for (std::uint32_t bits_ = (set), l; bits_ && (l = __builtin_ctz(bits_), true); bits_ &= bits_ - 1)
+
+        struct Lane
+        {
+            Cpu::Machine *machine;
+            std::uint64_t remaining;
+            Cpu::Status status;
+        };
+
+        // The live lanes at the lowest pc (the active set) execute; the rest wait. Steps taken
+        // since the active set last changed are counted in `pending_` and only applied to the
+        // per-lane pcs and step counts when the set changes, so a stretch of code that every
+        // active lane agrees on costs one scalar pc update per instruction.
+        class Pass
+        {
+        public:
+            Pass(Cpu::Machine *const *machines, const std::uint64_t *max_steps, unsigned count)
+                : program_(machines[0]->program())
+            {
+                for (unsigned l = 0; l < count; l++)
+                {
+                    lanes_[l] = {machines[l], max_steps[l], Cpu::Status::BUDGET_EXHAUSTED};
+                    memory_[l] = &machines[l]->memory();
+                    if (max_steps[l] > 0)
+                    {
+                        load(l);
+                        live_ |= 1u << l;
+                    }
+                }
+            }
+
+            Cpu::Status status(unsigned l) const { return lanes_[l].status; }
+
+            __attribute__((target_clones("avx2", "default"))) void run()
+            {
+                const Packed::Op *const code = program_.ops();
+                settle();
+                select();
+
+                while (live_)
+                {
+                    if (fuel_ == 0)
+                    {
+                        settle();
+                        select();
+                        continue;
+                    }
+                    if ((live_ & (live_ - 1)) == 0)
+                    {
+                        finish_alone(__builtin_ctz(live_));
+                        break;
+                    }
+                    if (pc_ >= program_.size())
+                    {
+                        fallback();
+                        continue;
+                    }
+
+                    const Packed::Op &op = code[pc_];
+                    Vec taken[GROUPS], any = {}, all = ~Vec{};
+                    std::uint64_t target;
+                    switch (op.opcode)
+                    {
+#define SET(dst, value)                                             \
+    do                                                              \
+    {                                                               \
+        const Vec value_ = (value);                                 \
+        (dst) = uniform_ ? value_ : BLEND(mask_[g], value_, (dst)); \
+    } while (0)
+#define ALU(expr)                         \
+    for (unsigned g = 0; g < GROUPS; g++) \
+    {                                     \
+        const Vec n = x_[op.rn][g];       \
+        const Vec m = x_[op.rm][g];       \
+        (void)n, (void)m;                 \
+        SET(x_[op.rd][g], expr);          \
+    }                                     \
+    goto next
+#define ALU_FLAGS(b, expr, carry, overflow) \
+    for (unsigned g = 0; g < GROUPS; g++)   \
+    {                                       \
+        const Vec a = x_[op.rn][g];         \
+        const Vec b_ = (b);                 \
+        const Vec r = (expr);               \
+        SET(n_[g], r);                      \
+        SET(z_[g], ZERO(r));                \
+        SET(c_[g], carry);                  \
+        SET(v_[g], overflow);               \
+        SET(x_[op.rd][g], r);               \
+    }                                       \
+    goto next
+#define REGISTER_OPERAND x_[op.rm][g]
+#define IMMEDIATE_OPERAND (x_[Register::XZR][g] + sext(op.imm))
+
+                    case Opcode::AND:
+                        ALU(n & m);
+                    case Opcode::ADD:
+                        ALU(n + m);
+                    case Opcode::ORR:
+                        ALU(n | m);
+                    case Opcode::EOR:
+                        ALU(n ^ m);
+                    case Opcode::SUB:
+                        ALU(n - m);
+                    case Opcode::MUL:
+                        ALU(n * m);
+                    case Opcode::LSL:
+                        ALU(n << (op.imm & 63));
+                    case Opcode::LSR:
+                        ALU(n >> (op.imm & 63));
+                    case Opcode::ADDS:
+                        ALU_FLAGS(REGISTER_OPERAND, a + b_, ADD_CARRY(a, b_, r), ADD_OVERFLOW(a, b_, r));
+                    case Opcode::SUBS:
+                        ALU_FLAGS(REGISTER_OPERAND, a - b_, SUB_CARRY(a, b_, r), SUB_OVERFLOW(a, b_, r));
+                    case Opcode::ANDS:
+                        ALU_FLAGS(REGISTER_OPERAND, a & b_, r - r, r - r);
+
+                    case Opcode::ADDI:
+                        ALU(n + sext(op.imm));
+                    case Opcode::SUBI:
+                        ALU(n - sext(op.imm));
+                    case Opcode::ANDI:
+                        ALU(n & sext(op.imm));
+                    case Opcode::ORRI:
+                        ALU(n | sext(op.imm));
+                    case Opcode::EORI:
+                        ALU(n ^ sext(op.imm));
+                    case Opcode::ADDIS:
+                        ALU_FLAGS(IMMEDIATE_OPERAND, a + b_, ADD_CARRY(a, b_, r), ADD_OVERFLOW(a, b_, r));
+                    case Opcode::SUBIS:
+                        ALU_FLAGS(IMMEDIATE_OPERAND, a - b_, SUB_CARRY(a, b_, r), SUB_OVERFLOW(a, b_, r));
+                    case Opcode::ANDIS:
+                        ALU_FLAGS(IMMEDIATE_OPERAND, a & b_, r - r, r - r);
+
+                    case Opcode::MOVZ:
+                        ALU(x_[Register::XZR][g] + (static_cast<std::uint64_t>(op.imm) << op.rm));
+                    case Opcode::MOVK:
+                        ALU((n & ~(std::uint64_t{0xFFFF} << op.rm)) | (static_cast<std::uint64_t>(op.imm) << op.rm));
+#undef ALU
+#undef ALU_FLAGS
+#undef REGISTER_OPERAND
+#undef IMMEDIATE_OPERAND
+
+                    case Opcode::LDUR:
+                    case Opcode::LDURB:
+                    case Opcode::LDURH:
+                    case Opcode::LDURSW:
+                    {
+                        const unsigned size = op.opcode == Opcode::LDUR ? 8 : op.opcode == Opcode::LDURB ? 1 : op.opcode == Opcode::LDURH ? 2 : 4;
+                        std::uint64_t values[WIDTH] = {};
+                        bool ok = true;
+                        FOR_EACH_LANE(l, active_)
+                        {
+                            if (!(ok = memory_[l]->load(LANE(x_[op.rn], l) + sext(op.imm), size, values[l])))
+                                break;
+                            if (op.opcode == Opcode::LDURSW)
+                                values[l] = sext(static_cast<std::int32_t>(values[l]));
+                        }
+                        if (!ok)
+                        {
+                            fallback();
+                            continue;
+                        }
+                        // Assembled in registers: writing single lanes of x_ and then reading
+                        // whole vectors back would stall store-to-load forwarding
+                        for (unsigned g = 0; g < GROUPS; g++)
+                        {
+                            Vec loaded;
+                            for (unsigned i = 0; i < LANES; i++)
+                                loaded[i] = values[g * LANES + i];
+                            SET(x_[op.rd][g], loaded);
+                        }
+                        goto next;
+                    }
+                    case Opcode::STUR:
+                    case Opcode::STURB:
+                    case Opcode::STURH:
+                    case Opcode::STURW:
+                    {
+                        // If a lane cannot store, every lane redoes the instruction on its own
+                        // machine; repeating the stores that did succeed writes the same values
+                        const unsigned size = op.opcode == Opcode::STUR ? 8 : op.opcode == Opcode::STURB ? 1 : op.opcode == Opcode::STURH ? 2 : 4;
+                        bool ok = true;
+                        FOR_EACH_LANE(l, active_)
+                        {
+                            if (!(ok = memory_[l]->store(LANE(x_[op.rn], l) + sext(op.imm), size, LANE(x_[op.rm], l))))
+                                break;
+                        }
+                        if (!ok)
+                        {
+                            fallback();
+                            continue;
+                        }
+                        goto next;
+                    }
+
+                    case Opcode::BL:
+                        for (unsigned g = 0; g < GROUPS; g++)
+                            SET(x_[Register::X30][g], x_[Register::XZR][g] + (pc_ + 1));
+                        [[fallthrough]];
+                    case Opcode::B:
+                        target = pc_ + op.imm;
+                        goto jump;
+
+#define BRANCH_IF(cond)                                              \
+    for (unsigned g = 0; g < GROUPS; g++)                            \
+    {                                                                \
+        const Vec N = n_[g], Z = z_[g], C = c_[g], V = v_[g];        \
+        const Vec X = x_[op.rn][g];                                  \
+        (void)N, (void)Z, (void)C, (void)V, (void)X;                 \
+        taken[g] = -((cond) >> 63);                                  \
+        any |= taken[g] & mask_[g];                                  \
+        all &= taken[g] | ~mask_[g];                                 \
+    }                                                                \
+    goto branch
+                    case Opcode::CBZ:
+                        BRANCH_IF(ZERO(X));
+                    case Opcode::CBNZ:
+                        BRANCH_IF(~ZERO(X));
+                    case Opcode::B_EQ:
+                        BRANCH_IF(Z);
+                    case Opcode::B_NE:
+                        BRANCH_IF(~Z);
+                    case Opcode::B_LT:
+                        BRANCH_IF(N ^ V);
+                    case Opcode::B_LE:
+                        BRANCH_IF(Z | (N ^ V));
+                    case Opcode::B_GT:
+                        BRANCH_IF(~Z & ~(N ^ V));
+                    case Opcode::B_GE:
+                        BRANCH_IF(~(N ^ V));
+                    case Opcode::B_LO:
+                        BRANCH_IF(~C);
+                    case Opcode::B_LS:
+                        BRANCH_IF(~C | Z);
+                    case Opcode::B_HI:
+                        BRANCH_IF(C & ~Z);
+                    case Opcode::B_HS:
+                        BRANCH_IF(C);
+                    case Opcode::B_MI:
+                        BRANCH_IF(N);
+                    case Opcode::B_VS:
+                        BRANCH_IF(V);
+#undef BRANCH_IF
+
+                    case Opcode::BR:
+                    {
+                        bool ok = true, same = true;
+                        target = LANE(x_[op.rn], __builtin_ctz(active_));
+                        FOR_EACH_LANE(l, active_)
+                        {
+                            ok &= LANE(x_[op.rn], l) <= program_.size();
+                            same &= LANE(x_[op.rn], l) == target;
+                        }
+                        if (!ok)
+                        {
+                            fallback();
+                            continue;
+                        }
+                        if (same)
+                            goto jump;
+
+                        materialize();
+                        for (unsigned g = 0; g < GROUPS; g++)
+                        {
+                            pcs_[g] = BLEND(mask_[g], x_[op.rn][g], pcs_[g]);
+                            executed_[g] -= mask_[g];
+                        }
+                        fuel_--;
+                        select();
+                        continue;
+                    }
+
+                    default: // no vector kernel
+                        fallback();
+                        continue;
+#undef SET
+                    }
+
+                next:
+                    fuel_--;
+                    pending_++;
+                    if (++pc_ >= waiting_pc_)
+                        select();
+                    continue;
+
+                branch:
+                {
+                    bool some = false, every = true;
+                    for (unsigned i = 0; i < LANES; i++)
+                    {
+                        some |= any[i] != 0;
+                        every &= all[i] != 0;
+                    }
+                    if (every || !some)
+                    {
+                        target = every ? pc_ + op.imm : pc_ + 1;
+                        goto jump;
+                    }
+
+                    // The active lanes disagree: from here on they have their own pcs
+                    materialize();
+                    for (unsigned g = 0; g < GROUPS; g++)
+                    {
+                        pcs_[g] = BLEND(mask_[g], pcs_[g] + 1 + (taken[g] & (sext(op.imm) - 1)), pcs_[g]);
+                        executed_[g] -= mask_[g];
+                    }
+                    fuel_--;
+                    select();
+                    continue;
+                }
+
+                jump: // every active lane goes to `target`
+                    fuel_--;
+                    pending_++;
+                    pc_ = target;
+                    if (pc_ >= waiting_pc_)
+                        select();
+                }
+            }
+
+        private:
+            void load(unsigned l)
+            {
+                const Cpu::State &state = lanes_[l].machine->state;
+                for (int r = 0; r <= Register::NONE; r++)
+                    LANE(x_[r], l) = state.x[r];
+                LANE(n_, l) = std::uint64_t{state.flags.n} << 63;
+                LANE(z_, l) = std::uint64_t{state.flags.z} << 63;
+                LANE(c_, l) = std::uint64_t{state.flags.c} << 63;
+                LANE(v_, l) = std::uint64_t{state.flags.v} << 63;
+                LANE(pcs_, l) = state.pc;
+                LANE(executed_, l) = 0;
+            }
+
+            void store(unsigned l)
+            {
+                Cpu::State &state = lanes_[l].machine->state;
+                for (int r = 0; r <= Register::NONE; r++)
+                    state.x[r] = LANE(x_[r], l);
+                state.flags = {LANE(n_, l) >> 63 != 0, LANE(z_, l) >> 63 != 0, LANE(c_, l) >> 63 != 0, LANE(v_, l) >> 63 != 0};
+                state.pc = LANE(pcs_, l);
+            }
+
+            void retire(unsigned l, Cpu::Status status)
+            {
+                lanes_[l].status = status;
+                live_ &= ~(1u << l);
+            }
+
+            // Applies the pending steps to the pcs and step counts of the active lanes
+            void materialize()
+            {
+                if (!pending_)
+                    return;
+                for (unsigned g = 0; g < GROUPS; g++)
+                {
+                    pcs_[g] = BLEND(mask_[g], x_[Register::XZR][g] + pc_, pcs_[g]);
+                    executed_[g] += (x_[Register::XZR][g] + pending_) & mask_[g];
+                }
+                pending_ = 0;
+            }
+
+            // Charges executed instructions to each lane's budget and retires lanes that have
+            // none left. No lane can run out before `fuel_` more steps.
+            void settle()
+            {
+                materialize();
+                fuel_ = UINT64_MAX;
+                FOR_EACH_LANE(l, live_)
+                {
+                    Lane &lane = lanes_[l];
+                    const std::uint64_t executed = LANE(executed_, l);
+                    LANE(executed_, l) = 0;
+                    lane.machine->retired += executed;
+                    lane.remaining -= executed;
+                    if (lane.remaining == 0)
+                    {
+                        store(l);
+                        retire(l, Cpu::Status::BUDGET_EXHAUSTED);
+                    }
+                    else
+                        fuel_ = std::min(fuel_, lane.remaining);
+                }
+            }
+
+            // Makes the live lanes at the lowest pc the active set
+            void select()
+            {
+                materialize();
+                std::uint64_t pc = UINT64_MAX;
+                FOR_EACH_LANE(l, live_)
+                {
+                    pc = std::min(pc, LANE(pcs_, l));
+                }
+                active_ = 0;
+                waiting_pc_ = UINT64_MAX;
+                FOR_EACH_LANE(l, live_)
+                {
+                    if (LANE(pcs_, l) == pc)
+                        active_ |= 1u << l;
+                    else
+                        waiting_pc_ = std::min(waiting_pc_, LANE(pcs_, l));
+                }
+                pc_ = pc;
+                uniform_ = active_ == live_;
+                for (unsigned l = 0; l < WIDTH; l++)
+                    LANE(mask_, l) = (active_ >> l & 1) ? ~std::uint64_t{0} : 0;
+            }
+
+            // Executes the current instruction for each active lane on its own machine
+            void fallback()
+            {
+                settle();
+                FOR_EACH_LANE(l, active_ & live_)
+                {
+                    Lane &lane = lanes_[l];
+                    store(l);
+                    const std::uint64_t before = lane.machine->retired;
+                    const Cpu::Status status = lane.machine->run(1);
+                    lane.remaining -= lane.machine->retired - before;
+                    if (status != Cpu::Status::BUDGET_EXHAUSTED || lane.remaining == 0)
+                        retire(l, status);
+                    else
+                        load(l);
+                }
+                settle();
+                select();
+            }
+
+            void finish_alone(unsigned l)
+            {
+                settle();
+                if (!(live_ & (1u << l)))
+                    return;
+                Lane &lane = lanes_[l];
+                store(l);
+                retire(l, lane.machine->run(lane.remaining));
+            }
+
+            const Cpu::Program &program_;
+            Lane lanes_[WIDTH] = {};
+            Memory::Space *memory_[WIDTH] = {};
+
+            Vec x_[Register::NONE + 1][GROUPS] = {}; // X0-X30, XZR, Packed::DISCARD
+            Vec n_[GROUPS] = {}, z_[GROUPS] = {}, c_[GROUPS] = {}, v_[GROUPS] = {};
+            Vec pcs_[GROUPS] = {};
+            Vec executed_[GROUPS] = {}; // instructions not yet charged to the lane's budget
+            Vec mask_[GROUPS] = {};     // all-ones for active lanes
+
+            std::uint32_t live_ = 0;   // lanes still running
+            std::uint32_t active_ = 0; // live lanes at pc_
+            bool uniform_ = true;      // every live lane is active
+            std::uint64_t pc_ = 0;
+            std::uint64_t waiting_pc_ = UINT64_MAX; // lowest pc of a live lane that is not active
+            std::uint64_t pending_ = 0;
+            std::uint64_t fuel_ = 0;
+        };
+#undef ZERO
+#undef ADD_CARRY
+#undef SUB_CARRY
+#undef ADD_OVERFLOW
+#undef SUB_OVERFLOW
+#undef BLEND
+#undef LANE
+#undef FOR_EACH_LANE
+    } // namespace
+
+    std::vector<Cpu::Status> run(const std::vector<Cpu::Machine *> &machines, const std::vector<std::uint64_t> &max_steps)
+    {
+        for (const Cpu::Machine *machine : machines)
+            if (&machine->program() != &machines.front()->program())
+                throw std::runtime_error("Error: lockstep machines must share one program");
+
+        std::vector<Cpu::Status> statuses;
+        for (std::size_t first = 0; first < machines.size(); first += WIDTH)
+        {
+            const unsigned count = static_cast<unsigned>(std::min<std::size_t>(WIDTH, machines.size() - first));
+            auto pass = std::make_unique<Pass>(&machines[first], &max_steps[first], count);
+            pass->run();
+            for (unsigned l = 0; l < count; l++)
+                statuses.push_back(pass->status(l));
+        }
+        return statuses;
+    }
+} // namespace Lockstep
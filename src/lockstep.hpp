@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "cpu.hpp"
+
+// Runs many machines that share one program on a single thread, WIDTH at a time.
+//
+// The register files of a pass are held as vectors, LANES machines per vector, so each
+// instruction is decoded once and its ALU work done for every machine with vector
+// arithmetic. Loads and stores go through each machine's own memory. When a branch sends
+// machines to different targets they split: the machines at the lowest pc run, the rest
+// wait, and they run together again as soon as their pcs meet (after an if/else, say).
+// Instructions without a vector kernel, faults and halts are handled by stepping each
+// machine on its own, and a machine left running alone finishes on Machine::run.
+namespace Lockstep
+{
+#ifdef __AVX512F__
+    constexpr unsigned LANES = 8;
+#else
+    constexpr unsigned LANES = 4; // AVX2 width; two SSE2 operations per vector otherwise
+#endif
+    constexpr unsigned WIDTH = 16; // machines per pass
+
+    // All machines must share one Cpu::Program. Each stops after its own `max_steps[i]`
+    // more instructions; statuses are as Machine::run would have returned them.
+    std::vector<Cpu::Status> run(const std::vector<Cpu::Machine *> &machines, const std::vector<std::uint64_t> &max_steps);
+} // namespace Lockstep
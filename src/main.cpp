@@ -1,45 +1,599 @@
 #include "parser.hpp"
 #include "decoder.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "encoding.hpp"
+#include "cache.hpp"
+#include "batch.hpp"
+#include "replay.hpp"
+#include "pipeline.hpp"
+#include "cachesim.hpp"
+#include "branchsim.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+#include "dataflow.hpp"
+#include "harts.hpp"
+#include "diagnostics.hpp"
+#include "devices.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <fstream>
+#include <sstream>
 #include <string>
 
+namespace
+{
+    struct Options
+    {
+        std::string filepath = "tests/heapsort.legv8asm";
+        std::vector<std::string> files; // every file named, for --check
+        std::string assemble;  // output path for a binary image
+        std::string cache_dir; // assembled-program cache, disabled when empty
+        std::string batch;     // job manifest; runs every job in it instead of `filepath`
+        unsigned threads = 0;  // batch workers, 0 for one per core
+        bool lockstep = false;
+        bool debug = false;
+        bool pipeline = false;
+        Pipeline::Config timing;
+        bool caches = false;
+        std::array<CacheSim::Config, CacheSim::LEVELS> cache_configs = {
+            CacheSim::Config(), CacheSim::parse_config("32K,8,64"), CacheSim::parse_config("256K,8,64")};
+        std::vector<BranchSim::Predictor> predictors;
+        unsigned return_stack = 16;
+        std::string profile; // annotated listing output path
+        std::string folded;  // folded call stacks output path
+        std::string trace;   // binary execution trace output path
+        bool dump = false;
+        bool check = false;
+        bool check_json = false;
+        bool jit = false;
+        bool fuse = false;
+        bool optimize = false;
+        unsigned harts = 0;        // 0 for a single machine
+        std::uint64_t quantum = 0; // harts' turns on one thread, 0 for a thread each
+        std::uint64_t max_steps = UINT64_MAX;
+        Memory::Config memory;
+        std::string disk; // block device image
+    };
+
+    void usage(const char *argv0)
+    {
+        std::cerr << "Usage: " << argv0 << " [options] [file]\n"
+                  << "  --dump            print tokens and decoded instructions instead of running\n"
+                  << "  --assemble OUT    write a binary program image to OUT instead of running\n"
+                  << "  --check           report every error and warning in each file named, without running\n"
+                  << "  --check-json      as --check, as one JSON object per line on stdout\n"
+                  << "  --cache-dir DIR   reuse assembled programs cached in DIR\n"
+                  << "  --batch MANIFEST  run every job listed in MANIFEST across all cores\n"
+                  << "  --threads N       number of batch worker threads (default: one per core)\n"
+                  << "  --lockstep        run batch jobs that share a program as SIMD lanes\n"
+                  << "  --debug           record the run and step it forward or backward from stdin\n"
+                  << "  --pipeline        time the run on a five-stage pipeline and report cycles and stalls\n"
+                  << "  --no-forwarding   pipeline without forwarding paths\n"
+                  << "  --resolve STAGE   pipeline stage deciding branches: ID, EX or MEM (default ID)\n"
+                  << "  --cache           simulate L1D and L2 caches and report misses per label\n"
+                  << "  --l1i SPEC        also simulate an instruction cache; SPEC is SIZE,WAYS,LINE[,lru|plru|random][,wb|wt][,wa|nwa]\n"
+                  << "  --l1d SPEC        data cache (default 32K,8,64), or none\n"
+                  << "  --l2 SPEC         unified second-level cache (default 256K,8,64), or none\n"
+                  << "  --predict LIST    compare branch predictors: static, bimodal[:BITS], gshare[:BITS],\n"
+                  << "                    tournament[:BITS], comma-separated, or all\n"
+                  << "  --return-stack N  return-address stack entries for --predict (default 16)\n"
+                  << "  --profile OUT     write the source annotated with execution counts to OUT\n"
+                  << "  --folded OUT      write call stacks in folded format for flame graphs to OUT\n"
+                  << "  --trace OUT       write a binary trace of every instruction to OUT (read it with legv8trace)\n"
+                  << "  --jit             translate basic blocks to native code\n"
+                  << "  --fuse            fuse common instruction pairs into superinstructions\n"
+                  << "  --optimize        propagate constants and remove dead writes before running\n"
+                  << "  --harts N         run the program on N harts sharing memory, each on its own thread\n"
+                  << "  --quantum N       run the harts in turn on one thread, N instructions at a time\n"
+                  << "  --max-steps N     stop after N retired instructions (per hart)\n"
+                  << "  --memory BYTES    limit on committed guest memory (default 1 GiB)\n"
+                  << "  --hugepages       back guest memory with 2 MiB huge pages if available\n"
+                  << "  --disk IMAGE      attach IMAGE as the guest's block device\n";
+    }
+
+    bool parse_options(int argc, char *argv[], Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char *arg = argv[i];
+            if (std::strcmp(arg, "--dump") == 0)
+                options.dump = true;
+            else if (std::strcmp(arg, "--assemble") == 0 && i + 1 < argc)
+                options.assemble = argv[++i];
+            else if (std::strcmp(arg, "--check") == 0)
+                options.check = true;
+            else if (std::strcmp(arg, "--check-json") == 0)
+                options.check = options.check_json = true;
+            else if (std::strcmp(arg, "--cache-dir") == 0 && i + 1 < argc)
+                options.cache_dir = argv[++i];
+            else if (std::strcmp(arg, "--batch") == 0 && i + 1 < argc)
+                options.batch = argv[++i];
+            else if (std::strcmp(arg, "--threads") == 0 && i + 1 < argc)
+                options.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (std::strcmp(arg, "--lockstep") == 0)
+                options.lockstep = true;
+            else if (std::strcmp(arg, "--debug") == 0)
+                options.debug = true;
+            else if (std::strcmp(arg, "--pipeline") == 0)
+                options.pipeline = true;
+            else if (std::strcmp(arg, "--no-forwarding") == 0)
+                options.timing.forwarding = false;
+            else if (std::strcmp(arg, "--resolve") == 0 && i + 1 < argc)
+            {
+                std::string stage = argv[++i];
+                if (stage == "ID")
+                    options.timing.resolve = Pipeline::Resolve::ID;
+                else if (stage == "EX")
+                    options.timing.resolve = Pipeline::Resolve::EX;
+                else if (stage == "MEM")
+                    options.timing.resolve = Pipeline::Resolve::MEM;
+                else
+                    return false;
+            }
+            else if (std::strcmp(arg, "--cache") == 0)
+                options.caches = true;
+            else if (std::strcmp(arg, "--l1i") == 0 && i + 1 < argc)
+            {
+                options.cache_configs[CacheSim::L1I] = CacheSim::parse_config(argv[++i]);
+                options.caches = true;
+            }
+            else if (std::strcmp(arg, "--l1d") == 0 && i + 1 < argc)
+            {
+                options.cache_configs[CacheSim::L1D] = CacheSim::parse_config(argv[++i]);
+                options.caches = true;
+            }
+            else if (std::strcmp(arg, "--l2") == 0 && i + 1 < argc)
+            {
+                options.cache_configs[CacheSim::L2] = CacheSim::parse_config(argv[++i]);
+                options.caches = true;
+            }
+            else if (std::strcmp(arg, "--predict") == 0 && i + 1 < argc)
+            {
+                std::string list = argv[++i];
+                if (list == "all")
+                    list = "static,bimodal,gshare,tournament";
+                for (std::size_t start = 0, comma; start <= list.size(); start = comma + 1)
+                {
+                    comma = std::min(list.find(',', start), list.size());
+                    options.predictors.push_back(BranchSim::Predictor::parse(std::string_view(list).substr(start, comma - start)));
+                }
+            }
+            else if (std::strcmp(arg, "--return-stack") == 0 && i + 1 < argc)
+                options.return_stack = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (std::strcmp(arg, "--profile") == 0 && i + 1 < argc)
+                options.profile = argv[++i];
+            else if (std::strcmp(arg, "--folded") == 0 && i + 1 < argc)
+                options.folded = argv[++i];
+            else if (std::strcmp(arg, "--trace") == 0 && i + 1 < argc)
+                options.trace = argv[++i];
+            else if (std::strcmp(arg, "--jit") == 0)
+                options.jit = true;
+            else if (std::strcmp(arg, "--fuse") == 0)
+                options.fuse = true;
+            else if (std::strcmp(arg, "--optimize") == 0)
+                options.optimize = true;
+            else if (std::strcmp(arg, "--harts") == 0 && i + 1 < argc)
+                options.harts = static_cast<unsigned>(std::stoul(argv[++i]));
+            else if (std::strcmp(arg, "--quantum") == 0 && i + 1 < argc)
+                options.quantum = std::stoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(arg, "--max-steps") == 0 && i + 1 < argc)
+                options.max_steps = std::stoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(arg, "--memory") == 0 && i + 1 < argc)
+                options.memory.max_bytes = std::stoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(arg, "--hugepages") == 0)
+                options.memory.hugepages = true;
+            else if (std::strcmp(arg, "--disk") == 0 && i + 1 < argc)
+                options.disk = argv[++i];
+            else if (arg[0] == '-')
+                return false;
+            else
+            {
+                options.filepath = arg;
+                options.files.push_back(arg);
+            }
+        }
+        return true;
+    }
+
+    // Prints a machine's registers and how its run ended
+    void report(const Cpu::Machine &machine, Cpu::Status status, const std::vector<int> &lines)
+    {
+        std::cout << machine.state;
+        std::cout << "Status: " << Cpu::to_string(status);
+        if (status == Cpu::Status::FAULT)
+        {
+            std::cout << " (" << machine.fault() << " at instruction " << machine.state.pc;
+            if (machine.state.pc < lines.size())
+                std::cout << ", line " << lines[machine.state.pc];
+            std::cout << ")";
+        }
+        std::cout << '\n';
+    }
+
+    // Runs the program on several harts over `memory` and reports each of them
+    int run_harts(std::shared_ptr<const Cpu::Program> program, Memory::Space &memory, Devices::Bus &devices,
+                  const std::vector<int> &lines, const Options &options)
+    {
+        Harts::System system(std::move(program), memory, {options.harts, options.quantum});
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Cpu::Status> statuses = system.run(options.max_steps);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        devices.finish();
+        bool faulted = false;
+        for (std::size_t i = 0; i < system.size(); i++)
+        {
+            std::cout << "Hart " << i << ":\n";
+            report(system.hart(i), statuses[i], lines);
+            faulted = faulted || statuses[i] == Cpu::Status::FAULT;
+        }
+        std::cerr << "Retired " << system.retired() << " instructions on " << system.size() << " harts in " << elapsed.count()
+                  << " s (" << (elapsed.count() > 0 ? system.retired() / elapsed.count() / 1e6 : 0.0) << " MIPS), "
+                  << memory.committed_pages() * Memory::PAGE_SIZE / 1024 << " KiB of guest memory committed" << std::endl;
+        return faulted ? 1 : static_cast<int>(devices.exit_status() & 0xFF);
+    }
+
+    // Reads commands from stdin and moves the machine back and forth through its recorded run
+    int run_debugger(Cpu::Machine &machine, Devices::Bus &devices, const std::vector<int> &lines, std::uint64_t max_steps)
+    {
+        Replay::Recorder recorder(machine);
+        Cpu::Status status = Cpu::Status::BUDGET_EXHAUSTED;
+        auto where = [&]()
+        {
+            devices.flush(); // what the guest printed comes first
+            std::cout << "retired " << machine.retired << ", pc " << machine.state.pc;
+            if (machine.state.pc < lines.size())
+                std::cout << " (line " << lines[machine.state.pc] << ")";
+            if (status == Cpu::Status::FAULT)
+                std::cout << ", fault: " << machine.fault();
+            else if (status == Cpu::Status::HALTED)
+                std::cout << ", halted";
+            std::cout << std::endl;
+        };
+
+        std::string line;
+        while (std::cout << "> " << std::flush, std::getline(std::cin, line))
+        {
+            std::istringstream in(line);
+            std::string command, argument;
+            in >> command >> argument;
+            try
+            {
+                if (!argument.empty() && argument[0] == '-')
+                    throw std::invalid_argument("expected a non-negative number");
+                std::uint64_t n = argument.empty() ? 1 : std::stoull(argument, nullptr, 0);
+                if (command == "s" || command == "step")
+                    status = recorder.seek(machine.retired + n);
+                else if (command == "b" || command == "back")
+                    status = recorder.seek(machine.retired - std::min(n, machine.retired - recorder.start()));
+                else if ((command == "g" || command == "goto") && !argument.empty())
+                    status = recorder.seek(n);
+                else if (command == "c" || command == "continue")
+                    status = recorder.run(max_steps > machine.retired ? max_steps - machine.retired : 0);
+                else if (command == "r" || command == "regs")
+                {
+                    std::cout << machine.state;
+                    continue;
+                }
+                else if ((command == "m" || command == "mem") && !argument.empty())
+                {
+                    std::uint64_t value = 0;
+                    machine.memory().load(n, 8, value);
+                    std::cout << "[0x" << std::hex << n << "] = 0x" << value << std::dec << std::endl;
+                    continue;
+                }
+                else if (command == "q" || command == "quit")
+                    break;
+                else
+                {
+                    std::cout << "commands: s|step [N], b|back [N], g|goto INDEX, c|continue, r|regs, m|mem ADDR, q|quit" << std::endl;
+                    continue;
+                }
+                where();
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << e.what() << std::endl;
+            }
+        }
+        devices.finish();
+        return status == Cpu::Status::FAULT ? 1 : 0;
+    }
+
+    int run_batch(const Options &options)
+    {
+        try
+        {
+            Parser::Source source(options.batch);
+            std::size_t slash = options.batch.rfind('/');
+            std::string base_dir = slash == std::string::npos ? "" : options.batch.substr(0, slash);
+            Batch::Manifest manifest = Batch::parse_manifest(source.text(), base_dir, options.max_steps);
+
+            Batch::Options batch;
+            batch.threads = options.threads;
+            batch.jit = options.jit;
+            batch.fuse = options.fuse;
+            batch.optimize = options.optimize;
+            batch.lockstep = options.lockstep;
+            batch.cache_dir = options.cache_dir;
+            batch.max_steps = options.max_steps;
+            batch.memory = options.memory;
+
+            auto start = std::chrono::steady_clock::now();
+            Batch::Summary summary = Batch::run(manifest, batch, std::cout);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            std::cerr << "Ran " << summary.jobs << " jobs (" << manifest.programs.size() << " programs, "
+                      << summary.failed << " failed) in " << elapsed.count() << " s, retiring " << summary.retired
+                      << " instructions (" << (elapsed.count() > 0 ? summary.retired / elapsed.count() / 1e6 : 0.0)
+                      << " MIPS)" << std::endl;
+            return summary.failed ? 1 : 0;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // Assembles every file without running it, one list reused across files
+    int run_check(const Options &options)
+    {
+        std::vector<std::string> files = options.files;
+        if (files.empty())
+            files.push_back(options.filepath);
+
+        Diagnostics::List list;
+        std::size_t errors = 0, warnings = 0;
+        for (const std::string &path : files)
+        {
+            try
+            {
+                Parser::Source source(path);
+                if (Encoding::is_image(source.text()))
+                    continue;
+                Diagnostics::check(source.text(), list);
+                if (options.check_json)
+                    Diagnostics::write_json(std::cout, path, list);
+                else
+                    Diagnostics::write_text(std::cerr, path, list);
+                errors += list.errors();
+                warnings += list.warnings();
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+                errors++;
+            }
+        }
+        std::cerr << "Checked " << files.size() << " files: " << errors << " errors, " << warnings << " warnings"
+                  << std::endl;
+        return errors ? 1 : 0;
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    std::string filepath;
-    if (argc < 2)
+    Options options;
+    try
+    {
+        if (!parse_options(argc, argv, options))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    catch (const std::exception &e)
     {
-        filepath = "tests/heapsort.legv8asm";
+        usage(argv[0]);
+        return 1;
     }
-    else
+
+    if (options.check)
+        return run_check(options);
+    if (!options.batch.empty())
+        return run_batch(options);
+
+    std::unique_ptr<Parser::Source> source;
+    try
     {
-        filepath = argv[1];
+        source = std::make_unique<Parser::Source>(options.filepath);
     }
-    std::ifstream infile(filepath);
-    if (!infile)
+    catch (const std::exception &e)
     {
-        std::cerr << "Failed to open " << filepath << std::endl;
+        std::cerr << e.what() << std::endl;
         return 1;
     }
 
     try
     {
-        std::vector<Parser::Token> tokens = Parser::parse(infile);
+        auto load_start = std::chrono::steady_clock::now();
+        const bool is_image = Encoding::is_image(source->text());
+        const bool use_cache = !options.cache_dir.empty() && !is_image && !options.dump && options.assemble.empty();
+        std::uint64_t cache_key = 0;
 
-        std::cout << "--- TOKENS ---\n";
-        for (const auto &token : tokens)
+        std::vector<Parser::Token> tokens;
+        std::vector<Decoder::Instruction> instructions;
+        Cache::Program program;
+        bool cached = false;
+        if (use_cache)
         {
-            std::cout << token << '\n';
+            cache_key = Cache::key(source->text());
+            cached = Cache::load(options.cache_dir, cache_key, source->text(), program);
+        }
+        if (!cached && is_image)
+            instructions = Encoding::decode(Encoding::read_image(source->text()));
+        else if (!cached)
+        {
+            tokens = Parser::parse(source->text());
+            instructions = Decoder::decode(tokens, program.symbols);
         }
 
-        std::vector<Decoder::Instruction> instructions = Decoder::decode(tokens);
+        if (!options.assemble.empty())
+        {
+            std::ofstream outfile(options.assemble, std::ios::binary);
+            if (!outfile)
+            {
+                std::cerr << "Failed to open " << options.assemble << std::endl;
+                return 1;
+            }
+            Encoding::write_image(outfile, Encoding::encode(instructions));
+            return 0;
+        }
 
-        std::cout << "\n--- INSTRUCTIONS ---\n";
-        for (const auto &instr : instructions)
+        if (options.dump)
         {
-            std::cout << instr << '\n';
+            std::cout << "--- TOKENS ---\n";
+            for (const auto &token : tokens)
+            {
+                std::cout << token << '\n';
+            }
+
+            std::cout << "\n--- INSTRUCTIONS ---\n";
+            for (const auto &instr : instructions)
+            {
+                std::cout << instr << '\n';
+            }
+            return 0;
         }
+
+        if (!cached)
+        {
+            program.ops = Packed::pack(instructions);
+            if (use_cache && !Cache::store(options.cache_dir, cache_key, source->text(), program))
+                std::cerr << "Warning: failed to write " << Cache::path(options.cache_dir, cache_key) << std::endl;
+        }
+        if (use_cache)
+        {
+            std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+            std::cerr << "Cache: " << (cached ? "hit" : "miss") << ", " << program.ops.size()
+                      << " instructions ready in " << load_time.count() << " s" << std::endl;
+        }
+
+        if (options.optimize)
+        {
+            Dataflow::Program optimized = Dataflow::optimize(program.ops);
+            program.ops = std::move(optimized.ops);
+            std::cerr << "Dataflow: " << optimized.stats << std::endl;
+        }
+
+        const std::vector<int> lines = std::move(program.symbols.lines);
+        Devices::Config device_config;
+        device_config.disk = options.disk;
+        if (options.debug)
+            device_config.input = -1; // stdin carries the debugger's commands
+        std::cout.flush();            // the console writes to stdout directly
+        Devices::Bus devices(device_config);
+        options.memory.devices = &devices;
+        Memory::Space memory(options.memory);
+        auto executable = std::make_shared<Cpu::Program>(std::move(program.ops));
+        if (options.fuse)
+            std::cerr << "Fusion: " << executable->enable_fusion() << std::endl;
+        const bool profiling = !options.profile.empty() || !options.folded.empty();
+        const bool tracing = !options.trace.empty();
+        if (options.harts)
+        {
+            if (options.debug || options.pipeline || options.caches || !options.predictors.empty() || profiling || tracing)
+            {
+                std::cerr << "Error: --harts cannot be combined with --debug or the analyses" << std::endl;
+                return 1;
+            }
+            if (options.jit)
+                std::cerr << "Warning: harts do not use the JIT, interpreting" << std::endl;
+            return run_harts(executable, memory, devices, lines, options);
+        }
+        if (options.jit && !executable->enable_jit())
+            std::cerr << "Warning: JIT not supported on this host, interpreting" << std::endl;
+        if (options.debug + options.pipeline + options.caches + !options.predictors.empty() + profiling + tracing > 1)
+        {
+            std::cerr << "Error: --debug, --pipeline, --cache, --predict, --profile/--folded and --trace cannot be combined"
+                      << std::endl;
+            return 1;
+        }
+        Cpu::Machine machine(executable, memory);
+        if (options.debug)
+            return run_debugger(machine, devices, lines, options.max_steps);
+
+        std::unique_ptr<Pipeline::Model> pipeline;
+        std::unique_ptr<CacheSim::Simulator> caches;
+        std::unique_ptr<BranchSim::Simulator> branches;
+        std::unique_ptr<Profile::Profiler> profiler;
+        std::unique_ptr<Trace::Writer> trace;
+        std::unique_ptr<Trace::Tracer> tracer;
+        if (options.pipeline)
+            pipeline = std::make_unique<Pipeline::Model>(machine, options.timing);
+        if (options.caches)
+            caches = std::make_unique<CacheSim::Simulator>(machine, options.cache_configs, program.symbols.labels);
+        if (!options.predictors.empty())
+            branches = std::make_unique<BranchSim::Simulator>(machine, std::move(options.predictors), program.symbols.labels,
+                                                              lines, options.return_stack);
+        if (profiling)
+            profiler = std::make_unique<Profile::Profiler>(machine, program.symbols.labels);
+        if (tracing)
+        {
+            trace = std::make_unique<Trace::Writer>(options.trace, machine);
+            tracer = std::make_unique<Trace::Tracer>(machine, *trace);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Cpu::Status status = pipeline   ? pipeline->run(options.max_steps)
+                             : caches   ? caches->run(options.max_steps)
+                             : branches ? branches->run(options.max_steps)
+                             : profiler ? profiler->run(options.max_steps)
+                             : tracer   ? tracer->run(options.max_steps)
+                                        : machine.run(options.max_steps);
+        if (trace)
+            trace->finish();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        devices.finish();
+        report(machine, status, lines);
+
+        std::cerr << "Retired " << machine.retired << " instructions in " << elapsed.count() << " s ("
+                  << (elapsed.count() > 0 ? machine.retired / elapsed.count() / 1e6 : 0.0) << " MIPS), " << memory.committed_pages() * Memory::PAGE_SIZE / 1024 << " KiB of guest memory committed" << std::endl;
+        if (pipeline)
+            std::cerr << "Pipeline: " << pipeline->stats() << std::endl;
+        if (caches)
+            caches->report(std::cerr);
+        if (branches)
+            branches->report(std::cerr);
+        if (trace)
+            std::cerr << "Trace: " << trace->entries() << " instructions in " << trace->bytes() << " bytes ("
+                      << (trace->entries() ? static_cast<double>(trace->bytes()) / trace->entries() : 0.0)
+                      << " per instruction) written to " << options.trace << std::endl;
+        if (profiler)
+        {
+            profiler->hottest(std::cerr);
+            if (!options.profile.empty())
+            {
+                std::ofstream out(options.profile);
+                if (!out)
+                    throw std::runtime_error("failed to open " + options.profile);
+                profiler->annotate(out, source->text(), lines);
+            }
+            if (!options.folded.empty())
+            {
+                std::ofstream out(options.folded);
+                if (!out)
+                    throw std::runtime_error("failed to open " + options.folded);
+                profiler->folded(out);
+            }
+        }
+
+        if (status == Cpu::Status::FAULT)
+            return 1;
+        return static_cast<int>(devices.exit_status() & 0xFF);
     }
     catch (const std::exception &e)
     {
@@ -0,0 +1,386 @@
+#include "memory.hpp"
+#include "devices.hpp"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+
+namespace Memory
+{
+    namespace
+    {
+        // Pages per leaf of the page table: 64, covering 256 KiB in 512 bytes
+        constexpr unsigned LEAF_BITS = 6;
+        constexpr std::size_t LEAF_SIZE = std::size_t{1} << LEAF_BITS;
+
+        constexpr std::size_t CHUNK_SIZE = std::size_t{2} << 20;
+        constexpr std::uint64_t EMPTY_TAG = PAGE_MASK; // masked addresses always have bits 3-11 clear
+
+        alignas(PAGE_SIZE) const std::uint8_t zero_page[PAGE_SIZE] = {};
+
+        // Set on page table entries for pages owned by a snapshot, which must be copied before
+        // they are written. Pages are page-aligned, so the bit is otherwise always clear.
+        constexpr std::uintptr_t SHARED = 1;
+
+        std::uint8_t *page_of(void *entry)
+        {
+            return reinterpret_cast<std::uint8_t *>(reinterpret_cast<std::uintptr_t>(entry) & ~SHARED);
+        }
+
+        bool is_shared(void *entry)
+        {
+            return reinterpret_cast<std::uintptr_t>(entry) & SHARED;
+        }
+
+        void *shared(const std::uint8_t *page)
+        {
+            return reinterpret_cast<void *>(reinterpret_cast<std::uintptr_t>(page) | SHARED);
+        }
+
+        void invalidate(TlbEntry *tlb)
+        {
+            for (unsigned i = 0; i < TLB_ENTRIES; i++)
+                tlb[i] = {EMPTY_TAG, nullptr};
+        }
+    } // namespace
+
+    struct Chunk
+    {
+        Chunk(void *mapping, std::size_t bytes) : base(static_cast<std::uint8_t *>(mapping)), size(bytes) {}
+        ~Chunk() { munmap(base, size); }
+
+        Chunk(const Chunk &) = delete;
+        Chunk &operator=(const Chunk &) = delete;
+
+        std::uint8_t *const base;
+        const std::size_t size;
+    };
+
+    class Snapshot
+    {
+    public:
+        const std::uint8_t *find(std::uint64_t vpn) const
+        {
+            auto it = std::lower_bound(pages.begin(), pages.end(), vpn,
+                                       [](const auto &page, std::uint64_t key)
+                                       { return page.first < key; });
+            return it != pages.end() && it->first == vpn ? it->second : nullptr;
+        }
+
+        std::vector<std::pair<std::uint64_t, const std::uint8_t *>> pages; // by vpn
+        std::vector<std::shared_ptr<Chunk>> chunks;                         // holding those pages
+    };
+
+    struct Space::Leaf
+    {
+        void *slot[LEAF_SIZE] = {}; // page, or null if the space has not touched it
+    };
+
+    Space::Space(const Config &config) : config_(config), owner_(this)
+    {
+        invalidate(read_tlb_);
+        invalidate(write_tlb_);
+    }
+
+    Space::Space(Space &memory) : config_(memory.config_), owner_(&memory), shared_(true)
+    {
+        invalidate(read_tlb_);
+        invalidate(write_tlb_);
+
+        // The owner may have cached pages that views will replace
+        std::lock_guard<std::mutex> lock(memory.mutex_);
+        if (!memory.granules_)
+            memory.granules_ = std::make_unique<std::uint64_t[]>(GRANULE_COUNTERS);
+        memory.shared_ = true;
+        invalidate(memory.read_tlb_);
+        invalidate(memory.write_tlb_);
+    }
+
+    Space::~Space()
+    {
+        clear();
+    }
+
+    void Space::clear()
+    {
+        if (owner_ != this) // a view
+        {
+            invalidate(read_tlb_);
+            invalidate(write_tlb_);
+            return;
+        }
+
+        leaves_.clear(); // pages live in the arena chunks
+        chunks_.clear();
+        chunk_next_ = chunk_end_ = nullptr;
+        committed_pages_ = 0;
+        base_.reset();
+        invalidate(read_tlb_);
+        invalidate(write_tlb_);
+    }
+
+    std::shared_ptr<const Snapshot> Space::snapshot()
+    {
+        auto snapshot = std::make_shared<Snapshot>();
+
+        // Merge the page table over the base snapshot's pages, marking every entry shared
+        std::vector<std::uint64_t> regions;
+        regions.reserve(leaves_.size());
+        for (const auto &leaf : leaves_)
+            regions.push_back(leaf.first);
+        std::sort(regions.begin(), regions.end());
+        std::vector<std::pair<std::uint64_t, const std::uint8_t *>> own;
+        for (std::uint64_t region : regions)
+        {
+            Leaf &leaf = *leaves_[region];
+            for (std::size_t i = 0; i < LEAF_SIZE; i++)
+                if (void *&entry = leaf.slot[i])
+                {
+                    own.emplace_back(region << LEAF_BITS | i, page_of(entry));
+                    entry = shared(page_of(entry));
+                }
+        }
+        if (base_)
+        {
+            snapshot->pages.reserve(own.size() + base_->pages.size());
+            auto it = own.begin();
+            for (const auto &page : base_->pages)
+            {
+                for (; it != own.end() && it->first < page.first; ++it)
+                    snapshot->pages.push_back(*it);
+                if (it == own.end() || it->first != page.first)
+                    snapshot->pages.push_back(page);
+            }
+            snapshot->pages.insert(snapshot->pages.end(), it, own.end());
+        }
+        else
+            snapshot->pages = std::move(own);
+
+        // Hold only the chunks that still contain live pages: once every snapshot and space
+        // has replaced the pages in a chunk, it is unmapped with its last holder
+        std::vector<std::shared_ptr<Chunk>> candidates = chunks_;
+        if (base_)
+            candidates.insert(candidates.end(), base_->chunks.begin(), base_->chunks.end());
+        std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b)
+                  { return a->base < b->base; });
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        std::vector<bool> used(candidates.size(), false);
+        for (const auto &page : snapshot->pages)
+        {
+            auto it = std::upper_bound(candidates.begin(), candidates.end(), page.second, [](const std::uint8_t *p, const auto &chunk)
+                                       { return p < chunk->base; });
+            used[it - candidates.begin() - 1] = true;
+        }
+        for (std::size_t i = 0; i < candidates.size(); i++)
+            if (used[i])
+                snapshot->chunks.push_back(candidates[i]);
+
+        // Every page is now shared; the space goes on allocating from its current chunk
+        chunks_ = snapshot->chunks;
+        for (std::size_t i = 0; i < candidates.size(); i++)
+            if (!used[i] && chunk_next_ != chunk_end_ && candidates[i]->base + candidates[i]->size == chunk_end_)
+                chunks_.push_back(candidates[i]);
+        committed_pages_ = 0;
+        base_ = snapshot;
+        invalidate(write_tlb_);
+        return snapshot;
+    }
+
+    void Space::restore(std::shared_ptr<const Snapshot> snapshot)
+    {
+        clear();
+        base_ = std::move(snapshot);
+    }
+
+    std::uint8_t *Space::allocate_page()
+    {
+        if ((committed_pages_ + 1) * PAGE_SIZE > config_.max_bytes)
+            return nullptr;
+
+        if (chunk_next_ == chunk_end_)
+        {
+            void *chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+            if (config_.hugepages)
+                chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+            if (chunk == MAP_FAILED)
+            {
+                chunk = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (chunk == MAP_FAILED)
+                    return nullptr; // reported as a fault, like exceeding the limit
+#ifdef MADV_HUGEPAGE
+                if (config_.hugepages)
+                    madvise(chunk, CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+            }
+            chunks_.push_back(std::make_shared<Chunk>(chunk, CHUNK_SIZE));
+            chunk_next_ = static_cast<std::uint8_t *>(chunk);
+            chunk_end_ = chunk_next_ + CHUNK_SIZE;
+        }
+
+        std::uint8_t *page = chunk_next_;
+        chunk_next_ += PAGE_SIZE;
+        committed_pages_++;
+        return page; // fresh anonymous memory is already zeroed
+    }
+
+    void **Space::slot(std::uint64_t vpn, bool allocate)
+    {
+        auto leaf = leaves_.find(vpn >> LEAF_BITS);
+        if (leaf == leaves_.end())
+        {
+            if (!allocate)
+                return nullptr;
+            leaf = leaves_.emplace(vpn >> LEAF_BITS, std::make_unique<Leaf>()).first;
+        }
+        return &leaf->second->slot[vpn & (LEAF_SIZE - 1)];
+    }
+
+    std::uint8_t *Space::page_for_read(std::uint64_t vpn)
+    {
+        if (shared_)
+            return page_for_write(vpn); // so no view caches the zero page or a snapshot's page
+
+        void **entry = slot(vpn, false);
+        std::uint8_t *page = entry ? page_of(*entry) : nullptr;
+        if (!page && base_)
+        {
+            if (const std::uint8_t *base_page = base_->find(vpn))
+            {
+                *slot(vpn, true) = shared(base_page); // saves the search next time
+                page = const_cast<std::uint8_t *>(base_page);
+            }
+        }
+        if (!page)
+            page = const_cast<std::uint8_t *>(zero_page); // never written: no write TLB entry points here
+        read_tlb_[vpn % TLB_ENTRIES] = {vpn << PAGE_BITS, page}; // shared pages only ever enter the read TLB
+        return page;
+    }
+
+    std::uint8_t *Space::page_for_write(std::uint64_t vpn)
+    {
+        std::unique_lock<std::mutex> lock;
+        if (shared_)
+            lock = std::unique_lock<std::mutex>(owner_->mutex_);
+        Space &table = *owner_;
+
+        void **entry = table.slot(vpn, true);
+        void *current = *entry;
+        if (!current && table.base_)
+            if (const std::uint8_t *base_page = table.base_->find(vpn))
+                current = shared(base_page);
+        std::uint8_t *page = page_of(current);
+        if (!current || is_shared(current))
+        {
+            std::uint8_t *copy = table.allocate_page();
+            if (!copy)
+                return nullptr;
+            if (page)
+                std::memcpy(copy, page, PAGE_SIZE);
+            *entry = page = copy;
+        }
+        write_tlb_[vpn % TLB_ENTRIES] = {vpn << PAGE_BITS, page};
+        read_tlb_[vpn % TLB_ENTRIES] = {vpn << PAGE_BITS, page}; // may have cached the zero page
+        return page;
+    }
+
+    bool Space::load_slow(std::uint64_t addr, unsigned size, std::uint64_t &value)
+    {
+        // Including accesses that start just below the devices, so no device page is ever cached
+        if (is_device(addr) || is_device(addr + size - 1))
+        {
+            value = config_.devices->load(*this, addr, size);
+            return true;
+        }
+
+        // Only shared spaces commit pages on reads, so only they can fail here
+        if (shared_ && (addr & (size - 1)) == 0)
+        {
+            const std::uint8_t *page = page_for_read(addr >> PAGE_BITS);
+            if (!page)
+                return false;
+            value = atomic_load(page + (addr & PAGE_MASK), size);
+            return true;
+        }
+
+        std::uint64_t v = 0;
+        for (unsigned done = 0; done < size;)
+        {
+            std::uint64_t a = addr + done;
+            unsigned n = static_cast<unsigned>(std::min<std::uint64_t>(size - done, PAGE_SIZE - (a & PAGE_MASK)));
+            const std::uint8_t *page = page_for_read(a >> PAGE_BITS);
+            if (!page)
+                return false;
+            std::memcpy(reinterpret_cast<std::uint8_t *>(&v) + done, page + (a & PAGE_MASK), n);
+            done += n;
+        }
+        value = v;
+        return true;
+    }
+
+    bool Space::store_slow(std::uint64_t addr, unsigned size, std::uint64_t value)
+    {
+        if (is_device(addr) || is_device(addr + size - 1))
+        {
+            config_.devices->store(*this, addr, size, value);
+            return true;
+        }
+
+        // Commit every page first so a failing access leaves memory untouched
+        std::uint8_t *pages[2];
+        std::uint64_t first = addr >> PAGE_BITS, last = (addr + size - 1) >> PAGE_BITS;
+        pages[0] = page_for_write(first);
+        pages[1] = last != first ? page_for_write(last) : pages[0];
+        if (!pages[0] || !pages[1])
+            return false;
+        if (shared_ && (addr & (size - 1)) == 0)
+        {
+            atomic_store(pages[0] + (addr & PAGE_MASK), size, value);
+            return true;
+        }
+
+        unsigned n = static_cast<unsigned>(std::min<std::uint64_t>(size, PAGE_SIZE - (addr & PAGE_MASK)));
+        std::memcpy(pages[0] + (addr & PAGE_MASK), &value, n);
+        if (n < size)
+            std::memcpy(pages[1], reinterpret_cast<std::uint8_t *>(&value) + n, size - n);
+        return true;
+    }
+
+    bool Space::load_exclusive(std::uint64_t addr, std::uint64_t &value, std::uint64_t &generation)
+    {
+        generation = 0;
+        if (!shared_ || is_device(addr))
+            return shared_ ? load_shared(addr, 8, value) : load(addr, 8, value);
+
+        std::uint64_t *const counter = granule(addr);
+        generation = lock(counter);
+        const bool loaded = load_shared(addr, 8, value);
+        unlock(counter, generation);
+        return loaded;
+    }
+
+    bool Space::store_exclusive(std::uint64_t addr, std::uint64_t value, std::uint64_t generation, bool &stored)
+    {
+        stored = false;
+        if (is_device(addr)) // devices have no exclusive access
+            return true;
+        if (!shared_)
+            return stored = store(addr, 8, value);
+
+        std::uint64_t *const counter = granule(addr);
+        const std::uint64_t current = lock(counter);
+        bool ok = true;
+        if (current == generation)
+        {
+            const TlbEntry &entry = write_tlb_[(addr >> PAGE_BITS) % TLB_ENTRIES];
+            if ((addr & (~PAGE_MASK | 7)) == entry.tag)
+                atomic_store(entry.page + (addr & PAGE_MASK), 8, value);
+            else
+                ok = store_slow(addr, 8, value);
+            stored = ok;
+        }
+        unlock(counter, current + stored);
+        return ok;
+    }
+} // namespace Memory
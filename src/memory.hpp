@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Devices
+{
+    class Bus;
+}
+
+namespace Memory
+{
+    constexpr unsigned PAGE_BITS = 12;
+    constexpr std::uint64_t PAGE_SIZE = std::uint64_t{1} << PAGE_BITS;
+    constexpr std::uint64_t PAGE_MASK = PAGE_SIZE - 1;
+
+    // Initial SP: the stack grows down from the top of the lower half of the address space
+    constexpr std::uint64_t STACK_TOP = std::uint64_t{1} << 47;
+
+    // Accesses from here up go to the devices, if the space has any (see Devices::Bus)
+    constexpr std::uint64_t DEVICE_BASE = std::uint64_t{0xFFFF} << 48;
+
+    constexpr unsigned TLB_ENTRIES = 256; // direct-mapped, indexed by the low bits of the page number
+
+    // Exclusive accesses reserve the 64-byte granule holding their doubleword. Granules hash
+    // onto a fixed number of generation counters; two that collide only make STXR fail more.
+    constexpr unsigned GRANULE_BITS = 6;
+    constexpr std::size_t GRANULE_COUNTERS = 4096;
+
+    struct TlbEntry
+    {
+        std::uint64_t tag;  // guest address of the cached page; an unaligned sentinel when empty
+        std::uint8_t *page; // host copy of the page
+    };
+
+    struct Config
+    {
+        std::uint64_t max_bytes = std::uint64_t{1} << 30; // commit limit; stores needing more fault
+        bool hugepages = false;                          // back pages with 2 MiB huge pages if available
+        Devices::Bus *devices = nullptr;                 // handles accesses from DEVICE_BASE up, if set
+    };
+
+    // Frozen contents of a Space; see Space::snapshot. Immutable, so one snapshot can be
+    // restored into any number of spaces, on any threads.
+    class Snapshot;
+
+    struct Chunk; // arena mapping, unmapped once no space or snapshot holds pages in it
+
+    // Naturally aligned accesses of 1, 2, 4 or 8 bytes as single atomic acquires and releases
+    inline std::uint64_t atomic_load(const std::uint8_t *p, unsigned size)
+    {
+        switch (size)
+        {
+        case 1:
+            return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+        case 2:
+            return __atomic_load_n(reinterpret_cast<const std::uint16_t *>(p), __ATOMIC_ACQUIRE);
+        case 4:
+            return __atomic_load_n(reinterpret_cast<const std::uint32_t *>(p), __ATOMIC_ACQUIRE);
+        default:
+            return __atomic_load_n(reinterpret_cast<const std::uint64_t *>(p), __ATOMIC_ACQUIRE);
+        }
+    }
+
+    inline void atomic_store(std::uint8_t *p, unsigned size, std::uint64_t value)
+    {
+        switch (size)
+        {
+        case 1:
+            __atomic_store_n(p, static_cast<std::uint8_t>(value), __ATOMIC_RELEASE);
+            break;
+        case 2:
+            __atomic_store_n(reinterpret_cast<std::uint16_t *>(p), static_cast<std::uint16_t>(value), __ATOMIC_RELEASE);
+            break;
+        case 4:
+            __atomic_store_n(reinterpret_cast<std::uint32_t *>(p), static_cast<std::uint32_t>(value), __ATOMIC_RELEASE);
+            break;
+        default:
+            __atomic_store_n(reinterpret_cast<std::uint64_t *>(p), value, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    // Sparse, byte-addressed 64-bit guest address space. Pages are committed on first store;
+    // loads from untouched pages read zeros without committing anything. Accesses are
+    // little-endian and may be unaligned or cross pages.
+    //
+    // Separate read and write TLBs sit in front of a page table, so an aligned access to a
+    // recently used page costs one compare against a TLB tag plus the access itself. The page
+    // table hashes each 256 KiB region to a 512-byte leaf of page slots, so it costs about one
+    // leaf per region touched; a forked space starts with none.
+    // Device addresses never enter the TLBs, so they always take the slow path to the devices.
+    //
+    // Several harts on different threads share memory through views (see the second
+    // constructor), each with TLBs of its own over the one page table. Once a space has views,
+    // every page is committed and made private on first access, so a page a view has cached is
+    // never replaced, and the slow paths lock the page table. Every store through a view
+    // then also bumps the generation of the granules it touches, which is what tells STXR
+    // whether anything was written since its LDXR (see load_exclusive).
+    class Space
+    {
+    public:
+        explicit Space(const Config &config = Config());
+
+        // A view of `memory` with its own TLBs, for a hart on another thread. It must not
+        // outlive `memory`, and neither may be snapshotted or restored while views exist.
+        explicit Space(Space &memory);
+        ~Space();
+
+        Space(const Space &) = delete;
+        Space &operator=(const Space &) = delete;
+
+        // Returns false (leaving `value` untouched) if the access cannot be performed
+        bool load(std::uint64_t addr, unsigned size, std::uint64_t &value)
+        {
+            const TlbEntry &entry = read_tlb_[(addr >> PAGE_BITS) % TLB_ENTRIES];
+            if ((addr & (~PAGE_MASK | (size - 1))) == entry.tag)
+            {
+                std::uint64_t v = 0;
+                std::memcpy(&v, entry.page + (addr & PAGE_MASK), size);
+                value = v;
+                return true;
+            }
+            return load_slow(addr, size, value);
+        }
+
+        bool store(std::uint64_t addr, unsigned size, std::uint64_t value)
+        {
+            const TlbEntry &entry = write_tlb_[(addr >> PAGE_BITS) % TLB_ENTRIES];
+            if ((addr & (~PAGE_MASK | (size - 1))) == entry.tag)
+            {
+                std::memcpy(entry.page + (addr & PAGE_MASK), &value, size);
+                return true;
+            }
+            return store_slow(addr, size, value);
+        }
+
+        // As load and store, but a naturally aligned access is a single atomic acquire or
+        // release, for spaces with views. Other accesses are made a byte range at a time.
+        bool load_shared(std::uint64_t addr, unsigned size, std::uint64_t &value)
+        {
+            const TlbEntry &entry = read_tlb_[(addr >> PAGE_BITS) % TLB_ENTRIES];
+            if ((addr & (~PAGE_MASK | (size - 1))) == entry.tag)
+            {
+                value = atomic_load(entry.page + (addr & PAGE_MASK), size);
+                return true;
+            }
+            return load_slow(addr, size, value);
+        }
+
+        bool store_shared(std::uint64_t addr, unsigned size, std::uint64_t value)
+        {
+            // Devices have no reservations, and their transfers store back into memory
+            if (is_device(addr) || is_device(addr + size - 1))
+                return store_slow(addr, size, value);
+
+            std::uint64_t *first = granule(addr), *last = granule(addr + size - 1);
+            if (last < first)
+                std::swap(first, last);
+            const std::uint64_t first_generation = lock(first);
+            const std::uint64_t last_generation = last != first ? lock(last) : first_generation;
+            bool stored = true;
+            const TlbEntry &entry = write_tlb_[(addr >> PAGE_BITS) % TLB_ENTRIES];
+            if ((addr & (~PAGE_MASK | (size - 1))) == entry.tag)
+                atomic_store(entry.page + (addr & PAGE_MASK), size, value);
+            else
+                stored = store_slow(addr, size, value);
+            if (last != first)
+                unlock(last, last_generation + stored);
+            unlock(first, first_generation + stored);
+            return stored;
+        }
+
+        // Exclusive access to the aligned doubleword at `addr`. load_exclusive reads it along
+        // with the generation of its granule. store_exclusive stores `value` only if nothing
+        // has been stored to the granule since that generation was read, setting `stored` to
+        // whether it did; the check and the store are one atomic step against every other
+        // store. Without views no other hart can store, so neither checks anything. Both
+        // return false, like load and store, if the access cannot be performed.
+        bool load_exclusive(std::uint64_t addr, std::uint64_t &value, std::uint64_t &generation);
+        bool store_exclusive(std::uint64_t addr, std::uint64_t value, std::uint64_t generation, bool &stored);
+
+        // Freezes the current contents. Every page becomes shared, copy-on-write, between this
+        // space, the snapshot and any space it is restored into; whichever writes to a page
+        // first gets its own copy. Costs a walk over the page table, not a copy of the data.
+        std::shared_ptr<const Snapshot> snapshot();
+
+        // Discards the current contents and reads the snapshot's pages instead, copying each
+        // only when it is first written
+        void restore(std::shared_ptr<const Snapshot> snapshot);
+
+        // Whether accesses to `addr` go to a device rather than to memory
+        bool is_device(std::uint64_t addr) const { return config_.devices && addr >= DEVICE_BASE; }
+
+        // Whether this space has views or is one, so other threads may be accessing its pages
+        bool has_views() const { return shared_; }
+
+        // Pages owned by this space alone; shared pages do not count against max_bytes
+        std::size_t committed_pages() const { return owner_->committed_pages_; }
+
+        // For native code that inlines the TLB lookup
+        const TlbEntry *read_tlb() const { return read_tlb_; }
+        const TlbEntry *write_tlb() const { return write_tlb_; }
+
+    private:
+        struct Leaf;
+
+        // Generation counters for exclusive accesses: bit 0 is a lock, held while storing to
+        // a granule, and the rest counts the stores
+        std::uint64_t *granule(std::uint64_t addr) const
+        {
+            return &owner_->granules_[(addr >> GRANULE_BITS) % GRANULE_COUNTERS];
+        }
+
+        // Returns the generation, which unlock is given back, plus one if the granule was stored to
+        static std::uint64_t lock(std::uint64_t *counter)
+        {
+            std::uint64_t current;
+            while ((current = __atomic_fetch_or(counter, 1, __ATOMIC_ACQUIRE)) & 1)
+                while (__atomic_load_n(counter, __ATOMIC_RELAXED) & 1)
+                {
+#if defined(__x86_64__)
+                    __builtin_ia32_pause();
+#endif
+                }
+            return current >> 1;
+        }
+
+        static void unlock(std::uint64_t *counter, std::uint64_t generation)
+        {
+            __atomic_store_n(counter, generation << 1, __ATOMIC_RELEASE);
+        }
+
+        bool load_slow(std::uint64_t addr, unsigned size, std::uint64_t &value);
+        bool store_slow(std::uint64_t addr, unsigned size, std::uint64_t value);
+
+        std::uint8_t *page_for_read(std::uint64_t vpn);
+        std::uint8_t *page_for_write(std::uint64_t vpn);
+        void **slot(std::uint64_t vpn, bool allocate);
+        std::uint8_t *allocate_page();
+        void clear();
+
+        TlbEntry read_tlb_[TLB_ENTRIES];
+        TlbEntry write_tlb_[TLB_ENTRIES];
+
+        Config config_;
+        std::unordered_map<std::uint64_t, std::unique_ptr<Leaf>> leaves_; // by vpn >> LEAF_BITS; empty in views
+        std::shared_ptr<const Snapshot> base_; // pages not in the table are read from here
+        std::vector<std::shared_ptr<Chunk>> chunks_; // holding this space's pages
+        std::uint8_t *chunk_next_ = nullptr;
+        std::uint8_t *chunk_end_ = nullptr;
+        std::size_t committed_pages_ = 0;
+
+        Space *owner_; // of the page table: this space, or the one this is a view of
+        bool shared_ = false; // has views, or is one
+        std::mutex mutex_; // guards the page table while shared
+        std::unique_ptr<std::uint64_t[]> granules_; // generation counters, in the owner once it has views
+    };
+} // namespace Memory
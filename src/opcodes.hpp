@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
-#include <unordered_map>
-#include <stdexcept>
+#include <string_view>
+
+#include "perfect_hash.hpp"
 
 namespace Opcode
 {
@@ -74,6 +76,7 @@ namespace Opcode
         LDUR,
         STURD,
         LDURD,
+        HALT,
         NONE
     };
 
@@ -88,193 +91,118 @@ namespace Opcode
         NONE
     };
 
-    inline Type from_string(const std::string &str)
-    {
-        static const std::unordered_map<std::string, Type> lookup = {
-            {"B", B},
-            {"FMULS", FMULS},
-            {"FDIVS", FDIVS},
-            {"FCMPS", FCMPS},
-            {"FADDS", FADDS},
-            {"FSUBS", FSUBS},
-            {"FMULD", FMULD},
-            {"FDIVD", FDIVD},
-            {"FCMPD", FCMPD},
-            {"FADDD", FADDD},
-            {"FSUBD", FSUBD},
-            {"STURB", STURB},
-            {"LDURB", LDURB},
-            {"B.EQ", B_EQ},
-            {"B.NE", B_NE},
-            {"B.LT", B_LT},
-            {"B.LE", B_LE},
-            {"B.GT", B_GT},
-            {"B.GE", B_GE},
-            {"B.LO", B_LO},
-            {"B.LS", B_LS},
-            {"B.HI", B_HI},
-            {"B.HS", B_HS},
-            {"B.MI", B_MI},
-            {"B.VS", B_VS},
-            {"STURH", STURH},
-            {"LDURH", LDURH},
-            {"AND", AND},
-            {"ADD", ADD},
-            {"ADDI", ADDI},
-            {"ANDI", ANDI},
-            {"BL", BL},
-            {"SDIV", SDIV},
-            {"UDIV", UDIV},
-            {"MUL", MUL},
-            {"SMULH", SMULH},
-            {"UMULH", UMULH},
-            {"ORR", ORR},
-            {"ADDS", ADDS},
-            {"ADDIS", ADDIS},
-            {"ORRI", ORRI},
-            {"CBZ", CBZ},
-            {"CBNZ", CBNZ},
-            {"STURW", STURW},
-            {"LDURSW", LDURSW},
-            {"STURS", STURS},
-            {"LDURS", LDURS},
-            {"STXR", STXR},
-            {"LDXR", LDXR},
-            {"EOR", EOR},
-            {"SUB", SUB},
-            {"SUBI", SUBI},
-            {"EORI", EORI},
-            {"MOVZ", MOVZ},
-            {"LSR", LSR},
-            {"LSL", LSL},
-            {"BR", BR},
-            {"ANDS", ANDS},
-            {"SUBS", SUBS},
-            {"SUBIS", SUBIS},
-            {"ANDIS", ANDIS},
-            {"MOVK", MOVK},
-            {"STUR", STUR},
-            {"LDUR", LDUR},
-            {"STURD", STURD},
-            {"LDURD", LDURD}};
+    constexpr std::int8_t ANY_SHAMT = -1;
 
-        auto it = lookup.find(str);
-        if (it != lookup.end())
-            return it->second;
+    struct Info
+    {
+        Type type;
+        std::string_view name;
+        Format format;
+        std::uint16_t opcode; // 11-bit machine opcode, the lowest value of the range for shorter fields
+        std::int8_t shamt;    // fixed shamt that tells R-format opcodes apart, or ANY_SHAMT
+    };
 
-        return NONE;
-    }
+    // Everything known about each opcode, indexed by Type. The interpreter's handler table
+    // is indexed by Type as well.
+    constexpr Info INFO[] = {
+        {B, "B", Format::B, 0x0A0, ANY_SHAMT},
+        {FMULS, "FMULS", Format::R, 0x0F1, 0x02},
+        {FDIVS, "FDIVS", Format::R, 0x0F1, 0x06},
+        {FCMPS, "FCMPS", Format::R, 0x0F1, 0x08},
+        {FADDS, "FADDS", Format::R, 0x0F1, 0x0A},
+        {FSUBS, "FSUBS", Format::R, 0x0F1, 0x0E},
+        {FMULD, "FMULD", Format::R, 0x0F3, 0x02},
+        {FDIVD, "FDIVD", Format::R, 0x0F3, 0x06},
+        {FCMPD, "FCMPD", Format::R, 0x0F3, 0x08},
+        {FADDD, "FADDD", Format::R, 0x0F3, 0x0A},
+        {FSUBD, "FSUBD", Format::R, 0x0F3, 0x0E},
+        {STURB, "STURB", Format::D, 0x1C0, ANY_SHAMT},
+        {LDURB, "LDURB", Format::D, 0x1C2, ANY_SHAMT},
+        {B_EQ, "B.EQ", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_NE, "B.NE", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_LT, "B.LT", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_LE, "B.LE", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_GT, "B.GT", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_GE, "B.GE", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_LO, "B.LO", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_LS, "B.LS", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_HI, "B.HI", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_HS, "B.HS", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_MI, "B.MI", Format::CB, 0x2A0, ANY_SHAMT},
+        {B_VS, "B.VS", Format::CB, 0x2A0, ANY_SHAMT},
+        {STURH, "STURH", Format::D, 0x3C0, ANY_SHAMT},
+        {LDURH, "LDURH", Format::D, 0x3C2, ANY_SHAMT},
+        {AND, "AND", Format::R, 0x450, ANY_SHAMT},
+        {ADD, "ADD", Format::R, 0x458, ANY_SHAMT},
+        {ADDI, "ADDI", Format::I, 0x488, ANY_SHAMT},
+        {ANDI, "ANDI", Format::I, 0x490, ANY_SHAMT},
+        {BL, "BL", Format::B, 0x4A0, ANY_SHAMT},
+        {SDIV, "SDIV", Format::R, 0x4D6, 0x02},
+        {UDIV, "UDIV", Format::R, 0x4D6, 0x03},
+        {MUL, "MUL", Format::R, 0x4D8, 0x1F},
+        {SMULH, "SMULH", Format::R, 0x4DA, ANY_SHAMT},
+        {UMULH, "UMULH", Format::R, 0x4DE, ANY_SHAMT},
+        {ORR, "ORR", Format::R, 0x550, ANY_SHAMT},
+        {ADDS, "ADDS", Format::R, 0x558, ANY_SHAMT},
+        {ADDIS, "ADDIS", Format::I, 0x588, ANY_SHAMT},
+        {ORRI, "ORRI", Format::I, 0x590, ANY_SHAMT},
+        {CBZ, "CBZ", Format::CB, 0x5A0, ANY_SHAMT},
+        {CBNZ, "CBNZ", Format::CB, 0x5A8, ANY_SHAMT},
+        {STURW, "STURW", Format::D, 0x5C0, ANY_SHAMT},
+        {LDURSW, "LDURSW", Format::D, 0x5C4, ANY_SHAMT},
+        {STURS, "STURS", Format::R, 0x5E0, ANY_SHAMT},
+        {LDURS, "LDURS", Format::R, 0x5E2, ANY_SHAMT},
+        {STXR, "STXR", Format::D, 0x640, ANY_SHAMT},
+        {LDXR, "LDXR", Format::D, 0x642, ANY_SHAMT},
+        {EOR, "EOR", Format::R, 0x650, ANY_SHAMT},
+        {SUB, "SUB", Format::R, 0x658, ANY_SHAMT},
+        {SUBI, "SUBI", Format::I, 0x688, ANY_SHAMT},
+        {EORI, "EORI", Format::I, 0x690, ANY_SHAMT},
+        {MOVZ, "MOVZ", Format::IW, 0x694, ANY_SHAMT},
+        {LSR, "LSR", Format::R, 0x69A, ANY_SHAMT},
+        {LSL, "LSL", Format::R, 0x69B, ANY_SHAMT},
+        {BR, "BR", Format::R, 0x6B0, ANY_SHAMT},
+        {ANDS, "ANDS", Format::R, 0x750, ANY_SHAMT},
+        {SUBS, "SUBS", Format::R, 0x758, ANY_SHAMT},
+        {SUBIS, "SUBIS", Format::I, 0x788, ANY_SHAMT},
+        {ANDIS, "ANDIS", Format::I, 0x790, ANY_SHAMT},
+        {MOVK, "MOVK", Format::IW, 0x794, ANY_SHAMT},
+        {STUR, "STUR", Format::D, 0x7C0, ANY_SHAMT},
+        {LDUR, "LDUR", Format::D, 0x7C2, ANY_SHAMT},
+        {STURD, "STURD", Format::R, 0x7E0, ANY_SHAMT},
+        {LDURD, "LDURD", Format::R, 0x7E2, ANY_SHAMT},
+        {HALT, "HALT", Format::R, 0x7FF, ANY_SHAMT}, // no operands; stops the machine
+        {NONE, "NONE", Format::NONE, 0, ANY_SHAMT},
+    };
 
-    inline Format format(const Type &op)
+    constexpr bool info_in_order()
     {
-        switch (op)
-        {
-        // R format
-        case Opcode::FMULS:
-        case Opcode::FDIVS:
-        case Opcode::FCMPS:
-        case Opcode::FADDS:
-        case Opcode::FSUBS:
-        case Opcode::FMULD:
-        case Opcode::FDIVD:
-        case Opcode::FCMPD:
-        case Opcode::FADDD:
-        case Opcode::FSUBD:
-        case Opcode::AND:
-        case Opcode::ADD:
-        case Opcode::SDIV:
-        case Opcode::UDIV:
-        case Opcode::MUL:
-        case Opcode::SMULH:
-        case Opcode::UMULH:
-        case Opcode::ORR:
-        case Opcode::ADDS:
-        case Opcode::STURS:
-        case Opcode::LDURS:
-        case Opcode::EOR:
-        case Opcode::SUB:
-        case Opcode::LSR:
-        case Opcode::LSL:
-        case Opcode::BR:
-        case Opcode::ANDS:
-        case Opcode::SUBS:
-        case Opcode::STURD:
-        case Opcode::LDURD:
-            return Format::R;
-
-        // I format
-        case Opcode::ADDI:
-        case Opcode::ANDI:
-        case Opcode::ADDIS:
-        case Opcode::ORRI:
-        case Opcode::SUBI:
-        case Opcode::EORI:
-        case Opcode::SUBIS:
-        case Opcode::ANDIS:
-            return Format::I;
+        for (int op = 0; op <= NONE; op++)
+            if (INFO[op].type != op)
+                return false;
+        return sizeof(INFO) / sizeof(INFO[0]) == NONE + 1;
+    }
+    static_assert(info_in_order(), "Opcode::INFO must list every Type in enum order");
 
-        // D format
-        case Opcode::STURB:
-        case Opcode::LDURB:
-        case Opcode::STURH:
-        case Opcode::LDURH:
-        case Opcode::STURW:
-        case Opcode::LDURSW:
-        case Opcode::STXR:
-        case Opcode::LDXR:
-        case Opcode::STUR:
-        case Opcode::LDUR:
-            return Format::D;
+    constexpr const Info &info(Type op) { return INFO[op <= NONE ? op : NONE]; }
 
-        // B format
-        case Opcode::B:
-        case Opcode::BL:
-            return Format::B;
+    constexpr Format format(const Type &op) { return info(op).format; }
 
-        // CB format
-        case Opcode::B_EQ:
-        case Opcode::B_NE:
-        case Opcode::B_LT:
-        case Opcode::B_LE:
-        case Opcode::B_GT:
-        case Opcode::B_GE:
-        case Opcode::B_LO:
-        case Opcode::B_LS:
-        case Opcode::B_HI:
-        case Opcode::B_HS:
-        case Opcode::B_MI:
-        case Opcode::B_VS:
-        case Opcode::CBZ:
-        case Opcode::CBNZ:
-            return Format::CB;
+    constexpr std::string_view name(Type op) { return op >= 0 && op <= NONE ? INFO[op].name : "UNKNOWN"; }
 
-        // IW format
-        case Opcode::MOVZ:
-        case Opcode::MOVK:
-            return Format::IW;
-        default:
-            return Format::NONE;
-        }
-    }
+    inline std::string to_string(Type op) { return std::string(name(op)); }
 
-    inline std::string to_string(Type op)
+    namespace detail
     {
-        static const char *names[] = {
-            "B", "FMULS", "FDIVS", "FCMPS", "FADDS", "FSUBS",
-            "FMULD", "FDIVD", "FCMPD", "FADDD", "FSUBD",
-            "STURB", "LDURB", "B.EQ", "B.NE", "B.LT", "B.LE", "B.GT", "B.GE",
-            "B.LO", "B.LS", "B.HI", "B.HS", "B.MI", "B.VS",
-            "STURH", "LDURH", "AND", "ADD", "ADDI", "ANDI", "BL", "SDIV",
-            "UDIV", "MUL", "SMULH", "UMULH", "ORR", "ADDS", "ADDIS", "ORRI",
-            "CBZ", "CBNZ", "STURW", "LDURSW", "STURS", "LDURS", "STXR", "LDXR",
-            "EOR", "SUB", "SUBI", "EORI", "MOVZ", "LSR", "LSL", "BR",
-            "ANDS", "SUBS", "SUBIS", "ANDIS", "MOVK", "STUR", "LDUR",
-            "STURD", "LDURD", "NONE"};
+        constexpr auto names = PerfectHash::build<512>(INFO);
+        static_assert(names.valid, "no perfect hash seed for opcode names");
+    } // namespace detail
 
-        if (op < 0 || op > NONE)
-            return "UNKNOWN";
-
-        return names[static_cast<int>(op)];
+    // Mnemonics are case-sensitive
+    constexpr Type from_string(std::string_view str)
+    {
+        int i = detail::names.candidate(str);
+        return i >= 0 && i < NONE && INFO[i].name == str ? static_cast<Type>(i) : NONE;
     }
 
-} // namespace Opcode
\ No newline at end of file
+} // namespace Opcode
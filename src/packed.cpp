@@ -0,0 +1,114 @@
+#include "packed.hpp"
+
+namespace Packed
+{
+    namespace
+    {
+        std::uint8_t dst(const Decoder::Operand &operand)
+        {
+            return operand.reg == Register::XZR ? DISCARD : static_cast<std::uint8_t>(operand.reg);
+        }
+
+        std::uint8_t src(const Decoder::Operand &operand)
+        {
+            return static_cast<std::uint8_t>(operand.reg);
+        }
+    } // namespace
+
+    bool is_store(Opcode::Type op)
+    {
+        switch (op)
+        {
+        case Opcode::STUR:
+        case Opcode::STURB:
+        case Opcode::STURH:
+        case Opcode::STURW:
+        case Opcode::STXR:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    Op pack(const Decoder::Instruction &inst)
+    {
+        Op op{static_cast<std::uint8_t>(inst.opcode), DISCARD, Register::XZR, Register::XZR, 0};
+
+        switch (inst.format)
+        {
+        case Opcode::Format::R:
+            if (inst.opcode == Opcode::HALT)
+                break; // no operands
+            if (inst.opcode == Opcode::BR)
+                op.rn = src(inst.R.Rn);
+            else if (inst.opcode == Opcode::LSL || inst.opcode == Opcode::LSR)
+            {
+                op.rd = dst(inst.R.Rd);
+                op.rn = src(inst.R.Rn);
+                op.imm = inst.R.shamt.imm; // the decoder keeps these in range
+            }
+            else
+            {
+                op.rd = dst(inst.R.Rd);
+                op.rn = src(inst.R.Rn);
+                op.rm = src(inst.R.Rm);
+            }
+            break;
+
+        case Opcode::Format::I:
+            op.rd = dst(inst.I.Rd);
+            op.rn = src(inst.I.Rn);
+            op.imm = inst.I.imm.imm;
+            break;
+
+        case Opcode::Format::D:
+            if (is_store(inst.opcode))
+            {
+                op.rm = src(inst.D.Rt);
+                if (inst.opcode == Opcode::STXR)
+                    op.rd = dst(inst.D.Rs);
+            }
+            else
+                op.rd = dst(inst.D.Rt);
+            op.rn = src(inst.D.Rn);
+            op.imm = inst.D.offset.imm;
+            break;
+
+        case Opcode::Format::B:
+            op.imm = inst.B.label.imm;
+            break;
+
+        case Opcode::Format::CB:
+            op.rn = src(inst.CB.Rt);
+            op.imm = inst.CB.label.imm;
+            break;
+
+        case Opcode::Format::IW:
+            op.rd = dst(inst.IW.Rd);
+            op.rn = src(inst.IW.Rd);
+            op.rm = static_cast<std::uint8_t>(inst.IW.shift.imm);
+            op.imm = inst.IW.imm.imm;
+            break;
+
+        default:
+            break;
+        }
+        return op;
+    }
+
+    std::vector<Op> pack(const std::vector<Decoder::Instruction> &instructions)
+    {
+        std::vector<Op> ops;
+        ops.reserve(instructions.size());
+        for (const auto &instruction : instructions)
+            ops.push_back(pack(instruction));
+        return ops;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const Op &op)
+    {
+        return os << Opcode::to_string(static_cast<Opcode::Type>(op.opcode))
+                  << " rd=" << static_cast<int>(op.rd) << " rn=" << static_cast<int>(op.rn)
+                  << " rm=" << static_cast<int>(op.rm) << " imm=" << op.imm;
+    }
+} // namespace Packed
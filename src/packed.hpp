@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "decoder.hpp"
+#include "opcodes.hpp"
+#include "registers.hpp"
+
+namespace Packed
+{
+    // Register slot that absorbs writes to XZR, so handlers can store results unconditionally.
+    // Register files used with packed ops therefore have Register::NONE + 1 entries.
+    constexpr std::uint8_t DISCARD = Register::NONE;
+
+    // Fixed 8-byte execution record with all operands resolved to register indices or immediates.
+    //
+    //  format | rd            | rn           | rm            | imm
+    //  -------+---------------+--------------+---------------+------------------------
+    //  R      | Rd            | Rn           | Rm            | shamt (LSL/LSR)
+    //  I      | Rd            | Rn           |               | immediate
+    //  D load | Rt            | Rn           |               | offset
+    //  D store|               | Rn           | Rt            | offset
+    //  STXR   | Rs (status)   | Rn           | Rt            | offset
+    //  B      |               |              |               | instruction offset
+    //  CB     |               | Rt           |               | instruction offset
+    //  IW     | Rd            | Rd (MOVK)    | shift         | 16-bit immediate
+    //
+    // Destination fields hold DISCARD instead of XZR; unused fields are XZR (or 0).
+    struct Op
+    {
+        std::uint8_t opcode; // Opcode::Type
+        std::uint8_t rd;
+        std::uint8_t rn;
+        std::uint8_t rm;
+        std::int32_t imm;
+    };
+    static_assert(sizeof(Op) == 8, "Packed::Op must stay 8 bytes");
+
+    // Superinstructions produced by Fusion::fuse, numbered after the real opcodes. Each one
+    // stands for the instruction in its slot plus the following one(s), whose original
+    // records the handler reads from the unfused program.
+    enum Synthetic : std::uint8_t
+    {
+        CMP_BRANCH = Opcode::NONE + 1, // SUBS + B.cond
+        CMPI_BRANCH,                   // SUBIS + B.cond
+        CONST64,                       // MOVZ + MOVK... (imm indexes the constant pool, rm = count)
+        ADJUST_LOAD,                   // ADDI/SUBI Xa, Xa + LDUR [Xa]
+        ADJUST_STORE,                  // ADDI/SUBI Xa, Xa + STUR [Xa]
+        LOAD_ADJUST,                   // LDUR [Xa] + ADDI/SUBI Xa, Xa
+        SHIFT_ADD,                     // LSL + ADD
+        SYNTHETIC_END
+    };
+
+    bool is_store(Opcode::Type op);
+
+    Op pack(const Decoder::Instruction &instruction);
+    std::vector<Op> pack(const std::vector<Decoder::Instruction> &instructions);
+
+    std::ostream &operator<<(std::ostream &os, const Op &op);
+} // namespace Packed
@@ -1,92 +1,205 @@
 #include "parser.hpp"
 
-#include <exception>
-#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Parser
 {
-    std::vector<Token> parse(std::istream &in)
+    namespace
     {
-        std::vector<Token> tokens;
-
-        std::string line;
-        int line_number = 0;
+        // Same set as std::isspace in the "C" locale
+        bool is_space(char ch)
+        {
+            return ch == ' ' || (ch >= '\t' && ch <= '\r');
+        }
 
-        while (std::getline(in, line))
+        bool is_delimiter(char ch)
         {
-            ++line_number;
+            return is_space(ch) || ch == ',' || ch == ':';
+        }
 
-            std::size_t comment_pos = line.find('/');
-            if (comment_pos == std::string::npos)
-                comment_pos = line.size();
+        // First whitespace, ',' or ':' in [p, end), or end
+        const char *find_delimiter(const char *p, const char *end)
+        {
+#ifdef __SSE2__
+            const __m128i space = _mm_set1_epi8(' ');
+            const __m128i comma = _mm_set1_epi8(',');
+            const __m128i colon = _mm_set1_epi8(':');
+            const __m128i tab = _mm_set1_epi8('\t');
+            const __m128i control_span = _mm_set1_epi8('\r' - '\t');
+            for (; end - p >= 16; p += 16)
+            {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                __m128i control = _mm_sub_epi8(chunk, tab); // '\t'..'\r' map to 0..4, unsigned
+                __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, comma)),
+                                           _mm_or_si128(_mm_cmpeq_epi8(chunk, colon),
+                                                        _mm_cmpeq_epi8(_mm_min_epu8(control, control_span), control)));
+                int mask = _mm_movemask_epi8(hit);
+                if (mask)
+                    return p + __builtin_ctz(mask);
+            }
+#endif
+            while (p < end && !is_delimiter(*p))
+                p++;
+            return p;
+        }
 
-            std::string lexeme;
+        // Splits one line, without its comment, into tokens. Returns false after reporting an
+        // error, leaving the tokens it added.
+        bool parse_line(const char *line_start, const char *end, int line, std::vector<Token> &tokens,
+                        Diagnostics::List &diagnostics)
+        {
             bool label_valid = true;
             bool instruction_valid = true;
+            auto column = [&](const char *at)
+            { return static_cast<int>(at - line_start) + 1; };
 
-            std::size_t i;
-            char ch;
-            for (i = 0; i < comment_pos; i++)
+            for (const char *p = line_start; p < end;)
             {
-                ch = line[i];
+                const char *delimiter = find_delimiter(p, end);
+                std::string_view lexeme(p, static_cast<std::size_t>(delimiter - p));
+                if (delimiter == end)
+                {
+                    // A mnemonic alone on its line, like HALT, is still an instruction
+                    if (!lexeme.empty())
+                        tokens.push_back({instruction_valid ? TOKEN_INSTRUCTION : TOKEN_OPERAND, lexeme, line, column(p)});
+                    return true;
+                }
+
+                char ch = *delimiter;
+                const char *start = p;
+                p = delimiter + 1;
                 if (ch == ':')
                 {
                     if (lexeme.empty())
                     {
-                        throw std::runtime_error("Line " + std::to_string(line_number) + ": Error: empty label");
+                        diagnostics.report(Diagnostics::EMPTY_LABEL, line, column(start), lexeme);
+                        return false;
                     }
                     if (!label_valid)
                     {
-                        throw std::runtime_error("Line " + std::to_string(line_number) + ": Error: multiple labels on the same line");
+                        diagnostics.report(Diagnostics::MULTIPLE_LABELS, line, column(start), lexeme);
+                        return false;
                     }
-                    tokens.push_back({TOKEN_LABEL, lexeme, line_number});
-                    lexeme.clear();
+                    tokens.push_back({TOKEN_LABEL, lexeme, line, column(start)});
                     label_valid = false;
                 }
-                else if (std::isspace(ch) && instruction_valid)
+                else if (is_space(ch) && instruction_valid)
                 {
                     if (!lexeme.empty())
                     {
-                        tokens.push_back({TOKEN_INSTRUCTION, lexeme, line_number});
-                        lexeme.clear();
+                        tokens.push_back({TOKEN_INSTRUCTION, lexeme, line, column(start)});
                         instruction_valid = false;
                         label_valid = false;
                     }
                 }
-                else if (std::isspace(ch) || ch == ',')
+                else if (!lexeme.empty()) // whitespace or ',' after an operand
                 {
-                    if (!lexeme.empty())
+                    if (is_space(ch))
                     {
-                        if (std::isspace(ch))
+                        while (p < end && is_space(*p))
+                            p++;
+                        if (p < end && *p != ',')
                         {
-                            std::size_t next_nonspace = i;
-                            while (next_nonspace < comment_pos && std::isspace(line[next_nonspace]))
-                                next_nonspace++;
-                            if (next_nonspace < comment_pos && line[next_nonspace] != ',')
-                            {
-                                throw std::runtime_error("Line " + std::to_string(line_number) + ": Error: Expected comma-separated operands");
-                            }
-                            tokens.push_back({TOKEN_OPERAND, lexeme, line_number});
-                            lexeme.clear();
-                            i = next_nonspace - 1; // since i will be incremented from for loop
-                        }
-                        else // ','
-                        {
-                            tokens.push_back({TOKEN_OPERAND, lexeme, line_number});
-                            lexeme.clear();
+                            diagnostics.report(Diagnostics::EXPECTED_COMMA, line, column(p), std::string_view(p, static_cast<std::size_t>(find_delimiter(p, end) - p)));
+                            return false;
                         }
                     }
+                    tokens.push_back({TOKEN_OPERAND, lexeme, line, column(start)});
                 }
-                else
-                {
-                    lexeme += ch;
-                }
             }
+            return true;
+        }
+    } // namespace
+
+    Source::Source(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open " + path);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void *mapping = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                mapping_ = mapping;
+                data_ = static_cast<const char *>(mapping);
+                size_ = static_cast<std::size_t>(st.st_size);
+                close(fd);
+                return;
+            }
+        }
+
+        // Pipes, empty files, or a failed mapping: read it instead
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+            buffer_.append(chunk, static_cast<std::size_t>(n));
+        close(fd);
+        if (n < 0)
+            throw std::runtime_error("Failed to read " + path);
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+
+    Source::Source(std::istream &in) : buffer_(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>())
+    {
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+
+    Source::~Source()
+    {
+        if (mapping_)
+            munmap(mapping_, size_);
+    }
+
+    std::vector<Token> parse(std::string_view text)
+    {
+        Diagnostics::List diagnostics(0);
+        std::vector<Token> tokens = parse(text, diagnostics);
+        Diagnostics::throw_first(diagnostics);
+        return tokens;
+    }
+
+    std::vector<Token> parse(std::string_view text, Diagnostics::List &diagnostics)
+    {
+        std::vector<Token> tokens;
+
+        const char *p = text.data();
+        const char *end = p + text.size();
+        int line_number = 0;
+
+        while (p < end)
+        {
+            ++line_number;
+
+            const char *newline = static_cast<const char *>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+            const char *line_end = newline ? newline : end;
+            const char *comment = static_cast<const char *>(std::memchr(p, '/', static_cast<std::size_t>(line_end - p)));
 
-            if (!lexeme.empty())
+            const std::size_t first = tokens.size();
+            if (!parse_line(p, comment ? comment : line_end, line_number, tokens, diagnostics))
             {
-                tokens.push_back({TOKEN_OPERAND, lexeme, line_number});
+                // Keep the label, so branches to it do not report errors of their own
+                tokens.erase(std::remove_if(tokens.begin() + first, tokens.end(), [](const Token &token)
+                                            { return token.type != TOKEN_LABEL; }),
+                             tokens.end());
             }
+            p = newline ? newline + 1 : end;
         }
 
         return tokens;
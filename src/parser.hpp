@@ -3,6 +3,9 @@
 #include <istream>
 #include <vector>
 #include <string>
+#include <string_view>
+
+#include "diagnostics.hpp"
 
 namespace Parser
 {
@@ -14,11 +17,13 @@ namespace Parser
         TOKEN_COMMENTS,
     };
 
+    // Lexemes point into the parsed text, which must outlive the tokens
     struct Token
     {
         TokenType type;
-        std::string lexeme;
+        std::string_view lexeme;
         int line;
+        int column; // 1-based, in bytes
     };
 
     inline const char *to_string(TokenType type)
@@ -43,5 +48,30 @@ namespace Parser
         return os << "line " << token.line << ": " << to_string(token.type) << ", " << token.lexeme;
     }
 
-    std::vector<Token> parse(std::istream &in);
-} // namespace Parser
\ No newline at end of file
+    // Read-only contents of a source file: memory-mapped when possible, otherwise read into a buffer
+    class Source
+    {
+    public:
+        explicit Source(const std::string &path); // throws std::runtime_error if the file cannot be read
+        explicit Source(std::istream &in);
+        ~Source();
+
+        Source(const Source &) = delete;
+        Source &operator=(const Source &) = delete;
+
+        std::string_view text() const { return {data_, size_}; }
+
+    private:
+        const char *data_ = nullptr;
+        std::size_t size_ = 0;
+        void *mapping_ = nullptr;
+        std::string buffer_;
+    };
+
+    // Throws std::runtime_error with the first error
+    std::vector<Token> parse(std::string_view text);
+
+    // Reports errors into `diagnostics` instead, dropping the tokens of each line in error
+    // except its label
+    std::vector<Token> parse(std::string_view text, Diagnostics::List &diagnostics);
+} // namespace Parser
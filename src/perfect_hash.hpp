@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Collision-free name lookup over a fixed key set, built at compile time. Keys are hashed
+// case-insensitively; callers choose whether the final comparison is exact or case-folded.
+namespace PerfectHash
+{
+    constexpr char fold(char c) { return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c; }
+
+    constexpr std::uint32_t hash(std::string_view key, std::uint32_t seed)
+    {
+        std::uint32_t h = 2166136261u ^ seed; // FNV-1a
+        for (char c : key)
+        {
+            h ^= static_cast<std::uint8_t>(fold(c));
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    constexpr bool equal_folded(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (std::size_t i = 0; i < a.size(); i++)
+            if (fold(a[i]) != fold(b[i]))
+                return false;
+        return true;
+    }
+
+    template <std::size_t SIZE>
+    struct Table
+    {
+        static_assert((SIZE & (SIZE - 1)) == 0, "table size must be a power of two");
+
+        std::uint32_t seed = 0;
+        std::array<std::uint8_t, SIZE> slot{}; // key index + 1, or 0 when empty
+        bool valid = false;
+
+        // Index of the key that `name` may equal, or -1; the caller still compares names
+        constexpr int candidate(std::string_view name) const
+        {
+            return static_cast<int>(slot[hash(name, seed) & (SIZE - 1)]) - 1;
+        }
+    };
+
+    // Tries seeds until every key lands in its own slot. `Entry` needs a `name` member.
+    template <std::size_t SIZE, typename Entry, std::size_t N>
+    constexpr Table<SIZE> build(const Entry (&entries)[N])
+    {
+        static_assert(N < 255, "slot indices are 8-bit");
+        Table<SIZE> table;
+        for (std::uint32_t seed = 1; seed < 100000; seed++)
+        {
+            table.seed = seed;
+            table.slot = {};
+            bool collision = false;
+            for (std::size_t i = 0; i < N && !collision; i++)
+            {
+                std::uint8_t &slot = table.slot[hash(entries[i].name, seed) & (SIZE - 1)];
+                collision = slot != 0;
+                slot = static_cast<std::uint8_t>(i + 1);
+            }
+            if (!collision)
+            {
+                table.valid = true;
+                return table;
+            }
+        }
+        return table;
+    }
+} // namespace PerfectHash
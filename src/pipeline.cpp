@@ -0,0 +1,88 @@
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace Pipeline
+{
+    namespace
+    {
+        enum class Control : std::uint8_t
+        {
+            NONE,
+            DIRECT,  // B, BL: target known in ID
+            DECIDED, // B.cond, CBZ, CBNZ, BR: taken or target known at Config::resolve
+        };
+
+        struct Traits
+        {
+            bool reads_rn, reads_rm, reads_flags, sets_flags, load;
+            Control control;
+        };
+
+        constexpr std::array<Traits, Opcode::NONE + 1> TRAITS = []
+        {
+            std::array<Traits, Opcode::NONE + 1> traits{};
+            for (int op = 0; op <= Opcode::NONE; op++)
+            {
+                const Opcode::Format format = Opcode::INFO[op].format;
+                traits[op].reads_rn = op != Opcode::MOVZ; // MOVZ carries Rd in rn for MOVK's sake
+                traits[op].reads_rm = format != Opcode::Format::IW; // rm holds the shift
+                if (format == Opcode::Format::CB)
+                    traits[op].control = Control::DECIDED;
+                traits[op].reads_flags = format == Opcode::Format::CB && op != Opcode::CBZ && op != Opcode::CBNZ;
+            }
+            traits[Opcode::B].control = traits[Opcode::BL].control = Control::DIRECT;
+            traits[Opcode::BR].control = Control::DECIDED;
+            for (int op : {Opcode::ADDS, Opcode::ADDIS, Opcode::SUBS, Opcode::SUBIS, Opcode::ANDS, Opcode::ANDIS})
+                traits[op].sets_flags = true;
+            for (int op : {Opcode::LDUR, Opcode::LDURB, Opcode::LDURH, Opcode::LDURSW, Opcode::LDXR})
+                traits[op].load = true;
+            return traits;
+        }();
+    } // namespace
+
+    Model::Model(Cpu::Machine &machine, const Config &config) : machine_(machine)
+    {
+        const Cpu::Program &program = machine.program();
+        timings_.resize(program.size());
+        for (std::size_t pc = 0; pc < program.size(); pc++)
+        {
+            const Packed::Op &op = program.ops()[pc];
+            const Traits &traits = TRAITS[std::min<unsigned>(op.opcode, Opcode::NONE)];
+            Timing &timing = timings_[pc];
+            timing.sources[0] = traits.reads_rn ? op.rn : UNUSED;
+            timing.sources[1] = traits.reads_rm ? op.rm : UNUSED;
+            timing.sources[2] = traits.reads_flags ? FLAGS : UNUSED;
+            timing.results[0] = op.rd == Packed::DISCARD ? IGNORED : op.rd;
+            timing.results[1] = op.opcode == Opcode::BL ? Register::X30 : traits.sets_flags ? FLAGS : IGNORED;
+
+            // Forwarded ALU results can be used from the end of EX, loads from the end of MEM;
+            // otherwise from WB
+            const unsigned latency = !config.forwarding ? 3 : traits.load ? 2 : 1;
+            timing.delay = static_cast<std::uint8_t>(latency << 1 | traits.load);
+            const bool decided = traits.control == Control::DECIDED;
+            timing.early = decided && config.forwarding && config.resolve == Resolve::ID ? 2 : 0;
+            timing.penalty = decided ? static_cast<std::uint8_t>(config.resolve) : traits.control == Control::DIRECT ? 1 : 0;
+        }
+    }
+
+    Cpu::Status Model::run(std::uint64_t max_steps)
+    {
+        Cpu::Status status = machine_.run(max_steps, *this);
+
+        // The last instruction seen retired if the budget ran out; otherwise it faulted or was
+        // the end-of-program sentinel. Either way the next pc is now known.
+        if (pending_ && status == Cpu::Status::BUDGET_EXHAUSTED)
+            issue(pc_, machine_.state.pc);
+        pending_ = false;
+        return status;
+    }
+
+    std::ostream &operator<<(std::ostream &os, const Stats &stats)
+    {
+        return os << stats.cycles << " cycles, CPI " << stats.cpi() << " (" << stats.data_stalls << " data, "
+                  << stats.load_use_stalls << " load-use and " << stats.branch_stalls << " branch stall cycles; "
+                  << stats.taken << " of " << stats.branches << " branches taken)";
+    }
+} // namespace Pipeline
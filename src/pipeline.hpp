@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "cpu.hpp"
+#include "packed.hpp"
+
+// Cycle-level timing of the classic five-stage LEGv8 pipeline (IF, ID, EX, MEM, WB).
+//
+// The model rides along with functional execution: the machine computes every result and
+// the model only works out when each instruction would have entered ID. One instruction
+// issues per cycle unless it must wait for an operand. With forwarding, a value can be used
+// by the next instruction's EX (the cycle after the producer's EX, or after a load's MEM);
+// without it, it can be read in ID once the producer has reached WB, since the register file
+// is written in the first half of a cycle and read in the second. Branches are predicted not
+// taken, so a taken branch flushes the instructions fetched behind it.
+namespace Pipeline
+{
+    // Stage that decides conditional branches and BR; a taken one costs this many bubbles.
+    // Deciding in ID also moves the branch's operand reads there, which adds hazards.
+    enum class Resolve : unsigned
+    {
+        ID = 1,
+        EX = 2,
+        MEM = 3,
+    };
+
+    struct Config
+    {
+        bool forwarding = true;
+        Resolve resolve = Resolve::ID; // B and BL always resolve in ID
+    };
+
+    struct Stats
+    {
+        std::uint64_t instructions = 0;
+        std::uint64_t cycles = 0; // from the first fetch to the last write-back
+        std::uint64_t data_stalls = 0;     // waiting for an ALU result
+        std::uint64_t load_use_stalls = 0; // waiting for a load
+        std::uint64_t branch_stalls = 0;   // bubbles behind taken branches
+        std::uint64_t branches = 0;
+        std::uint64_t taken = 0;
+
+        double cpi() const { return instructions ? static_cast<double>(cycles) / instructions : 0.0; }
+    };
+
+    class Model : public Cpu::Observer
+    {
+    public:
+        // Timing starts from the machine's current state with an empty pipeline
+        explicit Model(Cpu::Machine &machine, const Config &config = Config());
+
+        // Like Machine::run, but timed. Interprets without the JIT or fused instructions.
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        const Stats &stats() const { return stats_; }
+
+        // Hook for the interpreter, called before each instruction executes. An instruction
+        // is timed once the next one arrives, when it is known whether a branch was taken.
+        static constexpr bool OBSERVING = true;
+        void before(const Packed::Op &, std::size_t pc, std::uint64_t)
+        {
+            if (pending_)
+                issue(pc_, pc);
+            pc_ = pc;
+            pending_ = true;
+        }
+
+    private:
+        // Register slots: X0-X30, XZR, then NZCV, one that is never written and one that is
+        // never read, so unused operands need no branches
+        static constexpr unsigned FLAGS = Register::NONE + 1;
+        static constexpr unsigned UNUSED = FLAGS + 1;
+        static constexpr unsigned IGNORED = FLAGS + 2;
+
+        // What each instruction of the program reads and writes, decoded once up front
+        struct Timing
+        {
+            std::uint8_t sources[3];
+            std::uint8_t results[2];
+            std::uint8_t delay;   // cycles after ID until a result can be used, encoded as in ready_
+            std::uint8_t early;   // 2 if the operands are needed in ID, else 0
+            std::uint8_t penalty; // bubbles if the branch is taken, 0 for other instructions
+        };
+        static_assert(sizeof(Timing) == 8, "Pipeline::Model::Timing must stay 8 bytes");
+
+        void issue(std::size_t pc, std::size_t next_pc)
+        {
+            const Timing &timing = timings_[pc];
+
+            std::uint64_t when = next_id_ << 1;
+            for (std::uint8_t source : timing.sources)
+                when = std::max(when, ready_[source] + timing.early);
+            const std::uint64_t id = when >> 1;
+            const std::uint64_t stalls = id - next_id_;
+            const bool load = when & 1;
+            stats_.load_use_stalls += load ? stalls : 0;
+            stats_.data_stalls += load ? 0 : stalls;
+
+            const std::uint64_t result = (id << 1) + timing.delay;
+            ready_[timing.results[0]] = result;
+            ready_[timing.results[1]] = result;
+
+            // Only branches leave pc + 1, and each of them has a nonzero penalty
+            const bool taken = next_pc != pc + 1;
+            const std::uint64_t bubbles = taken ? timing.penalty : 0;
+            stats_.branches += timing.penalty != 0;
+            stats_.taken += taken;
+            stats_.branch_stalls += bubbles;
+
+            stats_.instructions++;
+            stats_.cycles = id + 4; // WB at id + 3, counting cycle 0
+            next_id_ = id + 1 + bubbles;
+        }
+
+        Cpu::Machine &machine_;
+        Stats stats_;
+        std::vector<Timing> timings_; // by pc
+        std::uint64_t next_id_ = 1;   // earliest cycle the next instruction can be in ID
+
+        // Per slot, the cycle from which an instruction in ID may use the latest value, times
+        // two, plus one if a load produced it: the max over an instruction's sources then
+        // gives both when it issues and whether it waited for a load
+        std::uint64_t ready_[IGNORED + 1] = {};
+        std::size_t pc_ = 0;
+        bool pending_ = false;
+    };
+
+    std::ostream &operator<<(std::ostream &os, const Stats &stats);
+} // namespace Pipeline
@@ -0,0 +1,213 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace Profile
+{
+    Profiler::Profiler(Cpu::Machine &machine, const std::vector<Decoder::Label> &labels)
+        : machine_(machine), calls_(machine.program_size() + 1, PLAIN), functions_(machine.program_size() + 1, 0),
+          starts_(machine.program_size() + 2), stops_(machine.program_size() + 2)
+    {
+        const std::size_t size = machine.program_size();
+        const Packed::Op *ops = machine.program().ops();
+        for (std::size_t pc = 0; pc < size; pc++)
+        {
+            if (ops[pc].opcode == Opcode::BL)
+                calls_[pc] = CALL;
+            else if (ops[pc].opcode == Opcode::BR)
+                calls_[pc] = RETURN;
+        }
+
+        std::vector<Decoder::Label> sorted = labels;
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Decoder::Label &a, const Decoder::Label &b)
+                         { return a.index < b.index; });
+        names_.push_back("(no label)");
+        label_pcs_.push_back(0);
+        for (std::size_t i = 0; i < sorted.size(); i++)
+        {
+            // Each label's function runs up to the next label
+            names_.push_back(sorted[i].name);
+            label_pcs_.push_back(sorted[i].index);
+            const std::size_t end = i + 1 < sorted.size() ? sorted[i + 1].index : functions_.size();
+            std::fill(functions_.begin() + std::min(sorted[i].index, functions_.size()), functions_.begin() + std::min(end, functions_.size()),
+                      static_cast<std::uint32_t>(names_.size() - 1));
+        }
+
+        contexts_.push_back({0, functions_[std::min(machine.state.pc, size)]});
+    }
+
+    Cpu::Status Profiler::run(std::uint64_t max_steps)
+    {
+        start_ = machine_.state.pc;
+        starts_[start_]++;
+        Cpu::Status status = machine_.run(max_steps, *this);
+
+        // Close the straight line that was running: it stopped short of machine_.state.pc
+        stops_[machine_.state.pc]++;
+        contexts_[context_].instructions += machine_.state.pc - start_;
+        return status;
+    }
+
+    void Profiler::call_or_return(std::size_t from, std::size_t to)
+    {
+        if (calls_[from] == RETURN)
+        {
+            // Any BR back to a pending return address returns, through as many frames as it
+            // skips; other BRs are jumps within the function
+            for (std::size_t frame = frames_.size(); frame-- > 0;)
+            {
+                if (frames_[frame].returns_to == to)
+                {
+                    context_ = frames_[frame].caller;
+                    frames_.resize(frame);
+                    break;
+                }
+            }
+            return;
+        }
+
+        frames_.push_back({context_, from + 1});
+        const std::uint32_t function = functions_[to];
+        auto [child, added] = children_.try_emplace(std::uint64_t{context_} << 32 | function,
+                                                    static_cast<std::uint32_t>(contexts_.size()));
+        if (added)
+            contexts_.push_back({context_, function});
+        context_ = child->second;
+    }
+
+    std::vector<std::uint64_t> Profiler::counts() const
+    {
+        std::vector<std::uint64_t> counts(machine_.program_size());
+        std::uint64_t running = 0;
+        for (std::size_t pc = 0; pc < counts.size(); pc++)
+        {
+            running += starts_[pc] - stops_[pc];
+            counts[pc] = running;
+        }
+        return counts;
+    }
+
+    std::string Profiler::name(std::size_t pc) const
+    {
+        const std::uint32_t function = functions_[pc];
+        if (function == 0)
+            return std::to_string(pc);
+        return names_[function] + "+" + std::to_string(pc - label_pcs_[function]);
+    }
+
+    void Profiler::annotate(std::ostream &os, std::string_view source, const std::vector<int> &lines) const
+    {
+        const std::vector<std::uint64_t> counts = this->counts();
+        const std::ios::fmtflags saved = os.flags();
+        if (lines.empty())
+        {
+            // No source to show (a binary image): list the instructions by label instead
+            os << std::setw(12) << "count" << "  instruction\n";
+            for (std::size_t pc = 0; pc < counts.size(); pc++)
+                os << std::setw(12) << counts[pc] << "  " << name(pc) << '\n';
+            os.flags(saved);
+            return;
+        }
+
+        std::uint64_t total = 0;
+        std::vector<std::uint64_t> by_line;
+        std::vector<bool> has_code;
+        for (std::size_t pc = 0; pc < counts.size() && pc < lines.size(); pc++)
+        {
+            const std::size_t line = static_cast<std::size_t>(lines[pc]);
+            if (line >= by_line.size())
+            {
+                by_line.resize(line + 1);
+                has_code.resize(line + 1);
+            }
+            by_line[line] += counts[pc];
+            has_code[line] = true;
+            total += counts[pc];
+        }
+
+        os << std::setw(12) << "count" << std::setw(9) << "%" << std::setw(7) << "line" << "  source\n";
+        std::size_t line = 1;
+        for (std::size_t start = 0; start < source.size(); line++)
+        {
+            std::size_t end = std::min(source.find('\n', start), source.size());
+            if (line < has_code.size() && has_code[line])
+                os << std::setw(12) << by_line[line] << std::setw(8) << std::fixed << std::setprecision(2)
+                   << (total ? 100.0 * by_line[line] / total : 0.0) << '%';
+            else
+                os << std::setw(21) << "";
+            os << std::setw(7) << line << "  " << source.substr(start, end - start) << '\n';
+            start = end + 1;
+        }
+        os.flags(saved);
+    }
+
+    void Profiler::folded(std::ostream &os) const
+    {
+        std::vector<std::uint32_t> path;
+        for (std::uint32_t context = 0; context < contexts_.size(); context++)
+        {
+            if (!contexts_[context].instructions)
+                continue;
+            path.clear();
+            for (std::uint32_t node = context;; node = contexts_[node].parent)
+            {
+                path.push_back(contexts_[node].function);
+                if (node == 0)
+                    break;
+            }
+            for (auto function = path.rbegin(); function != path.rend(); ++function)
+                os << (function == path.rbegin() ? "" : ";") << names_[*function];
+            os << ' ' << contexts_[context].instructions << '\n';
+        }
+    }
+
+    void Profiler::hottest(std::ostream &os, std::size_t top) const
+    {
+        // Blocks start at labels, branch targets and after branches, and wherever a run began
+        const std::vector<std::uint64_t> counts = this->counts();
+        const Packed::Op *ops = machine_.program().ops();
+        std::vector<bool> leader(counts.size() + 1);
+        leader[0] = true;
+        for (std::size_t pc = 0; pc < counts.size(); pc++)
+        {
+            leader[pc] = leader[pc] || starts_[pc] || (pc > 0 && functions_[pc] != functions_[pc - 1]);
+            const Opcode::Format format = Opcode::INFO[ops[pc].opcode].format;
+            if (format == Opcode::Format::B || format == Opcode::Format::CB || ops[pc].opcode == Opcode::BR)
+            {
+                leader[pc + 1] = true;
+                if (ops[pc].opcode != Opcode::BR && pc + ops[pc].imm < counts.size())
+                    leader[pc + ops[pc].imm] = true;
+            }
+        }
+
+        struct Block
+        {
+            std::size_t first, last;
+            std::uint64_t instructions;
+        };
+        std::vector<Block> blocks;
+        std::uint64_t total = 0;
+        for (std::size_t pc = 0; pc < counts.size(); pc++)
+        {
+            if (leader[pc])
+                blocks.push_back({pc, pc, 0});
+            blocks.back().last = pc;
+            blocks.back().instructions += counts[pc];
+            total += counts[pc];
+        }
+        std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b)
+                  { return a.instructions > b.instructions; });
+
+        const std::ios::fmtflags saved = os.flags();
+        os << "Hottest blocks:\n";
+        for (std::size_t i = 0; i < blocks.size() && i < top && blocks[i].instructions; i++)
+        {
+            const Block &block = blocks[i];
+            os << std::setw(14) << block.instructions << std::setw(8) << std::fixed << std::setprecision(2)
+               << 100.0 * block.instructions / total << "%  " << counts[block.first] << " x "
+               << name(block.first) << " .. " << name(block.last) << '\n';
+        }
+        os.flags(saved);
+    }
+} // namespace Profile
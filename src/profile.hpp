@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu.hpp"
+#include "decoder.hpp"
+
+// Counts where a guest program spends its instructions.
+//
+// Nothing is recorded per instruction. Execution runs in straight lines between branches,
+// so the profiler only counts, at each branch, where the straight line it ends began and
+// where the next one starts; per-instruction counts are then a running sum over the program.
+// It also follows BL and the BR that returns from it to keep a calling context, named by
+// the program's labels, and charges each straight line to the context it ran in.
+namespace Profile
+{
+    class Profiler : public Cpu::Observer
+    {
+    public:
+        // Counting starts from the machine's current state
+        Profiler(Cpu::Machine &machine, const std::vector<Decoder::Label> &labels);
+
+        // Like Machine::run, but profiled. Interprets without the JIT, fused or not.
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // Times each instruction retired
+        std::vector<std::uint64_t> counts() const;
+
+        // The source, each line prefixed by how many times its instruction retired and that
+        // count's share of the total. `lines` gives each instruction's source line; when it is
+        // empty, lists the instructions instead.
+        void annotate(std::ostream &os, std::string_view source, const std::vector<int> &lines) const;
+
+        // One "outer;inner;innermost COUNT" line per calling context, for flame graph tools
+        void folded(std::ostream &os) const;
+
+        // The `top` basic blocks that retired the most instructions
+        void hottest(std::ostream &os, std::size_t top = 10) const;
+
+        // Hook for the interpreter, called for every branch executed
+        void branch(std::size_t from, std::size_t to)
+        {
+            stops_[from + 1]++;
+            starts_[to]++;
+            contexts_[context_].instructions += from + 1 - start_;
+            start_ = to;
+            if (calls_[from] != PLAIN)
+                call_or_return(from, to);
+        }
+
+    private:
+        enum Call : std::uint8_t
+        {
+            PLAIN,
+            CALL,   // BL
+            RETURN, // BR, if it goes to a return address
+        };
+
+        struct Frame
+        {
+            std::uint32_t caller;   // context
+            std::size_t returns_to; // pc
+        };
+
+        struct Context
+        {
+            std::uint32_t parent;
+            std::uint32_t function; // index into names_
+            std::uint64_t instructions = 0;
+        };
+
+        void call_or_return(std::size_t from, std::size_t to);
+        std::string name(std::size_t pc) const; // nearest label+offset
+
+        Cpu::Machine &machine_;
+        std::vector<Call> calls_;              // by pc
+        std::vector<std::uint32_t> functions_; // by pc: index into names_ of the closest label at or before it
+        std::vector<std::string> names_;       // "(no label)", then the labels by index
+        std::vector<std::size_t> label_pcs_;   // index of each name's label
+
+        // A straight line from pc S through pc E counts starts_[S]++ and stops_[E + 1]++
+        std::vector<std::uint64_t> starts_, stops_;
+        std::size_t start_ = 0; // of the straight line running now
+
+        std::vector<Context> contexts_; // the first is the root
+        std::unordered_map<std::uint64_t, std::uint32_t> children_; // by parent << 32 | function
+        std::uint32_t context_ = 0;
+        std::vector<Frame> frames_; // calls not yet returned from
+    };
+} // namespace Profile
@@ -0,0 +1,155 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Replay
+{
+    Recorder::Recorder(Cpu::Machine &machine, const Config &config)
+        : machine_(machine), config_(config), head_(machine.retired), tail_(machine.retired),
+          interval_(std::max<std::uint64_t>(config.checkpoint_interval, 1))
+    {
+        std::size_t entries = 1;
+        while (entries < config.log_entries)
+            entries <<= 1;
+        log_.resize(entries);
+        mask_ = entries - 1;
+        checkpoints_.emplace_back(head_, machine_.snapshot());
+    }
+
+    Cpu::Status Recorder::run(std::uint64_t max_steps)
+    {
+        for (;;)
+        {
+            const std::uint64_t next = start() + ((head_ - start()) / interval_ + 1) * interval_;
+            const std::uint64_t before = machine_.retired;
+            Cpu::Status status = machine_.run(std::min(max_steps, next - head_), *this);
+            head_ += machine_.retired - before;
+            max_steps -= machine_.retired - before;
+
+            // An instruction that halted or faulted did not retire, but its entry was written
+            // too, possibly over the oldest
+            const bool stopped = status != Cpu::Status::BUDGET_EXHAUSTED;
+            if (head_ + stopped - tail_ > log_.size())
+                tail_ = head_ + stopped - log_.size();
+            while (!exclusives_.empty() && exclusives_.front().index < tail_)
+                exclusives_.pop_front();
+            if (stopped)
+            {
+                if (!exclusives_.empty() && exclusives_.back().index == head_)
+                    exclusives_.pop_back();
+                return status;
+            }
+            if (head_ == next && next > checkpoints_.back().first)
+                checkpoint();
+            if (max_steps == 0)
+                return status;
+        }
+    }
+
+    Cpu::Status Recorder::seek(std::uint64_t index)
+    {
+        if (index >= machine_.retired)
+            return run(index - machine_.retired);
+        if (index < start())
+            throw std::runtime_error("Error: instruction " + std::to_string(index) + " is before the recording started");
+
+        auto checkpoint = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), index,
+                                           [](std::uint64_t key, const auto &entry)
+                                           { return key < entry.first; }) -
+                          1;
+        if (index >= tail_ && machine_.retired - index <= index - checkpoint->first)
+        {
+            while (machine_.retired > index)
+                undo();
+            return Cpu::Status::BUDGET_EXHAUSTED;
+        }
+
+        machine_.restore(checkpoint->second);
+        head_ = tail_ = checkpoint->first;
+        exclusives_.clear();
+        return run(index - checkpoint->first);
+    }
+
+    void Recorder::record(Entry &entry, const Packed::Op &op, std::uint64_t index)
+    {
+        Cpu::State &state = machine_.state;
+        switch (UNDO[op.opcode])
+        {
+        case LINK:
+            entry.old = state.x[Register::X30];
+            break;
+        case EXCLUSIVE:
+            entry.old = state.x[op.rd];
+            break;
+        case STORE:
+        {
+            // Only the bytes the store covers, and nothing from a device, which reading
+            // could disturb and undo leaves alone
+            std::uint64_t old = 0;
+            const std::uint64_t address = state.x[op.rn] + static_cast<std::int64_t>(op.imm);
+            if (!machine_.memory().is_device(address))
+                switch (STORE_SIZES[op.opcode])
+                {
+                case 8: machine_.memory().load(address, 8, old); break;
+                case 4: machine_.memory().load(address, 4, old); break;
+                case 2: machine_.memory().load(address, 2, old); break;
+                default: machine_.memory().load(address, 1, old); break;
+                }
+            entry.old = old;
+            break;
+        }
+        }
+        if (op.opcode == Opcode::LDXR || op.opcode == Opcode::STXR)
+            exclusives_.push_back({index, state.x[op.rd], state.monitor});
+    }
+
+    void Recorder::undo()
+    {
+        const Entry &entry = log_[--head_ & mask_];
+        const Packed::Op &op = machine_.program().ops()[entry.pc];
+        Cpu::State &state = machine_.state;
+        switch (UNDO[op.opcode])
+        {
+        case REGISTER:
+        case EXCLUSIVE:
+            state.x[op.rd] = entry.old;
+            break;
+        case LINK:
+            state.x[Register::X30] = entry.old;
+            break;
+        case STORE:
+        {
+            // What reached a device stays done
+            const std::uint64_t address = state.x[op.rn] + static_cast<std::int64_t>(op.imm);
+            if (!machine_.memory().is_device(address))
+                machine_.memory().store(address, STORE_SIZES[op.opcode], entry.old);
+            break;
+        }
+        }
+        if (op.opcode == Opcode::LDXR || op.opcode == Opcode::STXR)
+        {
+            const Exclusive &exclusive = exclusives_.back();
+            state.x[op.rd] = exclusive.status;
+            state.monitor = exclusive.monitor;
+            exclusives_.pop_back();
+        }
+        state.flags = entry.flags;
+        state.pc = entry.pc;
+        machine_.retired--;
+    }
+
+    void Recorder::checkpoint()
+    {
+        checkpoints_.emplace_back(head_, machine_.snapshot());
+        if (checkpoints_.size() <= config_.max_checkpoints)
+            return;
+
+        // Keep the start and every other checkpoint after it
+        interval_ *= 2;
+        const std::uint64_t first = start();
+        checkpoints_.erase(std::remove_if(checkpoints_.begin() + 1, checkpoints_.end(), [&](const auto &entry)
+                                          { return (entry.first - first) % interval_ != 0; }),
+                           checkpoints_.end());
+    }
+} // namespace Replay
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "cpu.hpp"
+#include "opcodes.hpp"
+#include "packed.hpp"
+
+// Records a machine's execution so it can be stepped backward or moved to any earlier point.
+//
+// Before each instruction the recorder logs what that instruction is about to destroy: its
+// pc, the flags, and the old value of the register or memory it writes. The log is a ring
+// buffer, so recent history can be undone one instruction at a time. Every
+// `checkpoint_interval` instructions it also takes a copy-on-write snapshot of the machine.
+// A point older than the log is reached by restoring the checkpoint before it and replaying
+// forward, which costs at most one interval because execution is deterministic. When more
+// than `max_checkpoints` pile up, every other one is dropped and the interval doubles.
+namespace Replay
+{
+    struct Config
+    {
+        std::size_t log_entries = std::size_t{1} << 20;             // 16 bytes each; rounded up to a power of two
+        std::uint64_t checkpoint_interval = std::uint64_t{1} << 20; // instructions
+        std::size_t max_checkpoints = 64;
+    };
+
+    class Recorder : public Cpu::Observer
+    {
+    public:
+        // Recording starts from the machine's current state. While recording, run the machine
+        // only through the recorder.
+        explicit Recorder(Cpu::Machine &machine, const Config &config = Config());
+
+        // Like Machine::run, but recorded. Interprets without the JIT or fused instructions.
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // Moves the machine to where `index` instructions had retired (see Machine::retired),
+        // undoing from the current point or replaying from a checkpoint, whichever is shorter.
+        // Moving forward stops early, returning the status, if the program halts or faults.
+        // Throws std::runtime_error for points before the recording started.
+        Cpu::Status seek(std::uint64_t index);
+
+        std::uint64_t start() const { return checkpoints_.front().first; }
+
+        // Hook for the interpreter, called before each instruction executes
+        static constexpr bool OBSERVING = true;
+        void before(const Packed::Op &op, std::size_t pc, std::uint64_t step)
+        {
+            // head_ only moves between runs, so the log index depends on no earlier hook
+            const std::uint64_t index = head_ + step;
+            Entry &entry = log_[index & mask_];
+            entry.pc = static_cast<std::uint32_t>(pc);
+            entry.flags = machine_.state.flags;
+            // Most instructions overwrite only rd; the rest are recorded out of line so this
+            // stays small enough to inline into the interpreter
+            if (UNDO[op.opcode] == Undo::REGISTER)
+                entry.old = machine_.state.x[op.rd];
+            else
+                record(entry, op, index);
+        }
+
+    private:
+        struct Entry
+        {
+            std::uint32_t pc;
+            Cpu::Flags flags;
+            std::uint64_t old; // register the instruction writes, or memory it stores over
+        };
+        static_assert(sizeof(Entry) == 16, "Replay::Recorder::Entry must stay 16 bytes");
+
+        // What LDXR and STXR destroy beyond their entry: the monitor, and STXR's status register
+        struct Exclusive
+        {
+            std::uint64_t index;
+            std::uint64_t status;
+            Cpu::Monitor monitor;
+        };
+
+        // What an instruction destroys besides the pc and flags
+        enum Undo : std::uint8_t
+        {
+            REGISTER, // rd
+            LINK,     // X30
+            STORE,    // the memory it stores over; STXR also its status register and the monitor
+            EXCLUSIVE // LDXR: rd and the monitor
+        };
+
+        static constexpr std::array<std::uint8_t, Packed::SYNTHETIC_END> UNDO = []
+        {
+            std::array<std::uint8_t, Packed::SYNTHETIC_END> undo{};
+            undo[Opcode::BL] = LINK;
+            undo[Opcode::STUR] = undo[Opcode::STURW] = undo[Opcode::STURH] = undo[Opcode::STURB] = STORE;
+            undo[Opcode::STXR] = STORE;
+            undo[Opcode::LDXR] = EXCLUSIVE;
+            return undo;
+        }();
+
+        static constexpr std::array<std::uint8_t, Packed::SYNTHETIC_END> STORE_SIZES = []
+        {
+            std::array<std::uint8_t, Packed::SYNTHETIC_END> sizes{};
+            sizes[Opcode::STUR] = sizes[Opcode::STXR] = 8;
+            sizes[Opcode::STURW] = 4;
+            sizes[Opcode::STURH] = 2;
+            sizes[Opcode::STURB] = 1;
+            return sizes;
+        }();
+
+        void record(Entry &entry, const Packed::Op &op, std::uint64_t index);
+        void undo();
+        void checkpoint();
+
+        Cpu::Machine &machine_;
+        Config config_;
+        std::vector<Entry> log_;
+        std::deque<Exclusive> exclusives_; // by index, none before tail_
+        std::size_t mask_;
+        std::uint64_t head_; // index of the instruction the next entry is for, as of the last run
+        std::uint64_t tail_; // oldest index that can still be undone to
+        std::uint64_t interval_;
+        std::vector<std::pair<std::uint64_t, Cpu::Snapshot>> checkpoints_; // by index, the first at start()
+    };
+} // namespace Replay
@@ -0,0 +1,238 @@
+#include "trace.hpp"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace Trace
+{
+    namespace
+    {
+        enum Tag : std::uint8_t
+        {
+            JUMP = 1,
+            WRITE = 2,
+            ACCESS = 4,
+            FLAGS = 8,
+        };
+
+        constexpr std::array<bool, Opcode::NONE + 1> ACCESSES_MEMORY = []
+        {
+            std::array<bool, Opcode::NONE + 1> memory{};
+            for (int op = 0; op < Opcode::NONE; op++)
+                memory[op] = Opcode::INFO[op].format == Opcode::Format::D;
+            return memory;
+        }();
+
+        // tag, pc delta, opcode, register and value, address
+        constexpr std::size_t MAX_RECORD = 1 + 10 + 1 + 1 + 10 + 10;
+
+        std::uint8_t *put_varint(std::uint8_t *out, std::uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                *out++ = static_cast<std::uint8_t>(value | 0x80);
+                value >>= 7;
+            }
+            *out++ = static_cast<std::uint8_t>(value);
+            return out;
+        }
+
+        // Small differences either way become small numbers
+        std::uint64_t zigzag(std::uint64_t delta)
+        {
+            return delta << 1 ^ static_cast<std::uint64_t>(static_cast<std::int64_t>(delta) >> 63);
+        }
+
+        std::uint64_t unzigzag(std::uint64_t value) { return value >> 1 ^ (0 - (value & 1)); }
+
+        std::uint8_t pack(const Cpu::Flags &f) { return static_cast<std::uint8_t>(f.n << 3 | f.z << 2 | f.c << 1 | f.v); }
+
+        Cpu::Flags unpack(unsigned nzcv)
+        {
+            return {static_cast<bool>(nzcv & 8), static_cast<bool>(nzcv & 4), static_cast<bool>(nzcv & 2),
+                    static_cast<bool>(nzcv & 1)};
+        }
+
+        std::runtime_error corrupt() { return std::runtime_error("trace is truncated or corrupt"); }
+    } // namespace
+
+    Writer::Writer(const std::string &path, const Cpu::Machine &machine)
+        : file_(path, std::ios::binary), ops_(machine.program().ops()), pc_(machine.state.pc - 1),
+          flags_(machine.state.flags),
+          entries_out_([this](const Entry *entries, std::size_t count) { write(entries, count); })
+    {
+        if (!file_)
+            throw std::runtime_error("failed to create " + path);
+        std::memcpy(x_, machine.state.x, sizeof(x_));
+
+        std::vector<std::uint8_t> header(sizeof(MAGIC) + 1 + 10 + 1 + 10 * Register::XZR);
+        std::memcpy(header.data(), MAGIC, sizeof(MAGIC));
+        header[sizeof(MAGIC)] = VERSION;
+        std::uint8_t *p = put_varint(header.data() + sizeof(MAGIC) + 1, machine.state.pc);
+        *p++ = pack(flags_);
+        for (int r = Register::X0; r < Register::XZR; r++)
+            p = put_varint(p, x_[r]);
+        header.resize(static_cast<std::size_t>(p - header.data()));
+        file_.write(reinterpret_cast<const char *>(header.data()), static_cast<std::streamsize>(header.size()));
+        bytes_ = header.size();
+    }
+
+    Writer::~Writer()
+    {
+        try
+        {
+            finish();
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    void Writer::finish()
+    {
+        if (finished_)
+            return;
+        finished_ = true;
+        entries_out_.finish();
+
+        file_.flush();
+        if (failed_ || !file_)
+            throw std::runtime_error("failed to write the trace");
+    }
+
+    void Writer::write(const Entry *entries, std::size_t count)
+    {
+        out_.resize(count * MAX_RECORD);
+        std::uint8_t *p = out_.data();
+        for (std::size_t i = 0; i < count; i++)
+        {
+            const Entry &entry = entries[i];
+            const Packed::Op &op = ops_[entry.pc];
+            std::uint8_t *tag = p++;
+            *tag = 0;
+            if (entry.pc != pc_ + 1)
+            {
+                *tag |= JUMP;
+                p = put_varint(p, zigzag(entry.pc - (pc_ + 1)));
+            }
+            pc_ = entry.pc;
+            *p++ = op.opcode;
+
+            // Addresses come from the registers before the instruction wrote any
+            if (ACCESSES_MEMORY[op.opcode])
+            {
+                const std::uint64_t address = x_[op.rn] + static_cast<std::int64_t>(op.imm);
+                *tag |= ACCESS;
+                p = put_varint(p, zigzag(address - address_));
+                address_ = address;
+            }
+            const unsigned reg = op.opcode == Opcode::BL ? Register::X30 : op.rd;
+            if (reg < Register::XZR)
+            {
+                *tag |= WRITE;
+                *p++ = static_cast<std::uint8_t>(reg);
+                p = put_varint(p, zigzag(entry.value - x_[reg]));
+                x_[reg] = entry.value;
+            }
+            if (std::memcmp(&entry.flags, &flags_, sizeof(flags_)) != 0)
+            {
+                *tag |= FLAGS | pack(entry.flags) << 4;
+                flags_ = entry.flags;
+            }
+        }
+        out_.resize(static_cast<std::size_t>(p - out_.data()));
+        entries_ += count;
+
+        if (!failed_ && !file_.write(reinterpret_cast<const char *>(out_.data()), static_cast<std::streamsize>(out_.size())))
+            failed_ = true;
+        bytes_ += out_.size();
+    }
+
+    Cpu::Status Tracer::run(std::uint64_t max_steps)
+    {
+        Cpu::Status status = machine_.run(max_steps, *this);
+
+        // A faulting instruction did not retire; otherwise the budget ran out after the last one
+        if (pending_ && status != Cpu::Status::FAULT)
+            complete();
+        pending_ = false;
+        return status;
+    }
+
+    Reader::Reader(std::istream &in) : in_(in)
+    {
+        char header[sizeof(MAGIC) + 1];
+        if (!in_.read(header, sizeof(header)) || std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("not a trace file");
+        if (static_cast<std::uint8_t>(header[sizeof(MAGIC)]) != VERSION)
+            throw std::runtime_error("unsupported trace version " + std::to_string(static_cast<std::uint8_t>(header[sizeof(MAGIC)])));
+
+        start_.pc = static_cast<std::size_t>(varint());
+        start_.flags = unpack(static_cast<unsigned>(byte()));
+        for (int r = Register::X0; r < Register::XZR; r++)
+            start_.x[r] = varint();
+        pc_ = start_.pc - 1;
+        flags_ = start_.flags;
+        std::memcpy(x_, start_.x, sizeof(x_));
+    }
+
+    int Reader::byte()
+    {
+        const int c = in_.get();
+        if (c == std::char_traits<char>::eof())
+            throw corrupt();
+        return c;
+    }
+
+    std::uint64_t Reader::varint()
+    {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            const int c = byte();
+            value |= static_cast<std::uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80))
+                return value;
+        }
+        throw corrupt();
+    }
+
+    bool Reader::next(Event &event)
+    {
+        const int tag = in_.get();
+        if (tag == std::char_traits<char>::eof())
+            return false;
+
+        pc_ += 1 + (tag & JUMP ? unzigzag(varint()) : 0);
+        event.pc = static_cast<std::size_t>(pc_);
+        const int opcode = byte();
+        if (opcode >= Opcode::NONE)
+            throw corrupt();
+        event.opcode = static_cast<Opcode::Type>(opcode);
+
+        event.accesses_memory = tag & ACCESS;
+        if (event.accesses_memory)
+        {
+            address_ += unzigzag(varint());
+            event.address = address_;
+        }
+
+        event.reg = Register::NONE;
+        if (tag & WRITE)
+        {
+            const int reg = byte();
+            if (reg >= Register::XZR)
+                throw corrupt();
+            x_[reg] += unzigzag(varint());
+            event.reg = static_cast<Register::Name>(reg);
+            event.value = x_[reg];
+        }
+
+        event.flags_changed = tag & FLAGS;
+        if (event.flags_changed)
+            flags_ = unpack(static_cast<unsigned>(tag) >> 4);
+        event.flags = flags_;
+        return true;
+    }
+} // namespace Trace
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "background.hpp"
+#include "cpu.hpp"
+#include "opcodes.hpp"
+#include "packed.hpp"
+
+// Writes every retired instruction to a compact binary trace file.
+//
+// For each instruction the execution thread only appends its pc, the value of the register
+// it wrote and the flags to a Background::Writer. The writer thread looks everything else
+// up in the program, keeps its own copy of the registers to work out load and store
+// addresses, encodes each record against the one before, and writes it out. A typical
+// instruction takes 3 to 5 bytes.
+//
+// File layout: the 8-byte magic "LEGTRACE" and a version byte; the starting pc as a varint,
+// the starting NZCV in a byte and X0-X30 as varints; then one record per instruction:
+//   tag          bit 0: pc is not the previous pc + 1; bit 1: writes a register;
+//                bit 2: accesses memory; bit 3: flags changed, with NZCV in bits 7..4
+//   pc delta     if bit 0: zigzag varint of pc - (previous pc + 1)
+//   opcode       one byte, an Opcode::Type
+//   register     if bit 1: one byte, then a zigzag varint of the new value minus the old
+//   address      if bit 2: zigzag varint of the address minus the previous address
+namespace Trace
+{
+    constexpr char MAGIC[8] = {'L', 'E', 'G', 'T', 'R', 'A', 'C', 'E'};
+    constexpr std::uint8_t VERSION = 1;
+
+    // One instruction as the execution thread records it
+    struct Entry
+    {
+        std::uint64_t value; // of the register the instruction writes
+        std::uint32_t pc;
+        Cpu::Flags flags; // after the instruction
+    };
+    static_assert(sizeof(Entry) == 16, "Trace::Entry must stay 16 bytes");
+
+    // Encodes entries into a file on a background thread
+    class Writer
+    {
+    public:
+        // Traces `machine` from its current state. Throws std::runtime_error if the file
+        // cannot be created.
+        Writer(const std::string &path, const Cpu::Machine &machine);
+        ~Writer();
+
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        // The next entry to fill in
+        Entry &append() { return entries_out_.append(); }
+
+        // Writes out everything appended and stops the writer thread. Throws
+        // std::runtime_error if writing failed.
+        void finish();
+
+        std::uint64_t entries() const { return entries_; }
+        std::uint64_t bytes() const { return bytes_; }
+
+    private:
+        static constexpr std::size_t ENTRIES = std::size_t{1} << 16;
+
+        // Encodes and writes one buffer of entries, on the writer thread
+        void write(const Entry *entries, std::size_t count);
+
+        std::ofstream file_;
+        bool failed_ = false; // written by the writer thread, read after it stops
+        bool finished_ = false;
+
+        // Encoder state, owned by the writer thread
+        const Packed::Op *ops_;
+        std::uint64_t pc_;
+        std::uint64_t address_ = 0;
+        Cpu::Flags flags_;
+        std::uint64_t x_[Register::NONE + 1]; // as the traced instructions left them
+        std::uint64_t entries_ = 0, bytes_ = 0;
+        std::vector<std::uint8_t> out_;
+
+        // Last, so the writer thread starts after the state above and stops before it goes
+        Background::Writer<Entry, ENTRIES> entries_out_;
+    };
+
+    class Tracer : public Cpu::Observer
+    {
+    public:
+        // `writer` must have been created for `machine` in its current state
+        Tracer(Cpu::Machine &machine, Writer &writer) : machine_(machine), writer_(writer) {}
+
+        // Like Machine::run, but traced. Interprets without the JIT or fused instructions.
+        Cpu::Status run(std::uint64_t max_steps = UINT64_MAX);
+
+        // Hook for the interpreter, called before each instruction executes. An instruction
+        // is appended once the next one arrives, when what it wrote is known.
+        static constexpr bool OBSERVING = true;
+        void before(const Packed::Op &op, std::size_t pc, std::uint64_t)
+        {
+            if (pending_)
+                complete();
+            pending_ = op.opcode != Opcode::NONE && op.opcode != Opcode::HALT; // neither retires
+            pc_ = static_cast<std::uint32_t>(pc);
+            reg_ = op.opcode == Opcode::BL ? Register::X30 : op.rd;
+        }
+
+    private:
+        void complete()
+        {
+            Entry &entry = writer_.append();
+            entry.value = machine_.state.x[reg_];
+            entry.pc = pc_;
+            entry.flags = machine_.state.flags;
+        }
+
+        Cpu::Machine &machine_;
+        Writer &writer_;
+        bool pending_ = false;
+        std::uint32_t pc_ = 0;
+        std::uint8_t reg_ = 0;
+    };
+
+    // One instruction read back from a trace
+    struct Event
+    {
+        std::size_t pc;
+        Opcode::Type opcode;
+        Register::Name reg; // Register::NONE if nothing was written
+        std::uint64_t value;
+        bool accesses_memory;
+        std::uint64_t address;
+        bool flags_changed;
+        Cpu::Flags flags;
+    };
+
+    class Reader
+    {
+    public:
+        // Throws std::runtime_error if the stream does not start with a trace header
+        explicit Reader(std::istream &in);
+
+        // Registers, flags and pc when tracing started
+        const Cpu::State &start() const { return start_; }
+
+        // Returns false at the end of the trace. Throws std::runtime_error on corrupt data.
+        bool next(Event &event);
+
+    private:
+        std::uint64_t varint();
+        int byte();
+
+        std::istream &in_;
+        Cpu::State start_{};
+        std::uint64_t pc_;
+        std::uint64_t address_ = 0;
+        Cpu::Flags flags_;
+        std::uint64_t x_[Register::NONE + 1];
+    };
+} // namespace Trace
@@ -0,0 +1,4 @@
+#pragma once
+
+// Bump when assembler or decoder output changes, so cached program images are rebuilt
+#define LEGV8EMU_VERSION "0.4.1"
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Regression check, run by `make check`. Every program with an expected output in
+# tests/expected runs under the interpreter, --jit, --fuse and --optimize, and each run's
+# stdout must match it exactly.
+#
+#   tests/expected/NAME.out   what tests/NAME.legv8asm prints
+#   tests/expected/NAME.args  extra options for it, if any
+#   tests/expected/NAME.in    its stdin, if any (otherwise empty)
+#   tests/expected/gen-N.out  what the program bin/legv8gen writes for seed N prints
+#
+# tests/check.manifest also runs as a batch, with and without --lockstep, against
+# tests/expected/batch.out, and the multi-hart programs run on one thread against
+# NAME.harts.out. Outputs and diffs are left in bin/check.
+
+EMU=bin/legv8emu
+GEN=bin/legv8gen
+EXPECTED=tests/expected
+OUT=bin/check
+GEN_INSTRUCTIONS=5000
+
+mkdir -p "$OUT"
+passed=0
+failed=0
+
+# compare DESCRIPTION EXPECTED ACTUAL
+compare()
+{
+    if diff -u "$2" "$3" > "$3.diff"; then
+        passed=$((passed + 1))
+    else
+        failed=$((failed + 1))
+        echo "FAIL: $1 (see $3.diff)"
+        head -n 20 "$3.diff"
+    fi
+}
+
+for expected in "$EXPECTED"/*.out; do
+    name=$(basename "$expected" .out)
+    case "$name" in
+    batch | *.harts)
+        continue
+        ;;
+    gen-*)
+        program="$OUT/$name.legv8asm"
+        "$GEN" --instructions "$GEN_INSTRUCTIONS" --seed "${name#gen-}" --output "$program" 2> /dev/null
+        ;;
+    *)
+        program="tests/$name.legv8asm"
+        ;;
+    esac
+    args=""
+    [ -f "$EXPECTED/$name.args" ] && args=$(cat "$EXPECTED/$name.args")
+    input=/dev/null
+    [ -f "$EXPECTED/$name.in" ] && input="$EXPECTED/$name.in"
+
+    for mode in "" --jit --fuse --optimize; do
+        actual="$OUT/$name${mode:+.}${mode#--}.out"
+        # shellcheck disable=SC2086 # args and mode are lists of options
+        "$EMU" $mode $args "$program" < "$input" > "$actual" 2> /dev/null
+        compare "$name ${mode:-(interpreter)}" "$expected" "$actual"
+    done
+done
+
+# Jobs print as they finish, so in any order
+for mode in "" --lockstep; do
+    actual="$OUT/batch${mode:+.}${mode#--}.out"
+    "$EMU" --batch tests/check.manifest $mode 2> /dev/null | sort > "$actual"
+    compare "batch ${mode:-(threads)}" "$EXPECTED/batch.out" "$actual"
+done
+
+# Harts taking turns on one thread interleave the same way every run
+for expected in "$EXPECTED"/*.harts.out; do
+    name=$(basename "$expected" .harts.out)
+    actual="$OUT/$name.harts.out"
+    # shellcheck disable=SC2046 # the file holds a list of options
+    "$EMU" $(cat "$EXPECTED/$name.harts.args") "tests/$name.legv8asm" < /dev/null > "$actual" 2> /dev/null
+    compare "$name harts" "$expected" "$actual"
+done
+
+echo "Checked $((passed + failed)) runs: $passed passed, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,534 @@
+#include "cpu.hpp"
+#include "decoder.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Writes a random but valid .legv8asm program, the same for the same seed and options, and
+// optionally the output the emulator should print after running it.
+//
+// The generator executes each instruction as it writes it, so it needs no emulator and its
+// memory use does not grow with the program. Branches only skip forward over straight-line
+// code and loops count down a fixed number of times, so every program halts.
+namespace
+{
+    struct Options
+    {
+        std::uint64_t instructions = 1000;
+        std::uint64_t seed = 1;
+        double labels = 0.02;        // chance of an unreferenced label after each instruction
+        double branches = 0.1;       // chance that the next construct branches
+        unsigned mix[3] = {6, 2, 2}; // weights of conditional branches, B and loops
+        double memory = 0.2;         // share of straight-line instructions that load or store
+        double noise = 0.1;          // chance of comments, blank lines and odd spacing per line
+        std::string output;          // stdout if empty
+        std::string expect;          // expected emulator output, not written if empty
+    };
+
+    void usage(const char *argv0)
+    {
+        std::cerr << "Usage: " << argv0 << " [options]\n"
+                  << "  --instructions N  program length (default 1000, at least 17)\n"
+                  << "  --seed N          random seed (default 1)\n"
+                  << "  --labels P        chance of an extra label after each instruction (default 0.02)\n"
+                  << "  --branches P      chance that each construct is a branch or loop (default 0.1)\n"
+                  << "  --mix C,B,L       weights of conditional branches, B and loops (default 6,2,2)\n"
+                  << "  --memory P        share of other instructions that load or store (default 0.2)\n"
+                  << "  --noise P         chance of comments, blank lines and odd spacing per line (default 0.1)\n"
+                  << "  --output FILE     write the program to FILE instead of stdout\n"
+                  << "  --expect FILE     write what the emulator should print on stdout to FILE\n";
+    }
+
+    bool parse_options(int argc, char *argv[], Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char *arg = argv[i];
+            if (std::strcmp(arg, "--instructions") == 0 && i + 1 < argc)
+                options.instructions = std::stoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(arg, "--seed") == 0 && i + 1 < argc)
+                options.seed = std::stoull(argv[++i], nullptr, 0);
+            else if (std::strcmp(arg, "--labels") == 0 && i + 1 < argc)
+                options.labels = std::stod(argv[++i]);
+            else if (std::strcmp(arg, "--branches") == 0 && i + 1 < argc)
+                options.branches = std::stod(argv[++i]);
+            else if (std::strcmp(arg, "--mix") == 0 && i + 1 < argc)
+            {
+                if (std::sscanf(argv[++i], "%u,%u,%u", &options.mix[0], &options.mix[1], &options.mix[2]) != 3 ||
+                    options.mix[0] + options.mix[1] + options.mix[2] == 0)
+                    return false;
+            }
+            else if (std::strcmp(arg, "--memory") == 0 && i + 1 < argc)
+                options.memory = std::stod(argv[++i]);
+            else if (std::strcmp(arg, "--noise") == 0 && i + 1 < argc)
+                options.noise = std::stod(argv[++i]);
+            else if (std::strcmp(arg, "--output") == 0 && i + 1 < argc)
+                options.output = argv[++i];
+            else if (std::strcmp(arg, "--expect") == 0 && i + 1 < argc)
+                options.expect = argv[++i];
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // splitmix64, so programs do not depend on the standard library's distributions
+    class Random
+    {
+    public:
+        explicit Random(std::uint64_t seed) : state_(seed) {}
+
+        std::uint64_t next()
+        {
+            std::uint64_t z = state_ += 0x9e3779b97f4a7c15;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+        unsigned below(unsigned n) { return static_cast<unsigned>(next() % n); }
+        bool chance(double p) { return static_cast<double>(next() >> 11) * 0x1.0p-53 < p; }
+
+    private:
+        std::uint64_t state_;
+    };
+
+    enum class Kind
+    {
+        ADD,
+        SUB,
+        AND,
+        ORR,
+        EOR,
+        MUL,
+        ADDS,
+        SUBS,
+        ANDS,
+        ADDI,
+        SUBI,
+        ANDI,
+        ORRI,
+        EORI,
+        LSL,
+        LSR,
+        LDUR,
+        STUR,
+        LDURB,
+        STURB,
+    };
+
+    constexpr const char *NAMES[] = {"ADD", "SUB", "AND", "ORR", "EOR", "MUL", "ADDS", "SUBS", "ANDS", "ADDI",
+                                     "SUBI", "ANDI", "ORRI", "EORI", "LSL", "LSR", "LDUR", "STUR", "LDURB", "STURB"};
+    constexpr int ALU_KINDS = static_cast<int>(Kind::LSR) + 1;
+
+    constexpr const char *CONDITIONS[] = {"EQ", "NE", "LT", "LE", "GT", "GE", "LO", "LS", "HI", "HS", "MI", "VS"};
+
+    constexpr int DATA_REGISTERS = 16; // X0-X15 hold the values being computed
+    constexpr int COUNTER = 26;        // loop counter
+    constexpr int BASE = 27;           // points at the scratch memory
+    constexpr int BASE_ADDRESS = 1024;
+    constexpr int SCRATCH_BYTES = 256;
+
+    struct Op
+    {
+        Kind kind;
+        int rd, rn, rm; // rm is the stored register for stores
+        int imm;
+    };
+
+    class Generator
+    {
+    public:
+        Generator(const Options &options, std::ostream &out) : options_(options), out_(out), random_(options.seed)
+        {
+            // Start from the state the emulator starts in
+            Memory::Space memory;
+            Cpu::Machine machine(std::vector<Decoder::Instruction>{}, memory);
+            state_ = machine.state;
+        }
+
+        void generate()
+        {
+            comment("Generated by legv8gen --seed " + std::to_string(options_.seed) + " --instructions " +
+                    std::to_string(options_.instructions));
+            label("main");
+            emit({Kind::ADDI, BASE, 31, 0, BASE_ADDRESS}, true);
+            for (int r = 0; r < DATA_REGISTERS; r++)
+                emit({Kind::ADDI, r, 31, 0, static_cast<int>(random_.below(4096))}, true);
+
+            const unsigned total = options_.mix[0] + options_.mix[1] + options_.mix[2];
+            while (emitted_ < options_.instructions)
+            {
+                const std::uint64_t remaining = options_.instructions - emitted_;
+                if (remaining < 4 || !random_.chance(options_.branches))
+                {
+                    emit(straight(), true);
+                    continue;
+                }
+
+                const unsigned pick = random_.below(total);
+                if (pick < options_.mix[0])
+                    conditional(remaining);
+                else if (pick < options_.mix[0] + options_.mix[1])
+                    jump(remaining);
+                else
+                    loop(remaining);
+            }
+            state_.pc = emitted_;
+        }
+
+        const Cpu::State &state() const { return state_; }
+        std::uint64_t retired() const { return retired_; }
+        std::uint64_t labels() const { return labels_; }
+
+    private:
+        // An ALU or memory instruction on the data registers
+        Op straight()
+        {
+            const int rd = static_cast<int>(random_.below(DATA_REGISTERS));
+            const int rn = source();
+            if (random_.chance(options_.memory))
+            {
+                const bool bytes = random_.chance(0.25);
+                const bool store = random_.chance(0.5);
+                const int offset = bytes ? static_cast<int>(random_.below(SCRATCH_BYTES))
+                                         : static_cast<int>(random_.below(SCRATCH_BYTES / 8)) * 8;
+                const Kind kind = bytes ? (store ? Kind::STURB : Kind::LDURB) : (store ? Kind::STUR : Kind::LDUR);
+                return {kind, store ? 31 : rd, BASE, store ? rn : 31, offset};
+            }
+
+            const Kind kind = static_cast<Kind>(random_.below(ALU_KINDS));
+            if (kind >= Kind::LSL)
+                return {kind, rd, rn, 31, static_cast<int>(random_.below(64))};
+            if (kind >= Kind::ADDI)
+                return {kind, rd, rn, 31, static_cast<int>(random_.below(4096))};
+            return {kind, rd, rn, source(), 0};
+        }
+
+        int source() { return random_.chance(0.05) ? 31 : static_cast<int>(random_.below(DATA_REGISTERS)); }
+
+        // A compare and B.cond, or CBZ/CBNZ, skipping forward over straight-line code
+        void conditional(std::uint64_t remaining)
+        {
+            const std::string target = next_label();
+            bool taken;
+            if (random_.chance(0.5))
+            {
+                const int r = source();
+                const bool zero = random_.chance(0.5);
+                taken = (state_.x[r] == 0) == zero;
+                branch_line(std::string(zero ? "CBZ " : "CBNZ ") + reg(r) + sep() + target);
+                remaining -= 1;
+            }
+            else
+            {
+                emit({Kind::SUBS, 31, source(), source(), 0}, true);
+                const int condition = static_cast<int>(random_.below(12));
+                taken = evaluate(condition);
+                branch_line(std::string("B.") + CONDITIONS[condition] + " " + target);
+                remaining -= 2;
+            }
+            skip(remaining, !taken);
+            label(target);
+        }
+
+        // B over code that never runs
+        void jump(std::uint64_t remaining)
+        {
+            const std::string target = next_label();
+            branch_line("B " + target);
+            skip(remaining - 1, false);
+            label(target);
+        }
+
+        // A loop body that runs a fixed number of times
+        void loop(std::uint64_t remaining)
+        {
+            const int trips = 1 + static_cast<int>(random_.below(8));
+            const std::uint64_t length = 1 + random_.below(static_cast<unsigned>(std::min<std::uint64_t>(remaining - 3, 6)));
+            const std::string top = next_label();
+            emit({Kind::ADDI, COUNTER, 31, 0, trips}, true);
+            label(top);
+
+            std::vector<Op> body;
+            for (std::uint64_t i = 0; i < length; i++)
+            {
+                body.push_back(straight());
+                emit(body.back(), false);
+            }
+            emit({Kind::SUBI, COUNTER, COUNTER, 31, 1}, false);
+            instruction_line("CBNZ " + reg(COUNTER) + sep() + top);
+
+            for (int trip = 0; trip < trips; trip++)
+                for (const Op &op : body)
+                    execute(op);
+            state_.x[COUNTER] = 0;
+            retired_ += static_cast<std::uint64_t>(trips) * (length + 2);
+        }
+
+        // Up to eight straight-line instructions, executed only if `live`
+        void skip(std::uint64_t remaining, bool live)
+        {
+            const std::uint64_t length = 1 + random_.below(static_cast<unsigned>(std::min<std::uint64_t>(remaining, 8)));
+            for (std::uint64_t i = 0; i < length; i++)
+                emit(straight(), live);
+        }
+
+        bool evaluate(int condition) const
+        {
+            const Cpu::Flags &f = state_.flags;
+            switch (condition)
+            {
+            case 0:
+                return f.z;
+            case 1:
+                return !f.z;
+            case 2:
+                return f.n != f.v;
+            case 3:
+                return f.z || f.n != f.v;
+            case 4:
+                return !f.z && f.n == f.v;
+            case 5:
+                return f.n == f.v;
+            case 6:
+                return !f.c;
+            case 7:
+                return !f.c || f.z;
+            case 8:
+                return f.c && !f.z;
+            case 9:
+                return f.c;
+            case 10:
+                return f.n;
+            default:
+                return f.v;
+            }
+        }
+
+        void execute(const Op &op)
+        {
+            std::uint64_t *x = state_.x;
+            Cpu::Flags &f = state_.flags;
+            const std::uint64_t a = x[op.rn], b = x[op.rm];
+            const std::uint64_t imm = static_cast<std::uint64_t>(op.imm);
+            std::uint64_t r = 0;
+            switch (op.kind)
+            {
+            case Kind::ADD:
+                r = a + b;
+                break;
+            case Kind::SUB:
+                r = a - b;
+                break;
+            case Kind::AND:
+                r = a & b;
+                break;
+            case Kind::ORR:
+                r = a | b;
+                break;
+            case Kind::EOR:
+                r = a ^ b;
+                break;
+            case Kind::MUL:
+                r = a * b;
+                break;
+            case Kind::ADDS:
+                r = a + b;
+                f = {static_cast<bool>(r >> 63), r == 0, r < a, static_cast<bool>((~(a ^ b) & (a ^ r)) >> 63)};
+                break;
+            case Kind::SUBS:
+                r = a - b;
+                f = {static_cast<bool>(r >> 63), r == 0, a >= b, static_cast<bool>(((a ^ b) & (a ^ r)) >> 63)};
+                break;
+            case Kind::ANDS:
+                r = a & b;
+                f = {static_cast<bool>(r >> 63), r == 0, false, false};
+                break;
+            case Kind::ADDI:
+                r = a + imm;
+                break;
+            case Kind::SUBI:
+                r = a - imm;
+                break;
+            case Kind::ANDI:
+                r = a & imm;
+                break;
+            case Kind::ORRI:
+                r = a | imm;
+                break;
+            case Kind::EORI:
+                r = a ^ imm;
+                break;
+            case Kind::LSL:
+                r = a << imm;
+                break;
+            case Kind::LSR:
+                r = a >> imm;
+                break;
+            case Kind::LDUR:
+                std::memcpy(&r, scratch_ + op.imm, 8);
+                break;
+            case Kind::LDURB:
+                r = scratch_[op.imm];
+                break;
+            case Kind::STUR:
+                std::memcpy(scratch_ + op.imm, &b, 8);
+                return;
+            case Kind::STURB:
+                scratch_[op.imm] = static_cast<std::uint8_t>(b);
+                return;
+            }
+            if (op.rd != 31)
+                x[op.rd] = r;
+        }
+
+        void emit(const Op &op, bool live)
+        {
+            const int kind = static_cast<int>(op.kind);
+            std::string text = NAMES[kind];
+            text += ' ';
+            if (op.kind >= Kind::LDUR)
+            {
+                text += reg(op.kind == Kind::STUR || op.kind == Kind::STURB ? op.rm : op.rd);
+                text += sep() + "[" + reg(op.rn) + sep() + "#" + std::to_string(op.imm) + "]";
+            }
+            else
+            {
+                text += reg(op.rd) + sep() + reg(op.rn) + sep();
+                text += kind >= static_cast<int>(Kind::ADDI) ? "#" + std::to_string(op.imm) : reg(op.rm);
+            }
+            instruction_line(text);
+            if (live)
+            {
+                execute(op);
+                retired_++;
+            }
+        }
+
+        // Forward branches are executed where they are written
+        void branch_line(const std::string &text)
+        {
+            instruction_line(text);
+            retired_++;
+        }
+
+        void instruction_line(const std::string &text)
+        {
+            if (random_.chance(options_.noise))
+                out_ << (random_.chance(0.5) ? "\n" : "    // " + filler() + "\n");
+            out_ << (random_.chance(options_.noise) ? "\t" : "    ") << text;
+            if (random_.chance(options_.noise))
+                out_ << std::string(1 + random_.below(8), ' ') << "// " << filler();
+            out_ << '\n';
+            emitted_++;
+            if (random_.chance(options_.labels))
+                label(next_label());
+        }
+
+        void label(const std::string &name)
+        {
+            out_ << name << ':';
+            if (random_.chance(options_.noise))
+                out_ << " // " << filler();
+            out_ << '\n';
+        }
+
+        void comment(const std::string &text) { out_ << "// " << text << '\n'; }
+
+        std::string next_label() { return "L" + std::to_string(labels_++); }
+
+        std::string sep()
+        {
+            if (!random_.chance(options_.noise))
+                return ", ";
+            return random_.chance(0.5) ? "," : std::string(",") + std::string(1 + random_.below(4), ' ');
+        }
+
+        std::string filler()
+        {
+            static constexpr const char *WORDS[] = {"load", "the", "next", "value", "loop", "count", "check", "swap",
+                                                    "i++", "a[i]", "x = y", "TODO", "0x1F", "fast path"};
+            std::string text = WORDS[random_.below(14)];
+            for (unsigned n = random_.below(4); n > 0; n--)
+                text += std::string(" ") + WORDS[random_.below(14)];
+            return text;
+        }
+
+        static std::string reg(int r) { return r == 31 ? "XZR" : "X" + std::to_string(r); }
+
+        const Options &options_;
+        std::ostream &out_;
+        Random random_;
+        Cpu::State state_{};
+        std::uint8_t scratch_[SCRATCH_BYTES] = {};
+        std::uint64_t emitted_ = 0;
+        std::uint64_t retired_ = 0;
+        std::uint64_t labels_ = 0;
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    try
+    {
+        if (!parse_options(argc, argv, options))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.instructions < 1 + DATA_REGISTERS)
+    {
+        std::cerr << "Error: programs need at least " << 1 + DATA_REGISTERS << " instructions" << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!options.output.empty())
+    {
+        file.open(options.output);
+        if (!file)
+        {
+            std::cerr << "Failed to open " << options.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = options.output.empty() ? std::cout : file;
+
+    Generator generator(options, out);
+    generator.generate();
+    out.flush();
+    if (!out)
+    {
+        std::cerr << "Error: failed to write the program" << std::endl;
+        return 1;
+    }
+
+    if (!options.expect.empty())
+    {
+        std::ofstream expect(options.expect);
+        expect << generator.state() << "Status: " << Cpu::to_string(Cpu::Status::HALTED) << '\n';
+        if (!expect)
+        {
+            std::cerr << "Failed to write " << options.expect << std::endl;
+            return 1;
+        }
+    }
+    std::cerr << "Generated " << options.instructions << " instructions and " << generator.labels()
+              << " labels; running it retires " << generator.retired() << std::endl;
+    return 0;
+}
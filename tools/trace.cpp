@@ -0,0 +1,53 @@
+#include "trace.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// Prints a trace written by legv8emu --trace as text, one instruction per line:
+//   INDEX  PC  MNEMONIC  [Xn = VALUE]  [@ ADDRESS]  [NZCV = FLAGS]
+// where the flags are shown only when the instruction changed them.
+int main(int argc, char *argv[])
+{
+    if (argc != 2 || argv[1][0] == '-')
+    {
+        std::cerr << "Usage: " << argv[0] << " TRACE\n";
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::uint64_t index = 0;
+    try
+    {
+        Trace::Reader reader(file);
+        Trace::Event event;
+        std::cout << std::setfill('0');
+        while (reader.next(event))
+        {
+            std::cout << index++ << '\t' << event.pc << '\t' << Opcode::name(event.opcode);
+            if (event.reg != Register::NONE)
+                std::cout << '\t' << Register::name(event.reg) << " = 0x" << std::hex << std::setw(16) << event.value
+                          << std::dec;
+            if (event.accesses_memory)
+                std::cout << "\t@ 0x" << std::hex << event.address << std::dec;
+            if (event.flags_changed)
+                std::cout << "\tNZCV = " << event.flags.n << event.flags.z << event.flags.c << event.flags.v;
+            std::cout << '\n';
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << std::flush;
+        std::cerr << "Error: " << argv[1] << " after " << index << " instructions: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}